@@ -27,6 +27,8 @@
 #include <Limelight.h>
 
 #include <sys/stat.h>
+#include <pthread.h>
+#include <unistd.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <string.h>
@@ -46,18 +48,26 @@
 #define UNIQUEID_BYTES 8
 #define UNIQUEID_CHARS (UNIQUEID_BYTES*2)
 
-static char unique_id[UNIQUEID_CHARS+1];
-static X509 *cert;
-static char cert_hex[8192];
-static EVP_PKEY *privateKey;
-
-const char* gs_error;
+struct _GS_IDENTITY {
+  char uniqueId[UNIQUEID_CHARS+1];
+  X509 *cert;
+  char certHex[8192];
+  EVP_PKEY *privateKey;
+  char keyDirectory[PATH_MAX];
+};
 
 #define LEN_AS_HEX_STR(x) ((x) * 2 + 1)
 #define SIZEOF_AS_HEX_STR(x) LEN_AS_HEX_STR(sizeof(x))
 
 #define UUID_STRLEN 37
 
+#define ASSET_DIRECTORY "assets"
+#define ASSET_HASH_CHARS (SHA256_DIGEST_LENGTH*2)
+
+static void set_error(char* error, const char* message) {
+  snprintf(error, GS_ERROR_SIZE, "%s", message);
+}
+
 static int mkdirtree(const char* directory) {
   char buffer[PATH_MAX];
   char* p = buffer;
@@ -87,13 +97,13 @@ static int mkdirtree(const char* directory) {
   return 0;
 }
 
-static int load_unique_id(const char* keyDirectory) {
+static int load_unique_id(PGS_IDENTITY identity, const char* keyDirectory) {
   char uniqueFilePath[PATH_MAX];
   snprintf(uniqueFilePath, PATH_MAX, "%s/%s", keyDirectory, UNIQUE_FILE_NAME);
 
   FILE *fd = fopen(uniqueFilePath, "r");
-  if (fd == NULL || fread(unique_id, UNIQUEID_CHARS, 1, fd) != UNIQUEID_CHARS) {
-    snprintf(unique_id,UNIQUEID_CHARS+1,"0123456789ABCDEF");
+  if (fd == NULL || fread(identity->uniqueId, UNIQUEID_CHARS, 1, fd) != UNIQUEID_CHARS) {
+    snprintf(identity->uniqueId,UNIQUEID_CHARS+1,"0123456789ABCDEF");
 
     if (fd)
       fclose(fd);
@@ -101,15 +111,15 @@ static int load_unique_id(const char* keyDirectory) {
     if (fd == NULL)
       return GS_FAILED;
 
-    fwrite(unique_id, UNIQUEID_CHARS, 1, fd);
+    fwrite(identity->uniqueId, UNIQUEID_CHARS, 1, fd);
   }
   fclose(fd);
-  unique_id[UNIQUEID_CHARS] = 0;
+  identity->uniqueId[UNIQUEID_CHARS] = 0;
 
   return GS_OK;
 }
 
-static int load_cert(const char* keyDirectory) {
+static int load_cert(PGS_IDENTITY identity, const char* keyDirectory, char* error) {
   char certificateFilePath[PATH_MAX];
   snprintf(certificateFilePath, PATH_MAX, "%s/%s", keyDirectory, CERTIFICATE_FILE_NAME);
 
@@ -118,9 +128,9 @@ static int load_cert(const char* keyDirectory) {
 
   FILE *fd = fopen(certificateFilePath, "r");
   if (fd == NULL) {
-    printf("Generating certificate...");
+    fprintf(stderr, "Generating certificate...");
     CERT_KEY_PAIR cert = mkcert_generate();
-    printf("done\n");
+    fprintf(stderr, "done\n");
 
     char p12FilePath[PATH_MAX];
     snprintf(p12FilePath, PATH_MAX, "%s/%s", keyDirectory, P12_FILE_NAME);
@@ -131,12 +141,13 @@ static int load_cert(const char* keyDirectory) {
   }
 
   if (fd == NULL) {
-    gs_error = "Can't open certificate file";
+    set_error(error, "Can't open certificate file");
     return GS_FAILED;
   }
 
-  if (!(cert = PEM_read_X509(fd, NULL, NULL, NULL))) {
-    gs_error = "Error loading cert into memory";
+  if (!(identity->cert = PEM_read_X509(fd, NULL, NULL, NULL))) {
+    set_error(error, "Error loading cert into memory");
+    fclose(fd);
     return GS_FAILED;
   }
 
@@ -145,25 +156,40 @@ static int load_cert(const char* keyDirectory) {
   int c;
   int length = 0;
   while ((c = fgetc(fd)) != EOF) {
-    sprintf(cert_hex + length, "%02x", c);
+    sprintf(identity->certHex + length, "%02x", c);
     length += 2;
   }
-  cert_hex[length] = 0;
+  identity->certHex[length] = 0;
 
   fclose(fd);
 
   fd = fopen(keyFilePath, "r");
   if (fd == NULL) {
-    gs_error = "Error loading key into memory";
+    set_error(error, "Error loading key into memory");
     return GS_FAILED;
   }
 
-  PEM_read_PrivateKey(fd, &privateKey, NULL, NULL);
+  PEM_read_PrivateKey(fd, &identity->privateKey, NULL, NULL);
   fclose(fd);
 
   return GS_OK;
 }
 
+// Strings and modes of an earlier serverinfo request
+static void free_serverinfo(PSERVER_DATA server) {
+  free(server->gpuType);
+  free(server->gsVersion);
+  free((char*) server->serverInfo.serverInfoAppVersion);
+  free((char*) server->serverInfo.serverInfoGfeVersion);
+  while (server->modes != NULL) {
+    PDISPLAY_MODE next = server->modes->next;
+    free(server->modes);
+    server->modes = next;
+  }
+  server->gpuType = server->gsVersion = NULL;
+  server->serverInfo.serverInfoAppVersion = server->serverInfo.serverInfoGfeVersion = NULL;
+}
+
 static int load_serverinfo(PSERVER_DATA server, bool https) {
   uuid_t uuid;
   char uuid_str[UUID_STRLEN];
@@ -179,52 +205,53 @@ static int load_serverinfo(PSERVER_DATA server, bool https) {
   uuid_unparse(uuid, uuid_str);
 
   snprintf(url, sizeof(url), "%s://%s:%d/serverinfo?uniqueid=%s&uuid=%s",
-    https ? "https" : "http", server->serverInfo.address, https ? server->httpsPort : server->httpPort, unique_id, uuid_str);
+    https ? "https" : "http", server->serverInfo.address, https ? server->httpsPort : server->httpPort, server->identity->uniqueId, uuid_str);
 
   PHTTP_DATA data = http_create_data();
   if (data == NULL) {
     ret = GS_OUT_OF_MEMORY;
     goto cleanup;
   }
-  if (http_request(url, data) != GS_OK) {
+  if (http_request(server->http, url, data, server->error) != GS_OK) {
     ret = GS_IO_ERROR;
     goto cleanup;
   }
 
-  if (xml_status(data->memory, data->size) == GS_ERROR) {
+  if (xml_status(data->memory, data->size, server->error) == GS_ERROR) {
     ret = GS_ERROR;
     goto cleanup;
   }
 
-  if (xml_search(data->memory, data->size, "currentgame", &currentGameText) != GS_OK) {
+  free_serverinfo(server);
+  if (xml_search(data->memory, data->size, "currentgame", &currentGameText, server->error) != GS_OK) {
     goto cleanup;
   }
 
-  if (xml_search(data->memory, data->size, "PairStatus", &pairedText) != GS_OK)
+  if (xml_search(data->memory, data->size, "PairStatus", &pairedText, server->error) != GS_OK)
     goto cleanup;
 
-  if (xml_search(data->memory, data->size, "appversion", (char**) &server->serverInfo.serverInfoAppVersion) != GS_OK)
+  if (xml_search(data->memory, data->size, "appversion", (char**) &server->serverInfo.serverInfoAppVersion, server->error) != GS_OK)
     goto cleanup;
 
-  if (xml_search(data->memory, data->size, "state", &stateText) != GS_OK)
+  if (xml_search(data->memory, data->size, "state", &stateText, server->error) != GS_OK)
     goto cleanup;
 
-  if (xml_search(data->memory, data->size, "ServerCodecModeSupport", &serverCodecModeSupportText) != GS_OK)
+  if (xml_search(data->memory, data->size, "ServerCodecModeSupport", &serverCodecModeSupportText, server->error) != GS_OK)
     goto cleanup;
 
-  if (xml_search(data->memory, data->size, "gputype", &server->gpuType) != GS_OK)
+  if (xml_search(data->memory, data->size, "gputype", &server->gpuType, server->error) != GS_OK)
     goto cleanup;
 
-  if (xml_search(data->memory, data->size, "GsVersion", &server->gsVersion) != GS_OK)
+  if (xml_search(data->memory, data->size, "GsVersion", &server->gsVersion, server->error) != GS_OK)
     goto cleanup;
 
-  if (xml_search(data->memory, data->size, "GfeVersion", (char**) &server->serverInfo.serverInfoGfeVersion) != GS_OK)
+  if (xml_search(data->memory, data->size, "GfeVersion", (char**) &server->serverInfo.serverInfoGfeVersion, server->error) != GS_OK)
     goto cleanup;
 
-  if (xml_search(data->memory, data->size, "HttpsPort", &httpsPortText) != GS_OK)
+  if (xml_search(data->memory, data->size, "HttpsPort", &httpsPortText, server->error) != GS_OK)
     goto cleanup;
 
-  if (xml_modelist(data->memory, data->size, &server->modes) != GS_OK)
+  if (xml_modelist(data->memory, data->size, &server->modes, server->error) != GS_OK)
     goto cleanup;
 
   // These fields are present on all version of GFE that this client supports
@@ -290,10 +317,10 @@ static int load_server_status(PSERVER_DATA server) {
 
   if (ret == GS_OK && !server->unsupported) {
     if (server->serverMajorVersion > MAX_SUPPORTED_GFE_VERSION) {
-      gs_error = "Ensure you're running the latest version of Moonlight Embedded or downgrade GeForce Experience and try again";
+      set_error(server->error, "Ensure you're running the latest version of Moonlight Embedded or downgrade GeForce Experience and try again");
       ret = GS_UNSUPPORTED_VERSION;
     } else if (server->serverMajorVersion < MIN_SUPPORTED_GFE_VERSION) {
-      gs_error = "Moonlight Embedded requires a newer version of GeForce Experience. Please upgrade GFE on your PC and try again.";
+      set_error(server->error, "Moonlight Embedded requires a newer version of GeForce Experience. Please upgrade GFE on your PC and try again.");
       ret = GS_UNSUPPORTED_VERSION;
     }
   }
@@ -416,8 +443,8 @@ int gs_unpair(PSERVER_DATA server) {
 
   uuid_generate_random(uuid);
   uuid_unparse(uuid, uuid_str);
-  snprintf(url, sizeof(url), "http://%s:%u/unpair?uniqueid=%s&uuid=%s", server->serverInfo.address, server->httpPort, unique_id, uuid_str);
-  ret = http_request(url, data);
+  snprintf(url, sizeof(url), "http://%s:%u/unpair?uniqueid=%s&uuid=%s", server->serverInfo.address, server->httpPort, server->identity->uniqueId, uuid_str);
+  ret = http_request(server->http, url, data, server->error);
 
   http_free_data(data);
   return ret;
@@ -438,7 +465,7 @@ int gs_pair(PSERVER_DATA server, char* pin) {
   PHTTP_DATA data = NULL;
 
   if (server->paired) {
-    gs_error = "Already paired";
+    set_error(server->error, "Already paired");
     ret = GS_WRONG_STATE;
     goto cleanup;
   }
@@ -450,27 +477,27 @@ int gs_pair(PSERVER_DATA server, char* pin) {
 
   uuid_generate_random(uuid);
   uuid_unparse(uuid, uuid_str);
-  snprintf(url, url_max_len, "http://%s:%u/pair?uniqueid=%s&uuid=%s&devicename=roth&updateState=1&phrase=getservercert&salt=%s&clientcert=%s", server->serverInfo.address, server->httpPort, unique_id, uuid_str, salt_hex, cert_hex);
+  snprintf(url, url_max_len, "http://%s:%u/pair?uniqueid=%s&uuid=%s&devicename=roth&updateState=1&phrase=getservercert&salt=%s&clientcert=%s", server->serverInfo.address, server->httpPort, server->identity->uniqueId, uuid_str, salt_hex, server->identity->certHex);
   data = http_create_data();
   if (data == NULL)
     return GS_OUT_OF_MEMORY;
-  else if ((ret = http_request(url, data)) != GS_OK)
+  else if ((ret = http_request(server->http, url, data, server->error)) != GS_OK)
     goto cleanup;
 
-  if ((ret = xml_status(data->memory, data->size) != GS_OK))
+  if ((ret = xml_status(data->memory, data->size, server->error) != GS_OK))
     goto cleanup;
-  else if ((ret = xml_search(data->memory, data->size, "paired", &result)) != GS_OK)
+  else if ((ret = xml_search(data->memory, data->size, "paired", &result, server->error)) != GS_OK)
     goto cleanup;
 
   if (strcmp(result, "1") != 0) {
-    gs_error = "Pairing failed";
+    set_error(server->error, "Pairing failed");
     ret = GS_FAILED;
     goto cleanup;
   }
 
   free(result);
   result = NULL;
-  if ((ret = xml_search(data->memory, data->size, "plaincert", &result)) != GS_OK)
+  if ((ret = xml_search(data->memory, data->size, "plaincert", &result, server->error)) != GS_OK)
     goto cleanup;
 
 
@@ -499,26 +526,26 @@ int gs_pair(PSERVER_DATA server, char* pin) {
 
   uuid_generate_random(uuid);
   uuid_unparse(uuid, uuid_str);
-  snprintf(url, url_max_len, "http://%s:%u/pair?uniqueid=%s&uuid=%s&devicename=roth&updateState=1&clientchallenge=%s", server->serverInfo.address, server->httpPort, unique_id, uuid_str, challenge_hex);
-  if ((ret = http_request(url, data)) != GS_OK)
+  snprintf(url, url_max_len, "http://%s:%u/pair?uniqueid=%s&uuid=%s&devicename=roth&updateState=1&clientchallenge=%s", server->serverInfo.address, server->httpPort, server->identity->uniqueId, uuid_str, challenge_hex);
+  if ((ret = http_request(server->http, url, data, server->error)) != GS_OK)
     goto cleanup;
 
   free(result);
   result = NULL;
-  if ((ret = xml_status(data->memory, data->size) != GS_OK))
+  if ((ret = xml_status(data->memory, data->size, server->error) != GS_OK))
     goto cleanup;
-  else if ((ret = xml_search(data->memory, data->size, "paired", &result)) != GS_OK)
+  else if ((ret = xml_search(data->memory, data->size, "paired", &result, server->error)) != GS_OK)
     goto cleanup;
 
   if (strcmp(result, "1") != 0) {
-    gs_error = "Pairing failed";
+    set_error(server->error, "Pairing failed");
     ret = GS_FAILED;
     goto cleanup;
   }
 
   free(result);
   result = NULL;
-  if (xml_search(data->memory, data->size, "challengeresponse", &result) != GS_OK) {
+  if (xml_search(data->memory, data->size, "challengeresponse", &result, server->error) != GS_OK) {
     ret = GS_INVALID;
     goto cleanup;
   }
@@ -527,7 +554,7 @@ int gs_pair(PSERVER_DATA server, char* pin) {
   char challenge_response_data[sizeof(challenge_response_data_enc)];
 
   if (strlen(result) / 2 > sizeof(challenge_response_data_enc)) {
-    gs_error = "Server challenge response too big";
+    set_error(server->error, "Server challenge response too big");
     ret = GS_FAILED;
     goto cleanup;
   }
@@ -539,7 +566,7 @@ int gs_pair(PSERVER_DATA server, char* pin) {
   RAND_bytes(client_secret_data, sizeof(client_secret_data));
 
   const ASN1_BIT_STRING *asnSignature;
-  X509_get0_signature(&asnSignature, NULL, cert);
+  X509_get0_signature(&asnSignature, NULL, server->identity->cert);
 
   challenge_response = malloc(16 + asnSignature->length + sizeof(client_secret_data));
   char challenge_response_hash[32];
@@ -558,26 +585,26 @@ int gs_pair(PSERVER_DATA server, char* pin) {
 
   uuid_generate_random(uuid);
   uuid_unparse(uuid, uuid_str);
-  snprintf(url, url_max_len, "http://%s:%u/pair?uniqueid=%s&uuid=%s&devicename=roth&updateState=1&serverchallengeresp=%s", server->serverInfo.address, server->httpPort, unique_id, uuid_str, challenge_response_hex);
-  if ((ret = http_request(url, data)) != GS_OK)
+  snprintf(url, url_max_len, "http://%s:%u/pair?uniqueid=%s&uuid=%s&devicename=roth&updateState=1&serverchallengeresp=%s", server->serverInfo.address, server->httpPort, server->identity->uniqueId, uuid_str, challenge_response_hex);
+  if ((ret = http_request(server->http, url, data, server->error)) != GS_OK)
     goto cleanup;
 
   free(result);
   result = NULL;
-  if ((ret = xml_status(data->memory, data->size) != GS_OK))
+  if ((ret = xml_status(data->memory, data->size, server->error) != GS_OK))
     goto cleanup;
-  else if ((ret = xml_search(data->memory, data->size, "paired", &result)) != GS_OK)
+  else if ((ret = xml_search(data->memory, data->size, "paired", &result, server->error)) != GS_OK)
     goto cleanup;
 
   if (strcmp(result, "1") != 0) {
-    gs_error = "Pairing failed";
+    set_error(server->error, "Pairing failed");
     ret = GS_FAILED;
     goto cleanup;
   }
 
   free(result);
   result = NULL;
-  if (xml_search(data->memory, data->size, "pairingsecret", &result) != GS_OK) {
+  if (xml_search(data->memory, data->size, "pairingsecret", &result, server->error) != GS_OK) {
     ret = GS_INVALID;
     goto cleanup;
   }
@@ -591,15 +618,15 @@ int gs_pair(PSERVER_DATA server, char* pin) {
   pairing_secret = malloc(pairing_secret_len);
   hex_to_bytes(result, pairing_secret, pairing_secret_len*2);
   if (!verifySignature(pairing_secret, 16, pairing_secret+16, pairing_secret_len-16, plaincert)) {
-    gs_error = "MITM attack detected";
+    set_error(server->error, "MITM attack detected");
     ret = GS_FAILED;
     goto cleanup;
   }
 
   unsigned char *signature = NULL;
   size_t s_len;
-  if (sign_it(client_secret_data, sizeof(client_secret_data), &signature, &s_len, privateKey) != GS_OK) {
-      gs_error = "Failed to sign data";
+  if (sign_it(client_secret_data, sizeof(client_secret_data), &signature, &s_len, server->identity->privateKey) != GS_OK) {
+      set_error(server->error, "Failed to sign data");
       ret = GS_FAILED;
       goto cleanup;
   }
@@ -612,38 +639,38 @@ int gs_pair(PSERVER_DATA server, char* pin) {
 
   uuid_generate_random(uuid);
   uuid_unparse(uuid, uuid_str);
-  snprintf(url, url_max_len, "http://%s:%u/pair?uniqueid=%s&uuid=%s&devicename=roth&updateState=1&clientpairingsecret=%s", server->serverInfo.address, server->httpPort, unique_id, uuid_str, client_pairing_secret_hex);
-  if ((ret = http_request(url, data)) != GS_OK)
+  snprintf(url, url_max_len, "http://%s:%u/pair?uniqueid=%s&uuid=%s&devicename=roth&updateState=1&clientpairingsecret=%s", server->serverInfo.address, server->httpPort, server->identity->uniqueId, uuid_str, client_pairing_secret_hex);
+  if ((ret = http_request(server->http, url, data, server->error)) != GS_OK)
     goto cleanup;
 
   free(result);
   result = NULL;
-  if ((ret = xml_status(data->memory, data->size) != GS_OK))
+  if ((ret = xml_status(data->memory, data->size, server->error) != GS_OK))
     goto cleanup;
-  else if ((ret = xml_search(data->memory, data->size, "paired", &result)) != GS_OK)
+  else if ((ret = xml_search(data->memory, data->size, "paired", &result, server->error)) != GS_OK)
     goto cleanup;
 
   if (strcmp(result, "1") != 0) {
-    gs_error = "Pairing failed";
+    set_error(server->error, "Pairing failed");
     ret = GS_FAILED;
     goto cleanup;
   }
 
   uuid_generate_random(uuid);
   uuid_unparse(uuid, uuid_str);
-  snprintf(url, url_max_len, "https://%s:%u/pair?uniqueid=%s&uuid=%s&devicename=roth&updateState=1&phrase=pairchallenge", server->serverInfo.address, server->httpsPort, unique_id, uuid_str);
-  if ((ret = http_request(url, data)) != GS_OK)
+  snprintf(url, url_max_len, "https://%s:%u/pair?uniqueid=%s&uuid=%s&devicename=roth&updateState=1&phrase=pairchallenge", server->serverInfo.address, server->httpsPort, server->identity->uniqueId, uuid_str);
+  if ((ret = http_request(server->http, url, data, server->error)) != GS_OK)
     goto cleanup;
 
   free(result);
   result = NULL;
-  if ((ret = xml_status(data->memory, data->size) != GS_OK))
+  if ((ret = xml_status(data->memory, data->size, server->error) != GS_OK))
     goto cleanup;
-  else if ((ret = xml_search(data->memory, data->size, "paired", &result)) != GS_OK)
+  else if ((ret = xml_search(data->memory, data->size, "paired", &result, server->error)) != GS_OK)
     goto cleanup;
 
   if (strcmp(result, "1") != 0) {
-    gs_error = "Pairing failed";
+    set_error(server->error, "Pairing failed");
     ret = GS_FAILED;
     goto cleanup;
   }
@@ -667,7 +694,7 @@ int gs_pair(PSERVER_DATA server, char* pin) {
   // If we failed when attempting to pair with a game running, that's likely the issue.
   // Sunshine supports pairing with an active session, but GFE does not.
   if (ret != GS_OK && server->currentGame != 0) {
-    gs_error = "The computer is currently in a game. You must close the game before pairing.";
+    set_error(server->error, "The computer is currently in a game. You must close the game before pairing.");
     ret = GS_WRONG_STATE;
   }
 
@@ -685,18 +712,280 @@ int gs_applist(PSERVER_DATA server, PAPP_LIST *list) {
 
   uuid_generate_random(uuid);
   uuid_unparse(uuid, uuid_str);
-  snprintf(url, sizeof(url), "https://%s:%u/applist?uniqueid=%s&uuid=%s", server->serverInfo.address, server->httpsPort, unique_id, uuid_str);
-  if (http_request(url, data) != GS_OK)
+  snprintf(url, sizeof(url), "https://%s:%u/applist?uniqueid=%s&uuid=%s", server->serverInfo.address, server->httpsPort, server->identity->uniqueId, uuid_str);
+  if (http_request(server->http, url, data, server->error) != GS_OK)
     ret = GS_IO_ERROR;
-  else if (xml_status(data->memory, data->size) == GS_ERROR)
+  else if (xml_status(data->memory, data->size, server->error) == GS_ERROR)
     ret = GS_ERROR;
-  else if (xml_applist(data->memory, data->size, list) != GS_OK)
+  else if (xml_applist(data->memory, data->size, list, server->error) != GS_OK)
     ret = GS_INVALID;
 
   http_free_data(data);
   return ret;
 }
 
+struct asset_entry {
+  PAPP_LIST app;
+  char hash[ASSET_HASH_CHARS+1];
+  HTTP_VALIDATOR validator;
+  bool titleMatches;
+  bool fetch;
+};
+
+struct asset_fetch {
+  PSERVER_DATA server;
+  struct asset_entry* entries;
+  int count;
+  int next;
+  int failed;
+  int timeoutMs;
+  char error[GS_ERROR_SIZE];
+  pthread_mutex_t mutex;
+};
+
+static void asset_path(PSERVER_DATA server, const char* hash, char* path, size_t size) {
+  snprintf(path, size, "%s/%s/%s.png", server->identity->keyDirectory, ASSET_DIRECTORY, hash);
+}
+
+// Box art is stored once per content hash, the index of every host maps its apps to hashes
+static void asset_index_path(PSERVER_DATA server, char* path, size_t size) {
+  snprintf(path, size, "%s/%s/%s.idx", server->identity->keyDirectory, ASSET_DIRECTORY, server->serverInfo.address);
+}
+
+static int asset_store(PSERVER_DATA server, PHTTP_DATA data, char* hash, char* error) {
+  unsigned char digest[SHA256_DIGEST_LENGTH];
+  char path[PATH_MAX];
+  char tmpPath[PATH_MAX];
+
+  SHA256((unsigned char*) data->memory, data->size, digest);
+  bytes_to_hex(digest, hash, SHA256_DIGEST_LENGTH);
+  asset_path(server, hash, path, sizeof(path));
+  if (access(path, R_OK) == 0)
+    return GS_OK;
+
+  // Write to a private file first, so other threads and processes never see a partial image
+  snprintf(tmpPath, sizeof(tmpPath), "%s.%d.%lx", path, getpid(), (unsigned long) pthread_self());
+  FILE *fd = fopen(tmpPath, "wb");
+  if (fd == NULL) {
+    set_error(error, "Can't write app asset");
+    return GS_IO_ERROR;
+  }
+
+  bool written = fwrite(data->memory, 1, data->size, fd) == data->size;
+  if (fclose(fd) != 0 || !written || rename(tmpPath, path) != 0) {
+    unlink(tmpPath);
+    set_error(error, "Can't write app asset");
+    return GS_IO_ERROR;
+  }
+
+  return GS_OK;
+}
+
+// Cached box art is only transferred again when the host reports a change, unchanged
+// images sent anyway are recognized by their hash
+static int asset_fetch_entry(PSERVER_DATA server, PHTTP_CLIENT http, PHTTP_DATA data, struct asset_entry* entry, char* error) {
+  char url[4096];
+  uuid_t uuid;
+  char uuid_str[UUID_STRLEN];
+
+  uuid_generate_random(uuid);
+  uuid_unparse(uuid, uuid_str);
+  snprintf(url, sizeof(url), "https://%s:%u/appasset?uniqueid=%s&uuid=%s&appid=%d&AssetType=2&AssetIdx=0", server->serverInfo.address, server->httpsPort, server->identity->uniqueId, uuid_str, entry->app->id);
+
+  bool modified;
+  HTTP_VALIDATOR validator = entry->validator;
+  int ret = http_request_validated(http, url, data, &validator, &modified, error);
+  if (ret != GS_OK || !modified)
+    return ret;
+
+  if (data->size == 0) {
+    set_error(error, "Empty app asset");
+    return GS_INVALID;
+  }
+
+  ret = asset_store(server, data, entry->hash, error);
+  if (ret == GS_OK)
+    entry->validator = validator;
+  else
+    entry->hash[0] = 0;
+
+  return ret;
+}
+
+static void* asset_fetch_thread(void* arg) {
+  struct asset_fetch *fetch = arg;
+
+  // Every thread keeps its own connection open for all of its requests
+  PHTTP_CLIENT http = http_init(fetch->server->identity->keyDirectory, 0, fetch->timeoutMs);
+  PHTTP_DATA data = http_create_data();
+  char error[GS_ERROR_SIZE];
+  while (true) {
+    pthread_mutex_lock(&fetch->mutex);
+    int index = fetch->next++;
+    pthread_mutex_unlock(&fetch->mutex);
+    if (index >= fetch->count)
+      break;
+    if (!fetch->entries[index].fetch)
+      continue;
+
+    int ret = GS_OUT_OF_MEMORY;
+    if (http != NULL && data != NULL)
+      ret = asset_fetch_entry(fetch->server, http, data, &fetch->entries[index], error);
+    else
+      set_error(error, "Out of memory");
+
+    // The caller reports the first error
+    if (ret != GS_OK) {
+      pthread_mutex_lock(&fetch->mutex);
+      if (fetch->failed++ == 0)
+        set_error(fetch->error, error);
+      pthread_mutex_unlock(&fetch->mutex);
+    }
+  }
+
+  http_free_data(data);
+  http_cleanup(http);
+  return NULL;
+}
+
+// Index lines hold the app id, content hash, ETag, Last-Modified and title separated by tabs
+static void asset_lookup(FILE *index, struct asset_entry* entry) {
+  char line[1024];
+  char hash[ASSET_HASH_CHARS+1];
+  char etag[sizeof(entry->validator.etag)];
+  char lastModified[sizeof(entry->validator.lastModified)];
+  int id, title;
+
+  rewind(index);
+  while (fgets(line, sizeof(line), index) != NULL) {
+    if (sscanf(line, "%d\t%64[0-9a-f]\t%127[^\t]\t%63[^\t]\t%n", &id, hash, etag, lastModified, &title) == 4 && id == entry->app->id && strlen(hash) == ASSET_HASH_CHARS) {
+      strcpy(entry->hash, hash);
+      strcpy(entry->validator.etag, strcmp(etag, "-") == 0 ? "" : etag);
+      strcpy(entry->validator.lastModified, strcmp(lastModified, "-") == 0 ? "" : lastModified);
+      line[strcspn(line, "\n")] = 0;
+      entry->titleMatches = strcmp(line + title, entry->app->name) == 0;
+      return;
+    }
+  }
+}
+
+// Box art is requested again when it isn't cached, conditionally when the host sent a
+// validator for it. Hosts without validators would send every image again, so their
+// cached box art is used as long as the app keeps its id and title.
+static bool asset_needs_fetch(PSERVER_DATA server, struct asset_entry* entry) {
+  char path[PATH_MAX];
+
+  if (entry->hash[0] != 0) {
+    asset_path(server, entry->hash, path, sizeof(path));
+    if (access(path, R_OK) != 0)
+      entry->hash[0] = 0;
+  }
+  if (entry->hash[0] == 0) {
+    memset(&entry->validator, 0, sizeof(entry->validator));
+    return true;
+  }
+
+  return entry->validator.etag[0] != 0 || entry->validator.lastModified[0] != 0 || !entry->titleMatches;
+}
+
+int gs_app_assets(PSERVER_DATA server, PAPP_LIST list, int jobs, int timeoutMs) {
+  char path[PATH_MAX];
+  int count = 0;
+  for (PAPP_LIST app = list; app != NULL; app = app->next) {
+    if (app->name != NULL)
+      count++;
+
+    free(app->asset);
+    app->asset = NULL;
+  }
+
+  if (count == 0)
+    return GS_OK;
+
+  snprintf(path, sizeof(path), "%s/%s", server->identity->keyDirectory, ASSET_DIRECTORY);
+  mkdirtree(path);
+
+  struct asset_entry* entries = calloc(count, sizeof(struct asset_entry));
+  if (entries == NULL)
+    return GS_OUT_OF_MEMORY;
+
+  asset_index_path(server, path, sizeof(path));
+  FILE *index = fopen(path, "r");
+  int i = 0, pending = 0;
+  for (PAPP_LIST app = list; app != NULL; app = app->next) {
+    if (app->name == NULL)
+      continue;
+
+    entries[i].app = app;
+    if (index != NULL)
+      asset_lookup(index, &entries[i]);
+    entries[i].fetch = asset_needs_fetch(server, &entries[i]);
+    if (entries[i].fetch)
+      pending++;
+    i++;
+  }
+  if (index != NULL)
+    fclose(index);
+
+  struct asset_fetch fetch = {
+    .server = server,
+    .entries = entries,
+    .count = count,
+    .timeoutMs = timeoutMs,
+  };
+  pthread_mutex_init(&fetch.mutex, NULL);
+
+  if (jobs < 1)
+    jobs = 1;
+  if (jobs > pending)
+    jobs = pending;
+
+  pthread_t threads[jobs > 0 ? jobs : 1];
+  int started = 0;
+  for (; started < jobs; started++) {
+    if (pthread_create(&threads[started], NULL, asset_fetch_thread, &fetch) != 0)
+      break;
+  }
+  if (started == 0 && pending > 0)
+    asset_fetch_thread(&fetch);
+
+  for (int j = 0; j < started; j++)
+    pthread_join(threads[j], NULL);
+
+  pthread_mutex_destroy(&fetch.mutex);
+
+  int ret = GS_OK;
+  if (fetch.failed > 0) {
+    set_error(server->error, fetch.error);
+    ret = GS_IO_ERROR;
+  }
+
+  // Rewrite the index after fetching, dropping apps the host doesn't list anymore
+  char tmpPath[PATH_MAX];
+  asset_index_path(server, path, sizeof(path));
+  snprintf(tmpPath, sizeof(tmpPath), "%s.%d", path, getpid());
+  FILE *fd = fopen(tmpPath, "w");
+  for (i = 0; i < count; i++) {
+    struct asset_entry* entry = &entries[i];
+    if (entry->hash[0] == 0)
+      continue;
+
+    if (fd != NULL)
+      fprintf(fd, "%d\t%s\t%s\t%s\t%s\n", entry->app->id, entry->hash, entry->validator.etag[0] != 0 ? entry->validator.etag : "-", entry->validator.lastModified[0] != 0 ? entry->validator.lastModified : "-", entry->app->name);
+
+    asset_path(server, entry->hash, path, sizeof(path));
+    entry->app->asset = strdup(path);
+  }
+  if (fd != NULL) {
+    asset_index_path(server, path, sizeof(path));
+    if (fclose(fd) != 0 || rename(tmpPath, path) != 0)
+      unlink(tmpPath);
+  }
+
+  free(entries);
+  return ret;
+}
+
 int gs_start_app(PSERVER_DATA server, STREAM_CONFIGURATION *config, int appId, bool sops, bool localaudio, int gamepad_mask) {
   int ret = GS_OK;
   uuid_t uuid;
@@ -742,18 +1031,18 @@ int gs_start_app(PSERVER_DATA server, STREAM_CONFIGURATION *config, int appId, b
   uuid_unparse(uuid, uuid_str);
   int surround_info = SURROUNDAUDIOINFO_FROM_AUDIO_CONFIGURATION(config->audioConfiguration);
   snprintf(url, sizeof(url), "https://%s:%u/%s?uniqueid=%s&uuid=%s&appid=%d&mode=%dx%dx%d&additionalStates=1&sops=%d&rikey=%s&rikeyid=%d&localAudioPlayMode=%d&surroundAudioInfo=%d&remoteControllersBitmap=%d&gcmap=%d%s%s",
-           server->serverInfo.address, server->httpsPort, server->currentGame ? "resume" : "launch", unique_id, uuid_str, appId, config->width, config->height, fps, sops, rikey_hex, rikeyid, localaudio, surround_info, gamepad_mask, gamepad_mask,
+           server->serverInfo.address, server->httpsPort, server->currentGame ? "resume" : "launch", server->identity->uniqueId, uuid_str, appId, config->width, config->height, fps, sops, rikey_hex, rikeyid, localaudio, surround_info, gamepad_mask, gamepad_mask,
            (config->supportedVideoFormats & VIDEO_FORMAT_MASK_10BIT) ? "&hdrMode=1&clientHdrCapVersion=0&clientHdrCapSupportedFlagsInUint32=0&clientHdrCapMetaDataId=NV_STATIC_METADATA_TYPE_1&clientHdrCapDisplayData=0x0x0x0x0x0x0x0x0x0x0" : "",
            LiGetLaunchUrlQueryParameters());
-  if ((ret = http_request(url, data)) == GS_OK)
+  if ((ret = http_request(server->http, url, data, server->error)) == GS_OK)
     server->currentGame = appId;
   else
     goto cleanup;
 
-  if ((ret = xml_status(data->memory, data->size) != GS_OK))
+  if ((ret = xml_status(data->memory, data->size, server->error) != GS_OK))
     goto cleanup;
-  else if ((ret = xml_search(data->memory, data->size, "gamesession", &result)) != GS_OK &&
-           (ret = xml_search(data->memory, data->size, "resume", &result)) != GS_OK)
+  else if ((ret = xml_search(data->memory, data->size, "gamesession", &result, server->error)) != GS_OK &&
+           (ret = xml_search(data->memory, data->size, "resume", &result, server->error)) != GS_OK)
     goto cleanup;
 
   if (!strcmp(result, "0")) {
@@ -764,7 +1053,7 @@ int gs_start_app(PSERVER_DATA server, STREAM_CONFIGURATION *config, int appId, b
   free(result);
   result = NULL;
 
-  if (xml_search(data->memory, data->size, "sessionUrl0", &result) == GS_OK) {
+  if (xml_search(data->memory, data->size, "sessionUrl0", &result, server->error) == GS_OK) {
     server->serverInfo.rtspSessionUrl = result;
     result = NULL;
   }
@@ -789,13 +1078,13 @@ int gs_quit_app(PSERVER_DATA server) {
 
   uuid_generate_random(uuid);
   uuid_unparse(uuid, uuid_str);
-  snprintf(url, sizeof(url), "https://%s:%u/cancel?uniqueid=%s&uuid=%s", server->serverInfo.address, server->httpsPort, unique_id, uuid_str);
-  if ((ret = http_request(url, data)) != GS_OK)
+  snprintf(url, sizeof(url), "https://%s:%u/cancel?uniqueid=%s&uuid=%s", server->serverInfo.address, server->httpsPort, server->identity->uniqueId, uuid_str);
+  if ((ret = http_request(server->http, url, data, server->error)) != GS_OK)
     goto cleanup;
 
-  if ((ret = xml_status(data->memory, data->size) != GS_OK))
+  if ((ret = xml_status(data->memory, data->size, server->error) != GS_OK))
     goto cleanup;
-  else if ((ret = xml_search(data->memory, data->size, "cancel", &result)) != GS_OK)
+  else if ((ret = xml_search(data->memory, data->size, "cancel", &result, server->error)) != GS_OK)
     goto cleanup;
 
   if (strcmp(result, "0") == 0) {
@@ -811,20 +1100,73 @@ int gs_quit_app(PSERVER_DATA server) {
   return ret;
 }
 
-int gs_init(PSERVER_DATA server, char *address, unsigned short httpPort, const char *keyDirectory, int log_level, bool unsupported) {
+PGS_IDENTITY gs_identity_load(const char *keyDirectory, char* error) {
+  PGS_IDENTITY identity = calloc(1, sizeof(GS_IDENTITY));
+  if (identity == NULL) {
+    set_error(error, "Not enough memory");
+    return NULL;
+  }
+
   mkdirtree(keyDirectory);
-  if (load_unique_id(keyDirectory) != GS_OK)
-    return GS_FAILED;
+  if (load_unique_id(identity, keyDirectory) != GS_OK) {
+    set_error(error, "Can't write unique id");
+    gs_identity_free(identity);
+    return NULL;
+  } else if (load_cert(identity, keyDirectory, error) != GS_OK) {
+    gs_identity_free(identity);
+    return NULL;
+  }
 
-  if (load_cert(keyDirectory))
-    return GS_FAILED;
+  snprintf(identity->keyDirectory, sizeof(identity->keyDirectory), "%s", keyDirectory);
+  return identity;
+}
 
-  http_init(keyDirectory, log_level);
+void gs_identity_free(PGS_IDENTITY identity) {
+  if (identity == NULL)
+    return;
 
+  X509_free(identity->cert);
+  EVP_PKEY_free(identity->privateKey);
+  free(identity);
+}
+
+int gs_connect(PSERVER_DATA server, PGS_IDENTITY identity, char *address, unsigned short httpPort, int log_level, bool unsupported, int timeoutMs) {
+  memset(server, 0, sizeof(*server));
   LiInitializeServerInformation(&server->serverInfo);
   server->serverInfo.address = address;
+  server->identity = identity;
   server->unsupported = unsupported;
   server->httpPort = httpPort ? httpPort : 47989;
   server->httpsPort = 0; /* Populated by load_server_status() */
+
+  server->http = http_init(identity->keyDirectory, log_level, timeoutMs);
+  if (server->http == NULL)
+    return GS_OUT_OF_MEMORY;
+
   return load_server_status(server);
 }
+
+int gs_init(PSERVER_DATA server, char *address, unsigned short httpPort, const char *keyDirectory, int log_level, bool unsupported) {
+  PGS_IDENTITY identity = gs_identity_load(keyDirectory, server->error);
+  if (identity == NULL)
+    return GS_FAILED;
+
+  int ret = gs_connect(server, identity, address, httpPort, log_level, unsupported, 0);
+  server->ownsIdentity = true;
+  return ret;
+}
+
+int gs_refresh(PSERVER_DATA server) {
+  return load_server_status(server);
+}
+
+void gs_destroy(PSERVER_DATA server) {
+  http_cleanup(server->http);
+  server->http = NULL;
+
+  if (server->ownsIdentity)
+    gs_identity_free(server->identity);
+  server->identity = NULL;
+
+  free_serverinfo(server);
+}
@@ -19,6 +19,7 @@
 
 #pragma once
 
+#include "errors.h"
 #include "xml.h"
 
 #include <Limelight.h>
@@ -28,6 +29,9 @@
 #define MIN_SUPPORTED_GFE_VERSION 3
 #define MAX_SUPPORTED_GFE_VERSION 7
 
+// Client certificate, key and unique id, shared by connections to any number of servers
+typedef struct _GS_IDENTITY GS_IDENTITY, *PGS_IDENTITY;
+
 typedef struct _SERVER_DATA {
   char* gpuType;
   bool paired;
@@ -40,11 +44,32 @@ typedef struct _SERVER_DATA {
   SERVER_INFORMATION serverInfo;
   unsigned short httpPort;
   unsigned short httpsPort;
+  PGS_IDENTITY identity;
+  bool ownsIdentity;
+  struct _HTTP_CLIENT* http;
+  // Description of the last error of a call on this server
+  char error[GS_ERROR_SIZE];
 } SERVER_DATA, *PSERVER_DATA;
 
 int gs_init(PSERVER_DATA server, char* address, unsigned short httpPort, const char *keyDirectory, int logLevel, bool unsupported);
+
+// Servers using different SERVER_DATA can be queried from multiple threads at once.
+// A timeout of 0 waits for every request as long as it takes.
+PGS_IDENTITY gs_identity_load(const char *keyDirectory, char* error);
+void gs_identity_free(PGS_IDENTITY identity);
+int gs_connect(PSERVER_DATA server, PGS_IDENTITY identity, char* address, unsigned short httpPort, int logLevel, bool unsupported, int timeoutMs);
+// Reloads the pairing state, running game and display modes over the existing connection
+int gs_refresh(PSERVER_DATA server);
+void gs_destroy(PSERVER_DATA server);
+
 int gs_start_app(PSERVER_DATA server, PSTREAM_CONFIGURATION config, int appId, bool sops, bool localaudio, int gamepad_mask);
 int gs_applist(PSERVER_DATA server, PAPP_LIST *app_list);
+
+// Fetches the box art of all apps over up to jobs connections into a cache in the key directory,
+// cached images are revalidated with the host. Every request gives up after timeoutMs.
+// Sets the asset of every app to a local image file, which is the cached one when the host couldn't
+// be asked, or NULL when there is none.
+int gs_app_assets(PSERVER_DATA server, PAPP_LIST app_list, int jobs, int timeoutMs);
 int gs_unpair(PSERVER_DATA server);
 int gs_pair(PSERVER_DATA server, char* pin);
 int gs_quit_app(PSERVER_DATA server);
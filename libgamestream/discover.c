@@ -17,8 +17,16 @@
  * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
  */
 
-#include "errors.h"
+#include "discover.h"
+#include "mdns.h"
 
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef HAVE_AVAHI
 #include <avahi-client/client.h>
 #include <avahi-client/lookup.h>
 
@@ -26,11 +34,6 @@
 #include <avahi-common/malloc.h>
 #include <avahi-common/error.h>
 
-#include <stdio.h>
-#include <stdlib.h>
-#include <stdbool.h>
-#include <time.h>
-
 static AvahiSimplePoll *simple_poll = NULL;
 
 struct cb_ctx {
@@ -40,7 +43,7 @@ struct cb_ctx {
 
 static void client_callback(AvahiClient *c, AvahiClientState state, void *userdata) {
   if (state == AVAHI_CLIENT_FAILURE) {
-    gs_error = "Server connection failure";
+    fprintf(stderr, "Server connection failure\n");
     avahi_simple_poll_quit(simple_poll);
   }
 }
@@ -67,12 +70,12 @@ static void browse_callback(AvahiServiceBrowser *b, AvahiIfIndex interface, Avah
 
   switch (event) {
   case AVAHI_BROWSER_FAILURE:
-    gs_error = "Server browser failure";
+    fprintf(stderr, "Server browser failure\n");
     avahi_simple_poll_quit(simple_poll);
     break;
   case AVAHI_BROWSER_NEW:
     if (!(avahi_service_resolver_new(c, interface, protocol, name, type, domain, AVAHI_PROTO_INET, 0, resolve_callback, userdata)))
-      gs_error = "Failed to resolve service";
+      fprintf(stderr, "Failed to resolve service\n");
 
     break;
   case AVAHI_BROWSER_REMOVE:
@@ -80,19 +83,19 @@ static void browse_callback(AvahiServiceBrowser *b, AvahiIfIndex interface, Avah
   }
 }
 
-void gs_discover_server(char* dest, unsigned short* port) {
+static void avahi_discover_server(char* dest, unsigned short* port) {
   AvahiClient *client = NULL;
   AvahiServiceBrowser *sb = NULL;
 
   if (!(simple_poll = avahi_simple_poll_new())) {
-    gs_error = "Failed to create simple poll object";
+    fprintf(stderr, "Failed to create simple poll object\n");
     goto cleanup;
   }
 
   int error;
   client = avahi_client_new(avahi_simple_poll_get(simple_poll), 0, client_callback, NULL, &error);
   if (!client) {
-    gs_error = "Failed to create client";
+    fprintf(stderr, "Failed to create client\n");
     goto cleanup;
   }
 
@@ -100,11 +103,19 @@ void gs_discover_server(char* dest, unsigned short* port) {
   ctx.address = dest;
   ctx.port = port;
   if (!(sb = avahi_service_browser_new(client, AVAHI_IF_UNSPEC, AVAHI_PROTO_INET, "_nvstream._tcp", NULL, 0, browse_callback, &ctx))) {
-    gs_error = "Failed to create service browser";
+    fprintf(stderr, "Failed to create service browser\n");
     goto cleanup;
   }
 
-  avahi_simple_poll_loop(simple_poll);
+  struct timespec start, now;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  int remaining = DISCOVER_TIMEOUT_MS;
+  while (avahi_simple_poll_iterate(simple_poll, remaining) == 0) {
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    remaining = DISCOVER_TIMEOUT_MS - ((now.tv_sec - start.tv_sec) * 1000 + (now.tv_nsec - start.tv_nsec) / 1000000);
+    if (remaining <= 0)
+      break;
+  }
 
   cleanup:
   if (sb)
@@ -116,3 +127,18 @@ void gs_discover_server(char* dest, unsigned short* port) {
   if (simple_poll)
     avahi_simple_poll_free(simple_poll);
 }
+#endif
+
+void gs_discover_server(char* dest, unsigned short* port) {
+  MDNS_HOST host;
+  if (mdns_discover(MDNS_SERVICE, MDNS_GROUP, MDNS_PORT, DISCOVER_TIMEOUT_MS, &host, 1, 1) > 0) {
+    snprintf(dest, MAX_ADDRESS_SIZE, "%s", host.address);
+    *port = host.port;
+    return;
+  }
+
+  #ifdef HAVE_AVAHI
+  // The daemon may know about hosts on interfaces our query didn't reach
+  avahi_discover_server(dest, port);
+  #endif
+}
@@ -20,5 +20,6 @@
 #include "errors.h"
 
 #define MAX_ADDRESS_SIZE 40
+#define DISCOVER_TIMEOUT_MS 3000
 
 void gs_discover_server(char* dest, unsigned short* port);
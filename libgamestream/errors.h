@@ -31,4 +31,6 @@
 #define GS_ERROR -9
 #define GS_NOT_SUPPORTED_SOPS_RESOLUTION -10
 
-extern const char* gs_error;
+// Size of the buffers calls describe their errors in. The caller owns them, so any
+// number of calls can be made at once.
+#define GS_ERROR_SIZE 256
@@ -22,11 +22,21 @@
 
 #include <stdbool.h>
 #include <string.h>
+#include <strings.h>
+#include <pthread.h>
 #include <curl/curl.h>
 
-static CURL *curl;
+struct _HTTP_CLIENT {
+  CURL *curl;
+  bool debug;
+};
 
-static bool debug;
+static pthread_once_t curl_once = PTHREAD_ONCE_INIT;
+
+// curl_global_init isn't thread safe, make sure it runs before any handle is created
+static void http_global_init() {
+  curl_global_init(CURL_GLOBAL_DEFAULT);
+}
 
 static size_t _write_curl(void *contents, size_t size, size_t nmemb, void *userp)
 {
@@ -44,11 +54,58 @@ static size_t _write_curl(void *contents, size_t size, size_t nmemb, void *userp
   return realsize;
 }
 
-int http_init(const char* keyDirectory, int logLevel) {
-  curl = curl_easy_init();
-  debug = logLevel >= 2;
-  if (!curl)
-    return GS_FAILED;
+// Keeps the validators of the response, called for every header line
+static size_t _header_curl(char *buffer, size_t size, size_t nitems, void *userp)
+{
+  size_t realsize = size * nitems;
+  PHTTP_VALIDATOR validator = (PHTTP_VALIDATOR)userp;
+
+  char *field;
+  size_t fieldSize, nameSize;
+  if (realsize > 5 && strncasecmp(buffer, "ETag:", 5) == 0) {
+    field = validator->etag;
+    fieldSize = sizeof(validator->etag);
+    nameSize = 5;
+  } else if (realsize > 14 && strncasecmp(buffer, "Last-Modified:", 14) == 0) {
+    field = validator->lastModified;
+    fieldSize = sizeof(validator->lastModified);
+    nameSize = 14;
+  } else
+    return realsize;
+
+  const char *value = buffer + nameSize;
+  size_t length = realsize - nameSize;
+  while (length > 0 && (*value == ' ' || *value == '\t')) {
+    value++;
+    length--;
+  }
+  while (length > 0 && strchr(" \t\r\n", value[length - 1]) != NULL)
+    length--;
+
+  // A validator which doesn't fit is dropped, so the content is always transferred
+  if (length < fieldSize) {
+    memcpy(field, value, length);
+    field[length] = 0;
+  } else
+    field[0] = 0;
+
+  return realsize;
+}
+
+PHTTP_CLIENT http_init(const char* keyDirectory, int logLevel, int timeoutMs) {
+  pthread_once(&curl_once, http_global_init);
+
+  PHTTP_CLIENT client = malloc(sizeof(HTTP_CLIENT));
+  if (client == NULL)
+    return NULL;
+
+  CURL *curl = curl_easy_init();
+  if (!curl) {
+    free(client);
+    return NULL;
+  }
+  client->curl = curl;
+  client->debug = logLevel >= 2;
 
   char certificateFilePath[4096];
   snprintf(certificateFilePath, sizeof(certificateFilePath), "%s/%s", keyDirectory, CERTIFICATE_FILE_NAME);
@@ -67,18 +124,27 @@ int http_init(const char* keyDirectory, int logLevel) {
   curl_easy_setopt(curl, CURLOPT_FAILONERROR, 1L);
   curl_easy_setopt(curl, CURLOPT_SSL_SESSIONID_CACHE, 0L);
 
-  return GS_OK;
+  // Timeouts are implemented without signals, which would hit random threads
+  curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+  if (timeoutMs > 0) {
+    curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT_MS, (long) timeoutMs);
+    curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, (long) timeoutMs);
+  }
+
+  return client;
 }
 
-int http_request(char* url, PHTTP_DATA data) {
+int http_request(PHTTP_CLIENT client, char* url, PHTTP_DATA data, char* error) {
+  CURL *curl = client->curl;
   curl_easy_setopt(curl, CURLOPT_WRITEDATA, data);
   curl_easy_setopt(curl, CURLOPT_URL, url);
 #ifdef __FreeBSD__
   curl_easy_setopt(curl, CURLOPT_FORBID_REUSE, 1);
 #endif
 
-  if (debug)
-    printf("Request %s\n", url);
+  // Debug output goes to stderr, as stdout may carry the result of an action
+  if (client->debug)
+    fprintf(stderr, "Request %s\n", url);
 
   if (data->size > 0) {
     free(data->memory);
@@ -91,20 +157,60 @@ int http_request(char* url, PHTTP_DATA data) {
   CURLcode res = curl_easy_perform(curl);
 
   if(res != CURLE_OK) {
-    gs_error = curl_easy_strerror(res);
+    snprintf(error, GS_ERROR_SIZE, "%s", curl_easy_strerror(res));
     return GS_FAILED;
   } else if (data->memory == NULL) {
     return GS_OUT_OF_MEMORY;
   }
 
-  if (debug)
-    printf("Response:\n%s\n\n", data->memory);
+  if (client->debug)
+    fprintf(stderr, "Response:\n%s\n\n", data->memory);
 
   return GS_OK;
 }
 
-void http_cleanup() {
-  curl_easy_cleanup(curl);
+int http_request_validated(PHTTP_CLIENT client, char* url, PHTTP_DATA data, PHTTP_VALIDATOR validator, bool* modified, char* error) {
+  CURL *curl = client->curl;
+  struct curl_slist *headers = NULL;
+  char header[256];
+  if (validator->etag[0] != 0) {
+    snprintf(header, sizeof(header), "If-None-Match: %s", validator->etag);
+    headers = curl_slist_append(headers, header);
+  }
+  if (validator->lastModified[0] != 0) {
+    snprintf(header, sizeof(header), "If-Modified-Since: %s", validator->lastModified);
+    headers = curl_slist_append(headers, header);
+  }
+
+  HTTP_VALIDATOR response = {0};
+  curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+  curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, _header_curl);
+  curl_easy_setopt(curl, CURLOPT_HEADERDATA, &response);
+  int ret = http_request(client, url, data, error);
+
+  long code = 0;
+  if (ret == GS_OK)
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &code);
+
+  // The handle is reused for plain requests
+  curl_easy_setopt(curl, CURLOPT_HTTPHEADER, NULL);
+  curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, NULL);
+  curl_easy_setopt(curl, CURLOPT_HEADERDATA, NULL);
+  curl_slist_free_all(headers);
+
+  if (ret == GS_OK) {
+    *modified = code != 304;
+    if (*modified)
+      *validator = response;
+  }
+  return ret;
+}
+
+void http_cleanup(PHTTP_CLIENT client) {
+  if (client != NULL) {
+    curl_easy_cleanup(client->curl);
+    free(client);
+  }
 }
 
 PHTTP_DATA http_create_data() {
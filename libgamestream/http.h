@@ -20,6 +20,7 @@
 #pragma once
 
 #include <stdlib.h>
+#include <stdbool.h>
 
 #define CERTIFICATE_FILE_NAME "client.pem"
 #define KEY_FILE_NAME "key.pem"
@@ -29,7 +30,20 @@ typedef struct _HTTP_DATA {
   size_t size;
 } HTTP_DATA, *PHTTP_DATA;
 
-int http_init(const char* keyDirectory, int logLevel);
+// Validators of a cached response, sent back so unchanged content isn't transferred again
+typedef struct _HTTP_VALIDATOR {
+  char etag[128];
+  char lastModified[64];
+} HTTP_VALIDATOR, *PHTTP_VALIDATOR;
+
+// Connection state of a single server, requests on different clients can run concurrently
+typedef struct _HTTP_CLIENT HTTP_CLIENT, *PHTTP_CLIENT;
+
+PHTTP_CLIENT http_init(const char* keyDirectory, int logLevel, int timeoutMs);
+void http_cleanup(PHTTP_CLIENT client);
 PHTTP_DATA http_create_data();
-int http_request(char* url, PHTTP_DATA data);
+int http_request(PHTTP_CLIENT client, char* url, PHTTP_DATA data, char* error);
+// Only transfers the content if it changed since the validator was received, modified tells which
+// happened. The validator is replaced with the one of new content.
+int http_request_validated(PHTTP_CLIENT client, char* url, PHTTP_DATA data, PHTTP_VALIDATOR validator, bool* modified, char* error);
 void http_free_data(PHTTP_DATA data);
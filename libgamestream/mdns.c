@@ -0,0 +1,387 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2015-2019 Iwan Timmer
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Minimal mDNS querier for GameStream hosts, using one-shot queries
+// from an ephemeral port (RFC 6762 section 5.1) so no local responder
+// or daemon is needed. Answers arrive by unicast on the same socket.
+
+#include "mdns.h"
+#include "errors.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include <errno.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MDNS_RETRANSMIT_MS 250
+#define MDNS_MAX_NAME 256
+#define MDNS_MAX_PACKET 9000
+#define MDNS_MAX_QUESTIONS 32
+
+#define DNS_TYPE_A 1
+#define DNS_TYPE_PTR 12
+#define DNS_TYPE_SRV 33
+#define DNS_CLASS_IN 1
+#define DNS_CLASS_UNICAST 0x8000
+#define DNS_FLAG_RESPONSE 0x8000
+
+struct mdns_instance {
+  char name[MDNS_MAX_NAME];
+  char target[MDNS_MAX_NAME];
+  unsigned short port;
+  bool has_srv;
+  struct in_addr source;
+};
+
+struct mdns_address {
+  char name[MDNS_MAX_NAME];
+  struct in_addr address;
+};
+
+struct mdns_state {
+  const char* service;
+  struct mdns_instance instances[MDNS_MAX_HOSTS];
+  int instance_count;
+  struct mdns_address addresses[MDNS_MAX_HOSTS];
+  int address_count;
+};
+
+static uint64_t mdns_time_ms() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static int mdns_write_name(unsigned char* packet, int offset, int size, const char* name) {
+  while (*name) {
+    const char* end = strchr(name, '.');
+    size_t length = end ? (size_t) (end - name) : strlen(name);
+    if (length == 0 || length > 63 || offset + length + 2 > (size_t) size)
+      return -1;
+
+    packet[offset++] = length;
+    memcpy(packet + offset, name, length);
+    offset += length;
+    name += length;
+    if (*name == '.')
+      name++;
+  }
+
+  if (offset + 1 > size)
+    return -1;
+
+  packet[offset++] = 0;
+  return offset;
+}
+
+// Decode a possibly compressed name, returning the offset after it
+static int mdns_read_name(const unsigned char* packet, int length, int offset, char* name, int size) {
+  int end = -1;
+  int written = 0;
+  int jumps = 0;
+
+  while (offset < length) {
+    int label = packet[offset];
+    if ((label & 0xc0) == 0xc0) {
+      if (offset + 1 >= length || ++jumps > 16)
+        return -1;
+      if (end < 0)
+        end = offset + 2;
+      offset = ((label & 0x3f) << 8) | packet[offset + 1];
+      continue;
+    } else if (label & 0xc0)
+      return -1;
+
+    offset++;
+    if (label == 0) {
+      name[written] = 0;
+      return end < 0 ? offset : end;
+    }
+
+    if (offset + label > length || written + label + 2 > size)
+      return -1;
+
+    if (written > 0)
+      name[written++] = '.';
+    memcpy(name + written, packet + offset, label);
+    written += label;
+    offset += label;
+  }
+
+  return -1;
+}
+
+static bool mdns_in_service(const char* name, const char* service) {
+  size_t name_length = strlen(name);
+  size_t service_length = strlen(service);
+  return name_length > service_length + 1 && name[name_length - service_length - 1] == '.' && strcasecmp(name + name_length - service_length, service) == 0;
+}
+
+static struct mdns_instance* mdns_find_instance(struct mdns_state* state, const char* name, bool add) {
+  for (int i = 0; i < state->instance_count; i++) {
+    if (strcasecmp(state->instances[i].name, name) == 0)
+      return &state->instances[i];
+  }
+
+  if (!add || state->instance_count >= MDNS_MAX_HOSTS)
+    return NULL;
+
+  struct mdns_instance* instance = &state->instances[state->instance_count++];
+  memset(instance, 0, sizeof(*instance));
+  snprintf(instance->name, sizeof(instance->name), "%s", name);
+  return instance;
+}
+
+static struct mdns_address* mdns_find_address(struct mdns_state* state, const char* name) {
+  for (int i = 0; i < state->address_count; i++) {
+    if (strcasecmp(state->addresses[i].name, name) == 0)
+      return &state->addresses[i];
+  }
+  return NULL;
+}
+
+static bool mdns_resolved(struct mdns_state* state, struct mdns_instance* instance) {
+  return instance->has_srv && mdns_find_address(state, instance->target) != NULL;
+}
+
+static int mdns_known_count(struct mdns_state* state) {
+  int count = state->instance_count;
+  for (int i = 0; i < state->instance_count; i++) {
+    if (state->instances[i].has_srv)
+      count++;
+  }
+  return count;
+}
+
+static int mdns_resolved_count(struct mdns_state* state) {
+  int count = 0;
+  for (int i = 0; i < state->instance_count; i++) {
+    if (mdns_resolved(state, &state->instances[i]))
+      count++;
+  }
+  return count;
+}
+
+// Ask for the service itself and whatever is still missing to resolve
+// the instances seen so far
+static int mdns_send_query(int fd, struct sockaddr_in* dest, struct mdns_state* state) {
+  unsigned char packet[MDNS_MAX_PACKET];
+  const char* names[MDNS_MAX_QUESTIONS];
+  int types[MDNS_MAX_QUESTIONS];
+  int questions = 0;
+
+  names[questions] = state->service;
+  types[questions++] = DNS_TYPE_PTR;
+  for (int i = 0; i < state->instance_count && questions + 1 < MDNS_MAX_QUESTIONS; i++) {
+    struct mdns_instance* instance = &state->instances[i];
+    if (!instance->has_srv) {
+      names[questions] = instance->name;
+      types[questions++] = DNS_TYPE_SRV;
+    } else if (!mdns_resolved(state, instance)) {
+      names[questions] = instance->target;
+      types[questions++] = DNS_TYPE_A;
+    }
+  }
+
+  memset(packet, 0, 12);
+  packet[4] = questions >> 8;
+  packet[5] = questions & 0xff;
+
+  int offset = 12;
+  for (int i = 0; i < questions; i++) {
+    offset = mdns_write_name(packet, offset, sizeof(packet) - 4, names[i]);
+    if (offset < 0)
+      return -1;
+
+    packet[offset++] = types[i] >> 8;
+    packet[offset++] = types[i] & 0xff;
+    packet[offset++] = (DNS_CLASS_UNICAST | DNS_CLASS_IN) >> 8;
+    packet[offset++] = (DNS_CLASS_UNICAST | DNS_CLASS_IN) & 0xff;
+  }
+
+  return sendto(fd, packet, offset, 0, (struct sockaddr*) dest, sizeof(*dest));
+}
+
+// Collect PTR, SRV and A records from all sections of a response
+static void mdns_parse(struct mdns_state* state, const unsigned char* packet, int length, struct in_addr source) {
+  if (length < 12 || !((packet[2] << 8 | packet[3]) & DNS_FLAG_RESPONSE))
+    return;
+
+  int questions = packet[4] << 8 | packet[5];
+  int records = (packet[6] << 8 | packet[7]) + (packet[8] << 8 | packet[9]) + (packet[10] << 8 | packet[11]);
+  char name[MDNS_MAX_NAME], data[MDNS_MAX_NAME];
+
+  int offset = 12;
+  for (int i = 0; i < questions; i++) {
+    if ((offset = mdns_read_name(packet, length, offset, name, sizeof(name))) < 0)
+      return;
+    offset += 4;
+  }
+
+  for (int i = 0; i < records; i++) {
+    if ((offset = mdns_read_name(packet, length, offset, name, sizeof(name))) < 0 || offset + 10 > length)
+      return;
+
+    int type = packet[offset] << 8 | packet[offset + 1];
+    uint32_t ttl = (uint32_t) packet[offset + 4] << 24 | packet[offset + 5] << 16 | packet[offset + 6] << 8 | packet[offset + 7];
+    int rdlength = packet[offset + 8] << 8 | packet[offset + 9];
+    int rdata = offset + 10;
+    offset = rdata + rdlength;
+    if (offset > length)
+      return;
+
+    // Goodbye packets announce a service going away
+    if (ttl == 0)
+      continue;
+
+    struct mdns_instance* instance;
+    switch (type) {
+    case DNS_TYPE_PTR:
+      if (strcasecmp(name, state->service) == 0 && mdns_read_name(packet, length, rdata, data, sizeof(data)) >= 0 && mdns_in_service(data, state->service)) {
+        instance = mdns_find_instance(state, data, true);
+        if (instance != NULL && !instance->has_srv)
+          instance->source = source;
+      }
+      break;
+    case DNS_TYPE_SRV:
+      if (rdlength >= 7 && mdns_in_service(name, state->service) && mdns_read_name(packet, length, rdata + 6, data, sizeof(data)) >= 0) {
+        instance = mdns_find_instance(state, name, true);
+        if (instance != NULL) {
+          instance->port = packet[rdata + 4] << 8 | packet[rdata + 5];
+          snprintf(instance->target, sizeof(instance->target), "%s", data);
+          instance->has_srv = true;
+          instance->source = source;
+        }
+      }
+      break;
+    case DNS_TYPE_A:
+      if (rdlength == 4 && mdns_find_address(state, name) == NULL && state->address_count < MDNS_MAX_HOSTS) {
+        struct mdns_address* address = &state->addresses[state->address_count++];
+        snprintf(address->name, sizeof(address->name), "%s", name);
+        memcpy(&address->address, packet + rdata, 4);
+      }
+      break;
+    }
+  }
+}
+
+static void mdns_add_host(struct mdns_state* state, struct mdns_instance* instance, struct in_addr addr, PMDNS_HOST host) {
+  inet_ntop(AF_INET, &addr, host->address, sizeof(host->address));
+  host->port = instance->port;
+
+  size_t length = strlen(instance->name) - strlen(state->service) - 1;
+  if (length >= sizeof(host->name))
+    length = sizeof(host->name) - 1;
+  memcpy(host->name, instance->name, length);
+  host->name[length] = 0;
+}
+
+// Resolved hosts come first. Unless only resolved hosts are asked for,
+// hosts without an A record follow, using the address their SRV record
+// came from.
+static int mdns_collect(struct mdns_state* state, PMDNS_HOST hosts, int max_hosts, bool resolved_only) {
+  int count = 0;
+  for (int i = 0; i < state->instance_count && count < max_hosts; i++) {
+    struct mdns_instance* instance = &state->instances[i];
+    if (mdns_resolved(state, instance))
+      mdns_add_host(state, instance, mdns_find_address(state, instance->target)->address, &hosts[count++]);
+  }
+
+  for (int i = 0; i < state->instance_count && count < max_hosts && !resolved_only; i++) {
+    struct mdns_instance* instance = &state->instances[i];
+    if (instance->has_srv && !mdns_resolved(state, instance))
+      mdns_add_host(state, instance, instance->source, &hosts[count++]);
+  }
+  return count;
+}
+
+int mdns_discover(const char* service, const char* group, unsigned short port, int timeout_ms, PMDNS_HOST hosts, int max_hosts, int wanted) {
+  struct mdns_state state = {0};
+  state.service = service;
+
+  struct sockaddr_in dest = {0};
+  dest.sin_family = AF_INET;
+  dest.sin_port = htons(port);
+  if (inet_pton(AF_INET, group, &dest.sin_addr) != 1)
+    return GS_INVALID;
+
+  int fd = socket(AF_INET, SOCK_DGRAM, 0);
+  if (fd < 0)
+    return GS_IO_ERROR;
+
+  unsigned char ttl = 255;
+  unsigned char loop = 1;
+  setsockopt(fd, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl));
+  setsockopt(fd, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop));
+
+  uint64_t now = mdns_time_ms();
+  uint64_t deadline = now + timeout_ms;
+  uint64_t next_query = now;
+  int interval = MDNS_RETRANSMIT_MS;
+  bool followup = false;
+  int queries = 0;
+
+  while (now < deadline && (wanted <= 0 || mdns_resolved_count(&state) < wanted)) {
+    if (now >= next_query || followup) {
+      if (mdns_send_query(fd, &dest, &state) >= 0)
+        queries++;
+      else if (queries == 0) {
+        close(fd);
+        return GS_IO_ERROR;
+      }
+
+      if (now >= next_query) {
+        next_query = now + interval;
+        interval *= 2;
+      }
+      followup = false;
+    }
+
+    uint64_t wakeup = next_query < deadline ? next_query : deadline;
+    struct pollfd pfd = { .fd = fd, .events = POLLIN };
+    if (poll(&pfd, 1, wakeup - now) > 0) {
+      unsigned char packet[MDNS_MAX_PACKET];
+      struct sockaddr_in source;
+      socklen_t source_length = sizeof(source);
+      int length;
+      int known = mdns_known_count(&state);
+      while ((length = recvfrom(fd, packet, sizeof(packet), MSG_DONTWAIT, (struct sockaddr*) &source, &source_length)) > 0) {
+        mdns_parse(&state, packet, length, source.sin_addr);
+        source_length = sizeof(source);
+      }
+
+      // Ask right away for records of newly seen hosts that were not
+      // included in the answer, instead of waiting for the next retry
+      if (mdns_known_count(&state) > known && mdns_resolved_count(&state) < state.instance_count)
+        followup = true;
+    }
+    now = mdns_time_ms();
+  }
+
+  close(fd);
+  return mdns_collect(&state, hosts, max_hosts, wanted > 0);
+}
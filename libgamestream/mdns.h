@@ -0,0 +1,35 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2015-2019 Iwan Timmer
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+
+#define MDNS_GROUP "224.0.0.251"
+#define MDNS_PORT 5353
+#define MDNS_SERVICE "_nvstream._tcp.local"
+#define MDNS_MAX_HOSTS 16
+
+typedef struct _MDNS_HOST {
+  char name[64];
+  char address[40];
+  unsigned short port;
+} MDNS_HOST, *PMDNS_HOST;
+
+int mdns_discover(const char* service, const char* group, unsigned short port, int timeout_ms, PMDNS_HOST hosts, int max_hosts, int wanted);
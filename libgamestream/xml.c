@@ -32,6 +32,11 @@ struct xml_query {
   void* data;
 };
 
+struct xml_status {
+  int code;
+  char* message;
+};
+
 static void XMLCALL _xml_start_element(void *userData, const char *name, const char **atts) {
   struct xml_query *search = (struct xml_query*) userData;
   if (strcmp(search->data, name) == 0)
@@ -53,6 +58,7 @@ static void XMLCALL _xml_start_applist_element(void *userData, const char *name,
 
     app->id = 0;
     app->name = NULL;
+    app->asset = NULL;
     app->next = (PAPP_LIST) search->data;
     search->data = app;
   } else if (strcmp("ID", name) == 0 || strcmp("AppTitle", name) == 0) {
@@ -112,12 +118,12 @@ static void XMLCALL _xml_end_mode_element(void *userData, const char *name) {
 
 static void XMLCALL _xml_start_status_element(void *userData, const char *name, const char **atts) {
   if (strcmp("root", name) == 0) {
-    int* status = (int*) userData;
+    struct xml_status* status = (struct xml_status*) userData;
     for (int i = 0; atts[i]; i += 2) {
       if (strcmp("status_code", atts[i]) == 0)
-        *status = atoi(atts[i + 1]);
-      else if (*status != STATUS_OK && strcmp("status_message", atts[i]) == 0)
-        gs_error = strdup(atts[i + 1]);
+        status->code = atoi(atts[i + 1]);
+      else if (status->code != STATUS_OK && strcmp("status_message", atts[i]) == 0)
+        snprintf(status->message, GS_ERROR_SIZE, "%s", atts[i + 1]);
     }
   }
 }
@@ -137,7 +143,7 @@ static void XMLCALL _xml_write_data(void *userData, const XML_Char *s, int len)
   }
 }
 
-int xml_search(char* data, size_t len, char* node, char** result) {
+int xml_search(char* data, size_t len, char* node, char** result, char* error) {
   struct xml_query search;
   search.data = node;
   search.start = 0;
@@ -149,7 +155,7 @@ int xml_search(char* data, size_t len, char* node, char** result) {
   XML_SetCharacterDataHandler(parser, _xml_write_data);
   if (! XML_Parse(parser, data, len, 1)) {
     int code = XML_GetErrorCode(parser);
-    gs_error = XML_ErrorString(code);
+    snprintf(error, GS_ERROR_SIZE, "%s", XML_ErrorString(code));
     XML_ParserFree(parser);
     free(search.memory);
     return GS_INVALID;
@@ -164,7 +170,7 @@ int xml_search(char* data, size_t len, char* node, char** result) {
   return GS_OK;
 }
 
-int xml_applist(char* data, size_t len, PAPP_LIST *app_list) {
+int xml_applist(char* data, size_t len, PAPP_LIST *app_list, char* error) {
   struct xml_query query;
   query.memory = calloc(1, 1);
   query.size = 0;
@@ -176,7 +182,7 @@ int xml_applist(char* data, size_t len, PAPP_LIST *app_list) {
   XML_SetCharacterDataHandler(parser, _xml_write_data);
   if (! XML_Parse(parser, data, len, 1)) {
     int code = XML_GetErrorCode(parser);
-    gs_error = XML_ErrorString(code);
+    snprintf(error, GS_ERROR_SIZE, "%s", XML_ErrorString(code));
     XML_ParserFree(parser);
     return GS_INVALID;
   }
@@ -187,7 +193,7 @@ int xml_applist(char* data, size_t len, PAPP_LIST *app_list) {
   return GS_OK;
 }
 
-int xml_modelist(char* data, size_t len, PDISPLAY_MODE *mode_list) {
+int xml_modelist(char* data, size_t len, PDISPLAY_MODE *mode_list, char* error) {
   struct xml_query query = {0};
   query.memory = calloc(1, 1);
   XML_Parser parser = XML_ParserCreate("UTF-8");
@@ -196,7 +202,7 @@ int xml_modelist(char* data, size_t len, PDISPLAY_MODE *mode_list) {
   XML_SetCharacterDataHandler(parser, _xml_write_data);
   if (! XML_Parse(parser, data, len, 1)) {
     int code = XML_GetErrorCode(parser);
-    gs_error = XML_ErrorString(code);
+    snprintf(error, GS_ERROR_SIZE, "%s", XML_ErrorString(code));
     XML_ParserFree(parser);
     return GS_INVALID;
   }
@@ -208,18 +214,18 @@ int xml_modelist(char* data, size_t len, PDISPLAY_MODE *mode_list) {
 
 }
 
-int xml_status(char* data, size_t len) {
-  int status = 0;
+int xml_status(char* data, size_t len, char* error) {
+  struct xml_status status = { 0, error };
   XML_Parser parser = XML_ParserCreate("UTF-8");
   XML_SetUserData(parser, &status);
   XML_SetElementHandler(parser, _xml_start_status_element, _xml_end_status_element);
   if (!XML_Parse(parser, data, len, 1)) {
     int code = XML_GetErrorCode(parser);
-    gs_error = XML_ErrorString(code);
+    snprintf(error, GS_ERROR_SIZE, "%s", XML_ErrorString(code));
     XML_ParserFree(parser);
     return GS_INVALID;
   }
 
   XML_ParserFree(parser);
-  return status == STATUS_OK ? GS_OK : GS_ERROR;
+  return status.code == STATUS_OK ? GS_OK : GS_ERROR;
 }
@@ -23,6 +23,7 @@
 typedef struct _APP_LIST {
   char* name;
   int id;
+  char* asset;
   struct _APP_LIST *next;
 } APP_LIST, *PAPP_LIST;
 
@@ -33,7 +34,9 @@ typedef struct _DISPLAY_MODE {
   struct _DISPLAY_MODE *next;
 } DISPLAY_MODE, *PDISPLAY_MODE;
 
-int xml_search(char* data, size_t len, char* node, char** result);
-int xml_applist(char* data, size_t len, PAPP_LIST *app_list);
-int xml_modelist(char* data, size_t len, PDISPLAY_MODE *mode_list);
-int xml_status(char* data, size_t len);
+// Errors are described in error, which has room for GS_ERROR_SIZE characters
+int xml_search(char* data, size_t len, char* node, char** result, char* error);
+int xml_applist(char* data, size_t len, PAPP_LIST *app_list, char* error);
+int xml_modelist(char* data, size_t len, PDISPLAY_MODE *mode_list, char* error);
+// The status message of a failed request is copied to error
+int xml_status(char* data, size_t len, char* error);
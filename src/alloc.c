@@ -0,0 +1,412 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2015-2019 Iwan Timmer
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_ALLOC_TRACKER
+
+#define _GNU_SOURCE
+
+#include "alloc.h"
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#define ALLOC_MAX_THREADS 64
+#define ALLOC_CALLERS 128
+#define ALLOC_SAMPLE_INTERVAL 64
+#define ALLOC_PRINT_CALLERS 20
+
+// The allocator behind the interposed functions, exported by glibc
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t count, size_t size);
+extern void* __libc_realloc(void* ptr, size_t size);
+extern void* __libc_memalign(size_t alignment, size_t size);
+extern void __libc_free(void* ptr);
+
+struct alloc_counters {
+  uint64_t allocs;
+  uint64_t frees;
+  uint64_t bytes;
+};
+
+struct alloc_thread {
+  pid_t tid;
+  struct alloc_counters counters;
+};
+
+struct alloc_caller {
+  void* address;
+  enum alloc_path path;
+  bool steady;
+  uint64_t count;
+};
+
+static const char* path_names[ALLOC_PATHS] = { "other", "video", "audio", "input" };
+static const char* unit_names[ALLOC_PATHS] = { NULL, "frame", "packet", "event" };
+
+static struct alloc_counters path_counters[ALLOC_PATHS];
+static uint64_t path_units[ALLOC_PATHS];
+static uint64_t path_steady_allocs[ALLOC_PATHS];
+
+static struct alloc_thread threads[ALLOC_MAX_THREADS];
+static int thread_count;
+
+static pthread_mutex_t caller_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct alloc_caller callers[ALLOC_CALLERS];
+static int caller_count;
+static uint64_t callers_dropped;
+
+static __thread struct alloc_thread* current_thread;
+static __thread bool thread_registered;
+static __thread enum alloc_path current_path;
+static __thread bool in_tracker;
+static __thread unsigned int sample_counter;
+
+static pthread_t report_thread;
+static volatile bool report_running;
+
+static DECODER_RENDERER_CALLBACKS video_callbacks;
+static DecoderRendererSubmitDecodeUnit video_submit;
+static AUDIO_RENDERER_CALLBACKS audio_callbacks;
+static AudioRendererDecodeAndPlaySample audio_decode;
+
+// Threads get their own counters on their first allocation, without
+// allocating themselves
+static struct alloc_thread* alloc_thread() {
+  if (!thread_registered) {
+    thread_registered = true;
+    int index = __atomic_fetch_add(&thread_count, 1, __ATOMIC_RELAXED);
+    if (index < ALLOC_MAX_THREADS) {
+      current_thread = &threads[index];
+      current_thread->tid = syscall(SYS_gettid);
+    }
+  }
+  return current_thread;
+}
+
+static bool alloc_steady(enum alloc_path path) {
+  return path != ALLOC_OTHER && __atomic_load_n(&path_units[path], __ATOMIC_RELAXED) >= ALLOC_WARMUP_UNITS;
+}
+
+static void alloc_sample(void* address, enum alloc_path path, bool steady) {
+  pthread_mutex_lock(&caller_mutex);
+  int i;
+  for (i = 0; i < caller_count; i++) {
+    if (callers[i].address == address && callers[i].path == path && callers[i].steady == steady)
+      break;
+  }
+
+  if (i < caller_count)
+    callers[i].count++;
+  else if (caller_count < ALLOC_CALLERS) {
+    callers[caller_count].address = address;
+    callers[caller_count].path = path;
+    callers[caller_count].steady = steady;
+    callers[caller_count].count = 1;
+    caller_count++;
+  } else
+    callers_dropped++;
+  pthread_mutex_unlock(&caller_mutex);
+}
+
+// Every allocation after warm-up is recorded with its caller, before
+// that only every ALLOC_SAMPLE_INTERVAL one per thread
+static void alloc_count(size_t size, void* caller) {
+  if (in_tracker)
+    return;
+
+  in_tracker = true;
+  struct alloc_thread* thread = alloc_thread();
+  if (thread) {
+    thread->counters.allocs++;
+    thread->counters.bytes += size;
+  }
+
+  enum alloc_path path = current_path;
+  __atomic_fetch_add(&path_counters[path].allocs, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&path_counters[path].bytes, size, __ATOMIC_RELAXED);
+
+  bool steady = alloc_steady(path);
+  if (steady)
+    __atomic_fetch_add(&path_steady_allocs[path], 1, __ATOMIC_RELAXED);
+
+  if (steady || ++sample_counter % ALLOC_SAMPLE_INTERVAL == 0)
+    alloc_sample(caller, path, steady);
+
+  in_tracker = false;
+}
+
+static void alloc_count_free() {
+  if (in_tracker)
+    return;
+
+  in_tracker = true;
+  struct alloc_thread* thread = alloc_thread();
+  if (thread)
+    thread->counters.frees++;
+
+  __atomic_fetch_add(&path_counters[current_path].frees, 1, __ATOMIC_RELAXED);
+  in_tracker = false;
+}
+
+void* malloc(size_t size) {
+  alloc_count(size, __builtin_return_address(0));
+  return __libc_malloc(size);
+}
+
+void* calloc(size_t count, size_t size) {
+  alloc_count(count * size, __builtin_return_address(0));
+  return __libc_calloc(count, size);
+}
+
+void* realloc(void* ptr, size_t size) {
+  if (size > 0)
+    alloc_count(size, __builtin_return_address(0));
+  else if (ptr != NULL)
+    alloc_count_free();
+
+  return __libc_realloc(ptr, size);
+}
+
+void free(void* ptr) {
+  if (ptr != NULL)
+    alloc_count_free();
+
+  __libc_free(ptr);
+}
+
+void* memalign(size_t alignment, size_t size) {
+  alloc_count(size, __builtin_return_address(0));
+  return __libc_memalign(alignment, size);
+}
+
+void* aligned_alloc(size_t alignment, size_t size) {
+  alloc_count(size, __builtin_return_address(0));
+  return __libc_memalign(alignment, size);
+}
+
+int posix_memalign(void** ptr, size_t alignment, size_t size) {
+  if (alignment % sizeof(void*) != 0 || (alignment & (alignment - 1)) != 0)
+    return EINVAL;
+
+  alloc_count(size, __builtin_return_address(0));
+  void* mem = __libc_memalign(alignment, size);
+  if (mem == NULL)
+    return ENOMEM;
+
+  *ptr = mem;
+  return 0;
+}
+
+void alloc_enter(enum alloc_path path) {
+  current_path = path;
+}
+
+void alloc_leave() {
+  current_path = ALLOC_OTHER;
+}
+
+void alloc_unit(enum alloc_path path) {
+  __atomic_fetch_add(&path_units[path], 1, __ATOMIC_RELAXED);
+}
+
+static int alloc_submit_decode_unit(PDECODE_UNIT decodeUnit) {
+  alloc_enter(ALLOC_VIDEO);
+  int ret = video_submit(decodeUnit);
+  alloc_unit(ALLOC_VIDEO);
+  alloc_leave();
+  return ret;
+}
+
+static void alloc_decode_and_play_sample(char* data, int length) {
+  alloc_enter(ALLOC_AUDIO);
+  audio_decode(data, length);
+  alloc_unit(ALLOC_AUDIO);
+  alloc_leave();
+}
+
+PDECODER_RENDERER_CALLBACKS alloc_track_video(PDECODER_RENDERER_CALLBACKS callbacks) {
+  if (callbacks == NULL)
+    return NULL;
+
+  video_callbacks = *callbacks;
+  video_submit = callbacks->submitDecodeUnit;
+  video_callbacks.submitDecodeUnit = alloc_submit_decode_unit;
+  return &video_callbacks;
+}
+
+PAUDIO_RENDERER_CALLBACKS alloc_track_audio(PAUDIO_RENDERER_CALLBACKS callbacks) {
+  if (callbacks == NULL)
+    return NULL;
+
+  audio_callbacks = *callbacks;
+  audio_decode = callbacks->decodeAndPlaySample;
+  audio_callbacks.decodeAndPlaySample = alloc_decode_and_play_sample;
+  return &audio_callbacks;
+}
+
+static void* alloc_report_run(void* data) {
+  uint64_t last_allocs[ALLOC_PATHS], last_units[ALLOC_PATHS];
+  for (int i = 0; i < ALLOC_PATHS; i++) {
+    last_allocs[i] = __atomic_load_n(&path_counters[i].allocs, __ATOMIC_RELAXED);
+    last_units[i] = __atomic_load_n(&path_units[i], __ATOMIC_RELAXED);
+  }
+
+  while (report_running) {
+    for (int i = 0; i < 10 && report_running; i++)
+      usleep(100000);
+
+    char line[256];
+    int len = snprintf(line, sizeof(line), "Allocations/s:");
+    for (int i = 0; i < ALLOC_PATHS && len < sizeof(line); i++) {
+      uint64_t allocs = __atomic_load_n(&path_counters[i].allocs, __ATOMIC_RELAXED);
+      uint64_t units = __atomic_load_n(&path_units[i], __ATOMIC_RELAXED);
+      uint64_t delta = allocs - last_allocs[i];
+      if (unit_names[i] != NULL && units > last_units[i])
+        len += snprintf(line + len, sizeof(line) - len, " %s %llu (%.2f/%s)", path_names[i], (unsigned long long) delta, (double) delta / (units - last_units[i]), unit_names[i]);
+      else
+        len += snprintf(line + len, sizeof(line) - len, " %s %llu", path_names[i], (unsigned long long) delta);
+
+      last_allocs[i] = allocs;
+      last_units[i] = units;
+    }
+    printf("%s\n", line);
+  }
+
+  return NULL;
+}
+
+void alloc_start() {
+  report_running = true;
+  if (pthread_create(&report_thread, NULL, alloc_report_run, NULL) != 0) {
+    fprintf(stderr, "Can't start allocation report\n");
+    report_running = false;
+  }
+}
+
+void alloc_stop() {
+  if (report_running) {
+    report_running = false;
+    pthread_join(report_thread, NULL);
+  }
+}
+
+static void alloc_thread_name(pid_t tid, char* name, size_t size) {
+  char path[64];
+  snprintf(path, sizeof(path), "/proc/self/task/%d/comm", tid);
+
+  ssize_t len = -1;
+  int fd = open(path, O_RDONLY);
+  if (fd >= 0) {
+    len = read(fd, name, size - 1);
+    close(fd);
+  }
+
+  if (len <= 0) {
+    snprintf(name, size, "exited");
+    return;
+  }
+
+  name[len] = '\0';
+  name[strcspn(name, "\n")] = '\0';
+}
+
+// Allocations after warm-up first, then by count
+static int alloc_caller_compare(const void* a, const void* b) {
+  const struct alloc_caller* first = a;
+  const struct alloc_caller* second = b;
+  if (first->steady != second->steady)
+    return first->steady ? -1 : 1;
+  if (first->count != second->count)
+    return first->count > second->count ? -1 : 1;
+  return 0;
+}
+
+uint64_t alloc_print(FILE* out) {
+  uint64_t steady_total = 0;
+
+  fprintf(out, "Allocation statistics\n");
+  for (int i = 0; i < ALLOC_PATHS; i++) {
+    uint64_t allocs = __atomic_load_n(&path_counters[i].allocs, __ATOMIC_RELAXED);
+    uint64_t frees = __atomic_load_n(&path_counters[i].frees, __ATOMIC_RELAXED);
+    uint64_t bytes = __atomic_load_n(&path_counters[i].bytes, __ATOMIC_RELAXED);
+    fprintf(out, "  %s: %llu allocations, %llu frees, %llu bytes", path_names[i], (unsigned long long) allocs, (unsigned long long) frees, (unsigned long long) bytes);
+
+    if (unit_names[i] != NULL) {
+      uint64_t units = __atomic_load_n(&path_units[i], __ATOMIC_RELAXED);
+      uint64_t steady = __atomic_load_n(&path_steady_allocs[i], __ATOMIC_RELAXED);
+      if (units > 0)
+        fprintf(out, ", %.2f per %s", (double) allocs / units, unit_names[i]);
+      if (units >= ALLOC_WARMUP_UNITS)
+        fprintf(out, ", %llu after warm-up", (unsigned long long) steady);
+      else if (units > 0)
+        fprintf(out, ", warm-up not reached (%llu of %d %ss)", (unsigned long long) units, ALLOC_WARMUP_UNITS, unit_names[i]);
+      steady_total += steady;
+    }
+    fprintf(out, "\n");
+  }
+
+  int count = __atomic_load_n(&thread_count, __ATOMIC_RELAXED);
+  if (count > ALLOC_MAX_THREADS)
+    count = ALLOC_MAX_THREADS;
+  for (int i = 0; i < count; i++) {
+    char name[32];
+    alloc_thread_name(threads[i].tid, name, sizeof(name));
+    fprintf(out, "  Thread %d (%s): %llu allocations, %llu frees, %llu bytes\n", threads[i].tid, name, (unsigned long long) threads[i].counters.allocs, (unsigned long long) threads[i].counters.frees, (unsigned long long) threads[i].counters.bytes);
+  }
+
+  struct alloc_caller sorted[ALLOC_CALLERS];
+  pthread_mutex_lock(&caller_mutex);
+  int sorted_count = caller_count;
+  memcpy(sorted, callers, sizeof(struct alloc_caller) * sorted_count);
+  uint64_t dropped = callers_dropped;
+  pthread_mutex_unlock(&caller_mutex);
+
+  qsort(sorted, sorted_count, sizeof(struct alloc_caller), alloc_caller_compare);
+  if (sorted_count > 0)
+    fprintf(out, "Allocation callers (sampled 1 in %d during warm-up)\n", ALLOC_SAMPLE_INTERVAL);
+
+  for (int i = 0; i < sorted_count && i < ALLOC_PRINT_CALLERS; i++) {
+    Dl_info info;
+    fprintf(out, "  %s%s: %llu x ", path_names[sorted[i].path], sorted[i].steady ? " after warm-up" : "", (unsigned long long) sorted[i].count);
+    bool found = dladdr(sorted[i].address, &info) != 0;
+    if (found && info.dli_sname != NULL)
+      fprintf(out, "%s+0x%lx", info.dli_sname, (unsigned long) ((char*) sorted[i].address - (char*) info.dli_saddr));
+    else
+      fprintf(out, "%p", sorted[i].address);
+
+    if (found && info.dli_fname != NULL) {
+      const char* file = strrchr(info.dli_fname, '/');
+      fprintf(out, " (%s)", file ? file + 1 : info.dli_fname);
+    }
+    fprintf(out, "\n");
+  }
+
+  if (dropped > 0)
+    fprintf(out, "  %llu samples from other callers not recorded\n", (unsigned long long) dropped);
+
+  return steady_total;
+}
+
+#endif /* HAVE_ALLOC_TRACKER */
@@ -0,0 +1,50 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2015-2019 Iwan Timmer
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Optional allocation tracker, only compiled with ENABLE_ALLOC_TRACKER.
+// Allocations are charged to the path (video, audio or input) the
+// calling thread is currently working on, and are expected to stop once
+// a path has handled ALLOC_WARMUP_UNITS frames, packets or events.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define ALLOC_WARMUP_UNITS 120
+
+enum alloc_path { ALLOC_OTHER, ALLOC_VIDEO, ALLOC_AUDIO, ALLOC_INPUT, ALLOC_PATHS };
+
+#ifdef HAVE_ALLOC_TRACKER
+#include <Limelight.h>
+
+void alloc_enter(enum alloc_path path);
+void alloc_leave(void);
+void alloc_unit(enum alloc_path path);
+
+PDECODER_RENDERER_CALLBACKS alloc_track_video(PDECODER_RENDERER_CALLBACKS callbacks);
+PAUDIO_RENDERER_CALLBACKS alloc_track_audio(PAUDIO_RENDERER_CALLBACKS callbacks);
+
+void alloc_start(void);
+void alloc_stop(void);
+uint64_t alloc_print(FILE* out);
+#else
+#define alloc_enter(path)
+#define alloc_leave()
+#define alloc_unit(path)
+#endif
@@ -18,19 +18,26 @@
  */
 
 #include "audio.h"
+#include "surround.h"
+
+#include "../quality.h"
+#include "../stats.h"
 
 #include <stdio.h>
 #include <string.h>
+#include <errno.h>
 
-#include <opus_multistream.h>
 #include <alsa/asoundlib.h>
 
 #define CHECK_RETURN(f) if ((rc = f) < 0) { printf("Alsa error code %d\n", rc); return -1; }
 
 static snd_pcm_t *handle;
-static OpusMSDecoder* decoder;
+static SURROUND_DECODER* decoder;
 static short* pcmBuffer;
+static short* silenceBuffer;
+static snd_pcm_sframes_t prefilled;
 static int samplesPerFrame;
+static int pcmRate;
 
 static int alsa_renderer_init(int audioConfiguration, POPUS_MULTISTREAM_CONFIGURATION opusConfig, void* context, int arFlags) {
   int rc;
@@ -49,16 +56,22 @@ static int alsa_renderer_init(int audioConfiguration, POPUS_MULTISTREAM_CONFIGUR
   }
 
   samplesPerFrame = opusConfig->samplesPerFrame;
+  pcmRate = opusConfig->sampleRate;
   pcmBuffer = malloc(sizeof(short) * opusConfig->channelCount * samplesPerFrame);
-  if (pcmBuffer == NULL)
+  silenceBuffer = calloc(opusConfig->channelCount * samplesPerFrame, sizeof(short));
+  if (pcmBuffer == NULL || silenceBuffer == NULL)
     return -1;
 
-  decoder = opus_multistream_decoder_create(opusConfig->sampleRate, opusConfig->channelCount, opusConfig->streams, opusConfig->coupledStreams, alsaMapping, &rc);
+  prefilled = 0;
+
+  decoder = surround_decoder_create(opusConfig->sampleRate, opusConfig->channelCount, opusConfig->streams, opusConfig->coupledStreams, alsaMapping, audio_decode_threads, &rc);
 
   snd_pcm_hw_params_t *hw_params;
   snd_pcm_sw_params_t *sw_params;
-  snd_pcm_uframes_t period_size = (opusConfig->sampleRate * 20) / 1000; // 20 ms period
-  snd_pcm_uframes_t buffer_size = 3 * period_size; // 60 ms buffer
+  int period_frames, buffer_frames;
+  audio_buffer_size(opusConfig->sampleRate, samplesPerFrame, &period_frames, &buffer_frames);
+  snd_pcm_uframes_t period_size = period_frames;
+  snd_pcm_uframes_t buffer_size = buffer_frames;
   unsigned int sampleRate = opusConfig->sampleRate;
 
   char* audio_device = (char*) context;
@@ -95,7 +108,7 @@ static int alsa_renderer_init(int audioConfiguration, POPUS_MULTISTREAM_CONFIGUR
 
 static void alsa_renderer_cleanup() {
   if (decoder != NULL) {
-    opus_multistream_decoder_destroy(decoder);
+    surround_decoder_destroy(decoder);
     decoder = NULL;
   }
 
@@ -109,14 +122,47 @@ static void alsa_renderer_cleanup() {
     free(pcmBuffer);
     pcmBuffer = NULL;
   }
+
+  free(silenceBuffer);
+  silenceBuffer = NULL;
+}
+
+// Rebuild a deeper cushion against jitter after an underrun while the
+// connection is poor, as far as the device buffer allows
+static void alsa_prefill(int frames) {
+  snd_pcm_sframes_t avail = snd_pcm_avail(handle);
+  for (int i = 0; i < AUDIO_DEGRADED_EXTRA_PACKETS && avail >= 2 * frames; i++) {
+    if (snd_pcm_writei(handle, silenceBuffer, frames) != frames)
+      break;
+
+    prefilled += frames;
+    avail -= frames;
+  }
 }
 
 static void alsa_renderer_decode_and_play_sample(char* data, int length) {
-  int decodeLen = opus_multistream_decode(decoder, data, length, pcmBuffer, samplesPerFrame, 0);
+  int decodeLen = surround_decode(decoder, data, length, pcmBuffer, samplesPerFrame);
   if (decodeLen > 0) {
+    if (prefilled > 0 && !quality_degraded()) {
+      // The extra silence has been played already, get back to normal
+      // latency by skipping packets while the device has enough queued
+      snd_pcm_sframes_t delay;
+      if (snd_pcm_delay(handle, &delay) == 0 && delay >= prefilled + decodeLen) {
+        prefilled -= decodeLen < prefilled ? decodeLen : prefilled;
+        return;
+      }
+      prefilled = 0;
+    }
+
     int rc = snd_pcm_writei(handle, pcmBuffer, decodeLen);
     if (rc < 0) {
+      if (rc == -EPIPE)
+        stats_audio_underrun();
+      // The device ran dry, so the extra buffering is gone
+      prefilled = 0;
       rc = snd_pcm_recover(handle, rc, 0);
+      if (rc == 0 && quality_degraded())
+        alsa_prefill(decodeLen);
       if (rc == 0)
         rc = snd_pcm_writei(handle, pcmBuffer, decodeLen);
     }
@@ -125,6 +171,10 @@ static void alsa_renderer_decode_and_play_sample(char* data, int length) {
       printf("Alsa error from writei: %d\n", rc);
     else if (decodeLen != rc)
       printf("Alsa shortm write, write %d frames\n", rc);
+
+    snd_pcm_sframes_t delay;
+    if (audio_latency_sample_due() && snd_pcm_delay(handle, &delay) == 0)
+      audio_report_latency(delay * 1000000LL / pcmRate);
   } else if (decodeLen < 0) {
     printf("Opus error from decode: %d\n", decodeLen);
   }
@@ -0,0 +1,76 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2015-2017 Iwan Timmer
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "audio.h"
+
+#include "../clock.h"
+#include "../connection.h"
+#include "../quality.h"
+#include "../stats.h"
+
+#include <stdio.h>
+
+// Default device buffering: 20 ms periods and a 60 ms buffer
+#define DEFAULT_PERIOD_MS 20
+#define DEFAULT_PERIODS 3
+#define MIN_PERIODS 2
+
+int audio_latency = 0;
+int audio_decode_threads = 0;
+
+static uint64_t next_latency_sample_us;
+
+// Derive the device period and buffer size in frames. Without a target
+// latency the conservative defaults are used, otherwise the period
+// matches the packet duration and the buffer holds as many periods as
+// fit in the target latency.
+void audio_buffer_size(int sample_rate, int samples_per_frame, int* period_size, int* buffer_size) {
+  if (audio_latency <= 0) {
+    *period_size = sample_rate * DEFAULT_PERIOD_MS / 1000;
+    *buffer_size = DEFAULT_PERIODS * *period_size;
+  } else {
+    int periods = (sample_rate * audio_latency / 1000) / samples_per_frame;
+    if (periods < MIN_PERIODS)
+      periods = MIN_PERIODS;
+
+    *period_size = samples_per_frame;
+    *buffer_size = periods * samples_per_frame;
+  }
+
+  next_latency_sample_us = 0;
+  if (connection_debug)
+    printf("Audio: %d ms packets, %d ms period, %d ms buffer\n", samples_per_frame * 1000 / sample_rate, *period_size * 1000 / sample_rate, *buffer_size * 1000 / sample_rate);
+}
+
+// Only query the device latency once in a while as it might be costly
+bool audio_latency_sample_due() {
+  if (quality_degraded())
+    return false;
+
+  uint64_t now = clock_now_us();
+  if (now < next_latency_sample_us)
+    return false;
+
+  next_latency_sample_us = now + AUDIO_LATENCY_SAMPLE_INTERVAL_MS * 1000;
+  return true;
+}
+
+void audio_report_latency(uint32_t latency_us) {
+  stats_audio_latency(latency_us);
+}
@@ -18,9 +18,25 @@
  */
 
 #include <stdbool.h>
+#include <stdint.h>
 
 #include <Limelight.h>
 
+// Time between device latency measurements
+#define AUDIO_LATENCY_SAMPLE_INTERVAL_MS 250
+// Extra buffering while the connection is poor, in packets
+#define AUDIO_DEGRADED_EXTRA_PACKETS 4
+
+// Target audio device latency in ms, 0 for the default buffering
+extern int audio_latency;
+
+// Maximum number of threads decoding surround audio, 0 for one thread
+extern int audio_decode_threads;
+
+void audio_buffer_size(int sample_rate, int samples_per_frame, int* period_size, int* buffer_size);
+bool audio_latency_sample_due(void);
+void audio_report_latency(uint32_t latency_us);
+
 #ifdef HAVE_ALSA
 extern AUDIO_RENDERER_CALLBACKS audio_callbacks_alsa;
 #endif
@@ -21,8 +21,7 @@
 #include <sys/soundcard.h>
 #include <sys/ioctl.h>
 #include "audio.h"
-
-#include <opus_multistream.h>
+#include "surround.h"
 
 #include <errno.h>
 #include <fcntl.h>
@@ -30,7 +29,7 @@
 #include <stdlib.h>
 #include <unistd.h>
 
-static OpusMSDecoder* decoder;
+static SURROUND_DECODER* decoder;
 static short* pcmBuffer;
 static int samplesPerFrame;
 static int channelCount;
@@ -38,7 +37,7 @@ static int fd = -1;
 
 static int oss_renderer_init(int audioConfiguration, POPUS_MULTISTREAM_CONFIGURATION opusConfig, void* context, int arFlags) {
   int rc;
-  decoder = opus_multistream_decoder_create(opusConfig->sampleRate, opusConfig->channelCount, opusConfig->streams, opusConfig->coupledStreams, opusConfig->mapping, &rc);
+  decoder = surround_decoder_create(opusConfig->sampleRate, opusConfig->channelCount, opusConfig->streams, opusConfig->coupledStreams, opusConfig->mapping, audio_decode_threads, &rc);
 
   channelCount = opusConfig->channelCount;
   samplesPerFrame = opusConfig->samplesPerFrame;
@@ -72,7 +71,7 @@ static int oss_renderer_init(int audioConfiguration, POPUS_MULTISTREAM_CONFIGURA
 
 static void oss_renderer_cleanup() {
   if (decoder != NULL) {
-    opus_multistream_decoder_destroy(decoder);
+    surround_decoder_destroy(decoder);
     decoder = NULL;
   }
 
@@ -88,7 +87,7 @@ static void oss_renderer_cleanup() {
 }
 
 static void oss_renderer_decode_and_play_sample(char* data, int length) {
-  int decodeLen = opus_multistream_decode(decoder, data, length, pcmBuffer, samplesPerFrame, 0);
+  int decodeLen = surround_decode(decoder, data, length, pcmBuffer, samplesPerFrame);
   if (decodeLen > 0) {
     write(fd, pcmBuffer, decodeLen * channelCount * sizeof(short));
   } else if (decodeLen < 0) {
@@ -18,16 +18,16 @@
  */
 
 #include "audio.h"
+#include "surround.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-#include <opus_multistream.h>
 #include <pulse/simple.h>
 #include <pulse/error.h>
 
-static OpusMSDecoder* decoder;
+static SURROUND_DECODER* decoder;
 static pa_simple *dev = NULL;
 static short* pcmBuffer;
 static int samplesPerFrame;
@@ -71,7 +71,7 @@ static int pulse_renderer_init(int audioConfiguration, POPUS_MULTISTREAM_CONFIGU
     alsaMapping[5] = opusConfig->mapping[3];
   }
 
-  decoder = opus_multistream_decoder_create(opusConfig->sampleRate, opusConfig->channelCount, opusConfig->streams, opusConfig->coupledStreams, alsaMapping, &rc);
+  decoder = surround_decoder_create(opusConfig->sampleRate, opusConfig->channelCount, opusConfig->streams, opusConfig->coupledStreams, alsaMapping, audio_decode_threads, &rc);
 
   pa_sample_spec spec = {
     .format = PA_SAMPLE_S16LE,
@@ -82,8 +82,23 @@ static int pulse_renderer_init(int audioConfiguration, POPUS_MULTISTREAM_CONFIGU
   pa_channel_map map;
   pa_channel_map_init_auto(&map, opusConfig->channelCount, PA_CHANNEL_MAP_ALSA);
 
+  pa_buffer_attr* attr = NULL;
+  pa_buffer_attr buffer_attr;
+  if (audio_latency > 0) {
+    int period_size, buffer_size;
+    audio_buffer_size(opusConfig->sampleRate, samplesPerFrame, &period_size, &buffer_size);
+
+    size_t frame_size = sizeof(short) * channelCount;
+    buffer_attr.maxlength = (uint32_t) -1;
+    buffer_attr.tlength = buffer_size * frame_size;
+    buffer_attr.prebuf = (uint32_t) -1;
+    buffer_attr.minreq = period_size * frame_size;
+    buffer_attr.fragsize = (uint32_t) -1;
+    attr = &buffer_attr;
+  }
+
   char* audio_device = (char*) context;
-  dev = pa_simple_new(NULL, "Moonlight Embedded", PA_STREAM_PLAYBACK, audio_device, "Streaming", &spec, &map, NULL, &error);
+  dev = pa_simple_new(NULL, "Moonlight Embedded", PA_STREAM_PLAYBACK, audio_device, "Streaming", &spec, &map, attr, &error);
 
   if (!dev) {
     printf("Pulseaudio error: %s\n", pa_strerror(error));
@@ -94,13 +109,19 @@ static int pulse_renderer_init(int audioConfiguration, POPUS_MULTISTREAM_CONFIGU
 }
 
 static void pulse_renderer_decode_and_play_sample(char* data, int length) {
-  int decodeLen = opus_multistream_decode(decoder, data, length, pcmBuffer, samplesPerFrame, 0);
+  int decodeLen = surround_decode(decoder, data, length, pcmBuffer, samplesPerFrame);
   if (decodeLen > 0) {
     int error;
     int rc = pa_simple_write(dev, pcmBuffer, decodeLen * sizeof(short) * channelCount, &error);
 
     if (rc<0)
       printf("Pulseaudio error: %s\n", pa_strerror(error));
+
+    if (audio_latency_sample_due()) {
+      pa_usec_t latency = pa_simple_get_latency(dev, &error);
+      if (latency != (pa_usec_t) -1)
+        audio_report_latency(latency);
+    }
   } else if (decodeLen < 0) {
     printf("Opus error from decode: %d\n", decodeLen);
   }
@@ -108,7 +129,7 @@ static void pulse_renderer_decode_and_play_sample(char* data, int length) {
 
 static void pulse_renderer_cleanup() {
   if (decoder != NULL) {
-    opus_multistream_decoder_destroy(decoder);
+    surround_decoder_destroy(decoder);
     decoder = NULL;
   }
   if (dev != NULL) {
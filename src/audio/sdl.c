@@ -18,27 +18,36 @@
  */
 
 #include "audio.h"
+#include "surround.h"
+
+#include "../quality.h"
+#include "../stats.h"
 
 #include <SDL.h>
 #include <SDL_audio.h>
 
 #include <stdio.h>
-#include <opus_multistream.h>
 
-static OpusMSDecoder* decoder;
+static SURROUND_DECODER* decoder;
 static short* pcmBuffer;
+static short* silenceBuffer;
 static int samplesPerFrame;
 static SDL_AudioDeviceID dev;
 static int channelCount;
+static int sampleRate;
+static Uint32 maxQueuedSize;
+static bool playing;
 
 static int sdl_renderer_init(int audioConfiguration, POPUS_MULTISTREAM_CONFIGURATION opusConfig, void* context, int arFlags) {
   int rc;
-  decoder = opus_multistream_decoder_create(opusConfig->sampleRate, opusConfig->channelCount, opusConfig->streams, opusConfig->coupledStreams, opusConfig->mapping, &rc);
+  decoder = surround_decoder_create(opusConfig->sampleRate, opusConfig->channelCount, opusConfig->streams, opusConfig->coupledStreams, opusConfig->mapping, audio_decode_threads, &rc);
 
   channelCount = opusConfig->channelCount;
+  sampleRate = opusConfig->sampleRate;
   samplesPerFrame = opusConfig->samplesPerFrame;
   pcmBuffer = malloc(sizeof(short) * channelCount * samplesPerFrame);
-  if (pcmBuffer == NULL)
+  silenceBuffer = calloc(channelCount * samplesPerFrame, sizeof(short));
+  if (pcmBuffer == NULL || silenceBuffer == NULL)
     return -1;
 
   SDL_InitSubSystem(SDL_INIT_AUDIO);
@@ -48,7 +57,21 @@ static int sdl_renderer_init(int audioConfiguration, POPUS_MULTISTREAM_CONFIGURA
   want.freq = opusConfig->sampleRate;
   want.format = AUDIO_S16LSB;
   want.channels = opusConfig->channelCount;
-  want.samples = 4096;
+  if (audio_latency > 0) {
+    int period_size, buffer_size;
+    audio_buffer_size(opusConfig->sampleRate, samplesPerFrame, &period_size, &buffer_size);
+
+    // SDL requires a power of two for the device buffer
+    want.samples = 1;
+    while (want.samples < period_size)
+      want.samples <<= 1;
+
+    maxQueuedSize = buffer_size * channelCount * sizeof(short);
+  } else {
+    want.samples = 4096;
+    maxQueuedSize = 0;
+  }
+  playing = false;
 
   dev = SDL_OpenAudioDevice(NULL, 0, &want, &have, 0);
   if (dev == 0) {
@@ -63,7 +86,7 @@ static int sdl_renderer_init(int audioConfiguration, POPUS_MULTISTREAM_CONFIGURA
 
 static void sdl_renderer_cleanup() {
   if (decoder != NULL) {
-    opus_multistream_decoder_destroy(decoder);
+    surround_decoder_destroy(decoder);
     decoder = NULL;
   }
 
@@ -72,6 +95,9 @@ static void sdl_renderer_cleanup() {
     pcmBuffer = NULL;
   }
 
+  free(silenceBuffer);
+  silenceBuffer = NULL;
+
   if (dev != 0) {
     SDL_CloseAudioDevice(dev);
     dev = 0;
@@ -79,9 +105,34 @@ static void sdl_renderer_cleanup() {
 }
 
 static void sdl_renderer_decode_and_play_sample(char* data, int length) {
-  int decodeLen = opus_multistream_decode(decoder, data, length, pcmBuffer, samplesPerFrame, 0);
+  int decodeLen = surround_decode(decoder, data, length, pcmBuffer, samplesPerFrame);
   if (decodeLen > 0) {
-    SDL_QueueAudio(dev, pcmBuffer, decodeLen * channelCount * sizeof(short));
+    Uint32 queued = SDL_GetQueuedAudioSize(dev);
+    Uint32 packetSize = decodeLen * channelCount * sizeof(short);
+    bool degraded = quality_degraded();
+    if (queued == 0) {
+      // An empty queue only means the device ran dry once audio was playing
+      if (playing)
+        stats_audio_underrun();
+
+      // Rebuild a deeper cushion against jitter while the connection is poor
+      if (degraded) {
+        for (int i = 0; i < AUDIO_DEGRADED_EXTRA_PACKETS; i++)
+          SDL_QueueAudio(dev, silenceBuffer, packetSize);
+      }
+    } else if (maxQueuedSize > 0 && queued > maxQueuedSize + (degraded ? AUDIO_DEGRADED_EXTRA_PACKETS * packetSize : 0)) {
+      // Drop the backlog to get back to the target latency, the queue
+      // running dry right after is caused by the clear, not the network
+      SDL_ClearQueuedAudio(dev);
+      queued = 0;
+      playing = false;
+    }
+
+    if (audio_latency_sample_due())
+      audio_report_latency(queued / (channelCount * sizeof(short)) * 1000000LL / sampleRate);
+
+    if (SDL_QueueAudio(dev, pcmBuffer, packetSize) == 0 && queued > 0)
+      playing = true;
   } else if (decodeLen < 0) {
     printf("Opus error from decode: %d\n", decodeLen);
   }
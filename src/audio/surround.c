@@ -0,0 +1,500 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2015-2019 Iwan Timmer
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "surround.h"
+
+#include "../connection.h"
+#include "../cpu.h"
+#include "../quality.h"
+#include "../stats.h"
+
+#include <opus_multistream.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#define SURROUND_MAX_CHANNELS 8
+#define SURROUND_MAX_PACKET 1500
+
+// Number of packets decoded by both decoders for comparison in debug mode
+#define SURROUND_BENCHMARK_PACKETS 2000
+
+struct _SURROUND_DECODER {
+  OpusMSDecoder* multistream;
+
+  int channels;
+  int streams;
+  int coupled_streams;
+  int max_frame_size;
+  OpusDecoder* decoders[SURROUND_MAX_CHANNELS];
+  short* stream_pcm[SURROUND_MAX_CHANNELS];
+
+  // Source of every output channel, NULL for silence
+  const short* sources[SURROUND_MAX_CHANNELS];
+  int strides[SURROUND_MAX_CHANNELS];
+
+  // Current work, protected by mutex
+  const unsigned char* packets[SURROUND_MAX_CHANNELS];
+  int packet_sizes[SURROUND_MAX_CHANNELS];
+  unsigned char packet_buffers[SURROUND_MAX_CHANNELS][SURROUND_MAX_PACKET];
+  int results[SURROUND_MAX_CHANNELS];
+  int frame_size;
+  int next_stream;
+  int pending;
+  int generation;
+  bool quit;
+
+  pthread_mutex_t mutex;
+  pthread_cond_t work_cond;
+  pthread_cond_t done_cond;
+  pthread_t threads[SURROUND_MAX_CHANNELS];
+  int thread_count;
+
+  // Comparison with opus_multistream_decode in debug mode
+  OpusMSDecoder* reference;
+  short* reference_pcm;
+  int benchmark_packets;
+  int mismatches;
+  uint64_t parallel_us;
+  uint64_t reference_us;
+};
+
+// Read a frame size field, returning the number of bytes used
+static int surround_parse_size(const unsigned char* data, int len, int* size) {
+  if (len < 1)
+    return -1;
+  if (data[0] < 252) {
+    *size = data[0];
+    return 1;
+  }
+  if (len < 2)
+    return -1;
+
+  *size = 4 * data[1] + data[0];
+  return 2;
+}
+
+// All but the last stream of a multistream packet use the self-delimiting
+// framing of RFC 6716 Appendix B, which stores one extra frame size. Copy
+// the packet without that size field to get a regular Opus packet.
+// Returns the length of the self-delimited packet or -1 when malformed.
+static int surround_undelimit(const unsigned char* data, int len, unsigned char* out, int* out_len) {
+  int header = 1, frames = 0, padding = 0;
+  int skip_offset, skip_len, size, n;
+
+  if (len < 1)
+    return -1;
+
+  switch (data[0] & 0x3) {
+  case 0:
+  case 1:
+    skip_offset = header;
+    if ((skip_len = surround_parse_size(data + header, len - header, &size)) < 0)
+      return -1;
+    header += skip_len;
+    frames = (data[0] & 0x3) == 0 ? size : 2 * size;
+    break;
+  case 2:
+    if ((n = surround_parse_size(data + header, len - header, &size)) < 0)
+      return -1;
+    header += n;
+    frames = size;
+    skip_offset = header;
+    if ((skip_len = surround_parse_size(data + header, len - header, &size)) < 0)
+      return -1;
+    header += skip_len;
+    frames += size;
+    break;
+  default:
+    if (len < 2 || (data[1] & 0x3f) == 0)
+      return -1;
+
+    int count = data[1] & 0x3f;
+    bool vbr = data[1] & 0x80;
+    header = 2;
+    if (data[1] & 0x40) {
+      int value;
+      do {
+        if (header >= len)
+          return -1;
+        value = data[header++];
+        padding += value == 255 ? 254 : value;
+      } while (value == 255);
+    }
+
+    if (vbr) {
+      for (int i = 0; i < count - 1; i++) {
+        if ((n = surround_parse_size(data + header, len - header, &size)) < 0)
+          return -1;
+        header += n;
+        frames += size;
+      }
+    }
+
+    skip_offset = header;
+    if ((skip_len = surround_parse_size(data + header, len - header, &size)) < 0)
+      return -1;
+    header += skip_len;
+    frames += vbr ? size : count * size;
+  }
+
+  int total = header + frames + padding;
+  if (total > len || total - skip_len > SURROUND_MAX_PACKET)
+    return -1;
+
+  memcpy(out, data, skip_offset);
+  memcpy(out + skip_offset, data + skip_offset + skip_len, total - skip_offset - skip_len);
+  *out_len = total - skip_len;
+  return total;
+}
+
+// Decode streams until none are left, called with the mutex held
+static void surround_run(SURROUND_DECODER* decoder) {
+  while (decoder->next_stream < decoder->streams) {
+    int stream = decoder->next_stream++;
+    pthread_mutex_unlock(&decoder->mutex);
+
+    decoder->results[stream] = opus_decode(decoder->decoders[stream], decoder->packets[stream], decoder->packet_sizes[stream], decoder->stream_pcm[stream], decoder->frame_size, 0);
+
+    pthread_mutex_lock(&decoder->mutex);
+    if (--decoder->pending == 0)
+      pthread_cond_signal(&decoder->done_cond);
+  }
+}
+
+static void* surround_worker(void* data) {
+  SURROUND_DECODER* decoder = data;
+
+  pthread_mutex_lock(&decoder->mutex);
+  int generation = decoder->generation;
+  while (!decoder->quit) {
+    while (!decoder->quit && decoder->generation == generation)
+      pthread_cond_wait(&decoder->work_cond, &decoder->mutex);
+
+    generation = decoder->generation;
+    surround_run(decoder);
+  }
+  pthread_mutex_unlock(&decoder->mutex);
+
+  return NULL;
+}
+
+static void surround_interleave_scalar(SURROUND_DECODER* decoder, short* pcm, int start, int samples) {
+  for (int c = 0; c < decoder->channels; c++) {
+    const short* src = decoder->sources[c];
+    int stride = decoder->strides[c];
+    for (int i = start; i < samples; i++)
+      pcm[i * decoder->channels + c] = src ? src[i * stride] : 0;
+  }
+}
+
+#if defined(__SSE2__) || defined(__ARM_NEON)
+// Interleave 8 samples of every channel at a time by loading each
+// channel into a vector and transposing the 8x8 block of samples
+static int surround_interleave_simd(SURROUND_DECODER* decoder, short* pcm, int samples) {
+  int channels = decoder->channels;
+  int i = 0;
+  for (; i + 8 <= samples; i += 8) {
+    #if defined(__SSE2__)
+    __m128i rows[8];
+    for (int c = 0; c < 8; c++) {
+      const short* src = c < channels ? decoder->sources[c] : NULL;
+      if (src == NULL)
+        rows[c] = _mm_setzero_si128();
+      else if (decoder->strides[c] == 1)
+        rows[c] = _mm_loadu_si128((const __m128i*) (src + i));
+      else {
+        // Pick every other sample using 32 bit lanes
+        __m128i lo = _mm_loadu_si128((const __m128i*) (src + 2 * i));
+        __m128i hi = _mm_loadu_si128((const __m128i*) (src + 2 * i + 8));
+        lo = _mm_srai_epi32(_mm_slli_epi32(lo, 16), 16);
+        hi = _mm_srai_epi32(_mm_slli_epi32(hi, 16), 16);
+        rows[c] = _mm_packs_epi32(lo, hi);
+      }
+    }
+
+    __m128i a0 = _mm_unpacklo_epi16(rows[0], rows[1]), a1 = _mm_unpackhi_epi16(rows[0], rows[1]);
+    __m128i a2 = _mm_unpacklo_epi16(rows[2], rows[3]), a3 = _mm_unpackhi_epi16(rows[2], rows[3]);
+    __m128i a4 = _mm_unpacklo_epi16(rows[4], rows[5]), a5 = _mm_unpackhi_epi16(rows[4], rows[5]);
+    __m128i a6 = _mm_unpacklo_epi16(rows[6], rows[7]), a7 = _mm_unpackhi_epi16(rows[6], rows[7]);
+    __m128i b0 = _mm_unpacklo_epi32(a0, a2), b1 = _mm_unpackhi_epi32(a0, a2);
+    __m128i b2 = _mm_unpacklo_epi32(a1, a3), b3 = _mm_unpackhi_epi32(a1, a3);
+    __m128i b4 = _mm_unpacklo_epi32(a4, a6), b5 = _mm_unpackhi_epi32(a4, a6);
+    __m128i b6 = _mm_unpacklo_epi32(a5, a7), b7 = _mm_unpackhi_epi32(a5, a7);
+    __m128i frames[8] = {
+      _mm_unpacklo_epi64(b0, b4), _mm_unpackhi_epi64(b0, b4), _mm_unpacklo_epi64(b1, b5), _mm_unpackhi_epi64(b1, b5),
+      _mm_unpacklo_epi64(b2, b6), _mm_unpackhi_epi64(b2, b6), _mm_unpacklo_epi64(b3, b7), _mm_unpackhi_epi64(b3, b7),
+    };
+
+    for (int f = 0; f < 8; f++) {
+      short* dst = pcm + (i + f) * channels;
+      if (channels == 8)
+        _mm_storeu_si128((__m128i*) dst, frames[f]);
+      else {
+        int32_t last = _mm_cvtsi128_si32(_mm_srli_si128(frames[f], 8));
+        _mm_storel_epi64((__m128i*) dst, frames[f]);
+        memcpy(dst + 4, &last, sizeof(last));
+      }
+    }
+    #else
+    int16x8_t rows[8];
+    for (int c = 0; c < 8; c++) {
+      const short* src = c < channels ? decoder->sources[c] : NULL;
+      if (src == NULL)
+        rows[c] = vdupq_n_s16(0);
+      else if (decoder->strides[c] == 1)
+        rows[c] = vld1q_s16(src + i);
+      else
+        rows[c] = vld2q_s16(src + 2 * i).val[0];
+    }
+
+    int16x8x2_t b0 = vtrnq_s16(rows[0], rows[1]), b1 = vtrnq_s16(rows[2], rows[3]);
+    int16x8x2_t b2 = vtrnq_s16(rows[4], rows[5]), b3 = vtrnq_s16(rows[6], rows[7]);
+    int32x4x2_t c0 = vtrnq_s32(vreinterpretq_s32_s16(b0.val[0]), vreinterpretq_s32_s16(b1.val[0]));
+    int32x4x2_t c1 = vtrnq_s32(vreinterpretq_s32_s16(b0.val[1]), vreinterpretq_s32_s16(b1.val[1]));
+    int32x4x2_t c2 = vtrnq_s32(vreinterpretq_s32_s16(b2.val[0]), vreinterpretq_s32_s16(b3.val[0]));
+    int32x4x2_t c3 = vtrnq_s32(vreinterpretq_s32_s16(b2.val[1]), vreinterpretq_s32_s16(b3.val[1]));
+    int32x4_t frames[8] = {
+      vcombine_s32(vget_low_s32(c0.val[0]), vget_low_s32(c2.val[0])), vcombine_s32(vget_low_s32(c1.val[0]), vget_low_s32(c3.val[0])),
+      vcombine_s32(vget_low_s32(c0.val[1]), vget_low_s32(c2.val[1])), vcombine_s32(vget_low_s32(c1.val[1]), vget_low_s32(c3.val[1])),
+      vcombine_s32(vget_high_s32(c0.val[0]), vget_high_s32(c2.val[0])), vcombine_s32(vget_high_s32(c1.val[0]), vget_high_s32(c3.val[0])),
+      vcombine_s32(vget_high_s32(c0.val[1]), vget_high_s32(c2.val[1])), vcombine_s32(vget_high_s32(c1.val[1]), vget_high_s32(c3.val[1])),
+    };
+
+    for (int f = 0; f < 8; f++) {
+      short* dst = pcm + (i + f) * channels;
+      int16x8_t frame = vreinterpretq_s16_s32(frames[f]);
+      if (channels == 8)
+        vst1q_s16(dst, frame);
+      else {
+        vst1_s16(dst, vget_low_s16(frame));
+        vst1q_lane_s32((int32_t*) (dst + 4), vreinterpretq_s32_s16(frame), 2);
+      }
+    }
+    #endif
+  }
+
+  return i;
+}
+#endif
+
+// Interleave the decoded streams into the output channel order
+static void surround_interleave(SURROUND_DECODER* decoder, short* pcm, int samples) {
+  int done = 0;
+  #if defined(__SSE2__)
+  if ((decoder->channels == 6 || decoder->channels == 8) && cpu_has(CPU_FEATURE_SSE2))
+    done = surround_interleave_simd(decoder, pcm, samples);
+  #elif defined(__ARM_NEON)
+  if ((decoder->channels == 6 || decoder->channels == 8) && cpu_has(CPU_FEATURE_NEON))
+    done = surround_interleave_simd(decoder, pcm, samples);
+  #endif
+
+  surround_interleave_scalar(decoder, pcm, done, samples);
+}
+
+static int surround_decode_parallel(SURROUND_DECODER* decoder, const unsigned char* data, int len, short* pcm, int frame_size) {
+  // Split the packet, a missing packet means loss concealment for all streams
+  for (int s = 0; s < decoder->streams; s++) {
+    if (data == NULL) {
+      decoder->packets[s] = NULL;
+      decoder->packet_sizes[s] = 0;
+    } else if (s == decoder->streams - 1) {
+      decoder->packets[s] = data;
+      decoder->packet_sizes[s] = len;
+    } else {
+      int used = surround_undelimit(data, len, decoder->packet_buffers[s], &decoder->packet_sizes[s]);
+      if (used < 0)
+        return OPUS_INVALID_PACKET;
+
+      decoder->packets[s] = decoder->packet_buffers[s];
+      data += used;
+      len -= used;
+    }
+  }
+
+  if (frame_size > decoder->max_frame_size)
+    frame_size = decoder->max_frame_size;
+
+  pthread_mutex_lock(&decoder->mutex);
+  decoder->frame_size = frame_size;
+  decoder->next_stream = 0;
+  decoder->pending = decoder->streams;
+  decoder->generation++;
+  pthread_cond_broadcast(&decoder->work_cond);
+
+  // The calling thread takes part in decoding as well
+  surround_run(decoder);
+  while (decoder->pending > 0)
+    pthread_cond_wait(&decoder->done_cond, &decoder->mutex);
+  pthread_mutex_unlock(&decoder->mutex);
+
+  int samples = decoder->results[0];
+  for (int s = 0; s < decoder->streams; s++) {
+    if (decoder->results[s] < 0)
+      return decoder->results[s];
+    if (decoder->results[s] != samples)
+      return OPUS_INVALID_PACKET;
+  }
+
+  surround_interleave(decoder, pcm, samples);
+  return samples;
+}
+
+SURROUND_DECODER* surround_decoder_create(int sample_rate, int channels, int streams, int coupled_streams, const unsigned char* mapping, int threads, int* error) {
+  SURROUND_DECODER* decoder = calloc(1, sizeof(SURROUND_DECODER));
+  if (decoder == NULL) {
+    *error = OPUS_ALLOC_FAIL;
+    return NULL;
+  }
+
+  decoder->channels = channels;
+  decoder->streams = streams;
+  decoder->coupled_streams = coupled_streams;
+  if (threads < 2 || streams < 2 || channels > SURROUND_MAX_CHANNELS || streams > SURROUND_MAX_CHANNELS) {
+    decoder->multistream = opus_multistream_decoder_create(sample_rate, channels, streams, coupled_streams, mapping, error);
+    if (decoder->multistream == NULL) {
+      free(decoder);
+      return NULL;
+    }
+    return decoder;
+  }
+
+  // Largest Opus packet duration is 120 ms
+  decoder->max_frame_size = sample_rate * 120 / 1000;
+  for (int s = 0; s < streams; s++) {
+    int stream_channels = s < coupled_streams ? 2 : 1;
+    decoder->decoders[s] = opus_decoder_create(sample_rate, stream_channels, error);
+    decoder->stream_pcm[s] = malloc(sizeof(short) * stream_channels * decoder->max_frame_size);
+    if (decoder->decoders[s] == NULL || decoder->stream_pcm[s] == NULL) {
+      surround_decoder_destroy(decoder);
+      return NULL;
+    }
+  }
+
+  for (int c = 0; c < channels; c++) {
+    int source = mapping[c];
+    if (source == 255)
+      decoder->sources[c] = NULL;
+    else if (source < 2 * coupled_streams) {
+      decoder->sources[c] = decoder->stream_pcm[source / 2] + source % 2;
+      decoder->strides[c] = 2;
+    } else if (source - coupled_streams < streams) {
+      decoder->sources[c] = decoder->stream_pcm[source - coupled_streams];
+      decoder->strides[c] = 1;
+    } else {
+      *error = OPUS_BAD_ARG;
+      surround_decoder_destroy(decoder);
+      return NULL;
+    }
+  }
+
+  pthread_mutex_init(&decoder->mutex, NULL);
+  pthread_cond_init(&decoder->work_cond, NULL);
+  pthread_cond_init(&decoder->done_cond, NULL);
+
+  // The calling thread decodes as well, so one thread less is needed
+  threads = cpu_worker_threads(threads < streams ? threads : streams);
+  for (int i = 0; i < threads - 1; i++) {
+    if (pthread_create(&decoder->threads[i], NULL, surround_worker, decoder) == 0)
+      decoder->thread_count++;
+  }
+
+  if (connection_debug) {
+    int rc;
+    decoder->reference = opus_multistream_decoder_create(sample_rate, channels, streams, coupled_streams, mapping, &rc);
+    decoder->reference_pcm = malloc(sizeof(short) * channels * decoder->max_frame_size);
+    printf("Audio: decoding %d streams using %d threads\n", streams, decoder->thread_count + 1);
+  }
+
+  *error = OPUS_OK;
+  return decoder;
+}
+
+static void surround_benchmark_end(SURROUND_DECODER* decoder) {
+  if (decoder->benchmark_packets > 0)
+    printf("Audio: parallel decoding %.1f us, opus_multistream_decode %.1f us per packet, %d mismatching packets in %d\n",
+           (double) decoder->parallel_us / decoder->benchmark_packets, (double) decoder->reference_us / decoder->benchmark_packets, decoder->mismatches, decoder->benchmark_packets);
+
+  opus_multistream_decoder_destroy(decoder->reference);
+  decoder->reference = NULL;
+}
+
+int surround_decode(SURROUND_DECODER* decoder, const unsigned char* data, int len, short* pcm, int frame_size) {
+  if (decoder->multistream != NULL)
+    return opus_multistream_decode(decoder->multistream, data, len, pcm, frame_size, 0);
+
+  // The reference decoder would lose its state on skipped packets, so the
+  // comparison ends as soon as the connection gets poor
+  if (decoder->reference != NULL && quality_degraded())
+    surround_benchmark_end(decoder);
+
+  if (decoder->reference == NULL || decoder->reference_pcm == NULL)
+    return surround_decode_parallel(decoder, data, len, pcm, frame_size);
+
+  // Compare time and output against opus_multistream_decode
+  uint64_t start = stats_time_us();
+  int samples = surround_decode_parallel(decoder, data, len, pcm, frame_size);
+  uint64_t middle = stats_time_us();
+  int reference_samples = opus_multistream_decode(decoder->reference, data, len, decoder->reference_pcm, frame_size, 0);
+  uint64_t end = stats_time_us();
+
+  decoder->parallel_us += middle - start;
+  decoder->reference_us += end - middle;
+  if (samples != reference_samples || (samples > 0 && memcmp(pcm, decoder->reference_pcm, sizeof(short) * samples * decoder->channels) != 0))
+    decoder->mismatches++;
+
+  if (++decoder->benchmark_packets == SURROUND_BENCHMARK_PACKETS)
+    surround_benchmark_end(decoder);
+
+  return samples;
+}
+
+void surround_decoder_destroy(SURROUND_DECODER* decoder) {
+  if (decoder->multistream != NULL)
+    opus_multistream_decoder_destroy(decoder->multistream);
+
+  if (decoder->thread_count > 0) {
+    pthread_mutex_lock(&decoder->mutex);
+    decoder->quit = true;
+    pthread_cond_broadcast(&decoder->work_cond);
+    pthread_mutex_unlock(&decoder->mutex);
+    for (int i = 0; i < decoder->thread_count; i++)
+      pthread_join(decoder->threads[i], NULL);
+  }
+
+  for (int s = 0; s < decoder->streams && decoder->multistream == NULL; s++) {
+    if (decoder->decoders[s] != NULL)
+      opus_decoder_destroy(decoder->decoders[s]);
+    free(decoder->stream_pcm[s]);
+  }
+
+  if (decoder->reference != NULL)
+    opus_multistream_decoder_destroy(decoder->reference);
+  free(decoder->reference_pcm);
+  free(decoder);
+}
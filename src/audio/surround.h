@@ -0,0 +1,29 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2015-2019 Iwan Timmer
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdbool.h>
+
+typedef struct _SURROUND_DECODER SURROUND_DECODER;
+
+// Drop-in replacement for an OpusMSDecoder which decodes the elementary
+// streams in parallel on up to threads threads. With less than two
+// threads or a single stream opus_multistream_decode is used instead.
+SURROUND_DECODER* surround_decoder_create(int sample_rate, int channels, int streams, int coupled_streams, const unsigned char* mapping, int threads, int* error);
+int surround_decode(SURROUND_DECODER* decoder, const unsigned char* data, int len, short* pcm, int frame_size);
+void surround_decoder_destroy(SURROUND_DECODER* decoder);
@@ -0,0 +1,90 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2015-2019 Iwan Timmer
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "clock.h"
+
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+static pthread_mutex_t clock_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t clock_cond = PTHREAD_COND_INITIALIZER;
+static volatile bool virtual_clock;
+static uint64_t virtual_now_us;
+
+static uint64_t clock_system_us() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+uint64_t clock_now_us() {
+  if (!virtual_clock)
+    return clock_system_us();
+
+  pthread_mutex_lock(&clock_mutex);
+  uint64_t now = virtual_now_us;
+  pthread_mutex_unlock(&clock_mutex);
+  return now;
+}
+
+// On the virtual clock a sleeping thread waits for the driving thread to
+// advance the time, or returns immediately once the simulation has ended.
+void clock_sleep_us(uint64_t duration_us) {
+  if (!virtual_clock) {
+    usleep(duration_us);
+    return;
+  }
+
+  pthread_mutex_lock(&clock_mutex);
+  uint64_t wake_us = virtual_now_us + duration_us;
+  while (virtual_clock && virtual_now_us < wake_us)
+    pthread_cond_wait(&clock_cond, &clock_mutex);
+  pthread_mutex_unlock(&clock_mutex);
+}
+
+// The virtual clock continues from the current system time, so time
+// stamps from before and after the switch can still be compared.
+void clock_virtual_start() {
+  pthread_mutex_lock(&clock_mutex);
+  virtual_now_us = clock_system_us();
+  virtual_clock = true;
+  pthread_mutex_unlock(&clock_mutex);
+}
+
+void clock_virtual_stop() {
+  pthread_mutex_lock(&clock_mutex);
+  virtual_clock = false;
+  pthread_cond_broadcast(&clock_cond);
+  pthread_mutex_unlock(&clock_mutex);
+}
+
+bool clock_is_virtual() {
+  return virtual_clock;
+}
+
+// Move the virtual clock forward to time_us, waking the threads whose sleep has passed
+void clock_advance_us(uint64_t time_us) {
+  pthread_mutex_lock(&clock_mutex);
+  if (time_us > virtual_now_us) {
+    virtual_now_us = time_us;
+    pthread_cond_broadcast(&clock_cond);
+  }
+  pthread_mutex_unlock(&clock_mutex);
+}
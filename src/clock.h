@@ -0,0 +1,34 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2015-2019 Iwan Timmer
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Time used by everything that paces, times out or measures the session.
+// Normally the monotonic clock of the system. The virtual clock only moves
+// forward when the thread driving a simulation calls clock_advance_us(),
+// which makes replays deterministic and lets them run faster than real time.
+
+uint64_t clock_now_us(void);
+void clock_sleep_us(uint64_t duration_us);
+
+void clock_virtual_start(void);
+void clock_virtual_stop(void);
+bool clock_is_virtual(void);
+void clock_advance_us(uint64_t time_us);
@@ -19,8 +19,9 @@
 
 #include "platform.h"
 #include "config.h"
+#include "status.h"
+#include "thermal.h"
 #include "util.h"
-#include "cpu.h"
 
 #include "input/evdev.h"
 #include "audio/audio.h"
@@ -74,9 +75,26 @@ static struct option long_options[] = {
   {"verbose", no_argument, NULL, 'z'},
   {"debug", no_argument, NULL, 'Z'},
   {"nomouseemulation", no_argument, NULL, '4'},
+  {"noautotune", no_argument, NULL, 'D'},
+  {"export", required_argument, NULL, 'E'},
+  {"swapinterval", required_argument, NULL, 'F'},
+  {"jobs", required_argument, NULL, 'G'},
+  {"timeout", required_argument, NULL, 'H'},
+  {"socket", required_argument, NULL, 'O'},
   {"pin", required_argument, NULL, '5'},
   {"port", required_argument, NULL, '6'},
   {"hdr", no_argument, NULL, '7'},
+  {"audiolatency", required_argument, NULL, 'A'},
+  {"audiothreads", required_argument, NULL, 'B'},
+  {"replayloss", required_argument, NULL, '8'},
+  {"replayjitter", required_argument, NULL, '9'},
+  {"replaydrift", required_argument, NULL, 'I'},
+  {"replayduration", required_argument, NULL, 'J'},
+  {"virtualclock", no_argument, NULL, 'K'},
+  {"thermal", required_argument, NULL, 'L'},
+  {"watchdog", required_argument, NULL, 'M'},
+  {"recorder", required_argument, NULL, 'N'},
+  {"alloccheck", no_argument, NULL, 'C'},
   {0, 0, 0, 0},
 };
 
@@ -251,6 +269,24 @@ static void parse_argument(int c, char* value, PCONFIGURATION config) {
   case '4':
     config->mouse_emulation = false;
     break;
+  case 'D':
+    config->autotune = false;
+    break;
+  case 'E':
+    config->export_path = value;
+    break;
+  case 'F':
+    config->swap_interval = atoi(value);
+    break;
+  case 'G':
+    config->status_jobs = atoi(value);
+    break;
+  case 'H':
+    config->status_timeout = atoi(value);
+    break;
+  case 'O':
+    config->daemon_socket = value;
+    break;
   case '5':
     config->pin = atoi(value);
     break;
@@ -260,6 +296,44 @@ static void parse_argument(int c, char* value, PCONFIGURATION config) {
   case '7':
     config->hdr = true;
     break;
+  case 'A':
+    config->audio_latency = atoi(value);
+    break;
+  case 'B':
+    config->audio_threads = atoi(value);
+    break;
+  case '8':
+    config->replay_loss = atoi(value);
+    break;
+  case '9':
+    config->replay_jitter = atoi(value);
+    break;
+  case 'I':
+    config->replay_drift = atoi(value);
+    break;
+  case 'J':
+    config->replay_duration = atoi(value);
+    break;
+  case 'K':
+    config->virtual_clock = true;
+    break;
+  case 'L':
+    if (strcasecmp(value, "none") == 0)
+      config->thermal_policy = THERMAL_NONE;
+    else if (strcasecmp(value, "log") == 0)
+      config->thermal_policy = THERMAL_LOG;
+    else if (strcasecmp(value, "reduce") == 0)
+      config->thermal_policy = THERMAL_REDUCE;
+    break;
+  case 'M':
+    config->watchdog = atoi(value);
+    break;
+  case 'N':
+    config->recorder_path = value;
+    break;
+  case 'C':
+    config->alloc_check = true;
+    break;
   case 1:
     if (config->action == NULL)
       config->action = value;
@@ -329,8 +403,30 @@ void config_save(char* filename, PCONFIGURATION config) {
     write_config_bool(fd, "quitappafter", config->quitappafter);
   if (config->viewonly)
     write_config_bool(fd, "viewonly", config->viewonly);
+  if (!config->autotune)
+    write_config_bool(fd, "noautotune", true);
   if (config->rotate != 0)
     write_config_int(fd, "rotate", config->rotate);
+  if (config->audio_latency != 0)
+    write_config_int(fd, "audiolatency", config->audio_latency);
+  if (config->audio_threads != 0)
+    write_config_int(fd, "audiothreads", config->audio_threads);
+  if (config->export_path != NULL)
+    write_config_string(fd, "export", config->export_path);
+  if (config->swap_interval >= 0)
+    write_config_int(fd, "swapinterval", config->swap_interval);
+  if (config->thermal_policy != THERMAL_NONE)
+    write_config_string(fd, "thermal", config->thermal_policy == THERMAL_LOG ? "log" : "reduce");
+  if (config->watchdog > 0)
+    write_config_int(fd, "watchdog", config->watchdog);
+  if (config->recorder_path != NULL)
+    write_config_string(fd, "recorder", config->recorder_path);
+  if (config->status_jobs != STATUS_DEFAULT_JOBS)
+    write_config_int(fd, "jobs", config->status_jobs);
+  if (config->status_timeout != STATUS_DEFAULT_TIMEOUT_MS)
+    write_config_int(fd, "timeout", config->status_timeout);
+  if (config->daemon_socket != NULL)
+    write_config_string(fd, "socket", config->daemon_socket);
 
   if (strcmp(config->app, "Steam") != 0)
     write_config_string(fd, "app", config->app);
@@ -350,19 +446,6 @@ void config_parse(int argc, char* argv[], PCONFIGURATION config) {
   config->stream.audioConfiguration = AUDIO_CONFIGURATION_STEREO;
   config->stream.supportedVideoFormats = SCM_H264;
 
-  // Opt in for video encryption if the CPU has good AES performance
-  if (has_fast_aes()) {
-    config->stream.encryptionFlags = ENCFLG_ALL;
-  }
-  else if (has_slow_aes()) {
-    // For extremely slow CPUs, opt out of audio encryption
-    config->stream.encryptionFlags = ENCFLG_NONE;
-    printf("Disabling encryption on low performance CPU\n");
-  }
-  else {
-    config->stream.encryptionFlags = ENCFLG_AUDIO;
-  }
-
   config->debug_level = 0;
   config->platform = "auto";
   config->app = "Steam";
@@ -377,11 +460,28 @@ void config_parse(int argc, char* argv[], PCONFIGURATION config) {
   config->quitappafter = false;
   config->viewonly = false;
   config->mouse_emulation = true;
+  config->autotune = true;
   config->rotate = 0;
   config->codec = CODEC_UNSPECIFIED;
   config->hdr = false;
   config->pin = 0;
   config->port = 47989;
+  config->audio_latency = 0;
+  config->audio_threads = 0;
+  config->replay_loss = 0;
+  config->replay_jitter = 0;
+  config->replay_drift = 0;
+  config->replay_duration = 0;
+  config->virtual_clock = false;
+  config->thermal_policy = THERMAL_NONE;
+  config->watchdog = 0;
+  config->recorder_path = NULL;
+  config->alloc_check = false;
+  config->export_path = NULL;
+  config->swap_interval = -1;
+  config->status_jobs = STATUS_DEFAULT_JOBS;
+  config->daemon_socket = NULL;
+  config->status_timeout = STATUS_DEFAULT_TIMEOUT_MS;
 
   config->inputsCount = 0;
   config->mapping = get_path("gamecontrollerdb.txt", getenv("XDG_DATA_DIRS"));
@@ -399,7 +499,7 @@ void config_parse(int argc, char* argv[], PCONFIGURATION config) {
   } else {
     int option_index = 0;
     int c;
-    while ((c = getopt_long_only(argc, argv, "-abc:d:efg:h:i:j:k:lm:no:p:q:r:s:tu:v:w:xy45:6:7", long_options, &option_index)) != -1) {
+    while ((c = getopt_long_only(argc, argv, "-abc:d:efg:h:i:j:k:lm:no:p:q:r:s:tu:v:w:xy45:6:78:9:A:B:CDE:F:G:H:I:J:KL:M:N:O:", long_options, &option_index)) != -1) {
       parse_argument(c, optarg, config);
     }
   }
@@ -42,12 +42,29 @@ typedef struct _CONFIGURATION {
   bool quitappafter;
   bool viewonly;
   bool mouse_emulation;
+  bool autotune;
   char* inputs[MAX_INPUTS];
   int inputsCount;
   enum codecs codec;
   bool hdr;
   int pin;
   unsigned short port;
+  int audio_latency;
+  int audio_threads;
+  int replay_loss;
+  int replay_jitter;
+  int replay_drift;
+  int replay_duration;
+  bool virtual_clock;
+  int thermal_policy;
+  int watchdog;
+  char* recorder_path;
+  bool alloc_check;
+  char* export_path;
+  int swap_interval;
+  int status_jobs;
+  int status_timeout;
+  char* daemon_socket;
 } CONFIGURATION, *PCONFIGURATION;
 
 extern bool inputAdded;
@@ -18,6 +18,10 @@
  */
 
 #include "connection.h"
+#include "quality.h"
+#include "recorder.h"
+#include "stats.h"
+#include "watchdog.h"
 
 #include <stdio.h>
 #include <stdarg.h>
@@ -34,6 +38,22 @@ ConnListenerRumbleTriggers rumble_triggers_handler = NULL;
 ConnListenerSetMotionEventState set_motion_event_state_handler = NULL;
 ConnListenerSetControllerLED set_controller_led_handler = NULL;
 
+static DECODER_RENDERER_CALLBACKS video_callbacks;
+static DecoderRendererSubmitDecodeUnit video_submit;
+static int last_frame_number;
+
+// Makes the main loop return, ending the session
+void connection_interrupt() {
+  #ifdef HAVE_SDL
+      SDL_Event event;
+      event.type = SDL_QUIT;
+      SDL_PushEvent(&event);
+  #endif
+
+  if (main_thread_id != 0)
+    pthread_kill(main_thread_id, SIGTERM);
+}
+
 static void connection_terminated(int errorCode) {
   switch (errorCode) {
   case ML_ERROR_GRACEFUL_TERMINATION:
@@ -56,14 +76,7 @@ static void connection_terminated(int errorCode) {
     break;
   }
 
-  #ifdef HAVE_SDL
-      SDL_Event event;
-      event.type = SDL_QUIT;
-      SDL_PushEvent(&event);
-  #endif
-
-  if (main_thread_id != 0)
-    pthread_kill(main_thread_id, SIGTERM);
+  connection_interrupt();
 }
 
 static void connection_log_message(const char* format, ...) {
@@ -96,14 +109,48 @@ static void set_controller_led(unsigned short controllerNumber, unsigned char r,
 static void connection_status_update(int status) {
   switch (status) {
     case CONN_STATUS_OKAY:
-      printf("Connection is okay\n");
+      recorder_write(RECORDER_EVENT, RECORDER_CONNECTION_OKAY, 0, 0, 0);
+      quality_connection_status(false);
       break;
     case CONN_STATUS_POOR:
-      printf("Connection is poor\n");
+      recorder_write(RECORDER_EVENT, RECORDER_CONNECTION_POOR, 0, 0, 0);
+      quality_connection_status(true);
       break;
   }
 }
 
+// Frames lost or dropped before decoding show up as gaps in the frame numbers
+static int connection_submit_decode_unit(PDECODE_UNIT decodeUnit) {
+  if (last_frame_number > 0 && decodeUnit->frameNumber > last_frame_number + 1) {
+    for (int i = last_frame_number + 1; i < decodeUnit->frameNumber; i++)
+      stats_frame_dropped();
+  }
+  last_frame_number = decodeUnit->frameNumber;
+
+  stats_frame_received();
+  uint64_t start = stats_time_us();
+  watchdog_enter(WATCHDOG_SUBMIT);
+  int ret = video_submit(decodeUnit);
+  watchdog_leave(WATCHDOG_SUBMIT);
+  stats_frame_decoded(stats_time_us() - start);
+  if (ret == DR_NEED_IDR)
+    stats_idr_requested();
+
+  return ret;
+}
+
+// Collect decoder statistics of a streaming session
+PDECODER_RENDERER_CALLBACKS connection_track_video(PDECODER_RENDERER_CALLBACKS callbacks) {
+  if (callbacks == NULL)
+    return NULL;
+
+  video_callbacks = *callbacks;
+  video_submit = callbacks->submitDecodeUnit;
+  video_callbacks.submitDecodeUnit = connection_submit_decode_unit;
+  last_frame_number = 0;
+  return &video_callbacks;
+}
+
 CONNECTION_LISTENER_CALLBACKS connection_callbacks = {
   .stageStarting = NULL,
   .stageComplete = NULL,
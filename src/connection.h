@@ -29,3 +29,6 @@ extern ConnListenerRumble rumble_handler;
 extern ConnListenerRumbleTriggers rumble_triggers_handler;
 extern ConnListenerSetMotionEventState set_motion_event_state_handler;
 extern ConnListenerSetControllerLED set_controller_led_handler;
+
+PDECODER_RENDERER_CALLBACKS connection_track_video(PDECODER_RENDERER_CALLBACKS callbacks);
+void connection_interrupt(void);
@@ -22,6 +22,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <pthread.h>
 
 #ifdef HAVE_GETAUXVAL
 #include <sys/auxv.h>
@@ -29,6 +31,12 @@
 #ifndef HWCAP2_AES
 #define HWCAP2_AES (1 << 0)
 #endif
+#if defined(__arm__) && !defined(HWCAP_NEON)
+#define HWCAP_NEON (1 << 12)
+#endif
+#if defined(__aarch64__) && !defined(HWCAP_SVE)
+#define HWCAP_SVE (1 << 22)
+#endif
 #endif
 
 #if defined(__linux__) && defined(__riscv)
@@ -60,6 +68,11 @@ struct riscv_hwprobe {
 #define RISCV_HWPROBE_EXT_ZVKNED (1 << 21)
 #endif
 
+// RISC-V Vector extension
+#ifndef RISCV_HWPROBE_IMA_V
+#define RISCV_HWPROBE_IMA_V (1 << 2)
+#endif
+
 static int __riscv_hwprobe(struct riscv_hwprobe *pairs, size_t pair_count,
                            size_t cpu_count, unsigned long *cpus,
                            unsigned int flags)
@@ -118,4 +131,228 @@ bool has_slow_aes() {
 #endif
 
   return false;
-}
\ No newline at end of file
+}
+
+// Most cores whose capacity is compared
+#define CPU_MAX_CORES 1024
+// Capacity relative to the fastest core from which a core counts as a performance core
+#define CPU_PERFORMANCE_CAPACITY_PERCENT 50
+
+static pthread_once_t cpu_once = PTHREAD_ONCE_INIT;
+static int cpu_features;
+static int cpu_online;
+static int cpu_performance;
+static char cpu_model_name[128];
+
+static int detect_features() {
+  int features = 0;
+
+  if (has_fast_aes())
+    features |= CPU_FEATURE_AES;
+
+#if defined(__aarch64__)
+  // Advanced SIMD is mandatory on AArch64
+  features |= CPU_FEATURE_NEON;
+  #ifdef HAVE_GETAUXVAL
+  if (getauxval(AT_HWCAP) & HWCAP_SVE)
+    features |= CPU_FEATURE_SVE;
+  #endif
+#elif defined(__arm__) && defined(HAVE_GETAUXVAL)
+  if (getauxval(AT_HWCAP) & HWCAP_NEON)
+    features |= CPU_FEATURE_NEON;
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("sse2"))
+    features |= CPU_FEATURE_SSE2;
+  if (__builtin_cpu_supports("sse4.1"))
+    features |= CPU_FEATURE_SSE4_1;
+  if (__builtin_cpu_supports("avx2"))
+    features |= CPU_FEATURE_AVX2;
+  if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw"))
+    features |= CPU_FEATURE_AVX512;
+#elif defined(__linux__) && defined(__riscv)
+  struct riscv_hwprobe pairs[1] = {
+    { RISCV_HWPROBE_KEY_IMA_EXT_0, 0 },
+  };
+  __riscv_hwprobe(pairs, sizeof(pairs) / sizeof(struct riscv_hwprobe), 0, NULL, 0);
+  if (pairs[0].value & RISCV_HWPROBE_IMA_V)
+    features |= CPU_FEATURE_RVV;
+#endif
+
+  return features;
+}
+
+static long read_cpu_value(int cpu, const char* name) {
+  char path[128];
+  char value[32] = {};
+  snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/%s", cpu, name);
+  if (read_file(path, value, sizeof(value) - 1) <= 0)
+    return -1;
+
+  return atol(value);
+}
+
+// Online CPU ids from a list like "0-3,6,8-11", they don't have to be contiguous
+static int read_online_cpus(int* ids, int max) {
+  char list[256] = {};
+  if (read_file("/sys/devices/system/cpu/online", list, sizeof(list) - 1) <= 0)
+    return -1;
+
+  int count = 0;
+  char* range = list;
+  for (;;) {
+    char* end;
+    long first = strtol(range, &end, 10);
+    if (end == range)
+      break;
+
+    long last = first;
+    if (*end == '-') {
+      range = end + 1;
+      last = strtol(range, &end, 10);
+      if (end == range)
+        break;
+    }
+    for (long id = first; id <= last && count < max; id++)
+      ids[count++] = id;
+
+    if (*end != ',')
+      break;
+    range = end + 1;
+  }
+  return count;
+}
+
+// Cores with at least half the highest capacity are counted as performance
+// cores, so the big cores next to a single prime core of a tri-cluster SoC
+// are included. Only the scheduler capacity tells big and little cores apart:
+// maximum frequencies also differ between the favored cores of homogeneous
+// x86 processors, so without capacities all cores count as performance cores.
+static int detect_performance_cores(int count) {
+  int ids[CPU_MAX_CORES];
+  int online = read_online_cpus(ids, CPU_MAX_CORES);
+  if (online <= 0) {
+    online = count < CPU_MAX_CORES ? count : CPU_MAX_CORES;
+    for (int i = 0; i < online; i++)
+      ids[i] = i;
+  }
+
+  long capacities[CPU_MAX_CORES];
+  long max = -1;
+  for (int i = 0; i < online; i++) {
+    capacities[i] = read_cpu_value(ids[i], "cpu_capacity");
+    if (capacities[i] < 0)
+      return count;
+    if (capacities[i] > max)
+      max = capacities[i];
+  }
+  if (max <= 0)
+    return count;
+
+  int cores = 0;
+  for (int i = 0; i < online; i++) {
+    if (capacities[i] * 100 >= max * CPU_PERFORMANCE_CAPACITY_PERCENT)
+      cores++;
+  }
+  return cores;
+}
+
+// The model name on x86, or the implementer and part of every kind of core on ARM
+static void detect_model(char* model, size_t length) {
+  static char cpuinfo[65536];
+  int size = read_file("/proc/cpuinfo", cpuinfo, sizeof(cpuinfo) - 1);
+  model[0] = 0;
+  if (size <= 0)
+    return;
+  cpuinfo[size] = 0;
+
+  char implementer[32] = "";
+  char* saveptr;
+  for (char* line = strtok_r(cpuinfo, "\n", &saveptr); line != NULL; line = strtok_r(NULL, "\n", &saveptr)) {
+    char* value = strchr(line, ':');
+    if (value == NULL)
+      continue;
+    value += strspn(value + 1, " \t") + 1;
+
+    char part[80];
+    if (strncmp(line, "model name", 10) == 0 && model[0] == 0)
+      snprintf(model, length, "%s", value);
+    else if (strncmp(line, "CPU implementer", 15) == 0)
+      snprintf(implementer, sizeof(implementer), "%s", value);
+    else if (strncmp(line, "CPU part", 8) == 0) {
+      snprintf(part, sizeof(part), "%s:%s", implementer, value);
+      if (strstr(model, part) == NULL && strlen(model) + strlen(part) + 2 < length) {
+        if (model[0] != 0)
+          strcat(model, ",");
+        strcat(model, part);
+      }
+    }
+  }
+}
+
+static void cpu_detect() {
+  cpu_features = detect_features();
+
+  if (getenv("MOONLIGHT_FORCE_SCALAR") != NULL)
+    cpu_features &= ~CPU_FEATURE_SIMD_MASK;
+
+  cpu_online = sysconf(_SC_NPROCESSORS_ONLN);
+  if (cpu_online < 1)
+    cpu_online = 1;
+
+  cpu_performance = detect_performance_cores(cpu_online);
+  detect_model(cpu_model_name, sizeof(cpu_model_name));
+}
+
+void cpu_init() {
+  pthread_once(&cpu_once, cpu_detect);
+}
+
+bool cpu_has(int feature) {
+  cpu_init();
+  return (cpu_features & feature) == feature;
+}
+
+int cpu_count() {
+  cpu_init();
+  return cpu_online;
+}
+
+const char* cpu_model() {
+  cpu_init();
+  return cpu_model_name;
+}
+
+int cpu_performance_cores() {
+  cpu_init();
+  return cpu_performance;
+}
+
+int cpu_efficiency_cores() {
+  cpu_init();
+  return cpu_online - cpu_performance;
+}
+
+// Number of worker threads to use for latency sensitive work,
+// limited to the performance cores
+int cpu_worker_threads(int max) {
+  int threads = cpu_performance_cores();
+  if (threads > max)
+    threads = max;
+
+  return threads > 0 ? threads : 1;
+}
+
+void cpu_report() {
+  cpu_init();
+  printf("CPU: %d cores (%d performance, %d efficiency), features:%s%s%s%s%s%s%s%s%s\n", cpu_online, cpu_performance, cpu_online - cpu_performance,
+         cpu_features & CPU_FEATURE_AES ? " aes" : "",
+         cpu_features & CPU_FEATURE_NEON ? " neon" : "",
+         cpu_features & CPU_FEATURE_SVE ? " sve" : "",
+         cpu_features & CPU_FEATURE_SSE2 ? " sse2" : "",
+         cpu_features & CPU_FEATURE_SSE4_1 ? " sse4.1" : "",
+         cpu_features & CPU_FEATURE_AVX2 ? " avx2" : "",
+         cpu_features & CPU_FEATURE_AVX512 ? " avx512" : "",
+         cpu_features & CPU_FEATURE_RVV ? " rvv" : "",
+         getenv("MOONLIGHT_FORCE_SCALAR") != NULL ? " (scalar forced)" : "");
+}
@@ -17,5 +17,26 @@
 
 #include <stdbool.h>
 
+#define CPU_FEATURE_AES (1 << 0)
+#define CPU_FEATURE_NEON (1 << 1)
+#define CPU_FEATURE_SVE (1 << 2)
+#define CPU_FEATURE_SSE4_1 (1 << 3)
+#define CPU_FEATURE_AVX2 (1 << 4)
+#define CPU_FEATURE_AVX512 (1 << 5)
+#define CPU_FEATURE_RVV (1 << 6)
+#define CPU_FEATURE_SSE2 (1 << 7)
+
+// Features selecting optimized kernels, masked by MOONLIGHT_FORCE_SCALAR
+#define CPU_FEATURE_SIMD_MASK (CPU_FEATURE_NEON | CPU_FEATURE_SVE | CPU_FEATURE_SSE2 | CPU_FEATURE_SSE4_1 | CPU_FEATURE_AVX2 | CPU_FEATURE_AVX512 | CPU_FEATURE_RVV)
+
 bool has_fast_aes(void);
 bool has_slow_aes(void);
+
+void cpu_init(void);
+bool cpu_has(int feature);
+int cpu_count(void);
+const char* cpu_model(void);
+int cpu_performance_cores(void);
+int cpu_efficiency_cores(void);
+int cpu_worker_threads(int max);
+void cpu_report(void);
@@ -0,0 +1,183 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2015-2019 Iwan Timmer
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "crypto.h"
+#include "cpu.h"
+
+#include <Limelight.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/utsname.h>
+#include <openssl/evp.h>
+#include <openssl/opensslv.h>
+
+#define CRYPTO_CACHE_FILE "crypto.conf"
+
+// Time spent measuring each cipher
+#define BENCHMARK_DURATION_NS 20000000
+
+// Audio is sent in up to 200 packets per second of at most a few hundred bytes
+#define AUDIO_PACKET_RATE 200
+#define AUDIO_PACKET_SIZE 256
+
+// Maximum fraction of a single core to spend decrypting video and audio
+#define VIDEO_CPU_BUDGET 0.05
+#define AUDIO_CPU_BUDGET 0.01
+
+static uint64_t time_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Measure the average time in nanoseconds to decrypt a single packet
+static double benchmark_cipher(const EVP_CIPHER* cipher, int packet_size) {
+  unsigned char key[16] = {0}, iv[16] = {0}, tag[16] = {0};
+  unsigned char* input = calloc(1, packet_size);
+  unsigned char* output = malloc(packet_size + EVP_MAX_BLOCK_LENGTH);
+  EVP_CIPHER_CTX* ctx = EVP_CIPHER_CTX_new();
+  double result = -1;
+
+  if (input == NULL || output == NULL || ctx == NULL)
+    goto cleanup;
+
+  bool gcm = EVP_CIPHER_mode(cipher) == EVP_CIPH_GCM_MODE;
+  int packets = 0;
+  uint64_t start = time_ns();
+  uint64_t elapsed;
+  do {
+    int len;
+    if (EVP_DecryptInit_ex(ctx, cipher, NULL, key, iv) != 1)
+      goto cleanup;
+    if (!gcm)
+      EVP_CIPHER_CTX_set_padding(ctx, 0);
+    if (EVP_DecryptUpdate(ctx, output, &len, input, packet_size) != 1)
+      goto cleanup;
+    if (gcm)
+      EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_TAG, sizeof(tag), tag);
+    // Authentication failure is expected on the dummy data
+    EVP_DecryptFinal_ex(ctx, output + len, &len);
+
+    packets++;
+    elapsed = time_ns() - start;
+  } while (elapsed < BENCHMARK_DURATION_NS);
+
+  result = (double) elapsed / packets;
+
+cleanup:
+  if (ctx)
+    EVP_CIPHER_CTX_free(ctx);
+  free(input);
+  free(output);
+  return result;
+}
+
+// Results are only valid on the same machine and OpenSSL version. The CPU
+// model is hashed, as the cache doesn't allow spaces in the signature.
+static void machine_signature(char* signature, size_t length) {
+  struct utsname name;
+  uname(&name);
+
+  uint32_t model = 2166136261u;
+  for (const char* c = cpu_model(); *c != 0; c++)
+    model = (model ^ (unsigned char) *c) * 16777619u;
+
+  snprintf(signature, length, "%s-%d-%08x-%lx", name.machine, cpu_count(), model, (unsigned long) OPENSSL_VERSION_NUMBER);
+}
+
+static bool load_cache(char* path, char* signature, int packet_size, double* video_ns, double* audio_ns) {
+  FILE* fd = fopen(path, "r");
+  if (fd == NULL)
+    return false;
+
+  char cached_signature[128];
+  int cached_packet_size;
+  bool valid = fscanf(fd, "signature = %127s\npacketsize = %d\nvideo = %lf\naudio = %lf\n", cached_signature, &cached_packet_size, video_ns, audio_ns) == 4;
+  fclose(fd);
+
+  return valid && strcmp(cached_signature, signature) == 0 && cached_packet_size == packet_size;
+}
+
+static void save_cache(char* path, char* signature, int packet_size, double video_ns, double audio_ns) {
+  FILE* fd = fopen(path, "w");
+  if (fd == NULL)
+    return;
+
+  fprintf(fd, "signature = %s\npacketsize = %d\nvideo = %f\naudio = %f\n", signature, packet_size, video_ns, audio_ns);
+  fclose(fd);
+}
+
+static int select_by_heuristic() {
+  if (has_fast_aes())
+    return ENCFLG_ALL;
+  else if (has_slow_aes())
+    return ENCFLG_NONE;
+  else
+    return ENCFLG_AUDIO;
+}
+
+// Select the encryption flags from the measured time needed to decrypt
+// the video packets at the configured bitrate and all audio packets
+int crypto_select_encryption(int bitrate, int packet_size, char* cache_dir, bool debug) {
+  char signature[128];
+  char path[4096];
+  double video_ns, audio_ns;
+  bool cached = false;
+
+  machine_signature(signature, sizeof(signature));
+  snprintf(path, sizeof(path), "%s/%s", cache_dir, CRYPTO_CACHE_FILE);
+
+  if (load_cache(path, signature, packet_size, &video_ns, &audio_ns))
+    cached = true;
+  else {
+    video_ns = benchmark_cipher(EVP_aes_128_gcm(), packet_size);
+    audio_ns = benchmark_cipher(EVP_aes_128_cbc(), AUDIO_PACKET_SIZE);
+    if (video_ns < 0 || audio_ns < 0) {
+      int flags = select_by_heuristic();
+      if (debug)
+        printf("AES benchmark failed, using CPU heuristics for encryption flags 0x%x\n", flags);
+      return flags;
+    }
+    save_cache(path, signature, packet_size, video_ns, audio_ns);
+  }
+
+  double video_packet_rate = bitrate * 1000.0 / 8 / packet_size;
+  double video_load = video_packet_rate * video_ns / 1e9;
+  double audio_load = AUDIO_PACKET_RATE * audio_ns / 1e9;
+
+  int flags;
+  if (video_load + audio_load <= VIDEO_CPU_BUDGET)
+    flags = ENCFLG_ALL;
+  else if (audio_load <= AUDIO_CPU_BUDGET)
+    flags = ENCFLG_AUDIO;
+  else
+    flags = ENCFLG_NONE;
+
+  if (debug) {
+    printf("AES-GCM %.0f ns per %d byte packet, AES-CBC %.0f ns per audio packet%s\n", video_ns, packet_size, audio_ns, cached ? " (cached)" : "");
+    printf("Decryption would use %.1f%% CPU for video at %d kbps and %.2f%% for audio\n", video_load * 100, bitrate, audio_load * 100);
+    printf("Encryption: %s\n", flags == ENCFLG_ALL ? "audio and video" : (flags == ENCFLG_AUDIO ? "audio only" : "disabled"));
+  } else if (flags == ENCFLG_NONE)
+    printf("Disabling encryption on low performance CPU\n");
+
+  return flags;
+}
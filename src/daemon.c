@@ -0,0 +1,569 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2015-2019 Iwan Timmer
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+
+#include "platform.h"
+#include "config.h"
+#include "connection.h"
+#include "loop.h"
+#include "sdl.h"
+#include "stats.h"
+
+#include <client.h>
+#include <errors.h>
+
+#include "daemon.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+// How often the window is checked for events while waiting without a session
+#define DAEMON_IDLE_MS 100
+// Control connections served at the same time
+#define DAEMON_MAX_CLIENTS 8
+
+enum daemon_state { STATE_IDLE, STATE_LAUNCHING, STATE_STREAMING };
+
+static const char* state_names[] = { "idle", "launching", "streaming" };
+
+static pthread_mutex_t daemon_mutex = PTHREAD_MUTEX_INITIALIZER;
+static enum daemon_state state;
+static bool launch_requested, stop_requested, shutdown_requested, interrupted;
+static char launch_app[DAEMON_MAX_APP];
+static char session_app[DAEMON_MAX_APP];
+static uint64_t launch_request_us;
+static int sessions, last_result;
+
+static char socket_path[sizeof(((struct sockaddr_un*) 0)->sun_path)];
+static int listen_fd = -1;
+static int wake_fds[2] = { -1, -1 };
+static bool woken;
+static bool use_sdl;
+
+// Connection of the host thread, so listing apps doesn't disturb a session
+static SERVER_DATA control_server;
+static pthread_t control_thread, host_thread;
+static int asset_jobs, asset_timeout_ms;
+
+static void daemon_wake() {
+  char byte = 0;
+  if (write(wake_fds[1], &byte, 1) < 0 && errno != EAGAIN)
+    perror("Can't wake daemon");
+}
+
+static int daemon_handle_wake(int fd) {
+  char buffer[16];
+  while (read(fd, buffer, sizeof(buffer)) > 0);
+  woken = true;
+  return LOOP_RETURN;
+}
+
+// Prints every app, or with assets the local box art image of every app that has one
+static void daemon_list(FILE* out, bool assets) {
+  PAPP_LIST list = NULL;
+  if (gs_applist(&control_server, &list) != GS_OK) {
+    fprintf(out, "ERROR can't get app list: %s\n", control_server.error);
+    return;
+  }
+
+  int ret = assets ? gs_app_assets(&control_server, list, asset_jobs, asset_timeout_ms) : GS_OK;
+  while (list != NULL) {
+    PAPP_LIST next = list->next;
+    if (!assets)
+      fprintf(out, "%d %s\n", list->id, list->name);
+    else if (list->asset != NULL)
+      fprintf(out, "%d %s\n", list->id, list->asset);
+    free(list->name);
+    free(list->asset);
+    free(list);
+    list = next;
+  }
+
+  if (ret != GS_OK)
+    fprintf(out, "ERROR can't get all box art: %s\n", control_server.error);
+  else
+    fprintf(out, "OK\n");
+}
+
+static void daemon_status(FILE* out) {
+  VIDEO_STATS stats;
+  stats_get_video(&stats);
+
+  pthread_mutex_lock(&daemon_mutex);
+  fprintf(out, "state %s\n", state_names[state]);
+  if (state != STATE_IDLE)
+    fprintf(out, "app %s\n", session_app);
+  if (state == STATE_STREAMING && stats.firstFrameTimeUs > 0)
+    fprintf(out, "first_frame_ms %.1f\n", (stats.firstFrameTimeUs - stats.requestTimeUs) / 1000.0);
+  fprintf(out, "sessions %d\n", sessions);
+  if (sessions > 0)
+    fprintf(out, "last_result %s\n", last_result == 0 ? "ok" : "failed");
+  pthread_mutex_unlock(&daemon_mutex);
+  fprintf(out, "OK\n");
+}
+
+static void daemon_command(FILE* out, char* line) {
+  char* argument = strchr(line, ' ');
+  if (argument != NULL)
+    *argument++ = 0;
+
+  if (strcmp(line, "list") == 0)
+    daemon_list(out, false);
+  else if (strcmp(line, "assets") == 0)
+    daemon_list(out, true);
+  else if (strcmp(line, "status") == 0)
+    daemon_status(out);
+  else if (strcmp(line, "launch") == 0) {
+    if (argument == NULL || *argument == 0 || strlen(argument) >= DAEMON_MAX_APP) {
+      fprintf(out, "ERROR launch needs the name of an app\n");
+      return;
+    }
+
+    pthread_mutex_lock(&daemon_mutex);
+    if (state != STATE_IDLE || launch_requested || shutdown_requested)
+      fprintf(out, "ERROR already streaming %s\n", state != STATE_IDLE ? session_app : launch_app);
+    else {
+      strcpy(launch_app, argument);
+      launch_request_us = stats_time_us();
+      launch_requested = true;
+      daemon_wake();
+      fprintf(out, "OK\n");
+    }
+    pthread_mutex_unlock(&daemon_mutex);
+  } else if (strcmp(line, "stop") == 0) {
+    pthread_mutex_lock(&daemon_mutex);
+    if (launch_requested) {
+      launch_requested = false;
+      fprintf(out, "OK\n");
+    } else if (state == STATE_LAUNCHING) {
+      // Interrupted once the connection is started
+      stop_requested = true;
+      fprintf(out, "OK\n");
+    } else if (state == STATE_STREAMING) {
+      interrupted = true;
+      connection_interrupt();
+      fprintf(out, "OK\n");
+    } else
+      fprintf(out, "ERROR not streaming\n");
+    pthread_mutex_unlock(&daemon_mutex);
+  } else if (strcmp(line, "shutdown") == 0) {
+    pthread_mutex_lock(&daemon_mutex);
+    shutdown_requested = true;
+    launch_requested = false;
+    if (state == STATE_LAUNCHING)
+      stop_requested = true;
+    else if (state == STATE_STREAMING) {
+      interrupted = true;
+      connection_interrupt();
+    }
+    daemon_wake();
+    pthread_mutex_unlock(&daemon_mutex);
+    fprintf(out, "OK\n");
+  } else
+    fprintf(out, "ERROR unknown command %s\n", line);
+}
+
+// Replies are written in one go, a client that doesn't read them is dropped after this time
+#define DAEMON_SEND_TIMEOUT_MS 1000
+
+struct daemon_client {
+  int fd;
+  bool busy;
+  size_t length;
+  char buffer[DAEMON_MAX_APP + 16];
+};
+
+// Commands talking to the host can take long, fetching box art even more so. They
+// are run one at a time on the host thread, as they share its connection, and
+// the control thread continues with the client once the reply is sent.
+struct daemon_host_request {
+  int fd;
+  char line[sizeof(((struct daemon_client*) 0)->buffer)];
+};
+
+struct daemon_host_reply {
+  int fd;
+  bool sent;
+};
+
+static pthread_mutex_t host_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t host_cond = PTHREAD_COND_INITIALIZER;
+static struct daemon_host_request host_requests[DAEMON_MAX_CLIENTS];
+static int host_request_count;
+static int host_reply_fds[2] = { -1, -1 };
+
+static bool daemon_send(int fd, const char* data, size_t size) {
+  size_t sent = 0;
+  while (sent < size) {
+    ssize_t ret = send(fd, data + sent, size - sent, MSG_NOSIGNAL);
+    if (ret < 0 && errno == EINTR)
+      continue;
+    else if (ret <= 0)
+      return false;
+    sent += ret;
+  }
+  return true;
+}
+
+static bool daemon_reply(int fd, char* line) {
+  char* reply = NULL;
+  size_t size = 0;
+  FILE* out = open_memstream(&reply, &size);
+  if (out == NULL)
+    return false;
+
+  daemon_command(out, line);
+  fclose(out);
+  bool sent = daemon_send(fd, reply, size);
+  free(reply);
+  return sent;
+}
+
+static bool daemon_needs_host(const char* line) {
+  size_t length = strcspn(line, " ");
+  return (length == 4 && strncmp(line, "list", length) == 0) || (length == 6 && strncmp(line, "assets", length) == 0);
+}
+
+static bool daemon_host_queue(int fd, const char* line) {
+  pthread_mutex_lock(&host_mutex);
+  bool queued = host_request_count < DAEMON_MAX_CLIENTS;
+  if (queued) {
+    host_requests[host_request_count].fd = fd;
+    snprintf(host_requests[host_request_count].line, sizeof(host_requests[0].line), "%s", line);
+    host_request_count++;
+    pthread_cond_signal(&host_cond);
+  }
+  pthread_mutex_unlock(&host_mutex);
+  return queued;
+}
+
+static void* daemon_host(void* data) {
+  for (;;) {
+    pthread_mutex_lock(&host_mutex);
+    while (host_request_count == 0)
+      pthread_cond_wait(&host_cond, &host_mutex);
+    struct daemon_host_request request = host_requests[0];
+    memmove(host_requests, host_requests + 1, --host_request_count * sizeof(host_requests[0]));
+    pthread_mutex_unlock(&host_mutex);
+
+    struct daemon_host_reply reply = { request.fd, daemon_reply(request.fd, request.line) };
+    if (write(host_reply_fds[1], &reply, sizeof(reply)) != sizeof(reply))
+      perror("Can't hand back control client");
+  }
+  return NULL;
+}
+
+// Runs every complete command line received, up to one that is handed to the host
+// thread. Further commands wait until its reply is sent, to keep replies in order.
+// Returns false once the client is gone.
+static bool daemon_client_run(struct daemon_client* client) {
+  char* line = client->buffer;
+  char* end;
+  while (!client->busy && (end = strchr(line, '\n')) != NULL) {
+    *end = 0;
+    line[strcspn(line, "\r")] = 0;
+    if (line[0] != 0 && daemon_needs_host(line) && daemon_host_queue(client->fd, line))
+      client->busy = true;
+    else if (line[0] != 0 && !daemon_reply(client->fd, line))
+      return false;
+    line = end + 1;
+  }
+
+  client->length -= line - client->buffer;
+  memmove(client->buffer, line, client->length);
+  client->buffer[client->length] = 0;
+  if (!client->busy && client->length == sizeof(client->buffer) - 1) {
+    const char* error = "ERROR command too long\n";
+    daemon_send(client->fd, error, strlen(error));
+    return false;
+  }
+  return true;
+}
+
+static bool daemon_client_read(struct daemon_client* client) {
+  ssize_t length = read(client->fd, client->buffer + client->length, sizeof(client->buffer) - 1 - client->length);
+  if (length < 0 && errno == EINTR)
+    return true;
+  else if (length <= 0)
+    return false;
+
+  client->length += length;
+  client->buffer[client->length] = 0;
+  return daemon_client_run(client);
+}
+
+static void daemon_client_remove(struct daemon_client* clients, int* client_count, int index) {
+  close(clients[index].fd);
+  clients[index] = clients[--*client_count];
+}
+
+// Continues with the clients whose reply was sent by the host thread
+static void daemon_host_replied(struct daemon_client* clients, int* client_count) {
+  struct daemon_host_reply reply;
+  while (read(host_reply_fds[0], &reply, sizeof(reply)) == sizeof(reply)) {
+    for (int i = 0; i < *client_count; i++) {
+      if (clients[i].fd != reply.fd || !clients[i].busy)
+        continue;
+
+      clients[i].busy = false;
+      if (!reply.sent || !daemon_client_run(&clients[i]))
+        daemon_client_remove(clients, client_count, i);
+      break;
+    }
+  }
+}
+
+// Clients are polled together with the socket, a client can send any number of commands
+// and one that is slow to send a command or waits for the host doesn't hold up the others
+static void* daemon_control(void* data) {
+  struct daemon_client clients[DAEMON_MAX_CLIENTS];
+  struct pollfd fds[DAEMON_MAX_CLIENTS + 2];
+  int client_count = 0;
+
+  for (;;) {
+    fds[0].fd = listen_fd;
+    fds[0].events = POLLIN;
+    fds[1].fd = host_reply_fds[0];
+    fds[1].events = POLLIN;
+    for (int i = 0; i < client_count; i++) {
+      // Not read from while the host thread replies to it
+      fds[i + 2].fd = clients[i].busy ? -1 : clients[i].fd;
+      fds[i + 2].events = POLLIN;
+    }
+
+    if (poll(fds, client_count + 2, -1) < 0) {
+      if (errno == EINTR)
+        continue;
+      break;
+    }
+
+    // Served from the end, so the clients moved into the place of closed ones are already done
+    for (int i = client_count - 1; i >= 0; i--) {
+      if (fds[i + 2].revents != 0 && !daemon_client_read(&clients[i]))
+        daemon_client_remove(clients, &client_count, i);
+    }
+
+    if (fds[1].revents != 0)
+      daemon_host_replied(clients, &client_count);
+
+    if (fds[0].revents == 0)
+      continue;
+
+    int client = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+    if (client < 0) {
+      if (errno == EINTR || errno == ECONNABORTED || errno == EAGAIN)
+        continue;
+      break;
+    }
+
+    if (client_count == DAEMON_MAX_CLIENTS) {
+      const char* error = "ERROR too many clients\n";
+      daemon_send(client, error, strlen(error));
+      close(client);
+      continue;
+    }
+
+    struct timeval timeout = { DAEMON_SEND_TIMEOUT_MS / 1000, (DAEMON_SEND_TIMEOUT_MS % 1000) * 1000 };
+    setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    clients[client_count].fd = client;
+    clients[client_count].busy = false;
+    clients[client_count].length = 0;
+    client_count++;
+  }
+
+  for (int i = 0; i < client_count; i++)
+    close(clients[i].fd);
+  return NULL;
+}
+
+static int daemon_listen(const char* path) {
+  struct sockaddr_un addr = { .sun_family = AF_UNIX };
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "Socket path too long: %s\n", path);
+    return -1;
+  }
+  strcpy(addr.sun_path, path);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    perror("Can't create control socket");
+    return -1;
+  }
+
+  // A socket left behind by a daemon which didn't exit cleanly is replaced
+  if (connect(fd, (struct sockaddr*) &addr, sizeof(addr)) == 0) {
+    fprintf(stderr, "Another daemon is already listening on %s\n", path);
+    close(fd);
+    return -1;
+  } else if (errno == ECONNREFUSED)
+    unlink(path);
+
+  mode_t mask = umask(0077);
+  int ret = bind(fd, (struct sockaddr*) &addr, sizeof(addr));
+  umask(mask);
+  if (ret < 0 || listen(fd, 8) < 0) {
+    fprintf(stderr, "Can't listen on %s: %s\n", path, strerror(errno));
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+int daemon_init(PCONFIGURATION config, PSERVER_DATA server, bool sdl) {
+  if (config->daemon_socket != NULL)
+    snprintf(socket_path, sizeof(socket_path), "%s", config->daemon_socket);
+  else if (getenv("XDG_RUNTIME_DIR") != NULL)
+    snprintf(socket_path, sizeof(socket_path), "%s/moonlight.sock", getenv("XDG_RUNTIME_DIR"));
+  else
+    snprintf(socket_path, sizeof(socket_path), "/tmp/moonlight-%d.sock", (int) getuid());
+
+  int ret = gs_connect(&control_server, server->identity, config->address, config->port, config->debug_level, config->unsupported, config->status_timeout);
+  if (ret != GS_OK) {
+    fprintf(stderr, "Can't connect to server %s: %s\n", config->address, control_server.error);
+    return -1;
+  }
+
+  if (pipe2(wake_fds, O_CLOEXEC | O_NONBLOCK) < 0 || pipe2(host_reply_fds, O_CLOEXEC | O_NONBLOCK) < 0) {
+    perror("Can't create pipe");
+    gs_destroy(&control_server);
+    return -1;
+  }
+
+  listen_fd = daemon_listen(socket_path);
+  if (listen_fd < 0) {
+    gs_destroy(&control_server);
+    return -1;
+  }
+
+  use_sdl = sdl;
+  asset_jobs = config->status_jobs;
+  asset_timeout_ms = config->status_timeout;
+  state = STATE_IDLE;
+  if (pthread_create(&host_thread, NULL, daemon_host, NULL) != 0 || pthread_create(&control_thread, NULL, daemon_control, NULL) != 0) {
+    fprintf(stderr, "Can't start control thread\n");
+    close(listen_fd);
+    unlink(socket_path);
+    gs_destroy(&control_server);
+    return -1;
+  }
+  pthread_detach(host_thread);
+  pthread_detach(control_thread);
+
+  printf("Waiting for commands on %s\n", socket_path);
+  return 0;
+}
+
+enum daemon_request daemon_wait(char* app, size_t size, uint64_t* request_us) {
+  for (;;) {
+    pthread_mutex_lock(&daemon_mutex);
+    if (shutdown_requested) {
+      pthread_mutex_unlock(&daemon_mutex);
+      return DAEMON_SHUTDOWN;
+    } else if (launch_requested) {
+      launch_requested = false;
+      stop_requested = false;
+      state = STATE_LAUNCHING;
+      snprintf(session_app, sizeof(session_app), "%s", launch_app);
+      snprintf(app, size, "%s", launch_app);
+      *request_us = launch_request_us;
+      pthread_mutex_unlock(&daemon_mutex);
+      return DAEMON_LAUNCH;
+    }
+    pthread_mutex_unlock(&daemon_mutex);
+
+    #ifdef HAVE_SDL
+    if (use_sdl) {
+      if (!sdl_idle(DAEMON_IDLE_MS))
+        return DAEMON_SHUTDOWN;
+      continue;
+    }
+    #endif
+
+    // Input devices stay in the loop with their events ignored, only signals and commands end it
+    woken = false;
+    loop_add_fd(wake_fds[0], daemon_handle_wake, POLLIN);
+    loop_main();
+    loop_remove_fd(wake_fds[0]);
+    if (!woken)
+      return DAEMON_SHUTDOWN;
+  }
+}
+
+// Called by the session once the connection is started
+void daemon_streaming() {
+  pthread_mutex_lock(&daemon_mutex);
+  if (state == STATE_LAUNCHING) {
+    state = STATE_STREAMING;
+    if (stop_requested) {
+      interrupted = true;
+      connection_interrupt();
+    }
+  }
+  pthread_mutex_unlock(&daemon_mutex);
+}
+
+void daemon_session_ended(int result) {
+  pthread_mutex_lock(&daemon_mutex);
+  if (state != STATE_IDLE) {
+    sessions++;
+    last_result = result;
+  }
+  state = STATE_IDLE;
+  stop_requested = false;
+
+  // An interrupt racing with the end of the session must not stop the daemon
+  if (interrupted) {
+    interrupted = false;
+    if (use_sdl) {
+      #ifdef HAVE_SDL
+      SDL_FlushEvent(SDL_QUIT);
+      #endif
+    } else {
+      sigset_t sigset;
+      struct timespec timeout = {0};
+      sigemptyset(&sigset);
+      sigaddset(&sigset, SIGTERM);
+      sigtimedwait(&sigset, NULL, &timeout);
+    }
+  }
+  pthread_mutex_unlock(&daemon_mutex);
+}
+
+// The control and host threads are left running, they end with the process
+void daemon_destroy() {
+  if (listen_fd < 0)
+    return;
+
+  shutdown(listen_fd, SHUT_RDWR);
+  unlink(socket_path);
+  listen_fd = -1;
+}
@@ -0,0 +1,39 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2015-2019 Iwan Timmer
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+// The daemon action keeps a process running with the identity, host
+// connection, platform, input devices and window set up, and starts
+// sessions on request from a local UNIX socket. Commands are single
+// lines, every reply ends with a line starting with OK or ERROR.
+
+#include <client.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define DAEMON_MAX_APP 256
+
+enum daemon_request { DAEMON_LAUNCH, DAEMON_SHUTDOWN };
+
+int daemon_init(PCONFIGURATION config, PSERVER_DATA server, bool sdl);
+enum daemon_request daemon_wait(char* app, size_t size, uint64_t* request_us);
+void daemon_streaming(void);
+void daemon_session_ended(int result);
+void daemon_destroy(void);
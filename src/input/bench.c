@@ -0,0 +1,204 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2015-2019 Iwan Timmer
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Load test for the evdev input pipeline. A captured input stream is
+// replayed through uinput devices into evdev.c, and the events it would
+// send to the host are counted by the stub LiSend* functions below.
+
+#include "capture.h"
+#include "evdev.h"
+#include "mapping.h"
+
+#include "../loop.h"
+#include "../alloc.h"
+
+#include <Limelight.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+// Time to let the last events drain through the pipeline
+#define BENCH_DRAIN_MS 200
+
+enum sink_type { SINK_MOUSE_MOVE, SINK_MOUSE_BUTTON, SINK_KEYBOARD, SINK_SCROLL, SINK_CONTROLLER, SINK_ARRIVAL, SINK_TYPES };
+static const char* sink_names[SINK_TYPES] = { "Mouse motion", "Mouse button", "Keyboard", "Scroll", "Controller", "Controller arrival" };
+
+static pthread_mutex_t sink_mutex = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t sink_counts[SINK_TYPES];
+static uint64_t sink_latency_count, sink_total_latency_us, sink_max_latency_us;
+static uint64_t sink_first_us, sink_last_us;
+
+pthread_t main_thread_id = 0;
+
+static uint64_t bench_time_us() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// Latency is measured from the most recent event written to uinput
+static int sink_event(enum sink_type type) {
+  uint64_t now = bench_time_us();
+  uint64_t written = capture_replay_last_us;
+
+  pthread_mutex_lock(&sink_mutex);
+  sink_counts[type]++;
+  if (sink_first_us == 0)
+    sink_first_us = now;
+  sink_last_us = now;
+  if (written != 0 && now >= written) {
+    uint64_t latency = now - written;
+    sink_latency_count++;
+    sink_total_latency_us += latency;
+    if (latency > sink_max_latency_us)
+      sink_max_latency_us = latency;
+  }
+  pthread_mutex_unlock(&sink_mutex);
+  return 0;
+}
+
+int LiSendMouseMoveEvent(short deltaX, short deltaY) {
+  return sink_event(SINK_MOUSE_MOVE);
+}
+
+int LiSendMouseButtonEvent(char action, int button) {
+  return sink_event(SINK_MOUSE_BUTTON);
+}
+
+int LiSendKeyboardEvent(short keyCode, char keyAction, char modifiers) {
+  return sink_event(SINK_KEYBOARD);
+}
+
+int LiSendScrollEvent(signed char scrollClicks) {
+  return sink_event(SINK_SCROLL);
+}
+
+int LiSendHScrollEvent(signed char scrollClicks) {
+  return sink_event(SINK_SCROLL);
+}
+
+int LiSendMultiControllerEvent(short controllerNumber, short activeGamepadMask, int buttonFlags, unsigned char leftTrigger, unsigned char rightTrigger, short leftStickX, short leftStickY, short rightStickX, short rightStickY) {
+  return sink_event(SINK_CONTROLLER);
+}
+
+int LiSendControllerArrivalEvent(uint8_t controllerNumber, uint16_t activeGamepadMask, uint8_t type, uint32_t supportedButtonFlags, uint16_t capabilities) {
+  return sink_event(SINK_ARRIVAL);
+}
+
+static void bench_done() {
+  usleep(BENCH_DRAIN_MS * 1000);
+  pthread_kill(main_thread_id, SIGTERM);
+}
+
+static void bench_print() {
+  uint64_t total = 0;
+  printf("Input pipeline statistics\n");
+  for (int i = 0; i < SINK_TYPES; i++) {
+    if (sink_counts[i] > 0)
+      printf("  %s events: %llu\n", sink_names[i], (unsigned long long) sink_counts[i]);
+    total += sink_counts[i];
+  }
+
+  double seconds = (sink_last_us - sink_first_us) / 1000000.0;
+  printf("  Total events: %llu (%.0f events/s)\n", (unsigned long long) total, seconds > 0 ? total / seconds : 0);
+  if (sink_latency_count > 0)
+    printf("  Pipeline latency: avg %.3f ms, max %.3f ms\n", sink_total_latency_us / 1000.0 / sink_latency_count, sink_max_latency_us / 1000.0);
+}
+
+static void usage() {
+  printf("Usage: moonlight-inputbench [-speed <factor>] [-mapping <file>] [-alloccheck] [-verbose] <capture>\n\n");
+  printf("\t-speed <factor>\t\tReplay speed, 1 for the original timing, 0 as fast as possible (default 1)\n");
+  printf("\t-mapping <file>\t\tUse <file> as gamepad mappings configuration file\n");
+  printf("\t-alloccheck\t\tFail when input handling still allocates after warm-up (requires ENABLE_ALLOC_TRACKER)\n");
+  printf("\t-verbose\t\tEnable verbose output\n");
+  exit(0);
+}
+
+int main(int argc, char* argv[]) {
+  double speed = 1;
+  char* mapping = NULL;
+  char* filename = NULL;
+  bool verbose = false;
+  bool alloc_check = false;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-speed") == 0 && i + 1 < argc)
+      speed = atof(argv[++i]);
+    else if (strcmp(argv[i], "-mapping") == 0 && i + 1 < argc)
+      mapping = argv[++i];
+    else if (strcmp(argv[i], "-alloccheck") == 0)
+      alloc_check = true;
+    else if (strcmp(argv[i], "-verbose") == 0)
+      verbose = true;
+    else if (argv[i][0] == '-' || filename != NULL)
+      usage();
+    else
+      filename = argv[i];
+  }
+
+  if (filename == NULL)
+    usage();
+
+  #ifndef HAVE_ALLOC_TRACKER
+  if (alloc_check) {
+    fprintf(stderr, "Allocation tracker not compiled in, configure with ENABLE_ALLOC_TRACKER\n");
+    exit(-1);
+  }
+  #endif
+
+  struct mapping* mappings = NULL;
+  if (mapping != NULL)
+    mappings = mapping_load(mapping, verbose);
+
+  loop_init();
+
+  char* nodes[CAPTURE_MAX_DEVICES];
+  int count = capture_replay_init(filename, nodes, CAPTURE_MAX_DEVICES, verbose);
+  if (count < 0)
+    exit(-1);
+
+  for (int i = 0; i < count; i++)
+    evdev_create(nodes[i], mappings, verbose, 0);
+
+  evdev_init(false);
+
+  // Grab the virtual devices so the replayed input stays out of the desktop
+  evdev_start();
+
+  capture_replay_start(speed, bench_done);
+
+  loop_main();
+  evdev_stop();
+  capture_replay_destroy();
+
+  bench_print();
+
+  #ifdef HAVE_ALLOC_TRACKER
+  if (alloc_print(stdout) > 0 && alloc_check) {
+    fprintf(stderr, "Steady state allocations detected\n");
+    exit(-1);
+  }
+  #endif
+  return 0;
+}
@@ -0,0 +1,360 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2015-2019 Iwan Timmer
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "capture.h"
+
+#include "../loop.h"
+
+#include <linux/uinput.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+
+#ifndef input_event_sec
+#define input_event_sec time.tv_sec
+#define input_event_usec time.tv_usec
+#endif
+
+// Time to wait for udev to create the device node of a virtual device
+#define CAPTURE_NODE_TIMEOUT_MS 2000
+
+static FILE* capture_file;
+static int capture_fds[CAPTURE_MAX_DEVICES];
+static int capture_count;
+static uint64_t capture_events;
+static bool capture_verbose;
+
+static int replay_fds[CAPTURE_MAX_DEVICES];
+static int replay_count;
+static pthread_t replay_thread;
+static bool replay_started;
+static volatile bool replay_stopped;
+static double replay_speed;
+static void(*replay_done)();
+
+volatile uint64_t capture_replay_last_us;
+
+static bool capture_test_bit(const uint8_t* bits, int bit) {
+  return bits[bit / 8] & (1 << (bit % 8));
+}
+
+static uint64_t capture_time_us() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int capture_describe(int fd, struct capture_device* dev) {
+  memset(dev, 0, sizeof(*dev));
+  if (ioctl(fd, EVIOCGNAME(sizeof(dev->name) - 1), dev->name) < 0 || ioctl(fd, EVIOCGID, &dev->id) < 0)
+    return -1;
+
+  ioctl(fd, EVIOCGPROP(sizeof(dev->props)), dev->props);
+  ioctl(fd, EVIOCGBIT(0, sizeof(dev->bits[0])), dev->bits[0]);
+  for (int type = 1; type < EV_CNT; type++) {
+    if (capture_test_bit(dev->bits[0], type))
+      ioctl(fd, EVIOCGBIT(type, sizeof(dev->bits[type])), dev->bits[type]);
+  }
+
+  for (int code = 0; code < ABS_CNT; code++) {
+    if (capture_test_bit(dev->bits[EV_ABS], code))
+      ioctl(fd, EVIOCGABS(code), &dev->abs[code]);
+  }
+
+  return 0;
+}
+
+static int capture_handle(int fd) {
+  uint32_t device = 0;
+  while (device < capture_count && capture_fds[device] != fd)
+    device++;
+
+  struct input_event events[64];
+  ssize_t len;
+  while ((len = read(fd, events, sizeof(events))) > 0) {
+    for (int i = 0; i < len / sizeof(struct input_event); i++) {
+      struct capture_event record = {
+        .time_us = (uint64_t) events[i].input_event_sec * 1000000 + events[i].input_event_usec,
+        .device = device,
+        .type = events[i].type,
+        .code = events[i].code,
+        .value = events[i].value,
+      };
+      fwrite(&record, sizeof(record), 1, capture_file);
+      capture_events++;
+    }
+  }
+
+  if (len < 0 && errno != EAGAIN) {
+    fprintf(stderr, "Lost capture device %d: %s\n", device, strerror(errno));
+    loop_remove_fd(fd);
+  }
+
+  return LOOP_OK;
+}
+
+int capture_start(const char* filename, char** devices, int count, bool verbose) {
+  if (count > CAPTURE_MAX_DEVICES) {
+    fprintf(stderr, "Can't capture more than %d devices\n", CAPTURE_MAX_DEVICES);
+    return -1;
+  }
+
+  capture_file = fopen(filename, "wb");
+  if (capture_file == NULL) {
+    fprintf(stderr, "Can't open %s: %s\n", filename, strerror(errno));
+    return -1;
+  }
+
+  struct capture_header header = { .magic = CAPTURE_MAGIC, .version = CAPTURE_VERSION, .devices = count };
+  fwrite(&header, sizeof(header), 1, capture_file);
+
+  capture_verbose = verbose;
+  capture_events = 0;
+  capture_count = 0;
+  for (int i = 0; i < count; i++) {
+    int fd = open(devices[i], O_RDONLY|O_NONBLOCK);
+    struct capture_device dev;
+    if (fd < 0 || capture_describe(fd, &dev) < 0) {
+      fprintf(stderr, "Can't open input device %s\n", devices[i]);
+      return -1;
+    }
+
+    // Kernel timestamps from the same clock for all devices
+    int clock = CLOCK_MONOTONIC;
+    ioctl(fd, EVIOCSCLOCKID, &clock);
+
+    if (verbose)
+      printf("Capturing %s (%04x:%04x) from %s\n", dev.name, dev.id.vendor, dev.id.product, devices[i]);
+
+    fwrite(&dev, sizeof(dev), 1, capture_file);
+    capture_fds[capture_count++] = fd;
+    loop_add_fd(fd, capture_handle, POLLIN);
+  }
+
+  return 0;
+}
+
+void capture_stop() {
+  for (int i = 0; i < capture_count; i++) {
+    loop_remove_fd(capture_fds[i]);
+    close(capture_fds[i]);
+  }
+
+  fclose(capture_file);
+  if (capture_verbose)
+    printf("Captured %llu events\n", (unsigned long long) capture_events);
+}
+
+// Find the event device node udev creates for a uinput device
+static int capture_find_node(int fd, char* node, size_t size) {
+  char sysname[64];
+  if (ioctl(fd, UI_GET_SYSNAME(sizeof(sysname)), sysname) < 0)
+    return -1;
+
+  char path[PATH_MAX];
+  snprintf(path, sizeof(path), "/sys/devices/virtual/input/%s", sysname);
+  DIR* dir = opendir(path);
+  if (dir == NULL)
+    return -1;
+
+  struct dirent* entry;
+  int ret = -1;
+  while ((entry = readdir(dir)) != NULL) {
+    if (strncmp(entry->d_name, "event", 5) == 0) {
+      snprintf(node, size, "/dev/input/%s", entry->d_name);
+      ret = 0;
+      break;
+    }
+  }
+  closedir(dir);
+
+  for (int waited = 0; ret == 0 && access(node, R_OK|W_OK) != 0; waited += 10) {
+    if (waited >= CAPTURE_NODE_TIMEOUT_MS)
+      return -1;
+
+    usleep(10000);
+  }
+
+  return ret;
+}
+
+static int capture_create_device(struct capture_device* dev, char* node, size_t size) {
+  static const int code_bits[EV_CNT] = {
+    [EV_KEY] = UI_SET_KEYBIT, [EV_REL] = UI_SET_RELBIT, [EV_ABS] = UI_SET_ABSBIT, [EV_MSC] = UI_SET_MSCBIT,
+    [EV_SW] = UI_SET_SWBIT, [EV_LED] = UI_SET_LEDBIT, [EV_SND] = UI_SET_SNDBIT,
+  };
+
+  int fd = open("/dev/uinput", O_WRONLY);
+  if (fd < 0) {
+    fprintf(stderr, "Can't open /dev/uinput: %s\n", strerror(errno));
+    return -1;
+  }
+
+  for (int prop = 0; prop < INPUT_PROP_CNT; prop++) {
+    if (capture_test_bit(dev->props, prop))
+      ioctl(fd, UI_SET_PROPBIT, prop);
+  }
+
+  // Force feedback is left out, nothing would answer effect uploads
+  for (int type = 1; type < EV_CNT; type++) {
+    if (!capture_test_bit(dev->bits[0], type) || type == EV_FF)
+      continue;
+
+    ioctl(fd, UI_SET_EVBIT, type);
+    for (int code = 0; code_bits[type] != 0 && code < KEY_CNT; code++) {
+      if (capture_test_bit(dev->bits[type], code))
+        ioctl(fd, code_bits[type], code);
+    }
+  }
+
+  for (int code = 0; code < ABS_CNT; code++) {
+    if (capture_test_bit(dev->bits[EV_ABS], code)) {
+      struct uinput_abs_setup abs = { .code = code, .absinfo = dev->abs[code] };
+      ioctl(fd, UI_ABS_SETUP, &abs);
+    }
+  }
+
+  struct uinput_setup setup = { .id = dev->id };
+  strncpy(setup.name, dev->name, UINPUT_MAX_NAME_SIZE - 1);
+  if (ioctl(fd, UI_DEV_SETUP, &setup) < 0 || ioctl(fd, UI_DEV_CREATE) < 0) {
+    fprintf(stderr, "Can't create virtual device %s: %s\n", dev->name, strerror(errno));
+    close(fd);
+    return -1;
+  }
+
+  if (capture_find_node(fd, node, size) < 0) {
+    fprintf(stderr, "Can't find device node for virtual device %s\n", dev->name);
+    ioctl(fd, UI_DEV_DESTROY);
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+// Recreate the captured devices, returns the number of device nodes
+int capture_replay_init(const char* filename, char** nodes, int max_nodes, bool verbose) {
+  capture_file = fopen(filename, "rb");
+  if (capture_file == NULL) {
+    fprintf(stderr, "Can't open %s: %s\n", filename, strerror(errno));
+    return -1;
+  }
+
+  struct capture_header header;
+  if (fread(&header, sizeof(header), 1, capture_file) != 1 || header.magic != CAPTURE_MAGIC || header.version != CAPTURE_VERSION) {
+    fprintf(stderr, "%s is not an input capture\n", filename);
+    fclose(capture_file);
+    return -1;
+  }
+
+  if (header.devices > max_nodes || header.devices > CAPTURE_MAX_DEVICES) {
+    fprintf(stderr, "Too many devices in %s\n", filename);
+    fclose(capture_file);
+    return -1;
+  }
+
+  capture_verbose = verbose;
+  replay_count = 0;
+  for (int i = 0; i < header.devices; i++) {
+    struct capture_device dev;
+    char node[PATH_MAX];
+    if (fread(&dev, sizeof(dev), 1, capture_file) != 1 || (replay_fds[i] = capture_create_device(&dev, node, sizeof(node))) < 0) {
+      capture_replay_destroy();
+      return -1;
+    }
+
+    replay_count++;
+    nodes[i] = strdup(node);
+    if (verbose)
+      printf("Created virtual device %s on %s\n", dev.name, node);
+  }
+
+  return replay_count;
+}
+
+static void* capture_replay(void* data) {
+  struct capture_event record;
+  uint64_t first_us = 0, start_us = capture_time_us(), events = 0;
+  while (!replay_stopped && fread(&record, sizeof(record), 1, capture_file) == 1) {
+    if (record.device >= replay_count)
+      continue;
+
+    if (first_us == 0)
+      first_us = record.time_us;
+
+    // Keep the original timing, scaled by the replay speed
+    if (replay_speed > 0) {
+      uint64_t due_us = start_us + (record.time_us - first_us) / replay_speed;
+      uint64_t now_us = capture_time_us();
+      if (due_us > now_us)
+        usleep(due_us - now_us);
+    }
+
+    struct input_event event = { .type = record.type, .code = record.code, .value = record.value };
+    if (write(replay_fds[record.device], &event, sizeof(event)) != sizeof(event))
+      fprintf(stderr, "Can't write event to virtual device %d\n", record.device);
+
+    capture_replay_last_us = capture_time_us();
+    events++;
+  }
+
+  if (capture_verbose)
+    printf("Replayed %llu events in %.2f seconds\n", (unsigned long long) events, (capture_time_us() - start_us) / 1000000.0);
+
+  if (replay_done && !replay_stopped)
+    replay_done();
+
+  return NULL;
+}
+
+// Speed 1.0 keeps the original timing, 0 replays as fast as possible.
+// The done callback is called from the replay thread at the end.
+void capture_replay_start(double speed, void(*done)()) {
+  replay_speed = speed;
+  replay_done = done;
+  replay_stopped = false;
+  capture_replay_last_us = 0;
+  replay_started = pthread_create(&replay_thread, NULL, capture_replay, NULL) == 0;
+}
+
+void capture_replay_destroy() {
+  if (replay_started) {
+    replay_stopped = true;
+    pthread_join(replay_thread, NULL);
+    replay_started = false;
+  }
+
+  for (int i = 0; i < replay_count; i++) {
+    ioctl(replay_fds[i], UI_DEV_DESTROY);
+    close(replay_fds[i]);
+  }
+  replay_count = 0;
+
+  fclose(capture_file);
+}
@@ -0,0 +1,61 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2015-2019 Iwan Timmer
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <linux/input.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define CAPTURE_MAGIC 0x43494c4d /* MLIC */
+#define CAPTURE_VERSION 1
+#define CAPTURE_MAX_DEVICES 16
+#define CAPTURE_NAME_SIZE 80
+
+struct capture_header {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t devices;
+};
+
+// Everything needed to recreate a device with uinput
+struct capture_device {
+  char name[CAPTURE_NAME_SIZE];
+  struct input_id id;
+  uint8_t props[(INPUT_PROP_CNT + 7) / 8];
+  uint8_t bits[EV_CNT][(KEY_CNT + 7) / 8];
+  struct input_absinfo abs[ABS_CNT];
+};
+
+// Fixed size event record, independent of the struct timeval layout
+struct capture_event {
+  uint64_t time_us;
+  uint32_t device;
+  uint16_t type;
+  uint16_t code;
+  int32_t value;
+};
+
+int capture_start(const char* filename, char** devices, int count, bool verbose);
+void capture_stop();
+
+int capture_replay_init(const char* filename, char** nodes, int max_nodes, bool verbose);
+void capture_replay_start(double speed, void(*done)());
+void capture_replay_destroy();
+
+extern volatile uint64_t capture_replay_last_us;
@@ -22,6 +22,10 @@
 #include "keyboard.h"
 
 #include "../loop.h"
+#include "../alloc.h"
+#include "../clock.h"
+#include "../watchdog.h"
+#include "../recorder.h"
 
 #include "libevdev/libevdev.h"
 #include <Limelight.h>
@@ -128,6 +132,7 @@ static short* currentAbs;
 static bool* currentReverse;
 
 static bool grabbingDevices;
+static bool ignoringEvents;
 static bool mouseEmulationEnabled;
 
 static bool waitingToExitOnModifiersUp = false;
@@ -234,7 +239,7 @@ void *HandleMouseEmulation(void* param)
   struct input_device* dev = (struct input_device*) param;
 
   while (dev->mouseEmulation) {
-    usleep(MOUSE_EMULATION_POLLING_INTERVAL);
+    clock_sleep_us(MOUSE_EMULATION_POLLING_INTERVAL);
 
     short rawX;
     short rawY;
@@ -450,7 +455,7 @@ static bool evdev_handle_event(struct input_event *ev, struct input_device *dev)
               int holdTimeMs = elapsedTime.tv_sec * 1000 + elapsedTime.tv_usec / 1000;
               int button = holdTimeMs >= TOUCH_RCLICK_TIME ? BUTTON_RIGHT : BUTTON_LEFT;
               LiSendMouseButtonEvent(BUTTON_ACTION_PRESS, button);
-              usleep(TOUCH_CLICK_DELAY);
+              clock_sleep_us(TOUCH_CLICK_DELAY);
               LiSendMouseButtonEvent(BUTTON_ACTION_RELEASE, button);
             }
           }
@@ -759,8 +764,16 @@ static int evdev_handle(int fd) {
       while ((rc = libevdev_next_event(devices[i].dev, LIBEVDEV_READ_FLAG_NORMAL, &ev)) >= 0) {
         if (rc == LIBEVDEV_READ_STATUS_SYNC)
           fprintf(stderr, "Error: cannot keep up\n");
-        else if (rc == LIBEVDEV_READ_STATUS_SUCCESS) {
-          if (!handler(&ev, &devices[i]))
+        else if (rc == LIBEVDEV_READ_STATUS_SUCCESS && !ignoringEvents) {
+          if (ev.type != EV_SYN)
+            recorder_write(RECORDER_INPUT, RECORDER_INPUT_EVENT, RECORDER_INPUT_EVDEV, ev.type, ev.code);
+          alloc_enter(ALLOC_INPUT);
+          watchdog_enter(WATCHDOG_INPUT);
+          bool running = handler(&ev, &devices[i]);
+          watchdog_leave(WATCHDOG_INPUT);
+          alloc_unit(ALLOC_INPUT);
+          alloc_leave();
+          if (!running)
             return LOOP_RETURN;
         }
       }
@@ -1073,12 +1086,28 @@ void evdev_start() {
 
   // Any new input devices detected after this point will be grabbed immediately
   grabbingDevices = true;
+  ignoringEvents = false;
+  waitingToExitOnModifiersUp = false;
 
   // Handle input events until the quit combo is pressed
 }
 
 void evdev_stop() {
   evdev_drain();
+  evdev_ignore();
+
+  // Give the devices back until the next session of the daemon
+  grabbingDevices = false;
+  for (int i = 0; i < numDevices; i++) {
+    if (devices[i].is_keyboard || devices[i].is_mouse || devices[i].is_touchscreen)
+      ioctl(devices[i].fd, EVIOCGRAB, 0);
+  }
+}
+
+// Until the next evdev_start, events are read and dropped. Between the sessions of the
+// daemon the devices aren't grabbed, so their input is meant for other programs.
+void evdev_ignore() {
+  ignoringEvents = true;
 }
 
 void evdev_init(bool mouse_emulation_enabled) {
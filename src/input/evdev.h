@@ -27,5 +27,6 @@ void evdev_loop();
 void evdev_init(bool mouse_emulation_enabled);
 void evdev_start();
 void evdev_stop();
+void evdev_ignore();
 void evdev_map(char* device);
 void evdev_rumble(unsigned short controller_id, unsigned short low_freq_motor, unsigned short high_freq_motor);
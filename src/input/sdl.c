@@ -19,6 +19,7 @@
 
 #include "sdl.h"
 #include "../sdl.h"
+#include "../clock.h"
 
 #include <Limelight.h>
 
@@ -39,6 +40,17 @@ static const int SDL_TO_LI_BUTTON_MAP[] = {
   TOUCHPAD_FLAG,
 };
 
+// Sensor samples averaged down to the rate requested by the host
+typedef struct _MOTION_STATE {
+  unsigned short rate_hz;
+  uint64_t next_send_us;
+  float sum[3];
+  int samples;
+} MOTION_STATE, *PMOTION_STATE;
+
+// Indexed by LI_MOTION_TYPE_* - 1
+#define MOTION_TYPES 2
+
 typedef struct _GAMEPAD_STATE {
   unsigned char leftTrigger, rightTrigger;
   short leftStickX, leftStickY;
@@ -52,6 +64,8 @@ typedef struct _GAMEPAD_STATE {
 #endif
   short id;
   bool initialized;
+  bool axes_changed;
+  MOTION_STATE motion[MOTION_TYPES];
 } GAMEPAD_STATE, *PGAMEPAD_STATE;
 
 // Limited by number of bits in activeGamepadMask
@@ -63,6 +77,12 @@ static int activeGamepadMask = 0;
 
 int sdl_gamepads = 0;
 
+static uint64_t axis_events, controller_packets;
+static uint64_t motion_samples, motion_packets;
+
+static SDL_TimerID motion_timer;
+static Uint32 motion_interval_ms;
+
 #define VK_0 0x30
 #define VK_A 0x41
 
@@ -337,6 +357,70 @@ static void send_controller_arrival(PGAMEPAD_STATE state) {
 #endif
 }
 
+static void send_gamepad_state(PGAMEPAD_STATE gamepad) {
+  LiSendMultiControllerEvent(gamepad->id, activeGamepadMask, gamepad->buttons, gamepad->leftTrigger, gamepad->rightTrigger, gamepad->leftStickX, gamepad->leftStickY, gamepad->rightStickX, gamepad->rightStickY);
+  gamepad->axes_changed = false;
+  controller_packets++;
+}
+
+static void send_motion_state(PGAMEPAD_STATE gamepad, int type) {
+  PMOTION_STATE motion = &gamepad->motion[type];
+  if (motion->samples == 0)
+    return;
+
+  if (motion->rate_hz == 0) {
+    motion->samples = 0;
+    return;
+  }
+
+  // The timer runs at the fastest requested rate, allow for its jitter
+  uint64_t now = clock_now_us();
+  uint64_t interval = 1000000 / motion->rate_hz;
+  if (now + interval / 2 < motion->next_send_us)
+    return;
+
+  LiSendControllerMotionEvent(gamepad->id, type + 1, motion->sum[0] / motion->samples, motion->sum[1] / motion->samples, motion->sum[2] / motion->samples);
+  memset(motion->sum, 0, sizeof(motion->sum));
+  motion->samples = 0;
+  motion_packets++;
+
+  // Keep a steady cadence, unless the samples stopped for a while
+  motion->next_send_us += interval;
+  if (motion->next_send_us <= now)
+    motion->next_send_us = now + interval;
+}
+
+// Runs on the timer thread of SDL, motion is sent from the event loop
+static Uint32 motion_timer_tick(Uint32 interval, void* param) {
+  SDL_Event event = {0};
+  event.type = SDL_USEREVENT;
+  event.user.code = SDL_CODE_MOTION;
+  SDL_PushEvent(&event);
+  return interval;
+}
+
+// Tick at the fastest rate any host requested motion events at
+static void motion_timer_update(void) {
+  unsigned short rate_hz = 0;
+  for (int i = 0; i < MAX_GAMEPADS; i++) {
+    for (int type = 0; type < MOTION_TYPES && gamepads[i].initialized; type++) {
+      if (gamepads[i].motion[type].rate_hz > rate_hz)
+        rate_hz = gamepads[i].motion[type].rate_hz;
+    }
+  }
+
+  Uint32 interval_ms = rate_hz > 0 ? 1000 / rate_hz : 0;
+  if (rate_hz > 0 && interval_ms == 0)
+    interval_ms = 1;
+  if (interval_ms == motion_interval_ms)
+    return;
+
+  if (motion_timer != 0)
+    SDL_RemoveTimer(motion_timer);
+  motion_timer = interval_ms > 0 ? SDL_AddTimer(interval_ms, motion_timer_tick, NULL) : 0;
+  motion_interval_ms = interval_ms;
+}
+
 static PGAMEPAD_STATE get_gamepad(SDL_JoystickID sdl_id, bool add) {
   // See if a gamepad already exists
   for (int i = 0;i<MAX_GAMEPADS;i++) {
@@ -424,6 +508,7 @@ static void remove_gamepad(SDL_JoystickID sdl_id) {
 
       memset(&gamepads[i], 0, sizeof(*gamepads));
       sdl_gamepads--;
+      motion_timer_update();
       break;
     }
   }
@@ -431,6 +516,8 @@ static void remove_gamepad(SDL_JoystickID sdl_id) {
 
 void sdlinput_init(char* mappings) {
   memset(gamepads, 0, sizeof(gamepads));
+  axis_events = controller_packets = 0;
+  motion_samples = motion_packets = 0;
 
   SDL_InitSubSystem(SDL_INIT_GAMECONTROLLER);
 #if !SDL_VERSION_ATLEAST(2, 0, 9)
@@ -571,7 +658,9 @@ int sdlinput_handle_event(SDL_Window* window, SDL_Event* event) {
     default:
       return SDL_NOTHING;
     }
-    LiSendMultiControllerEvent(gamepad->id, activeGamepadMask, gamepad->buttons, gamepad->leftTrigger, gamepad->rightTrigger, gamepad->leftStickX, gamepad->leftStickY, gamepad->rightStickX, gamepad->rightStickY);
+    // Sent by sdlinput_flush() once the event queue is drained
+    gamepad->axes_changed = true;
+    axis_events++;
     break;
   case SDL_CONTROLLERBUTTONDOWN:
   case SDL_CONTROLLERBUTTONUP:
@@ -589,7 +678,8 @@ int sdlinput_handle_event(SDL_Window* window, SDL_Event* event) {
     if ((gamepad->buttons & QUIT_BUTTONS) == QUIT_BUTTONS)
       return SDL_QUIT_APPLICATION;
 
-    LiSendMultiControllerEvent(gamepad->id, activeGamepadMask, gamepad->buttons, gamepad->leftTrigger, gamepad->rightTrigger, gamepad->leftStickX, gamepad->leftStickY, gamepad->rightStickX, gamepad->rightStickY);
+    // Button edges aren't delayed, pending axis changes go along
+    send_gamepad_state(gamepad);
     break;
   case SDL_CONTROLLERDEVICEADDED:
     add_gamepad(event->cdevice.which);
@@ -602,18 +692,26 @@ int sdlinput_handle_event(SDL_Window* window, SDL_Event* event) {
     gamepad = get_gamepad(event->csensor.which, false);
     if (!gamepad)
       return SDL_NOTHING;
+    PMOTION_STATE motion;
+    float scale = 1.0f;
     switch (event->csensor.sensor) {
     case SDL_SENSOR_ACCEL:
-      LiSendControllerMotionEvent(gamepad->id, LI_MOTION_TYPE_ACCEL, event->csensor.data[0], event->csensor.data[1], event->csensor.data[2]);
+      motion = &gamepad->motion[LI_MOTION_TYPE_ACCEL - 1];
       break;
     case SDL_SENSOR_GYRO:
       // Convert rad/s to deg/s
-      LiSendControllerMotionEvent(gamepad->id, LI_MOTION_TYPE_GYRO,
-                                  event->csensor.data[0] * 57.2957795f,
-                                  event->csensor.data[1] * 57.2957795f,
-                                  event->csensor.data[2] * 57.2957795f);
+      motion = &gamepad->motion[LI_MOTION_TYPE_GYRO - 1];
+      scale = 57.2957795f;
       break;
+    default:
+      return SDL_NOTHING;
     }
+
+    // Sent at the host requested rate by sdlinput_send_motion()
+    for (int i = 0; i < 3; i++)
+      motion->sum[i] += event->csensor.data[i] * scale;
+    motion->samples++;
+    motion_samples++;
     break;
   case SDL_CONTROLLERTOUCHPADDOWN:
   case SDL_CONTROLLERTOUCHPADUP:
@@ -643,6 +741,42 @@ int sdlinput_handle_event(SDL_Window* window, SDL_Event* event) {
   return SDL_NOTHING;
 }
 
+void sdlinput_flush(void) {
+  for (int i = 0; i < MAX_GAMEPADS; i++) {
+    if (!gamepads[i].initialized)
+      continue;
+
+    if (gamepads[i].axes_changed)
+      send_gamepad_state(&gamepads[i]);
+  }
+}
+
+void sdlinput_send_motion(void) {
+  for (int i = 0; i < MAX_GAMEPADS; i++) {
+    if (!gamepads[i].initialized)
+      continue;
+
+    for (int type = 0; type < MOTION_TYPES; type++)
+      send_motion_state(&gamepads[i], type);
+  }
+}
+
+void sdlinput_stop_motion(void) {
+  for (int i = 0; i < MAX_GAMEPADS; i++) {
+    for (int type = 0; type < MOTION_TYPES && gamepads[i].initialized; type++) {
+      if (gamepads[i].motion[type].rate_hz > 0)
+        sdlinput_set_motion_event_state(i, type + 1, 0);
+    }
+  }
+}
+
+void sdlinput_print_stats(FILE* fd) {
+  if (axis_events > 0)
+    fprintf(fd, "Gamepad axis events: %llu, controller packets sent: %llu\n", (unsigned long long) axis_events, (unsigned long long) controller_packets);
+  if (motion_samples > 0)
+    fprintf(fd, "Motion sensor samples: %llu, motion packets sent: %llu\n", (unsigned long long) motion_samples, (unsigned long long) motion_packets);
+}
+
 void sdlinput_rumble(unsigned short controller_id, unsigned short low_freq_motor, unsigned short high_freq_motor) {
   if (controller_id >= MAX_GAMEPADS)
     return;
@@ -692,11 +826,18 @@ void sdlinput_rumble_triggers(unsigned short controller_id, unsigned short left_
 }
 
 void sdlinput_set_motion_event_state(unsigned short controller_id, unsigned char motion_type, unsigned short report_rate_hz) {
+  if (controller_id >= MAX_GAMEPADS || motion_type < 1 || motion_type > MOTION_TYPES)
+    return;
+
   PGAMEPAD_STATE state = &gamepads[controller_id];
 
   if (!state->initialized)
     return;
 
+  // Sensors stay disabled until the host asks for them
+  state->motion[motion_type - 1].rate_hz = report_rate_hz;
+  motion_timer_update();
+
 #if SDL_VERSION_ATLEAST(2, 0, 14)
   switch (motion_type) {
   case LI_MOTION_TYPE_ACCEL:
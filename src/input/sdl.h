@@ -18,12 +18,20 @@
  */
 
 #include <stdbool.h>
+#include <stdio.h>
 #include <SDL.h>
 
 extern int sdl_gamepads;
 
 void sdlinput_init(char* mappings);
 int sdlinput_handle_event(SDL_Window* window, SDL_Event* event);
+// Send the accumulated axis changes, one packet per gamepad
+void sdlinput_flush(void);
+// Send the averaged motion sensor samples that are due
+void sdlinput_send_motion(void);
+// Disable the sensors at the end of a session
+void sdlinput_stop_motion(void);
+void sdlinput_print_stats(FILE* fd);
 void sdlinput_rumble(unsigned short controller_id, unsigned short low_freq_motor, unsigned short high_freq_motor);
 void sdlinput_rumble_triggers(unsigned short controller_id, unsigned short left_trigger, unsigned short right_trigger);
 void sdlinput_set_motion_event_state(unsigned short controller_id, unsigned char motion_type, unsigned short report_rate_hz);
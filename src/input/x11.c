@@ -38,6 +38,8 @@ static Display *display;
 static Window window;
 
 static Atom wm_deletemessage;
+static Atom wm_state;
+static Atom wm_state_hidden;
 
 static int last_x = -1, last_y = -1;
 static int keyboard_modifiers;
@@ -46,6 +48,36 @@ static const char data[1] = {0};
 static Cursor cursor;
 static bool grabbed = True;
 
+X11EventHandler x11_generic_event_handler = NULL;
+X11VisibilityHandler x11_visibility_handler = NULL;
+
+static bool mapped = true;
+static bool obscured = false;
+static bool minimized = false;
+
+static void x11_update_visibility() {
+  if (x11_visibility_handler)
+    x11_visibility_handler(mapped && !obscured && !minimized);
+}
+
+// Window managers mark minimized windows with _NET_WM_STATE_HIDDEN
+static bool x11_window_minimized() {
+  Atom type;
+  int format;
+  unsigned long count, remaining;
+  Atom* states = NULL;
+  bool found = false;
+
+  if (XGetWindowProperty(display, window, wm_state, 0, 64, False, XA_ATOM, &type, &format, &count, &remaining, (unsigned char**) &states) == Success && states) {
+    for (unsigned long i = 0; i < count; i++) {
+      if (states[i] == wm_state_hidden)
+        found = true;
+    }
+    XFree(states);
+  }
+  return found;
+}
+
 static int x11_handler(int fd) {
   XEvent event;
   int button = 0;
@@ -147,6 +179,26 @@ static int x11_handler(int fd) {
         return LOOP_RETURN;
 
       break;
+    case GenericEvent:
+      if (x11_generic_event_handler)
+        x11_generic_event_handler(&event);
+
+      break;
+    case MapNotify:
+    case UnmapNotify:
+      mapped = event.type == MapNotify;
+      x11_update_visibility();
+      break;
+    case VisibilityNotify:
+      obscured = event.xvisibility.state == VisibilityFullyObscured;
+      x11_update_visibility();
+      break;
+    case PropertyNotify:
+      if (event.xproperty.atom == wm_state) {
+        minimized = x11_window_minimized();
+        x11_update_visibility();
+      }
+      break;
     }
   }
 
@@ -160,6 +212,9 @@ void x11_input_init(Display* x11_display, Window x11_window) {
   wm_deletemessage = XInternAtom(display, "WM_DELETE_WINDOW", False);
   XSetWMProtocols(display, window, &wm_deletemessage, 1);
 
+  wm_state = XInternAtom(display, "_NET_WM_STATE", False);
+  wm_state_hidden = XInternAtom(display, "_NET_WM_STATE_HIDDEN", False);
+
   /* make a blank cursor */
   XColor dummy;
   Pixmap blank = XCreateBitmapFromData(display, window, data, 1, 1);
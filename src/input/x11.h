@@ -19,4 +19,12 @@
 
 #include <X11/Xlib.h>
 
+#include <stdbool.h>
+
+typedef void(*X11EventHandler)(XEvent* event);
+typedef void(*X11VisibilityHandler)(bool visible);
+
 void x11_input_init(Display* display, Window window);
+
+extern X11EventHandler x11_generic_event_handler;
+extern X11VisibilityHandler x11_visibility_handler;
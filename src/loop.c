@@ -19,12 +19,14 @@
 
 #include "loop.h"
 
+#include "clock.h"
 #include "connection.h"
 
 #include <sys/stat.h>
 #include <sys/signalfd.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <errno.h>
 #include <unistd.h>
 #include <poll.h>
 #include <signal.h>
@@ -36,6 +38,19 @@ static int numFds = 0;
 
 static int sigFd;
 
+#define LOOP_MAX_TIMEOUTS 8
+// The virtual clock doesn't move with the system clock, so it's checked this often instead
+#define LOOP_VIRTUAL_POLL_MS 1
+
+struct loop_timeout {
+  TimeoutHandler handler;
+  uint64_t interval_us;
+  uint64_t due_us;
+};
+
+static struct loop_timeout timeouts[LOOP_MAX_TIMEOUTS];
+static int numTimeouts = 0;
+
 static int loop_sig_handler(int fd) {
   struct signalfd_siginfo info;
   if (read(fd, &info, sizeof(info)) != sizeof(info))
@@ -89,6 +104,58 @@ void loop_remove_fd(int fd) {
   }
 }
 
+void loop_add_timeout(uint64_t interval_us, TimeoutHandler handler) {
+  if (numTimeouts == LOOP_MAX_TIMEOUTS) {
+    fprintf(stderr, "Too many loop timeouts\n");
+    exit(EXIT_FAILURE);
+  }
+
+  timeouts[numTimeouts].handler = handler;
+  timeouts[numTimeouts].interval_us = interval_us;
+  timeouts[numTimeouts].due_us = clock_now_us() + interval_us;
+  numTimeouts++;
+}
+
+void loop_remove_timeout(TimeoutHandler handler) {
+  for (int i=0;i<numTimeouts;i++) {
+    if (timeouts[i].handler == handler) {
+      timeouts[i] = timeouts[--numTimeouts];
+      break;
+    }
+  }
+}
+
+static int loop_poll_timeout() {
+  if (numTimeouts == 0)
+    return -1;
+  else if (clock_is_virtual())
+    return LOOP_VIRTUAL_POLL_MS;
+
+  uint64_t now = clock_now_us();
+  uint64_t due = timeouts[0].due_us;
+  for (int i=1;i<numTimeouts;i++) {
+    if (timeouts[i].due_us < due)
+      due = timeouts[i].due_us;
+  }
+  return due <= now ? 0 : (due - now + 999) / 1000;
+}
+
+// Intervals missed while the loop was busy are skipped rather than run back to back
+static int loop_run_timeouts() {
+  uint64_t now = clock_now_us();
+  for (int i=0;i<numTimeouts;i++) {
+    if (timeouts[i].due_us > now)
+      continue;
+
+    timeouts[i].due_us += timeouts[i].interval_us;
+    if (timeouts[i].due_us <= now)
+      timeouts[i].due_us = now + timeouts[i].interval_us;
+    if (timeouts[i].handler() == LOOP_RETURN)
+      return LOOP_RETURN;
+  }
+  return LOOP_OK;
+}
+
 void loop_init() {
   main_thread_id = pthread_self();
   sigset_t sigset;
@@ -103,8 +170,12 @@ void loop_init() {
 }
 
 void loop_main() {
-  while (poll(fds, numFds, -1)) {
-    for (int i=0;i<numFds;i++) {
+  for (;;) {
+    int ready = poll(fds, numFds, loop_poll_timeout());
+    if (ready < 0 && errno != EINTR)
+      return;
+
+    for (int i=0;i<numFds && ready > 0;i++) {
       if (fds[i].revents > 0) {
         int ret = fdHandlers[i](fds[i].fd);
         if (ret == LOOP_RETURN) {
@@ -112,5 +183,8 @@ void loop_main() {
         }
       }
     }
+
+    if (loop_run_timeouts() == LOOP_RETURN)
+      return;
   }
 }
@@ -17,13 +17,20 @@
  * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <stdint.h>
+
 #define LOOP_RETURN 1
 #define LOOP_OK 0
 
 typedef int(*FdHandler)(int fd);
+typedef int(*TimeoutHandler)(void);
 
 void loop_add_fd(int fd, FdHandler handler, int events);
 void loop_remove_fd(int fd);
 
+// Calls the handler every interval of the session clock until it is removed
+void loop_add_timeout(uint64_t interval_us, TimeoutHandler handler);
+void loop_remove_timeout(TimeoutHandler handler);
+
 void loop_init();
 void loop_main();
@@ -23,6 +23,18 @@
 #include "platform.h"
 #include "config.h"
 #include "sdl.h"
+#include "cpu.h"
+#include "replay.h"
+#include "quality.h"
+#include "stats.h"
+#include "alloc.h"
+#include "tune.h"
+#include "crypto.h"
+#include "status.h"
+#include "thermal.h"
+#include "watchdog.h"
+#include "recorder.h"
+#include "daemon.h"
 
 #include "audio/audio.h"
 #include "video/video.h"
@@ -30,6 +42,7 @@
 #include "input/mapping.h"
 #include "input/evdev.h"
 #include "input/udev.h"
+#include "input/capture.h"
 #ifdef HAVE_LIBCEC
 #include "input/cec.h"
 #endif
@@ -83,11 +96,11 @@ static int get_app_id(PSERVER_DATA server, const char *name) {
   return -1;
 }
 
-static void stream(PSERVER_DATA server, PCONFIGURATION config, enum platform system) {
+static int stream(PSERVER_DATA server, PCONFIGURATION config, enum platform system, uint64_t request_us) {
   int appId = get_app_id(server, config->app);
   if (appId<0) {
     fprintf(stderr, "Can't find app %s\n", config->app);
-    exit(-1);
+    return -1;
   }
 
   int gamepads = 0;
@@ -108,10 +121,10 @@ static void stream(PSERVER_DATA server, PCONFIGURATION config, enum platform sys
     else if (ret == GS_NOT_SUPPORTED_SOPS_RESOLUTION)
       fprintf(stderr, "Optimal Playable Settings isn't supported for the resolution %dx%d, use supported resolution or add --nosops option\n", config->stream.width, config->stream.height);
     else if (ret == GS_ERROR)
-      fprintf(stderr, "Gamestream error: %s\n", gs_error);
+      fprintf(stderr, "Gamestream error: %s\n", server->error);
     else
       fprintf(stderr, "Errorcode starting app: %d\n", ret);
-    exit(-1);
+    return -1;
   }
 
   int drFlags = 0;
@@ -139,11 +152,35 @@ static void stream(PSERVER_DATA server, PCONFIGURATION config, enum platform sys
     connection_debug = true;
   }
 
-  if (IS_EMBEDDED(system))
-    loop_init();
+  audio_latency = config->audio_latency;
+  audio_decode_threads = config->audio_threads;
+  video_export_path = config->export_path;
+  video_swap_interval = config->swap_interval;
+
+  if (config->recorder_path != NULL && recorder_init(config->recorder_path, config->stream.width, config->stream.height, config->stream.fps, config->stream.bitrate) < 0)
+    return -1;
+
+  PDECODER_RENDERER_CALLBACKS video_callbacks = connection_track_video(platform_get_video(system));
+  PAUDIO_RENDERER_CALLBACKS audio_callbacks = platform_get_audio(system, config->audio_device);
+  #ifdef HAVE_ALLOC_TRACKER
+  video_callbacks = alloc_track_video(video_callbacks);
+  audio_callbacks = alloc_track_audio(audio_callbacks);
+  alloc_start();
+  #endif
+  if (config->watchdog > 0) {
+    audio_callbacks = watchdog_track_audio(audio_callbacks);
+    watchdog_start(config->watchdog);
+  }
 
   platform_start(system);
-  LiStartConnection(&server->serverInfo, &config->stream, &connection_callbacks, platform_get_video(system), platform_get_audio(system, config->audio_device), NULL, drFlags, config->audio_device, 0);
+  stats_reset();
+  stats_request_time(request_us);
+  quality_reset();
+  thermal_init(config->thermal_policy, config->stream.bitrate);
+  if (IS_EMBEDDED(system))
+    thermal_start_loop();
+  LiStartConnection(&server->serverInfo, &config->stream, &connection_callbacks, video_callbacks, audio_callbacks, NULL, drFlags, config->audio_device, 0);
+  daemon_streaming();
 
   if (IS_EMBEDDED(system)) {
     if (!config->viewonly)
@@ -156,9 +193,24 @@ static void stream(PSERVER_DATA server, PCONFIGURATION config, enum platform sys
   else if (system == SDL)
     sdl_loop();
   #endif
+  thermal_stop();
+  watchdog_stop();
+
+  if (config->autotune)
+    tune_record(config);
 
   LiStopConnection();
 
+  if (config->debug_level > 0) {
+    stats_print(stdout);
+    thermal_print(stdout);
+  }
+
+  #ifdef HAVE_ALLOC_TRACKER
+  alloc_stop();
+  alloc_print(stdout);
+  #endif
+
   if (config->quitappafter) {
     if (config->debug_level > 0)
       printf("Sending app quit request ...\n");
@@ -166,6 +218,141 @@ static void stream(PSERVER_DATA server, PCONFIGURATION config, enum platform sys
   }
 
   platform_stop(system);
+  recorder_destroy();
+  return 0;
+}
+
+// Codecs and settings of a session, adjusted to the platform and the previous sessions
+static int stream_prepare(PCONFIGURATION config, enum platform system) {
+  if (config->autotune)
+    tune_apply(config);
+
+  // Opt in for encryption as far as the measured AES performance allows,
+  // only streaming pays for the benchmark
+  config->stream.encryptionFlags = crypto_select_encryption(config->stream.bitrate, config->stream.packetSize, config->key_dir, config->debug_level > 0);
+
+  config->stream.supportedVideoFormats = VIDEO_FORMAT_H264;
+  if (config->codec == CODEC_HEVC || (config->codec == CODEC_UNSPECIFIED && platform_prefers_codec(system, CODEC_HEVC))) {
+    config->stream.supportedVideoFormats |= VIDEO_FORMAT_H265;
+    if (config->hdr)
+      config->stream.supportedVideoFormats |= VIDEO_FORMAT_H265_MAIN10;
+  }
+  if (config->codec == CODEC_AV1 || (config->codec == CODEC_UNSPECIFIED && platform_prefers_codec(system, CODEC_AV1))) {
+    config->stream.supportedVideoFormats |= VIDEO_FORMAT_AV1_MAIN8;
+    if (config->hdr)
+      config->stream.supportedVideoFormats |= VIDEO_FORMAT_AV1_MAIN10;
+  }
+
+  if (config->hdr && !(config->stream.supportedVideoFormats & VIDEO_FORMAT_MASK_10BIT)) {
+    fprintf(stderr, "HDR streaming requires HEVC or AV1 codec\n");
+    return -1;
+  }
+  return 0;
+}
+
+// Sessions started from the control socket reuse the identity, host
+// connection, platform, input devices and window set up once
+static void run_daemon(PSERVER_DATA server, PCONFIGURATION config, enum platform system) {
+  if (daemon_init(config, server, system == SDL) < 0)
+    exit(-1);
+  if (IS_EMBEDDED(system) && !config->viewonly)
+    evdev_ignore();
+
+  char app[DAEMON_MAX_APP];
+  uint64_t request_us;
+  while (daemon_wait(app, sizeof(app), &request_us) == DAEMON_LAUNCH) {
+    // Adjustments made for one session don't carry over to the next
+    CONFIGURATION session = *config;
+    session.app = app;
+
+    int ret = gs_refresh(server);
+    if (ret != GS_OK)
+      fprintf(stderr, "Can't reach server %s: %s\n", config->address, server->error);
+    else if (!server->paired) {
+      fprintf(stderr, "You must pair with the PC first\n");
+      ret = -1;
+    } else if ((ret = stream_prepare(&session, system)) == 0)
+      ret = stream(server, &session, system, request_us);
+    daemon_session_ended(ret);
+  }
+
+  daemon_destroy();
+}
+
+static void replay(PCONFIGURATION config, enum platform system) {
+  REPLAY_CONFIGURATION replay_config = {
+    .filename = config->address,
+    .videoFormat = VIDEO_FORMAT_H264,
+    .width = config->stream.width,
+    .height = config->stream.height,
+    .fps = config->stream.fps,
+    .drFlags = config->fullscreen ? DISPLAY_FULLSCREEN : 0,
+    .loss = config->replay_loss,
+    .jitter = config->replay_jitter,
+    .drift = config->replay_drift,
+    .duration = config->replay_duration,
+    .virtualClock = config->virtual_clock,
+  };
+
+  if (config->codec == CODEC_HEVC)
+    replay_config.videoFormat = config->hdr ? VIDEO_FORMAT_H265_MAIN10 : VIDEO_FORMAT_H265;
+  else if (config->codec == CODEC_AV1)
+    replay_config.videoFormat = VIDEO_FORMAT_AV1_MAIN8;
+
+  if (config->debug_level > 0) {
+    printf("Replaying %s at %d x %d, %d fps (loss %d%%, jitter %d ms, drift %d ppm)%s\n", config->address, config->stream.width, config->stream.height, config->stream.fps, config->replay_loss, config->replay_jitter, config->replay_drift, config->virtual_clock ? " on a virtual clock" : "");
+    connection_debug = true;
+  }
+
+  video_export_path = config->export_path;
+  video_swap_interval = config->swap_interval;
+
+  if (IS_EMBEDDED(system))
+    loop_init();
+
+  PDECODER_RENDERER_CALLBACKS video_callbacks = platform_get_video(system);
+  #ifdef HAVE_ALLOC_TRACKER
+  video_callbacks = alloc_track_video(video_callbacks);
+  alloc_start();
+  #endif
+
+  if (config->watchdog > 0)
+    watchdog_start(config->watchdog);
+  if (config->recorder_path != NULL && recorder_init(config->recorder_path, config->stream.width, config->stream.height, config->stream.fps, 0) < 0)
+    exit(-1);
+
+  platform_start(system);
+  quality_reset();
+  thermal_init(config->thermal_policy, config->stream.bitrate);
+  if (IS_EMBEDDED(system))
+    thermal_start_loop();
+  if (replay_init(&replay_config, video_callbacks) < 0) {
+    platform_stop(system);
+    exit(-1);
+  }
+  replay_start();
+
+  if (IS_EMBEDDED(system))
+    loop_main();
+  #ifdef HAVE_SDL
+  else if (system == SDL)
+    sdl_loop();
+  #endif
+  thermal_stop();
+  watchdog_stop();
+
+  replay_stop();
+  thermal_print(stdout);
+  platform_stop(system);
+  recorder_destroy();
+
+  #ifdef HAVE_ALLOC_TRACKER
+  alloc_stop();
+  if (alloc_print(stdout) > 0 && config->alloc_check) {
+    fprintf(stderr, "Steady state allocations detected\n");
+    exit(-1);
+  }
+  #endif
 }
 
 static void help() {
@@ -175,6 +362,8 @@ static void help() {
   printf("Moonlight Embedded %d.%d.%d\n", VERSION_MAJOR, VERSION_MINOR, VERSION_PATCH);
   #endif
   printf("Usage: moonlight [action] (options) [host]\n");
+  printf("       moonlight replay (options) [file]\n");
+  printf("       moonlight capture -input <device> (options) [file]\n");
   printf("       moonlight [configfile]\n");
   printf("\n Actions\n\n");
   printf("\tpair\t\t\tPair device with computer\n");
@@ -183,6 +372,10 @@ static void help() {
   printf("\tlist\t\t\tList available games and applications\n");
   printf("\tquit\t\t\tQuit the application or game being streamed\n");
   printf("\tmap\t\t\tCreate mapping for gamepad\n");
+  printf("\tcapture\t\t\tRecord raw events of input devices for moonlight-inputbench\n");
+  printf("\tdaemon\t\t\tKeep running connected to the host and stream apps on request from a UNIX socket\n");
+  printf("\tstatus\t\t\tQuery the state of one host, a file listing hosts or all discovered hosts as JSON\n");
+  printf("\treplay\t\t\tDecode and render a H.264/HEVC elementary stream file as if it was streamed\n");
   printf("\thelp\t\t\tShow this help\n");
   printf("\n Global Options\n\n");
   printf("\t-config <config>\tLoad configuration file\n");
@@ -208,6 +401,8 @@ static void help() {
   printf("\t-nosops\t\t\tDon't allow GFE to modify game settings\n");
   printf("\t-localaudio\t\tPlay audio locally on the host computer\n");
   printf("\t-surround <5.1/7.1>\t\tStream 5.1 or 7.1 surround sound\n");
+  printf("\t-audiolatency <ms>\tTarget audio output latency, matching device buffers to the packet duration (default 0 for device defaults)\n");
+  printf("\t-audiothreads <n>\tDecode the streams of surround sound in parallel on up to <n> threads (default 0)\n");
   printf("\t-keydir <directory>\tLoad encryption keys from directory\n");
   printf("\t-mapping <file>\t\tUse <file> as gamepad mappings configuration file\n");
   printf("\t-platform <system>\tSpecify system used for audio, video and input: pi/imx/aml/rk/x11/x11_vdpau/sdl/fake (default auto)\n");
@@ -215,10 +410,30 @@ static void help() {
   printf("\t-quitappafter\t\tSend quit app request to remote after quitting session\n");
   printf("\t-viewonly\t\tDisable all input processing (view-only mode)\n");
   printf("\t-nomouseemulation\t\tDisable gamepad mouse emulation support (long pressing Start button)\n");
+  printf("\t-noautotune\t\tDon't adjust the stream settings from previous sessions with the same host\n");
+  printf("\t-thermal <none/log/reduce>\tWhen the device is about to overheat, only report it, recommend a lower bitrate or reduce decoding cost (default none)\n");
+  printf("\t-watchdog <ms>\t\tReport pipeline stages busy for longer than <ms> with their recent activity (default 0 to disable)\n");
+  printf("\t-recorder <file>\tKeep the last %d seconds of frame timing, audio levels, input and connection events in <file>\n", RECORDER_SECONDS);
+  printf("\t-export <socket>\tShare decoded frames with other programs through a UNIX socket (FFmpeg decoders only)\n");
+  printf("\n Daemon options\n\n");
+  printf("\t-socket <path>\t\tListen for commands on <path> (default $XDG_RUNTIME_DIR/moonlight.sock)\n");
+  printf("\n Status options\n\n");
+  printf("\t-jobs <n>\t\tQuery up to <n> hosts or box art images at once (default %d)\n", STATUS_DEFAULT_JOBS);
+  printf("\t-timeout <ms>\t\tGive up on a host after <ms> (default %d)\n", STATUS_DEFAULT_TIMEOUT_MS);
+  printf("\n Replay options\n\n");
+  printf("\t-replayloss <percent>\tSimulate loss of the given percentage of frames (default 0)\n");
+  printf("\t-replayjitter <ms>\tSimulate random frame arrival delays up to <ms> (default 0)\n");
+  printf("\t-replaydrift <ppm>\tSimulate a host clock running <ppm> parts per million fast, or slow when negative (default 0)\n");
+  printf("\t-replayduration <s>\tRepeat the file until the replay lasted <s> seconds (default 0 to play it once)\n");
+  printf("\t-virtualclock\t\tReplay on a simulated clock, as fast as frames can be decoded and with reproducible timing\n");
+  printf("\t-alloccheck\t\tFail when decoding or rendering still allocates after warm-up (requires ENABLE_ALLOC_TRACKER)\n");
   #if defined(HAVE_SDL) || defined(HAVE_X11)
   printf("\n WM options (SDL and X11 only)\n\n");
   printf("\t-windowed\t\tDisplay screen in a window\n");
   #endif
+  #ifdef HAVE_X11
+  printf("\t-swapinterval <n>\tWait for <n> vblanks per frame with the X11 renderer, 0 to disable vsync (default driver setting)\n");
+  #endif
   #ifdef HAVE_EMBEDDED
   printf("\n I/O options (Not for SDL)\n\n");
   printf("\t-input <device>\t\tUse <device> as input. Can be used multiple times\n");
@@ -236,14 +451,18 @@ static void pair_check(PSERVER_DATA server) {
 }
 
 int main(int argc, char* argv[]) {
+  // Cold starts count the time to the first frame from here
+  uint64_t start_us = stats_time_us();
   CONFIGURATION config;
   config_parse(argc, argv, &config);
 
   if (config.action == NULL || strcmp("help", config.action) == 0)
     help();
 
-  if (config.debug_level > 0)
+  if (config.debug_level > 0) {
     printf("Moonlight Embedded %d.%d.%d (%s)\n", VERSION_MAJOR, VERSION_MINOR, VERSION_PATCH, COMPILE_OPTIONS);
+    cpu_report();
+  }
 
   if (strcmp("map", config.action) == 0) {
     if (config.inputsCount != 1) {
@@ -256,6 +475,60 @@ int main(int argc, char* argv[]) {
     exit(0);
   }
 
+  if (strcmp("capture", config.action) == 0) {
+    if (config.inputsCount == 0 || config.address == NULL) {
+      printf("You need to specify input devices using -input and a file to capture to.\n");
+      exit(-1);
+    }
+
+    loop_init();
+    if (capture_start(config.address, config.inputs, config.inputsCount, config.debug_level > 0) < 0)
+      exit(-1);
+
+    printf("Capturing input, press Ctrl+C to stop\n");
+    loop_main();
+    capture_stop();
+    exit(0);
+  }
+
+  if (strcmp("replay", config.action) == 0) {
+    if (config.address == NULL) {
+      fprintf(stderr, "You need to specify a video file to replay.\n");
+      exit(-1);
+    }
+
+    #ifndef HAVE_ALLOC_TRACKER
+    if (config.alloc_check) {
+      fprintf(stderr, "Allocation tracker not compiled in, configure with ENABLE_ALLOC_TRACKER\n");
+      exit(-1);
+    }
+    #endif
+
+    enum platform system = platform_check(config.platform);
+    if (system == 0) {
+      fprintf(stderr, "Platform '%s' not found\n", config.platform);
+      exit(-1);
+    }
+
+    if (config.debug_level > 0)
+      printf("Platform %s\n", platform_name(system));
+
+    #ifdef HAVE_SDL
+    if (system == SDL)
+      sdl_init(config.stream.width, config.stream.height, config.fullscreen);
+    #endif
+
+    replay(&config, system);
+    #ifdef HAVE_SDL
+    if (system == SDL)
+      sdl_destroy();
+    #endif
+    exit(0);
+  }
+
+  if (strcmp("status", config.action) == 0)
+    exit(status_print(&config) < 0 ? -1 : 0);
+
   if (config.address == NULL) {
     config.address = malloc(MAX_ADDRESS_SIZE);
     if (config.address == NULL) {
@@ -284,13 +557,13 @@ int main(int argc, char* argv[]) {
     fprintf(stderr, "Not enough memory\n");
     exit(-1);
   } else if (ret == GS_ERROR) {
-    fprintf(stderr, "Gamestream error: %s\n", gs_error);
+    fprintf(stderr, "Gamestream error: %s\n", server.error);
     exit(-1);
   } else if (ret == GS_INVALID) {
-    fprintf(stderr, "Invalid data received from server: %s\n", gs_error);
+    fprintf(stderr, "Invalid data received from server: %s\n", server.error);
     exit(-1);
   } else if (ret == GS_UNSUPPORTED_VERSION) {
-    fprintf(stderr, "Unsupported version: %s\n", gs_error);
+    fprintf(stderr, "Unsupported version: %s\n", server.error);
     exit(-1);
   } else if (ret != GS_OK) {
     fprintf(stderr, "Can't connect to server %s\n", config.address);
@@ -305,7 +578,7 @@ int main(int argc, char* argv[]) {
   if (strcmp("list", config.action) == 0) {
     pair_check(&server);
     applist(&server);
-  } else if (strcmp("stream", config.action) == 0) {
+  } else if (strcmp("stream", config.action) == 0 || strcmp("daemon", config.action) == 0) {
     pair_check(&server);
     enum platform system = platform_check(config.platform);
     if (config.debug_level > 0)
@@ -319,22 +592,9 @@ int main(int argc, char* argv[]) {
       exit(-1);
     }
 
-    config.stream.supportedVideoFormats = VIDEO_FORMAT_H264;
-    if (config.codec == CODEC_HEVC || (config.codec == CODEC_UNSPECIFIED && platform_prefers_codec(system, CODEC_HEVC))) {
-      config.stream.supportedVideoFormats |= VIDEO_FORMAT_H265;
-      if (config.hdr)
-        config.stream.supportedVideoFormats |= VIDEO_FORMAT_H265_MAIN10;
-    }
-    if (config.codec == CODEC_AV1 || (config.codec == CODEC_UNSPECIFIED && platform_prefers_codec(system, CODEC_AV1))) {
-      config.stream.supportedVideoFormats |= VIDEO_FORMAT_AV1_MAIN8;
-      if (config.hdr)
-        config.stream.supportedVideoFormats |= VIDEO_FORMAT_AV1_MAIN10;
-    }
-
-    if (config.hdr && !(config.stream.supportedVideoFormats & VIDEO_FORMAT_MASK_10BIT)) {
-      fprintf(stderr, "HDR streaming requires HEVC or AV1 codec\n");
+    bool resident = strcmp("daemon", config.action) == 0;
+    if (!resident && stream_prepare(&config, system) < 0)
       exit(-1);
-    }
 
     #ifdef HAVE_SDL
     if (system == SDL)
@@ -392,7 +652,18 @@ int main(int argc, char* argv[]) {
       #endif
     }
 
-    stream(&server, &config, system);
+    if (IS_EMBEDDED(system))
+      loop_init();
+
+    if (resident)
+      run_daemon(&server, &config, system);
+    else if (stream(&server, &config, system, start_us) < 0)
+      exit(-1);
+
+    #ifdef HAVE_SDL
+    if (system == SDL)
+      sdl_destroy();
+    #endif
   } else if (strcmp("pair", config.action) == 0) {
     char pin[5];
     if (config.pin > 0 && config.pin <= 9999) {
@@ -403,13 +674,13 @@ int main(int argc, char* argv[]) {
     printf("Please enter the following PIN on the target PC: %s\n", pin);
     fflush(stdout);
     if (gs_pair(&server, &pin[0]) != GS_OK) {
-      fprintf(stderr, "Failed to pair to server: %s\n", gs_error);
+      fprintf(stderr, "Failed to pair to server: %s\n", server.error);
     } else {
       printf("Succesfully paired\n");
     }
   } else if (strcmp("unpair", config.action) == 0) {
     if (gs_unpair(&server) != GS_OK) {
-      fprintf(stderr, "Failed to unpair to server: %s\n", gs_error);
+      fprintf(stderr, "Failed to unpair to server: %s\n", server.error);
     } else {
       printf("Succesfully unpaired\n");
     }
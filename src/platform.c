@@ -31,6 +31,11 @@
 #include <unistd.h>
 #include <dlfcn.h>
 
+int video_decoder_threads = 0;
+int video_buffered_frames = 0;
+char* video_export_path = NULL;
+int video_swap_interval = -1;
+
 typedef bool(*ImxInit)();
 
 enum platform platform_check(char* name) {
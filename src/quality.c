@@ -0,0 +1,112 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2015-2019 Iwan Timmer
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "quality.h"
+#include "clock.h"
+#include "recorder.h"
+#include "util.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdint.h>
+
+static pthread_mutex_t quality_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static volatile bool degraded;
+static bool connection_poor;
+static bool frames_poor;
+static int window_frames, window_corrupt;
+static uint64_t last_poor_us, degraded_us;
+static uint32_t poor_periods;
+static uint64_t poor_total_us;
+
+// Degrade immediately on any sign of a poor connection, but only
+// restore after it has been fine for a while. Must hold quality_mutex.
+static void quality_update() {
+  uint64_t now = clock_now_us();
+  if (connection_poor || frames_poor) {
+    last_poor_us = now;
+    if (!degraded) {
+      degraded = true;
+      degraded_us = now;
+      poor_periods++;
+      recorder_write(RECORDER_EVENT, RECORDER_QUALITY_DEGRADED, connection_poor, frames_poor, 0);
+      log_message(connection_poor ? "Connection is poor, showing only the newest frame and buffering more audio" : "Too many corrupt frames, showing only the newest frame and buffering more audio");
+    }
+  } else if (degraded && now - last_poor_us >= QUALITY_RECOVERY_MS * 1000) {
+    degraded = false;
+    poor_total_us += now - degraded_us;
+    recorder_write(RECORDER_EVENT, RECORDER_QUALITY_RESTORED, (now - degraded_us) / 1000, 0, 0);
+    char message[96];
+    snprintf(message, sizeof(message), "Connection is okay, restoring normal operation after %.1f seconds", (now - degraded_us) / 1000000.0);
+    log_message(message);
+  }
+}
+
+void quality_reset() {
+  pthread_mutex_lock(&quality_mutex);
+  degraded = false;
+  connection_poor = false;
+  frames_poor = false;
+  window_frames = 0;
+  window_corrupt = 0;
+  poor_periods = 0;
+  poor_total_us = 0;
+  pthread_mutex_unlock(&quality_mutex);
+}
+
+void quality_connection_status(bool poor) {
+  pthread_mutex_lock(&quality_mutex);
+  connection_poor = poor;
+  quality_update();
+  pthread_mutex_unlock(&quality_mutex);
+}
+
+void quality_frame(bool corrupt) {
+  pthread_mutex_lock(&quality_mutex);
+  window_frames++;
+  if (corrupt)
+    window_corrupt++;
+
+  if (window_frames == QUALITY_WINDOW_FRAMES) {
+    frames_poor = window_corrupt * 100 >= QUALITY_POOR_PERCENT * window_frames;
+    window_frames = 0;
+    window_corrupt = 0;
+  }
+  quality_update();
+  pthread_mutex_unlock(&quality_mutex);
+}
+
+// Checked by renderers to pick between their normal behaviour and
+// the mitigations for a poor connection
+bool quality_degraded() {
+  return degraded;
+}
+
+// Number and total duration of the degraded periods since the last reset
+void quality_get_poor(uint32_t* periods, uint64_t* duration_ms) {
+  pthread_mutex_lock(&quality_mutex);
+  uint64_t total_us = poor_total_us;
+  if (degraded)
+    total_us += clock_now_us() - degraded_us;
+
+  *periods = poor_periods;
+  *duration_ms = total_us / 1000;
+  pthread_mutex_unlock(&quality_mutex);
+}
@@ -0,0 +1,33 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2015-2019 Iwan Timmer
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Share of corrupt frames in a window which degrades the quality
+#define QUALITY_WINDOW_FRAMES 120
+#define QUALITY_POOR_PERCENT 5
+// Time without any sign of a poor connection before restoring
+#define QUALITY_RECOVERY_MS 5000
+
+void quality_reset(void);
+void quality_connection_status(bool poor);
+void quality_frame(bool corrupt);
+bool quality_degraded(void);
+void quality_get_poor(uint32_t* periods, uint64_t* duration_ms);
@@ -0,0 +1,135 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2015-2019 Iwan Timmer
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "recorder.h"
+#include "stats.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+static struct recorder_header* header;
+static struct recorder_entry* rings[RECORDER_RINGS];
+static size_t mapped_size;
+
+int recorder_init(const char* path, int width, int height, int fps, int bitrate) {
+  uint32_t capacities[RECORDER_RINGS] = {
+    // Received, decoded and presented or rendered for every frame
+    [RECORDER_VIDEO] = RECORDER_SECONDS * fps * 4,
+    [RECORDER_AUDIO] = RECORDER_SECONDS * RECORDER_AUDIO_RATE,
+    [RECORDER_INPUT] = RECORDER_SECONDS * RECORDER_INPUT_RATE,
+    [RECORDER_EVENT] = RECORDER_EVENTS,
+  };
+
+  size_t page_size = sysconf(_SC_PAGESIZE);
+  size_t size = (sizeof(struct recorder_header) + page_size - 1) / page_size * page_size;
+  uint64_t offsets[RECORDER_RINGS];
+  for (int i = 0; i < RECORDER_RINGS; i++) {
+    offsets[i] = size;
+    size += capacities[i] * sizeof(struct recorder_entry);
+  }
+
+  // The recording of the previous session is often the one to look at, keep it next to the new one
+  char previous[PATH_MAX];
+  snprintf(previous, sizeof(previous), "%s.1", path);
+  if (rename(path, previous) < 0 && errno != ENOENT) {
+    fprintf(stderr, "Can't keep previous flight recorder file %s: %s\n", path, strerror(errno));
+    return -1;
+  }
+
+  int fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    fprintf(stderr, "Can't create flight recorder file: %s\n", path);
+    return -1;
+  }
+
+  // Allocate all blocks now, so recording never faults on a full disk
+  if (posix_fallocate(fd, 0, size) != 0 && ftruncate(fd, size) != 0) {
+    fprintf(stderr, "Can't resize flight recorder file: %s\n", path);
+    close(fd);
+    return -1;
+  }
+
+  void* data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    fprintf(stderr, "Can't map flight recorder file: %s\n", path);
+    return -1;
+  }
+
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+
+  struct recorder_header* init = data;
+  init->version = RECORDER_VERSION;
+  init->pid = getpid();
+  init->ringCount = RECORDER_RINGS;
+  init->startTimeUs = stats_time_us();
+  init->startRealtimeUs = (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+  init->width = width;
+  init->height = height;
+  init->fps = fps;
+  init->bitrate = bitrate;
+  for (int i = 0; i < RECORDER_RINGS; i++) {
+    init->rings[i].offset = offsets[i];
+    init->rings[i].capacity = capacities[i];
+    init->rings[i].head = 0;
+    rings[i] = (struct recorder_entry*) ((char*) data + offsets[i]);
+  }
+  // Readers check the magic last written
+  __atomic_store_n(&init->magic, RECORDER_MAGIC, __ATOMIC_RELEASE);
+
+  mapped_size = size;
+  header = init;
+  return 0;
+}
+
+void recorder_destroy() {
+  if (header == NULL)
+    return;
+
+  recorder_write(RECORDER_EVENT, RECORDER_SESSION_END, 0, 0, 0);
+  struct recorder_header* mapped = header;
+  header = NULL;
+  munmap(mapped, mapped_size);
+}
+
+void recorder_write(enum recorder_ring ring, enum recorder_type type, uint32_t a, uint32_t b, uint32_t c) {
+  struct recorder_header* mapped = header;
+  if (mapped == NULL)
+    return;
+
+  uint64_t index = __atomic_fetch_add(&mapped->rings[ring].head, 1, __ATOMIC_RELAXED);
+  struct recorder_entry* entry = &rings[ring][index % mapped->rings[ring].capacity];
+
+  // Invalidate the entry first, a crash halfway leaves it unreadable instead of mixed up
+  __atomic_store_n(&entry->sequence, 0, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  entry->timeUs = stats_time_us();
+  entry->type = type;
+  entry->a = a;
+  entry->b = b;
+  entry->c = c;
+  __atomic_store_n(&entry->sequence, index + 1, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,95 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2015-2019 Iwan Timmer
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Flight recorder keeping the last seconds of a session in a memory mapped
+// file, so timing data survives crashes and kills. Every ring is claimed
+// with an atomic increment and entries carry their sequence number, which
+// is written last, so a reader can skip entries torn by a crash. Recording
+// doesn't make any system calls. moonlight-recorderdump reads the file.
+
+#include <stdint.h>
+
+#define RECORDER_MAGIC 0x52464c4d
+#define RECORDER_VERSION 1
+#define RECORDER_SECONDS 30
+#define RECORDER_EVENTS 1024
+#define RECORDER_INPUT_RATE 1000
+#define RECORDER_AUDIO_RATE 200
+
+enum recorder_ring { RECORDER_VIDEO, RECORDER_AUDIO, RECORDER_INPUT, RECORDER_EVENT, RECORDER_RINGS };
+
+enum recorder_type {
+  // Video: a = decode or latency time in us, b = queue depth or missed vblanks
+  RECORDER_FRAME_RECEIVED = 1,
+  RECORDER_FRAME_DECODED,
+  RECORDER_FRAME_DROPPED,
+  RECORDER_FRAME_PRESENTED,
+  RECORDER_FRAME_RENDERED,
+  // Audio: a = output latency in us
+  RECORDER_AUDIO_LATENCY,
+  RECORDER_AUDIO_UNDERRUN,
+  // Input: a = source, b = event type, c = event code
+  RECORDER_INPUT_EVENT,
+  // Events: a and b depend on the event
+  RECORDER_CONNECTION_OKAY,
+  RECORDER_CONNECTION_POOR,
+  RECORDER_QUALITY_DEGRADED,
+  RECORDER_QUALITY_RESTORED,
+  RECORDER_IDR_REQUESTED,
+  RECORDER_RECOVERED,
+  RECORDER_STALL,
+  RECORDER_THERMAL,
+  RECORDER_SESSION_END,
+};
+
+enum recorder_input_source { RECORDER_INPUT_EVDEV, RECORDER_INPUT_SDL };
+
+struct recorder_entry {
+  uint64_t sequence;
+  uint64_t timeUs;
+  uint32_t type;
+  uint32_t a;
+  uint32_t b;
+  uint32_t c;
+};
+
+struct recorder_ring_header {
+  uint64_t offset;
+  uint64_t head;
+  uint32_t capacity;
+  uint32_t reserved;
+};
+
+struct recorder_header {
+  uint32_t magic;
+  uint32_t version;
+  int32_t pid;
+  uint32_t ringCount;
+  uint64_t startTimeUs;
+  uint64_t startRealtimeUs;
+  uint32_t width;
+  uint32_t height;
+  uint32_t fps;
+  uint32_t bitrate;
+  struct recorder_ring_header rings[RECORDER_RINGS];
+};
+
+int recorder_init(const char* path, int width, int height, int fps, int bitrate);
+void recorder_destroy(void);
+void recorder_write(enum recorder_ring ring, enum recorder_type type, uint32_t a, uint32_t b, uint32_t c);
@@ -0,0 +1,357 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2015-2019 Iwan Timmer
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Reads the file written with -recorder, also when the session crashed or
+// got killed halfway, and prints it as a timeline or as a Chrome trace
+// which can be opened with chrome://tracing or Perfetto.
+
+#include "recorder.h"
+
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Input events are summarized as rates over short intervals
+#define INPUT_INTERVAL_US 100000
+
+struct dump_entry {
+  int ring;
+  struct recorder_entry entry;
+};
+
+// Same order as the watchdog stages and thermal levels
+static const char* stage_names[] = { "submit", "decode", "present", "audio", "input" };
+static const char* thermal_names[] = { "normal", "warning", "throttled" };
+static const char* ring_names[RECORDER_RINGS] = { "video", "audio", "input", "events" };
+
+static const struct recorder_header* header;
+static bool chrome;
+static bool first_event = true;
+
+static uint64_t input_interval;
+static uint32_t input_counts[2];
+
+static const char* event_name(uint32_t type) {
+  switch (type) {
+  case RECORDER_FRAME_RECEIVED: return "received";
+  case RECORDER_FRAME_DECODED: return "decode";
+  case RECORDER_FRAME_DROPPED: return "dropped";
+  case RECORDER_FRAME_PRESENTED: return "present";
+  case RECORDER_FRAME_RENDERED: return "render";
+  case RECORDER_AUDIO_LATENCY: return "audio latency";
+  case RECORDER_AUDIO_UNDERRUN: return "underrun";
+  case RECORDER_CONNECTION_OKAY: return "connection okay";
+  case RECORDER_CONNECTION_POOR: return "connection poor";
+  case RECORDER_QUALITY_DEGRADED: return "quality degraded";
+  case RECORDER_QUALITY_RESTORED: return "quality restored";
+  case RECORDER_IDR_REQUESTED: return "IDR requested";
+  case RECORDER_RECOVERED: return "recovered";
+  case RECORDER_STALL: return "stall";
+  case RECORDER_THERMAL: return "thermal";
+  case RECORDER_SESSION_END: return "session end";
+  default: return "unknown";
+  }
+}
+
+static int compare_entries(const void* a, const void* b) {
+  const struct dump_entry* x = a;
+  const struct dump_entry* y = b;
+  if (x->entry.timeUs != y->entry.timeUs)
+    return x->entry.timeUs < y->entry.timeUs ? -1 : 1;
+  if (x->ring != y->ring)
+    return x->ring - y->ring;
+  return x->entry.sequence < y->entry.sequence ? -1 : x->entry.sequence > y->entry.sequence;
+}
+
+// Entries still being written or overwritten when the recording stopped
+// don't carry the sequence number of their slot and are left out
+static struct dump_entry* collect_entries(size_t* count, uint64_t* valid) {
+  size_t total = 0;
+  for (int i = 0; i < RECORDER_RINGS; i++)
+    total += header->rings[i].capacity;
+
+  struct dump_entry* entries = malloc(total * sizeof(struct dump_entry));
+  if (entries == NULL)
+    return NULL;
+
+  *count = 0;
+  for (int i = 0; i < RECORDER_RINGS; i++) {
+    const struct recorder_ring_header* ring = &header->rings[i];
+    const struct recorder_entry* data = (const struct recorder_entry*) ((const char*) header + ring->offset);
+    uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    uint64_t first = head > ring->capacity ? head - ring->capacity : 0;
+    valid[i] = 0;
+    for (uint64_t index = first; index < head; index++) {
+      const struct recorder_entry* entry = &data[index % ring->capacity];
+      if (__atomic_load_n(&entry->sequence, __ATOMIC_ACQUIRE) != index + 1)
+        continue;
+
+      entries[*count].ring = i;
+      entries[*count].entry = *entry;
+      // Skip entries overwritten while copying, the fence keeps the copy before the check
+      __atomic_thread_fence(__ATOMIC_ACQUIRE);
+      if (__atomic_load_n(&entry->sequence, __ATOMIC_RELAXED) != index + 1)
+        continue;
+
+      (*count)++;
+      valid[i]++;
+    }
+  }
+
+  qsort(entries, *count, sizeof(struct dump_entry), compare_entries);
+  return entries;
+}
+
+static void print_time(uint64_t time_us) {
+  uint64_t relative = time_us - header->startTimeUs;
+  uint64_t realtime = header->startRealtimeUs + relative;
+  time_t seconds = realtime / 1000000;
+  struct tm tm;
+  char wall[16];
+  localtime_r(&seconds, &tm);
+  strftime(wall, sizeof(wall), "%H:%M:%S", &tm);
+  printf("%s.%06llu %11.6f  ", wall, (unsigned long long) realtime % 1000000, relative / 1000000.0);
+}
+
+static void chrome_event(const char* format, ...) __attribute__((format(printf, 1, 2)));
+
+static void chrome_event(const char* format, ...) {
+  va_list args;
+  va_start(args, format);
+  printf(first_event ? "\n    " : ",\n    ");
+  vprintf(format, args);
+  va_end(args);
+  first_event = false;
+}
+
+static void flush_input(uint64_t next_interval) {
+  uint32_t count = input_counts[RECORDER_INPUT_EVDEV] + input_counts[RECORDER_INPUT_SDL];
+  if (count > 0) {
+    uint64_t time = header->startTimeUs + input_interval * INPUT_INTERVAL_US;
+    uint32_t rate = count * (1000000 / INPUT_INTERVAL_US);
+    if (chrome) {
+      chrome_event("{\"name\":\"input\",\"ph\":\"C\",\"pid\":%d,\"tid\":%d,\"ts\":%llu,\"args\":{\"events/s\":%u}}", header->pid, RECORDER_INPUT + 1, (unsigned long long) (time - header->startTimeUs), rate);
+      // Drop back to zero when the next events come later
+      if (next_interval > input_interval + 1)
+        chrome_event("{\"name\":\"input\",\"ph\":\"C\",\"pid\":%d,\"tid\":%d,\"ts\":%llu,\"args\":{\"events/s\":0}}", header->pid, RECORDER_INPUT + 1, (unsigned long long) (time - header->startTimeUs + INPUT_INTERVAL_US));
+    } else {
+      // Printed once the interval is over, to keep the timeline in order
+      print_time(time + INPUT_INTERVAL_US);
+      printf("input   %u events/s (evdev %u, sdl %u)\n", rate, input_counts[RECORDER_INPUT_EVDEV], input_counts[RECORDER_INPUT_SDL]);
+    }
+  }
+  input_counts[RECORDER_INPUT_EVDEV] = 0;
+  input_counts[RECORDER_INPUT_SDL] = 0;
+  input_interval = next_interval;
+}
+
+static void print_entry(const struct dump_entry* item) {
+  const struct recorder_entry* e = &item->entry;
+  print_time(e->timeUs);
+  printf("%-7s ", ring_names[item->ring]);
+  switch (e->type) {
+  case RECORDER_FRAME_DECODED:
+    printf("decoded in %.2f ms\n", e->a / 1000.0);
+    break;
+  case RECORDER_FRAME_PRESENTED:
+    printf("presented after %.2f ms%s", e->a / 1000.0, e->c ? ", flipped" : "");
+    if (e->b > 0)
+      printf(", %u vblanks missed", e->b);
+    printf("\n");
+    break;
+  case RECORDER_FRAME_RENDERED:
+    printf("rendered with %u frames queued", e->b);
+    if (e->a > 0)
+      printf(", waited %.2f ms on the fence", e->a / 1000.0);
+    printf("\n");
+    break;
+  case RECORDER_AUDIO_LATENCY:
+    printf("latency %.1f ms\n", e->a / 1000.0);
+    break;
+  case RECORDER_QUALITY_DEGRADED:
+    printf("quality degraded (%s)\n", e->a ? "poor connection" : "corrupt frames");
+    break;
+  case RECORDER_QUALITY_RESTORED:
+    printf("quality restored after %.1f s\n", e->a / 1000.0);
+    break;
+  case RECORDER_RECOVERED:
+    printf("recovered after %u ms\n", e->a);
+    break;
+  case RECORDER_STALL:
+    printf("%s stage stuck for %u ms\n", e->a < sizeof(stage_names) / sizeof(stage_names[0]) ? stage_names[e->a] : "unknown", e->b);
+    break;
+  case RECORDER_THERMAL:
+    printf("thermal %s\n", e->a < sizeof(thermal_names) / sizeof(thermal_names[0]) ? thermal_names[e->a] : "unknown");
+    break;
+  default:
+    printf("%s\n", event_name(e->type));
+  }
+}
+
+static void chrome_entry(const struct dump_entry* item) {
+  const struct recorder_entry* e = &item->entry;
+  unsigned long long ts = e->timeUs - header->startTimeUs;
+  int pid = header->pid;
+  int tid = item->ring + 1;
+  const char* name = event_name(e->type);
+  switch (e->type) {
+  case RECORDER_FRAME_DECODED:
+  case RECORDER_FRAME_PRESENTED:
+    // Durations end at the time of the entry
+    chrome_event("{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,\"ts\":%llu,\"dur\":%u,\"args\":{\"missed vblanks\":%u}}", name, pid, tid, e->a < ts ? ts - e->a : 0, e->a, e->b);
+    break;
+  case RECORDER_FRAME_RENDERED:
+    if (e->a > 0)
+      chrome_event("{\"name\":\"fence wait\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,\"ts\":%llu,\"dur\":%u}", pid, tid, e->a < ts ? ts - e->a : 0, e->a);
+    chrome_event("{\"name\":\"queue depth\",\"ph\":\"C\",\"pid\":%d,\"tid\":%d,\"ts\":%llu,\"args\":{\"frames\":%u}}", pid, tid, ts, e->b);
+    break;
+  case RECORDER_AUDIO_LATENCY:
+    chrome_event("{\"name\":\"%s\",\"ph\":\"C\",\"pid\":%d,\"tid\":%d,\"ts\":%llu,\"args\":{\"ms\":%.1f}}", name, pid, tid, ts, e->a / 1000.0);
+    break;
+  case RECORDER_RECOVERED:
+    chrome_event("{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,\"ts\":%llu,\"dur\":%llu}", name, pid, tid, (unsigned long long) e->a * 1000 < ts ? ts - (unsigned long long) e->a * 1000 : 0, (unsigned long long) e->a * 1000);
+    break;
+  case RECORDER_STALL:
+    chrome_event("{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"g\",\"pid\":%d,\"tid\":%d,\"ts\":%llu,\"args\":{\"stage\":\"%s\",\"ms\":%u}}", name, pid, tid, ts, e->a < sizeof(stage_names) / sizeof(stage_names[0]) ? stage_names[e->a] : "unknown", e->b);
+    break;
+  case RECORDER_THERMAL:
+    chrome_event("{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"g\",\"pid\":%d,\"tid\":%d,\"ts\":%llu,\"args\":{\"level\":\"%s\"}}", name, pid, tid, ts, e->a < sizeof(thermal_names) / sizeof(thermal_names[0]) ? thermal_names[e->a] : "unknown");
+    break;
+  default:
+    chrome_event("{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"%s\",\"pid\":%d,\"tid\":%d,\"ts\":%llu}", name, item->ring == RECORDER_EVENT ? "g" : "t", pid, tid, ts);
+  }
+}
+
+static void dump(const struct dump_entry* entries, size_t count, const uint64_t* valid) {
+  bool ended = count > 0 && entries[count - 1].entry.type == RECORDER_SESSION_END;
+
+  if (chrome) {
+    printf("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+    for (int i = 0; i < RECORDER_RINGS; i++)
+      chrome_event("{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"%s\"}}", header->pid, i + 1, ring_names[i]);
+  } else {
+    time_t seconds = header->startRealtimeUs / 1000000;
+    struct tm tm;
+    char start[32];
+    localtime_r(&seconds, &tm);
+    strftime(start, sizeof(start), "%Y-%m-%d %H:%M:%S", &tm);
+    printf("Flight recorder of process %d started at %s\n", header->pid, start);
+    printf("Stream %u x %u, %u fps, %u kbps\n", header->width, header->height, header->fps, header->bitrate);
+    printf("Entries: %llu video, %llu audio, %llu input, %llu events\n", (unsigned long long) valid[RECORDER_VIDEO], (unsigned long long) valid[RECORDER_AUDIO], (unsigned long long) valid[RECORDER_INPUT], (unsigned long long) valid[RECORDER_EVENT]);
+    if (count > 0)
+      printf("Covering %.3f seconds, %s\n\n", (entries[count - 1].entry.timeUs - entries[0].entry.timeUs) / 1000000.0, ended ? "session ended normally" : "session didn't end, it likely crashed or was killed");
+  }
+
+  for (size_t i = 0; i < count; i++) {
+    const struct recorder_entry* e = &entries[i].entry;
+    uint64_t interval = (e->timeUs - header->startTimeUs) / INPUT_INTERVAL_US;
+    if (interval != input_interval)
+      flush_input(interval);
+
+    if (entries[i].ring == RECORDER_INPUT) {
+      if (e->a <= RECORDER_INPUT_SDL)
+        input_counts[e->a]++;
+    } else if (chrome)
+      chrome_entry(&entries[i]);
+    else
+      print_entry(&entries[i]);
+  }
+  flush_input(input_interval + 2);
+
+  if (chrome)
+    printf("\n]}\n");
+}
+
+static void usage() {
+  printf("Usage: moonlight-recorderdump [-chrome] <file>\n\n");
+  printf("\t-chrome\t\t\tPrint a Chrome trace instead of a timeline\n");
+  exit(0);
+}
+
+int main(int argc, char* argv[]) {
+  char* path = NULL;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-chrome") == 0)
+      chrome = true;
+    else if (argv[i][0] == '-' || path != NULL)
+      usage();
+    else
+      path = argv[i];
+  }
+
+  if (path == NULL)
+    usage();
+
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) < 0) {
+    fprintf(stderr, "Can't open flight recorder file: %s\n", path);
+    exit(-1);
+  }
+
+  if (st.st_size < sizeof(struct recorder_header)) {
+    fprintf(stderr, "Not a flight recorder file: %s\n", path);
+    exit(-1);
+  }
+
+  void* data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    fprintf(stderr, "Can't map flight recorder file: %s\n", path);
+    exit(-1);
+  }
+
+  header = data;
+  if (__atomic_load_n(&header->magic, __ATOMIC_ACQUIRE) != RECORDER_MAGIC) {
+    fprintf(stderr, "Not a flight recorder file: %s\n", path);
+    exit(-1);
+  }
+  if (header->version != RECORDER_VERSION || header->ringCount != RECORDER_RINGS) {
+    fprintf(stderr, "Unsupported flight recorder version %u\n", header->version);
+    exit(-1);
+  }
+  for (int i = 0; i < RECORDER_RINGS; i++) {
+    if (header->rings[i].capacity == 0 || header->rings[i].offset + (uint64_t) header->rings[i].capacity * sizeof(struct recorder_entry) > st.st_size) {
+      fprintf(stderr, "Truncated flight recorder file: %s\n", path);
+      exit(-1);
+    }
+  }
+
+  size_t count;
+  uint64_t valid[RECORDER_RINGS];
+  struct dump_entry* entries = collect_entries(&count, valid);
+  if (entries == NULL) {
+    fprintf(stderr, "Not enough memory\n");
+    exit(-1);
+  }
+
+  dump(entries, count, valid);
+
+  free(entries);
+  munmap(data, st.st_size);
+  return 0;
+}
@@ -0,0 +1,341 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2015-2019 Iwan Timmer
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "replay.h"
+#include "connection.h"
+#include "stats.h"
+#include "clock.h"
+#include "watchdog.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define MAX_NALS_PER_FRAME 64
+
+// A replayed access unit, pointing into the mapped elementary stream
+struct replay_frame {
+  int nalCount;
+  int frameType;
+  int fullLength;
+  LENTRY entries[MAX_NALS_PER_FRAME];
+};
+
+static PREPLAY_CONFIGURATION replay_config;
+static PDECODER_RENDERER_CALLBACKS decoder;
+
+static unsigned char* stream_data;
+static size_t stream_size;
+static size_t stream_offset;
+
+static pthread_t replay_thread;
+static volatile bool replay_running;
+
+static bool is_hevc() {
+  return replay_config->videoFormat & VIDEO_FORMAT_MASK_H265;
+}
+
+// Find the next Annex B start code, returning its offset and length
+static size_t next_start_code(size_t offset, int* length) {
+  for (size_t i = offset; i + 3 <= stream_size; i++) {
+    if (stream_data[i] == 0 && stream_data[i + 1] == 0) {
+      if (stream_data[i + 2] == 1) {
+        *length = 3;
+        return i;
+      } else if (i + 4 <= stream_size && stream_data[i + 2] == 0 && stream_data[i + 3] == 1) {
+        *length = 4;
+        return i;
+      }
+    }
+  }
+  *length = 0;
+  return stream_size;
+}
+
+static int nal_buffer_type(unsigned char* nal) {
+  if (is_hevc()) {
+    switch ((nal[0] >> 1) & 0x3f) {
+    case 32:
+      return BUFFER_TYPE_VPS;
+    case 33:
+      return BUFFER_TYPE_SPS;
+    case 34:
+      return BUFFER_TYPE_PPS;
+    }
+  } else {
+    switch (nal[0] & 0x1f) {
+    case 7:
+      return BUFFER_TYPE_SPS;
+    case 8:
+      return BUFFER_TYPE_PPS;
+    }
+  }
+  return BUFFER_TYPE_PICDATA;
+}
+
+static bool nal_is_slice(unsigned char* nal) {
+  if (is_hevc())
+    return ((nal[0] >> 1) & 0x3f) < 32;
+  else
+    return (nal[0] & 0x1f) >= 1 && (nal[0] & 0x1f) <= 5;
+}
+
+static bool nal_is_idr(unsigned char* nal) {
+  if (is_hevc()) {
+    int type = (nal[0] >> 1) & 0x3f;
+    return type >= 16 && type <= 21;
+  } else
+    return (nal[0] & 0x1f) == 5;
+}
+
+// Slices continuing a picture have first_mb_in_slice (H.264) or
+// first_slice_segment_in_pic_flag (HEVC) unset, everything else
+// after the first slice starts a new access unit.
+static bool nal_starts_frame(unsigned char* nal, size_t length) {
+  if (nal_is_slice(nal)) {
+    if (is_hevc())
+      return length > 2 && (nal[2] & 0x80);
+    else
+      return length > 1 && (nal[1] & 0x80);
+  }
+  return true;
+}
+
+static bool read_frame(struct replay_frame* frame) {
+  bool has_slice = false;
+  int sc_length;
+
+  frame->nalCount = 0;
+  frame->frameType = FRAME_TYPE_PFRAME;
+  frame->fullLength = 0;
+
+  size_t start = next_start_code(stream_offset, &sc_length);
+  while (start < stream_size) {
+    unsigned char* nal = stream_data + start + sc_length;
+    int next_length;
+    size_t end = next_start_code(start + sc_length, &next_length);
+    size_t nal_length = end - start - sc_length;
+
+    if (nal_length == 0) {
+      start = end;
+      sc_length = next_length;
+      continue;
+    }
+
+    if (has_slice && nal_starts_frame(nal, nal_length))
+      break;
+
+    if (frame->nalCount >= MAX_NALS_PER_FRAME) {
+      fprintf(stderr, "Too many NAL units in frame\n");
+      break;
+    }
+
+    PLENTRY entry = &frame->entries[frame->nalCount];
+    entry->data = (char*) stream_data + start;
+    entry->length = end - start;
+    entry->bufferType = nal_buffer_type(nal);
+    entry->next = NULL;
+    if (frame->nalCount > 0)
+      frame->entries[frame->nalCount - 1].next = entry;
+
+    frame->nalCount++;
+    frame->fullLength += entry->length;
+    if (nal_is_idr(nal))
+      frame->frameType = FRAME_TYPE_IDR;
+    if (nal_is_slice(nal))
+      has_slice = true;
+
+    start = end;
+    sc_length = next_length;
+  }
+
+  stream_offset = start;
+  return has_slice;
+}
+
+// Start over at the beginning of the file until the session lasted long enough
+static bool next_frame(struct replay_frame* frame, uint64_t start_us) {
+  if (replay_config->duration > 0 && clock_now_us() - start_us >= replay_config->duration * 1000000ULL)
+    return false;
+
+  if (read_frame(frame))
+    return true;
+
+  if (replay_config->duration <= 0)
+    return false;
+
+  stream_offset = 0;
+  return read_frame(frame);
+}
+
+static void* replay_thread_run(void* data) {
+  struct replay_frame* frame = malloc(sizeof(struct replay_frame));
+  if (frame == NULL) {
+    fprintf(stderr, "Not enough memory\n");
+    return NULL;
+  }
+
+  uint64_t frame_interval_us = 1000000 / replay_config->fps;
+  // The clock of a drifting host produces frames slightly faster or slower than nominal
+  double arrival_interval_us = frame_interval_us / (1 + replay_config->drift / 1000000.0);
+  uint64_t start_us = clock_now_us();
+  bool waiting_for_idr = false;
+  int frame_number = 0;
+
+  while (replay_running && next_frame(frame, start_us)) {
+    // Simulate network delay variation on top of the frame pacing
+    uint64_t arrival_us = start_us + (uint64_t) (frame_number * arrival_interval_us);
+    if (replay_config->jitter > 0)
+      arrival_us += (random() % (replay_config->jitter * 1000 + 1));
+    frame_number++;
+
+    // The virtual clock jumps to the arrival, which is what makes replays faster than real time
+    if (clock_is_virtual())
+      clock_advance_us(arrival_us);
+    else {
+      uint64_t now = clock_now_us();
+      if (arrival_us > now)
+        usleep(arrival_us - now);
+    }
+
+    stats_frame_received();
+
+    if (replay_config->loss > 0 && random() % 100 < replay_config->loss) {
+      // A lost frame breaks the reference chain until the next IDR frame
+      stats_frame_dropped();
+      if (!waiting_for_idr)
+        stats_idr_requested();
+      waiting_for_idr = true;
+      continue;
+    }
+
+    if (waiting_for_idr) {
+      if (frame->frameType != FRAME_TYPE_IDR) {
+        stats_frame_dropped();
+        continue;
+      }
+      waiting_for_idr = false;
+    }
+
+    DECODE_UNIT decode_unit = {0};
+    decode_unit.frameNumber = frame_number;
+    decode_unit.frameType = frame->frameType;
+    decode_unit.fullLength = frame->fullLength;
+    decode_unit.bufferList = frame->entries;
+    decode_unit.receiveTimeMs = arrival_us / 1000;
+    decode_unit.enqueueTimeMs = clock_now_us() / 1000;
+    decode_unit.presentationTimeMs = (frame_number * frame_interval_us) / 1000;
+
+    uint64_t submit_us = stats_time_us();
+    watchdog_enter(WATCHDOG_SUBMIT);
+    int ret = decoder->submitDecodeUnit(&decode_unit);
+    watchdog_leave(WATCHDOG_SUBMIT);
+    stats_frame_decoded(stats_time_us() - submit_us);
+
+    if (ret == DR_NEED_IDR) {
+      stats_idr_requested();
+      waiting_for_idr = true;
+    }
+  }
+
+  free(frame);
+
+  if (replay_running)
+    connection_callbacks.connectionTerminated(ML_ERROR_GRACEFUL_TERMINATION);
+
+  return NULL;
+}
+
+int replay_init(PREPLAY_CONFIGURATION config, PDECODER_RENDERER_CALLBACKS callbacks) {
+  replay_config = config;
+  decoder = callbacks;
+
+  if (decoder == NULL) {
+    fprintf(stderr, "No video decoder available for replay\n");
+    return -1;
+  }
+
+  if (config->videoFormat & VIDEO_FORMAT_MASK_AV1) {
+    fprintf(stderr, "Replay only supports H.264 and HEVC elementary streams\n");
+    return -1;
+  }
+
+  int fd = open(config->filename, O_RDONLY);
+  if (fd < 0) {
+    fprintf(stderr, "Can't open replay file: %s\n", config->filename);
+    return -1;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) < 0 || st.st_size == 0) {
+    fprintf(stderr, "Can't read replay file: %s\n", config->filename);
+    close(fd);
+    return -1;
+  }
+
+  stream_size = st.st_size;
+  stream_data = mmap(NULL, stream_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (stream_data == MAP_FAILED) {
+    fprintf(stderr, "Can't map replay file: %s\n", config->filename);
+    return -1;
+  }
+  stream_offset = 0;
+
+  if (decoder->setup(config->videoFormat, config->width, config->height, config->fps, NULL, config->drFlags) != 0) {
+    fprintf(stderr, "Couldn't initialize video decoder\n");
+    munmap(stream_data, stream_size);
+    return -1;
+  }
+
+  return 0;
+}
+
+void replay_start() {
+  if (decoder->start)
+    decoder->start();
+
+  if (replay_config->virtualClock)
+    clock_virtual_start();
+
+  stats_reset();
+  replay_running = true;
+  pthread_create(&replay_thread, NULL, replay_thread_run, NULL);
+}
+
+void replay_stop() {
+  replay_running = false;
+  pthread_join(replay_thread, NULL);
+
+  if (decoder->stop)
+    decoder->stop();
+  if (decoder->cleanup)
+    decoder->cleanup();
+
+  munmap(stream_data, stream_size);
+  stats_print(stdout);
+
+  if (replay_config->virtualClock)
+    clock_virtual_stop();
+}
@@ -0,0 +1,40 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2015-2019 Iwan Timmer
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <Limelight.h>
+
+#include <stdbool.h>
+
+typedef struct _REPLAY_CONFIGURATION {
+  char* filename;
+  int videoFormat;
+  int width;
+  int height;
+  int fps;
+  int drFlags;
+  int loss;
+  int jitter;
+  int drift;
+  int duration;
+  bool virtualClock;
+} REPLAY_CONFIGURATION, *PREPLAY_CONFIGURATION;
+
+int replay_init(PREPLAY_CONFIGURATION config, PDECODER_RENDERER_CALLBACKS callbacks);
+void replay_start(void);
+void replay_stop(void);
@@ -21,8 +21,18 @@
 
 #include "sdl.h"
 #include "input/sdl.h"
+#include "video/ffmpeg.h"
+#include "video/video.h"
+#include "connection.h"
+#include "quality.h"
+#include "alloc.h"
+#include "thermal.h"
+#include "watchdog.h"
+#include "recorder.h"
+#include "util.h"
 
 #include <Limelight.h>
+#include <libavutil/pixdesc.h>
 
 static bool done;
 static int fullscreen_flags;
@@ -30,6 +40,11 @@ static int fullscreen_flags;
 static SDL_Window *window;
 static SDL_Renderer *renderer;
 static SDL_Texture *bmp;
+static Uint32 bmp_format;
+static int bmp_width, bmp_height;
+static int unsupported_format = AV_PIX_FMT_NONE;
+static void* planar_buffer;
+static size_t planar_buffer_size;
 
 SDL_mutex *mutex;
 
@@ -38,7 +53,7 @@ int sdlCurrentFrame, sdlNextFrame;
 void sdl_init(int width, int height, bool fullscreen) {
   sdlCurrentFrame = sdlNextFrame = 0;
 
-  if(SDL_Init(SDL_INIT_VIDEO | SDL_INIT_EVENTS)) {
+  if(SDL_Init(SDL_INIT_VIDEO | SDL_INIT_EVENTS | SDL_INIT_TIMER)) {
     fprintf(stderr, "Could not initialize SDL - %s\n", SDL_GetError());
     exit(1);
   }
@@ -56,12 +71,6 @@ void sdl_init(int width, int height, bool fullscreen) {
     exit(1);
   }
 
-  bmp = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_YV12, SDL_TEXTUREACCESS_STREAMING, width, height);
-  if (!bmp) {
-    fprintf(stderr, "SDL: could not create texture - exiting\n");
-    exit(1);
-  }
-
   mutex = SDL_CreateMutex();
   if (!mutex) {
     fprintf(stderr, "Couldn't create mutex\n");
@@ -69,50 +78,251 @@ void sdl_init(int width, int height, bool fullscreen) {
   }
 }
 
-void sdl_loop() {
-  SDL_Event event;
+// Texture format matching the decoder output, P010 and YUV420P10 are reduced to 8 bit
+static Uint32 sdl_texture_format(int format) {
+  switch (format) {
+  case AV_PIX_FMT_YUV420P:
+  case AV_PIX_FMT_YUVJ420P:
+  case AV_PIX_FMT_YUV420P10:
+    return SDL_PIXELFORMAT_YV12;
+  case AV_PIX_FMT_NV12:
+  case AV_PIX_FMT_P010:
+    return SDL_PIXELFORMAT_NV12;
+  case AV_PIX_FMT_NV21:
+    return SDL_PIXELFORMAT_NV21;
+  default:
+    return SDL_PIXELFORMAT_UNKNOWN;
+  }
+}
 
-  SDL_SetRelativeMouseMode(SDL_TRUE);
+// Copy both planes of a semi-planar frame into a locked NV12 texture,
+// keeping only the most significant byte of 16 bit samples
+static void sdl_copy_semiplanar(AVFrame* frame, Uint8* pixels, int pitch, bool high_depth) {
+  for (int plane = 0; plane < 2; plane++) {
+    int rows = plane == 0 ? frame->height : (frame->height + 1) / 2;
+    int width = plane == 0 ? frame->width : (frame->width + 1) / 2 * 2;
+    for (int y = 0; y < rows; y++) {
+      Uint8* src = frame->data[plane] + y * frame->linesize[plane];
+      if (high_depth) {
+        Uint16* src16 = (Uint16*) src;
+        for (int x = 0; x < width; x++)
+          pixels[x] = src16[x] >> 8;
+      } else
+        memcpy(pixels, src, width);
 
-  while(!done && SDL_WaitEvent(&event)) {
-    switch (sdlinput_handle_event(window, &event)) {
-    case SDL_QUIT_APPLICATION:
+      pixels += pitch;
+    }
+  }
+}
+
+// Reduce the 10 bit planes output by software HEVC Main10 decoding to 8 bit
+static int sdl_update_high_depth_planar(AVFrame* frame) {
+  int widths[3] = { frame->width, (frame->width + 1) / 2, (frame->width + 1) / 2 };
+  int heights[3] = { frame->height, (frame->height + 1) / 2, (frame->height + 1) / 2 };
+  ensure_buf_size(&planar_buffer, &planar_buffer_size, widths[0] * heights[0] + 2 * widths[1] * heights[1]);
+
+  Uint8* planes[3];
+  Uint8* pixels = planar_buffer;
+  for (int plane = 0; plane < 3; plane++) {
+    planes[plane] = pixels;
+    for (int y = 0; y < heights[plane]; y++) {
+      Uint16* src = (Uint16*) (frame->data[plane] + y * frame->linesize[plane]);
+      for (int x = 0; x < widths[plane]; x++)
+        pixels[x] = src[x] >> 2;
+
+      pixels += widths[plane];
+    }
+  }
+
+  return SDL_UpdateYUVTexture(bmp, NULL, planes[0], widths[0], planes[1], widths[1], planes[2], widths[2]);
+}
+
+static int sdl_update_texture(AVFrame* frame) {
+  Uint32 format = sdl_texture_format(frame->format);
+  if (format == SDL_PIXELFORMAT_UNKNOWN) {
+    if (unsupported_format != frame->format)
+      fprintf(stderr, "SDL: unsupported frame format %s\n", av_get_pix_fmt_name(frame->format));
+
+    unsupported_format = frame->format;
+    return -1;
+  }
+
+  // (Re)create the texture when the decoder output changes
+  if (!bmp || format != bmp_format || frame->width != bmp_width || frame->height != bmp_height) {
+    if (bmp)
+      SDL_DestroyTexture(bmp);
+
+    bmp = SDL_CreateTexture(renderer, format, SDL_TEXTUREACCESS_STREAMING, frame->width, frame->height);
+    if (!bmp) {
+      fprintf(stderr, "SDL: could not create texture - %s\n", SDL_GetError());
+      return -1;
+    }
+
+    bmp_format = format;
+    bmp_width = frame->width;
+    bmp_height = frame->height;
+    if (connection_debug)
+      printf("SDL: using %dx%d texture for %s frames\n", frame->width, frame->height, av_get_pix_fmt_name(frame->format));
+  }
+
+  void* pixels;
+  int pitch;
+  switch (frame->format) {
+  case AV_PIX_FMT_P010:
+    if (SDL_LockTexture(bmp, NULL, &pixels, &pitch) < 0)
+      return -1;
+
+    sdl_copy_semiplanar(frame, pixels, pitch, true);
+    SDL_UnlockTexture(bmp);
+    return 0;
+  case AV_PIX_FMT_NV12:
+  case AV_PIX_FMT_NV21:
+    #if SDL_VERSION_ATLEAST(2, 0, 16)
+    return SDL_UpdateNVTexture(bmp, NULL, frame->data[0], frame->linesize[0], frame->data[1], frame->linesize[1]);
+    #else
+    if (SDL_LockTexture(bmp, NULL, &pixels, &pitch) < 0)
+      return -1;
+
+    sdl_copy_semiplanar(frame, pixels, pitch, false);
+    SDL_UnlockTexture(bmp);
+    return 0;
+    #endif
+  case AV_PIX_FMT_YUV420P10:
+    return sdl_update_high_depth_planar(frame);
+  default:
+    return SDL_UpdateYUVTexture(bmp, NULL, frame->data[0], frame->linesize[0], frame->data[1], frame->linesize[1], frame->data[2], frame->linesize[2]);
+  }
+}
+
+static void sdl_handle_event(SDL_Event* event) {
+  // Keyboard, mouse, controller and touch events
+  if (event->type >= SDL_KEYDOWN && event->type < SDL_CLIPBOARDUPDATE)
+    recorder_write(RECORDER_INPUT, RECORDER_INPUT_EVENT, RECORDER_INPUT_SDL, event->type, 0);
+  watchdog_enter(WATCHDOG_INPUT);
+  int action = sdlinput_handle_event(window, event);
+  watchdog_leave(WATCHDOG_INPUT);
+  switch (action) {
+  case SDL_QUIT_APPLICATION:
+    done = true;
+    break;
+  case SDL_TOGGLE_FULLSCREEN:
+    fullscreen_flags ^= SDL_WINDOW_FULLSCREEN;
+    SDL_SetWindowFullscreen(window, fullscreen_flags);
+    break;
+  case SDL_MOUSE_GRAB:
+    SDL_ShowCursor(SDL_ENABLE);
+    SDL_SetRelativeMouseMode(SDL_TRUE);
+    break;
+  case SDL_MOUSE_UNGRAB:
+    SDL_SetRelativeMouseMode(SDL_FALSE);
+    SDL_ShowCursor(SDL_DISABLE);
+    break;
+  default:
+    if (event->type == SDL_QUIT)
       done = true;
-      break;
-    case SDL_TOGGLE_FULLSCREEN:
-      fullscreen_flags ^= SDL_WINDOW_FULLSCREEN;
-      SDL_SetWindowFullscreen(window, fullscreen_flags);
-      break;
-    case SDL_MOUSE_GRAB:
-      SDL_ShowCursor(SDL_ENABLE);
-      SDL_SetRelativeMouseMode(SDL_TRUE);
-      break;
-    case SDL_MOUSE_UNGRAB:
-      SDL_SetRelativeMouseMode(SDL_FALSE);
-      SDL_ShowCursor(SDL_DISABLE);
-      break;
-    default:
-      if (event.type == SDL_QUIT)
-        done = true;
-      else if (event.type == SDL_USEREVENT) {
-        if (event.user.code == SDL_CODE_FRAME) {
-          if (++sdlCurrentFrame <= sdlNextFrame - SDL_BUFFER_FRAMES) {
-            //Skip frame
-          } else if (SDL_LockMutex(mutex) == 0) {
-            Uint8** data = ((Uint8**) event.user.data1);
-            int* linesize = ((int*) event.user.data2);
-            SDL_UpdateYUVTexture(bmp, NULL, data[0], linesize[0], data[1], linesize[1], data[2], linesize[2]);
-            SDL_UnlockMutex(mutex);
+    else if (event->type == SDL_WINDOWEVENT) {
+      switch (event->window.event) {
+      case SDL_WINDOWEVENT_HIDDEN:
+      case SDL_WINDOWEVENT_MINIMIZED:
+        ffmpeg_set_visible(false);
+        break;
+      case SDL_WINDOWEVENT_SHOWN:
+      case SDL_WINDOWEVENT_RESTORED:
+      case SDL_WINDOWEVENT_EXPOSED:
+        ffmpeg_set_visible(true);
+        break;
+      }
+    } else if (event->type == SDL_USEREVENT) {
+      if (event->user.code == SDL_CODE_FRAME) {
+        // Presenting may wait for vsync, don't hold back gamepad state
+        sdlinput_flush();
+
+        // Only show the newest frame while the connection is poor
+        int buffered = SDL_BUFFER_FRAMES;
+        if (quality_degraded())
+          buffered = 1;
+        else if (video_buffered_frames > 0 && video_buffered_frames < SDL_BUFFER_FRAMES)
+          buffered = video_buffered_frames;
+        if (++sdlCurrentFrame <= sdlNextFrame - buffered) {
+          //Skip frame
+        } else if (SDL_LockMutex(mutex) == 0) {
+          alloc_enter(ALLOC_VIDEO);
+          watchdog_enter(WATCHDOG_PRESENT);
+          int err = sdl_update_texture((AVFrame*) event->user.data1);
+          SDL_UnlockMutex(mutex);
+          if (err == 0) {
             SDL_RenderClear(renderer);
             SDL_RenderCopy(renderer, bmp, NULL, NULL);
             SDL_RenderPresent(renderer);
-          } else
-            fprintf(stderr, "Couldn't lock mutex\n");
-        }
-      }
+          }
+          watchdog_leave(WATCHDOG_PRESENT);
+          alloc_leave();
+        } else
+          fprintf(stderr, "Couldn't lock mutex\n");
+      } else if (event->user.code == SDL_CODE_THERMAL)
+        thermal_sample();
+      else if (event->user.code == SDL_CODE_MOTION)
+        sdlinput_send_motion();
     }
   }
+}
+
+// Runs on the timer thread of SDL, sampling happens in the event loop
+static Uint32 sdl_thermal_timer(Uint32 interval, void* param) {
+  SDL_Event event = {0};
+  event.type = SDL_USEREVENT;
+  event.user.code = SDL_CODE_THERMAL;
+  SDL_PushEvent(&event);
+  return interval;
+}
+
+void sdl_loop() {
+  SDL_Event event;
+
+  done = false;
+  SDL_SetRelativeMouseMode(SDL_TRUE);
+  SDL_TimerID thermal_timer = SDL_AddTimer(THERMAL_INTERVAL_MS, sdl_thermal_timer, NULL);
+
+  while(!done && SDL_WaitEvent(&event)) {
+    // Drain the queue before sending gamepad state, so axis
+    // changes arriving together go out as a single packet
+    do {
+      sdl_handle_event(&event);
+    } while (!done && SDL_PollEvent(&event));
+    sdlinput_flush();
+  }
+
+  SDL_RemoveTimer(thermal_timer);
+  sdlinput_stop_motion();
+  if (connection_debug)
+    sdlinput_print_stats(stdout);
+
+  // The window stays open for the next session of the daemon
+  SDL_SetRelativeMouseMode(SDL_FALSE);
+  if (bmp)
+    SDL_DestroyTexture(bmp);
+  bmp = NULL;
+  free(planar_buffer);
+  planar_buffer = NULL;
+  planar_buffer_size = 0;
+}
+
+// Waits for events between sessions of the daemon, dropping frames left
+// behind by the last session. Returns false when the window got closed.
+bool sdl_idle(int timeout_ms) {
+  SDL_Event event;
+  sdlCurrentFrame = sdlNextFrame = 0;
+  if (!SDL_WaitEventTimeout(&event, timeout_ms))
+    return true;
+
+  do {
+    if (event.type == SDL_QUIT)
+      return false;
+  } while (SDL_PollEvent(&event));
+  return true;
+}
 
+void sdl_destroy() {
   SDL_DestroyWindow(window);
   SDL_Quit();
 }
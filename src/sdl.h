@@ -30,11 +30,15 @@
 #define SDL_TOGGLE_FULLSCREEN 4
 
 #define SDL_CODE_FRAME 0
+#define SDL_CODE_THERMAL 1
+#define SDL_CODE_MOTION 2
 
 #define SDL_BUFFER_FRAMES 2
 
 void sdl_init(int width, int height, bool fullscreen);
 void sdl_loop();
+bool sdl_idle(int timeout_ms);
+void sdl_destroy();
 
 extern SDL_mutex *mutex;
 extern int sdlCurrentFrame, sdlNextFrame;
@@ -0,0 +1,296 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2015-2019 Iwan Timmer
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "stats.h"
+#include "clock.h"
+#include "recorder.h"
+
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+
+static VIDEO_STATS video_stats;
+static AUDIO_STATS audio_stats;
+static pthread_mutex_t stats_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static bool video_hidden;
+static uint64_t visibility_time_us, visibility_cpu_us;
+
+// Real time, for measuring how long some work took
+uint64_t stats_time_us() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// Processor time consumed by all threads of the process
+uint64_t stats_cpu_time_us() {
+  struct timespec ts;
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+  return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// Add the wall and processor time since the last visibility change
+// to the totals of the current state. Must hold stats_mutex.
+static void stats_account_visibility() {
+  uint64_t now = stats_time_us();
+  uint64_t cpu = stats_cpu_time_us();
+  if (video_hidden) {
+    video_stats.hiddenTimeUs += now - visibility_time_us;
+    video_stats.hiddenCpuUs += cpu - visibility_cpu_us;
+  } else {
+    video_stats.visibleTimeUs += now - visibility_time_us;
+    video_stats.visibleCpuUs += cpu - visibility_cpu_us;
+  }
+  visibility_time_us = now;
+  visibility_cpu_us = cpu;
+}
+
+void stats_reset() {
+  pthread_mutex_lock(&stats_mutex);
+  memset(&video_stats, 0, sizeof(video_stats));
+  video_stats.minLatencyUs = UINT32_MAX;
+  video_stats.startTimeUs = clock_now_us();
+  video_hidden = false;
+  visibility_time_us = stats_time_us();
+  visibility_cpu_us = stats_cpu_time_us();
+  memset(&audio_stats, 0, sizeof(audio_stats));
+  audio_stats.minLatencyUs = UINT32_MAX;
+  pthread_mutex_unlock(&stats_mutex);
+}
+
+// Real time the session was asked for, to measure the time to the first frame
+void stats_request_time(uint64_t time_us) {
+  pthread_mutex_lock(&stats_mutex);
+  video_stats.requestTimeUs = time_us;
+  pthread_mutex_unlock(&stats_mutex);
+}
+
+void stats_frame_received() {
+  recorder_write(RECORDER_VIDEO, RECORDER_FRAME_RECEIVED, 0, 0, 0);
+  pthread_mutex_lock(&stats_mutex);
+  video_stats.receivedFrames++;
+  pthread_mutex_unlock(&stats_mutex);
+}
+
+void stats_frame_decoded(uint32_t latency_us) {
+  int bucket = latency_us / STATS_LATENCY_BUCKET_US;
+  if (bucket >= STATS_LATENCY_BUCKETS)
+    bucket = STATS_LATENCY_BUCKETS - 1;
+
+  recorder_write(RECORDER_VIDEO, RECORDER_FRAME_DECODED, latency_us, 0, 0);
+  pthread_mutex_lock(&stats_mutex);
+  if (video_stats.decodedFrames == 0)
+    video_stats.firstFrameTimeUs = stats_time_us();
+  video_stats.decodedFrames++;
+  video_stats.totalLatencyUs += latency_us;
+  if (latency_us < video_stats.minLatencyUs)
+    video_stats.minLatencyUs = latency_us;
+  if (latency_us > video_stats.maxLatencyUs)
+    video_stats.maxLatencyUs = latency_us;
+  video_stats.latencyHistogram[bucket]++;
+  pthread_mutex_unlock(&stats_mutex);
+}
+
+// Time spent in the decoder itself, reported by decoders that can
+// measure it apart from queueing and rendering
+void stats_decode_time(uint32_t decode_us) {
+  int bucket = decode_us / STATS_LATENCY_BUCKET_US;
+  if (bucket >= STATS_LATENCY_BUCKETS)
+    bucket = STATS_LATENCY_BUCKETS - 1;
+
+  pthread_mutex_lock(&stats_mutex);
+  video_stats.timedFrames++;
+  video_stats.decodeTimeHistogram[bucket]++;
+  pthread_mutex_unlock(&stats_mutex);
+}
+
+void stats_frame_dropped() {
+  recorder_write(RECORDER_VIDEO, RECORDER_FRAME_DROPPED, 0, 0, 0);
+  pthread_mutex_lock(&stats_mutex);
+  video_stats.droppedFrames++;
+  pthread_mutex_unlock(&stats_mutex);
+}
+
+void stats_idr_requested() {
+  recorder_write(RECORDER_EVENT, RECORDER_IDR_REQUESTED, 0, 0, 0);
+  pthread_mutex_lock(&stats_mutex);
+  video_stats.idrRequests++;
+  pthread_mutex_unlock(&stats_mutex);
+}
+
+void stats_frame_held() {
+  pthread_mutex_lock(&stats_mutex);
+  video_stats.heldFrames++;
+  pthread_mutex_unlock(&stats_mutex);
+}
+
+void stats_recovered(uint32_t duration_ms) {
+  recorder_write(RECORDER_EVENT, RECORDER_RECOVERED, duration_ms, 0, 0);
+  pthread_mutex_lock(&stats_mutex);
+  video_stats.recoveries++;
+  video_stats.totalRecoveryMs += duration_ms;
+  if (duration_ms > video_stats.maxRecoveryMs)
+    video_stats.maxRecoveryMs = duration_ms;
+  pthread_mutex_unlock(&stats_mutex);
+}
+
+void stats_frame_presented(uint32_t latency_us, uint32_t missed_vblanks, bool flipped) {
+  recorder_write(RECORDER_VIDEO, RECORDER_FRAME_PRESENTED, latency_us, missed_vblanks, flipped);
+  pthread_mutex_lock(&stats_mutex);
+  video_stats.presentedFrames++;
+  if (flipped)
+    video_stats.flippedFrames++;
+  video_stats.missedVblanks += missed_vblanks;
+  video_stats.totalPresentLatencyUs += latency_us;
+  if (latency_us > video_stats.maxPresentLatencyUs)
+    video_stats.maxPresentLatencyUs = latency_us;
+  pthread_mutex_unlock(&stats_mutex);
+}
+
+void stats_frame_rendered(uint32_t queue_depth, uint32_t fence_wait_us) {
+  recorder_write(RECORDER_VIDEO, RECORDER_FRAME_RENDERED, fence_wait_us, queue_depth, 0);
+  pthread_mutex_lock(&stats_mutex);
+  video_stats.renderedFrames++;
+  video_stats.totalQueueDepth += queue_depth;
+  if (queue_depth > video_stats.maxQueueDepth)
+    video_stats.maxQueueDepth = queue_depth;
+  if (fence_wait_us > 0) {
+    video_stats.fenceWaits++;
+    video_stats.totalFenceWaitUs += fence_wait_us;
+    if (fence_wait_us > video_stats.maxFenceWaitUs)
+      video_stats.maxFenceWaitUs = fence_wait_us;
+  }
+  pthread_mutex_unlock(&stats_mutex);
+}
+
+void stats_frames_replaced(uint32_t count) {
+  pthread_mutex_lock(&stats_mutex);
+  video_stats.replacedFrames += count;
+  pthread_mutex_unlock(&stats_mutex);
+}
+
+void stats_visibility(bool visible) {
+  pthread_mutex_lock(&stats_mutex);
+  stats_account_visibility();
+  if (!visible && !video_hidden)
+    video_stats.hiddenPeriods++;
+  video_hidden = !visible;
+  pthread_mutex_unlock(&stats_mutex);
+}
+
+void stats_audio_latency(uint32_t latency_us) {
+  recorder_write(RECORDER_AUDIO, RECORDER_AUDIO_LATENCY, latency_us, 0, 0);
+  pthread_mutex_lock(&stats_mutex);
+  audio_stats.latencySamples++;
+  audio_stats.totalLatencyUs += latency_us;
+  if (latency_us < audio_stats.minLatencyUs)
+    audio_stats.minLatencyUs = latency_us;
+  if (latency_us > audio_stats.maxLatencyUs)
+    audio_stats.maxLatencyUs = latency_us;
+  pthread_mutex_unlock(&stats_mutex);
+}
+
+void stats_audio_underrun() {
+  recorder_write(RECORDER_AUDIO, RECORDER_AUDIO_UNDERRUN, 0, 0, 0);
+  pthread_mutex_lock(&stats_mutex);
+  audio_stats.underruns++;
+  pthread_mutex_unlock(&stats_mutex);
+}
+
+void stats_get_video(PVIDEO_STATS stats) {
+  pthread_mutex_lock(&stats_mutex);
+  stats_account_visibility();
+  memcpy(stats, &video_stats, sizeof(VIDEO_STATS));
+  pthread_mutex_unlock(&stats_mutex);
+}
+
+void stats_get_audio(PAUDIO_STATS stats) {
+  pthread_mutex_lock(&stats_mutex);
+  memcpy(stats, &audio_stats, sizeof(AUDIO_STATS));
+  pthread_mutex_unlock(&stats_mutex);
+}
+
+// Upper bound of the histogram bucket containing the given percentile
+static uint32_t stats_percentile(uint32_t* histogram, uint32_t total, int percentile) {
+  uint32_t target = ((uint64_t) total * percentile + 99) / 100;
+  uint32_t count = 0;
+  for (int i = 0; i < STATS_LATENCY_BUCKETS; i++) {
+    count += histogram[i];
+    if (count >= target && count > 0)
+      return (i + 1) * STATS_LATENCY_BUCKET_US;
+  }
+  return 0;
+}
+
+uint32_t stats_latency_percentile(PVIDEO_STATS stats, int percentile) {
+  return stats_percentile(stats->latencyHistogram, stats->decodedFrames, percentile);
+}
+
+uint32_t stats_decode_time_percentile(PVIDEO_STATS stats, int percentile) {
+  return stats_percentile(stats->decodeTimeHistogram, stats->timedFrames, percentile);
+}
+
+void stats_print(FILE* out) {
+  VIDEO_STATS stats;
+  AUDIO_STATS audio;
+  stats_get_video(&stats);
+  stats_get_audio(&audio);
+
+  double seconds = (clock_now_us() - stats.startTimeUs) / 1000000.0;
+  fprintf(out, "Video statistics over %.1f seconds\n", seconds);
+  fprintf(out, "  Received frames: %u (%.2f fps)\n", stats.receivedFrames, seconds > 0 ? stats.receivedFrames / seconds : 0);
+  fprintf(out, "  Decoded frames: %u\n", stats.decodedFrames);
+  if (stats.requestTimeUs > 0 && stats.firstFrameTimeUs > 0)
+    fprintf(out, "  Time to first frame: %.1f ms\n", (stats.firstFrameTimeUs - stats.requestTimeUs) / 1000.0);
+  fprintf(out, "  Dropped frames: %u (%.2f%%)\n", stats.droppedFrames, stats.receivedFrames > 0 ? 100.0 * stats.droppedFrames / stats.receivedFrames : 0);
+  fprintf(out, "  IDR requests: %u\n", stats.idrRequests);
+  fprintf(out, "  Held frames: %u\n", stats.heldFrames);
+  if (stats.recoveries > 0)
+    fprintf(out, "  Recovery time: %u recoveries, avg %.1f ms, max %u ms\n", stats.recoveries, (double) stats.totalRecoveryMs / stats.recoveries, stats.maxRecoveryMs);
+  if (stats.decodedFrames > 0) {
+    fprintf(out, "  Decode latency: min %.2f ms, avg %.2f ms, max %.2f ms\n", stats.minLatencyUs / 1000.0, stats.totalLatencyUs / 1000.0 / stats.decodedFrames, stats.maxLatencyUs / 1000.0);
+    fprintf(out, "  Decode latency: p50 %.1f ms, p95 %.1f ms, p99 %.1f ms\n", stats_latency_percentile(&stats, 50) / 1000.0, stats_latency_percentile(&stats, 95) / 1000.0, stats_latency_percentile(&stats, 99) / 1000.0);
+  }
+  if (stats.timedFrames > 0)
+    fprintf(out, "  Decoder time: p50 %.1f ms, p95 %.1f ms, p99 %.1f ms\n", stats_decode_time_percentile(&stats, 50) / 1000.0, stats_decode_time_percentile(&stats, 95) / 1000.0, stats_decode_time_percentile(&stats, 99) / 1000.0);
+  if (stats.presentedFrames > 0) {
+    fprintf(out, "  Presented frames: %u (%u flipped), %u missed vblanks\n", stats.presentedFrames, stats.flippedFrames, stats.missedVblanks);
+    fprintf(out, "  Present latency: avg %.2f ms, max %.2f ms\n", stats.totalPresentLatencyUs / 1000.0 / stats.presentedFrames, stats.maxPresentLatencyUs / 1000.0);
+  }
+  if (stats.renderedFrames > 0) {
+    fprintf(out, "  Rendered frames: %u (%u replaced by a newer frame)\n", stats.renderedFrames, stats.replacedFrames);
+    fprintf(out, "  GPU queue depth: avg %.2f, max %u\n", (double) stats.totalQueueDepth / stats.renderedFrames, stats.maxQueueDepth);
+    if (stats.fenceWaits > 0)
+      fprintf(out, "  Fence waits: %u, avg %.2f ms, max %.2f ms\n", stats.fenceWaits, stats.totalFenceWaitUs / 1000.0 / stats.fenceWaits, stats.maxFenceWaitUs / 1000.0);
+  }
+  if (stats.hiddenPeriods > 0 && stats.hiddenTimeUs > 0 && stats.visibleTimeUs > 0) {
+    double hidden_load = (double) stats.hiddenCpuUs / stats.hiddenTimeUs;
+    double visible_load = (double) stats.visibleCpuUs / stats.visibleTimeUs;
+    double saved = (visible_load - hidden_load) * stats.hiddenTimeUs / 1000000.0;
+    fprintf(out, "  Hidden: %u times for %.1f seconds\n", stats.hiddenPeriods, stats.hiddenTimeUs / 1000000.0);
+    fprintf(out, "  CPU load: %.1f%% visible, %.1f%% hidden, %.1f CPU seconds saved\n", 100 * visible_load, 100 * hidden_load, saved > 0 ? saved : 0);
+  }
+  if (audio.latencySamples > 0 || audio.underruns > 0) {
+    fprintf(out, "Audio statistics\n");
+    fprintf(out, "  Underruns: %u\n", audio.underruns);
+    if (audio.latencySamples > 0)
+      fprintf(out, "  Device latency: min %.1f ms, avg %.1f ms, max %.1f ms\n", audio.minLatencyUs / 1000.0, audio.totalLatencyUs / 1000.0 / audio.latencySamples, audio.maxLatencyUs / 1000.0);
+  }
+}
@@ -0,0 +1,97 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2015-2019 Iwan Timmer
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Decode latency histogram resolution (100 us buckets up to 100 ms)
+#define STATS_LATENCY_BUCKET_US 100
+#define STATS_LATENCY_BUCKETS 1000
+
+typedef struct _VIDEO_STATS {
+  uint32_t receivedFrames;
+  uint32_t decodedFrames;
+  uint32_t droppedFrames;
+  uint32_t idrRequests;
+  uint32_t heldFrames;
+  uint32_t recoveries;
+  uint64_t totalRecoveryMs;
+  uint32_t maxRecoveryMs;
+  uint32_t presentedFrames;
+  uint32_t flippedFrames;
+  uint32_t missedVblanks;
+  uint64_t totalPresentLatencyUs;
+  uint32_t maxPresentLatencyUs;
+  uint32_t renderedFrames;
+  uint32_t replacedFrames;
+  uint64_t totalQueueDepth;
+  uint32_t maxQueueDepth;
+  uint32_t fenceWaits;
+  uint64_t totalFenceWaitUs;
+  uint32_t maxFenceWaitUs;
+  uint64_t totalLatencyUs;
+  uint32_t minLatencyUs;
+  uint32_t maxLatencyUs;
+  uint32_t latencyHistogram[STATS_LATENCY_BUCKETS];
+  uint32_t timedFrames;
+  uint32_t decodeTimeHistogram[STATS_LATENCY_BUCKETS];
+  uint32_t hiddenPeriods;
+  uint64_t hiddenTimeUs;
+  uint64_t hiddenCpuUs;
+  uint64_t visibleTimeUs;
+  uint64_t visibleCpuUs;
+  uint64_t startTimeUs;
+  uint64_t requestTimeUs;
+  uint64_t firstFrameTimeUs;
+} VIDEO_STATS, *PVIDEO_STATS;
+
+typedef struct _AUDIO_STATS {
+  uint32_t underruns;
+  uint32_t latencySamples;
+  uint64_t totalLatencyUs;
+  uint32_t minLatencyUs;
+  uint32_t maxLatencyUs;
+} AUDIO_STATS, *PAUDIO_STATS;
+
+uint64_t stats_time_us(void);
+uint64_t stats_cpu_time_us(void);
+
+void stats_reset(void);
+void stats_request_time(uint64_t time_us);
+void stats_frame_received(void);
+void stats_frame_decoded(uint32_t latency_us);
+void stats_decode_time(uint32_t decode_us);
+void stats_frame_dropped(void);
+void stats_idr_requested(void);
+void stats_frame_held(void);
+void stats_recovered(uint32_t duration_ms);
+void stats_frame_presented(uint32_t latency_us, uint32_t missed_vblanks, bool flipped);
+void stats_frame_rendered(uint32_t queue_depth, uint32_t fence_wait_us);
+void stats_frames_replaced(uint32_t count);
+void stats_visibility(bool visible);
+
+void stats_audio_latency(uint32_t latency_us);
+void stats_audio_underrun(void);
+
+void stats_get_video(PVIDEO_STATS stats);
+void stats_get_audio(PAUDIO_STATS stats);
+uint32_t stats_latency_percentile(PVIDEO_STATS stats, int percentile);
+uint32_t stats_decode_time_percentile(PVIDEO_STATS stats, int percentile);
+void stats_print(FILE* out);
@@ -0,0 +1,216 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2015-2019 Iwan Timmer
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "platform.h"
+#include "config.h"
+#include "status.h"
+#include "clock.h"
+
+#include <Limelight.h>
+
+#include <client.h>
+#include <errors.h>
+#include <mdns.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+
+typedef struct _HOST_STATUS {
+  char* address;
+  unsigned short port;
+  int ret;
+  uint32_t responseMs;
+  SERVER_DATA server;
+} HOST_STATUS, *PHOST_STATUS;
+
+static PHOST_STATUS hosts;
+static int host_count;
+
+static pthread_mutex_t status_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int next_host;
+
+static PGS_IDENTITY identity;
+static int status_timeout_ms;
+static int status_log_level;
+
+static void add_host(const char* address, unsigned short port) {
+  if (host_count >= STATUS_MAX_HOSTS) {
+    fprintf(stderr, "Ignoring %s, at most %d hosts can be queried\n", address, STATUS_MAX_HOSTS);
+    return;
+  }
+
+  PHOST_STATUS host = &hosts[host_count++];
+  memset(host, 0, sizeof(*host));
+  host->address = strdup(address);
+  host->port = port;
+}
+
+// One address per line, empty lines and lines starting with # are ignored
+static int load_hosts_file(const char* filename, unsigned short port) {
+  FILE* fd = fopen(filename, "r");
+  if (fd == NULL) {
+    fprintf(stderr, "Can't open host list: %s\n", filename);
+    return -1;
+  }
+
+  char line[256];
+  while (fgets(line, sizeof(line), fd) != NULL) {
+    char address[64];
+    if (sscanf(line, " %63s", address) == 1 && address[0] != '#')
+      add_host(address, port);
+  }
+
+  fclose(fd);
+  return 0;
+}
+
+static void* status_worker(void* arg) {
+  while (true) {
+    pthread_mutex_lock(&status_mutex);
+    int index = next_host++;
+    pthread_mutex_unlock(&status_mutex);
+    if (index >= host_count)
+      break;
+
+    PHOST_STATUS host = &hosts[index];
+    uint64_t start = clock_now_us();
+    // Unsupported versions are reported instead of refused
+    host->ret = gs_connect(&host->server, identity, host->address, host->port, status_log_level, true, status_timeout_ms);
+    host->responseMs = (clock_now_us() - start) / 1000;
+    if (host->ret != GS_OK && host->server.error[0] == 0)
+      snprintf(host->server.error, sizeof(host->server.error), "Can't connect to server");
+  }
+
+  return NULL;
+}
+
+static void print_json_string(const char* value) {
+  if (value == NULL) {
+    printf("null");
+    return;
+  }
+
+  putchar('"');
+  for (const unsigned char* c = (const unsigned char*) value; *c; c++) {
+    if (*c == '"' || *c == '\\')
+      printf("\\%c", *c);
+    else if (*c < 0x20)
+      printf("\\u%04x", *c);
+    else
+      putchar(*c);
+  }
+  putchar('"');
+}
+
+static void print_host(PHOST_STATUS host) {
+  PSERVER_DATA server = &host->server;
+  bool online = host->ret == GS_OK;
+
+  printf("  {\"address\": ");
+  print_json_string(host->address);
+  printf(", \"online\": %s, \"responseMs\": %u", online ? "true" : "false", host->responseMs);
+  if (!online) {
+    printf(", \"error\": ");
+    print_json_string(server->error);
+    printf("}");
+    return;
+  }
+
+  int codecs = server->serverInfo.serverCodecModeSupport;
+  bool supported = server->serverMajorVersion >= MIN_SUPPORTED_GFE_VERSION && server->serverMajorVersion <= MAX_SUPPORTED_GFE_VERSION;
+  printf(", \"paired\": %s, \"currentGame\": %d, \"gpu\": ", server->paired ? "true" : "false", server->currentGame);
+  print_json_string(server->gpuType);
+  printf(", \"appVersion\": ");
+  print_json_string(server->serverInfo.serverInfoAppVersion);
+  printf(", \"gfeVersion\": ");
+  print_json_string(server->serverInfo.serverInfoGfeVersion);
+  printf(", \"supported\": %s, \"codecs\": [\"h264\"%s%s], \"hdr\": %s}", supported ? "true" : "false",
+         codecs & SCM_HEVC ? ", \"hevc\"" : "", codecs & (SCM_AV1_MAIN8 | SCM_AV1_MAIN10) ? ", \"av1\"" : "",
+         codecs & (SCM_HEVC_MAIN10 | SCM_AV1_MAIN10) ? "true" : "false");
+}
+
+int status_print(PCONFIGURATION config) {
+  hosts = calloc(STATUS_MAX_HOSTS, sizeof(HOST_STATUS));
+  if (hosts == NULL) {
+    fprintf(stderr, "Not enough memory\n");
+    return -1;
+  }
+
+  if (config->address == NULL) {
+    MDNS_HOST found[MDNS_MAX_HOSTS];
+    int count = mdns_discover(MDNS_SERVICE, MDNS_GROUP, MDNS_PORT, config->status_timeout, found, MDNS_MAX_HOSTS, 0);
+    for (int i = 0; i < count; i++)
+      add_host(found[i].address, found[i].port ? found[i].port : config->port);
+  } else if (access(config->address, R_OK) == 0) {
+    if (load_hosts_file(config->address, config->port) < 0)
+      return -1;
+  } else
+    add_host(config->address, config->port);
+
+  char error[GS_ERROR_SIZE];
+  identity = gs_identity_load(config->key_dir, error);
+  if (identity == NULL) {
+    fprintf(stderr, "Can't load client identity: %s\n", error);
+    return -1;
+  }
+
+  status_timeout_ms = config->status_timeout;
+  status_log_level = config->debug_level;
+  next_host = 0;
+
+  int jobs = config->status_jobs < host_count ? config->status_jobs : host_count;
+  if (jobs < 1)
+    jobs = 1;
+
+  uint64_t start = clock_now_us();
+  pthread_t threads[jobs];
+  int started = 0;
+  for (; started < jobs; started++) {
+    if (pthread_create(&threads[started], NULL, status_worker, NULL) != 0)
+      break;
+  }
+
+  // Query on this thread too in case no worker could be started
+  if (started == 0)
+    status_worker(NULL);
+
+  for (int i = 0; i < started; i++)
+    pthread_join(threads[i], NULL);
+
+  printf("[\n");
+  for (int i = 0; i < host_count; i++) {
+    print_host(&hosts[i]);
+    printf(i + 1 < host_count ? ",\n" : "\n");
+    gs_destroy(&hosts[i].server);
+    free(hosts[i].address);
+  }
+  printf("]\n");
+
+  if (config->debug_level > 0)
+    fprintf(stderr, "Queried %d hosts with %d jobs in %llu ms\n", host_count, started, (unsigned long long) (clock_now_us() - start) / 1000);
+
+  gs_identity_free(identity);
+  free(hosts);
+  return 0;
+}
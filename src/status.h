@@ -0,0 +1,27 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2015-2019 Iwan Timmer
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+// The status action queries the server info of many hosts concurrently
+// and prints the result as JSON, for monitoring a fleet of hosts.
+
+#define STATUS_DEFAULT_JOBS 32
+#define STATUS_DEFAULT_TIMEOUT_MS 5000
+#define STATUS_MAX_HOSTS 4096
+
+int status_print(PCONFIGURATION config);
@@ -0,0 +1,405 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2015-2019 Iwan Timmer
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "thermal.h"
+#include "clock.h"
+#include "loop.h"
+#include "recorder.h"
+#include "stats.h"
+#include "util.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define THERMAL_MAX_ZONES 16
+#define THERMAL_MAX_POLICIES 8
+#define THERMAL_MAX_COUNTERS 32
+
+#define THERMAL_ZONE_PATH "/sys/class/thermal"
+#define THERMAL_CPUFREQ_PATH "/sys/devices/system/cpu/cpufreq"
+#define THERMAL_CPU_PATH "/sys/devices/system/cpu"
+// Raspberry Pi firmware throttling flags, the low bits are the current state
+#define THERMAL_RPI_THROTTLED_PATH "/sys/devices/platform/soc/soc:firmware/get_throttled"
+#define THERMAL_RPI_THROTTLED_NOW 0xf
+
+enum thermal_level { LEVEL_NORMAL, LEVEL_WARNING, LEVEL_THROTTLED };
+
+struct thermal_zone {
+  int fd;
+  char type[32];
+  int limit;
+};
+
+struct cpufreq_policy {
+  int cur_fd;
+  int max_fd;
+  int hw_max;
+  int initial_max;
+};
+
+static struct thermal_zone zones[THERMAL_MAX_ZONES];
+static int zone_count;
+static struct cpufreq_policy policies[THERMAL_MAX_POLICIES];
+static int policy_count;
+static int counter_fds[THERMAL_MAX_COUNTERS];
+static int counter_count;
+static int rpi_fd = -1;
+static bool sampling;
+
+static int thermal_policy;
+static int stream_bitrate;
+static enum thermal_level level;
+static volatile bool reduce_decode;
+
+static uint64_t last_counters;
+static uint64_t last_sample_us;
+static uint32_t last_dropped, last_received;
+
+static struct {
+  uint32_t samples;
+  int maxTemp;
+  int minFreqPercent;
+  uint32_t warnings;
+  uint32_t throttleOnsets;
+  uint64_t throttledUs;
+  uint32_t throttledFrames, throttledDrops;
+  uint32_t normalFrames, normalDrops;
+} thermal_stats;
+
+// Sysfs attributes are kept open and read again from the start on every sample
+static long long read_value(int fd, int base) {
+  char buffer[32];
+  ssize_t len = pread(fd, buffer, sizeof(buffer) - 1, 0);
+  if (len <= 0)
+    return -1;
+
+  buffer[len] = 0;
+  return strtoll(buffer, NULL, base);
+}
+
+static int open_attribute(const char* directory, const char* name) {
+  char path[512];
+  snprintf(path, sizeof(path), "%s/%s", directory, name);
+  return open(path, O_RDONLY | O_CLOEXEC);
+}
+
+static long long read_attribute(const char* directory, const char* name) {
+  int fd = open_attribute(directory, name);
+  if (fd < 0)
+    return -1;
+
+  long long value = read_value(fd, 10);
+  close(fd);
+  return value;
+}
+
+// Lowest passive trip point of the zone, where the kernel starts to slow down the processor
+static int zone_limit(const char* directory) {
+  int limit = THERMAL_DEFAULT_LIMIT_MC;
+  for (int i = 0; ; i++) {
+    char name[32], type[16] = {0};
+    snprintf(name, sizeof(name), "trip_point_%d_type", i);
+    int fd = open_attribute(directory, name);
+    if (fd < 0)
+      break;
+
+    ssize_t len = pread(fd, type, sizeof(type) - 1, 0);
+    close(fd);
+    if (len > 0 && strncmp(type, "passive", 7) == 0) {
+      snprintf(name, sizeof(name), "trip_point_%d_temp", i);
+      long long temp = read_attribute(directory, name);
+      if (temp > 0 && (limit == THERMAL_DEFAULT_LIMIT_MC || temp < limit))
+        limit = temp;
+    }
+  }
+  return limit;
+}
+
+static void discover_zones() {
+  DIR* dir = opendir(THERMAL_ZONE_PATH);
+  if (dir == NULL)
+    return;
+
+  struct dirent* entry;
+  while ((entry = readdir(dir)) != NULL && zone_count < THERMAL_MAX_ZONES) {
+    if (strncmp(entry->d_name, "thermal_zone", 12) != 0)
+      continue;
+
+    char directory[300];
+    snprintf(directory, sizeof(directory), "%s/%s", THERMAL_ZONE_PATH, entry->d_name);
+    struct thermal_zone* zone = &zones[zone_count];
+    zone->fd = open_attribute(directory, "temp");
+    if (zone->fd < 0 || read_value(zone->fd, 10) < 0) {
+      if (zone->fd >= 0)
+        close(zone->fd);
+      continue;
+    }
+
+    int fd = open_attribute(directory, "type");
+    ssize_t len = fd >= 0 ? pread(fd, zone->type, sizeof(zone->type) - 1, 0) : 0;
+    zone->type[len > 0 ? len : 0] = 0;
+    zone->type[strcspn(zone->type, "\n")] = 0;
+    if (fd >= 0)
+      close(fd);
+
+    zone->limit = zone_limit(directory);
+    zone_count++;
+  }
+  closedir(dir);
+}
+
+static void discover_cpufreq() {
+  DIR* dir = opendir(THERMAL_CPUFREQ_PATH);
+  if (dir == NULL)
+    return;
+
+  struct dirent* entry;
+  while ((entry = readdir(dir)) != NULL && policy_count < THERMAL_MAX_POLICIES) {
+    if (strncmp(entry->d_name, "policy", 6) != 0)
+      continue;
+
+    char directory[300];
+    snprintf(directory, sizeof(directory), "%s/%s", THERMAL_CPUFREQ_PATH, entry->d_name);
+    struct cpufreq_policy* policy = &policies[policy_count];
+    policy->hw_max = read_attribute(directory, "cpuinfo_max_freq");
+    policy->cur_fd = open_attribute(directory, "scaling_cur_freq");
+    policy->max_fd = open_attribute(directory, "scaling_max_freq");
+    if (policy->hw_max <= 0 || policy->cur_fd < 0 || policy->max_fd < 0) {
+      if (policy->cur_fd >= 0)
+        close(policy->cur_fd);
+      if (policy->max_fd >= 0)
+        close(policy->max_fd);
+      continue;
+    }
+
+    // A limit set by the user before streaming isn't throttling
+    policy->initial_max = read_value(policy->max_fd, 10);
+    policy_count++;
+  }
+  closedir(dir);
+}
+
+// Throttle event counters of x86 processors
+static void discover_counters() {
+  DIR* dir = opendir(THERMAL_CPU_PATH);
+  if (dir == NULL)
+    return;
+
+  struct dirent* entry;
+  while ((entry = readdir(dir)) != NULL && counter_count + 2 <= THERMAL_MAX_COUNTERS) {
+    if (strncmp(entry->d_name, "cpu", 3) != 0 || entry->d_name[3] < '0' || entry->d_name[3] > '9')
+      continue;
+
+    char directory[300];
+    snprintf(directory, sizeof(directory), "%s/%s/thermal_throttle", THERMAL_CPU_PATH, entry->d_name);
+    int fd = open_attribute(directory, "core_throttle_count");
+    if (fd >= 0)
+      counter_fds[counter_count++] = fd;
+    fd = open_attribute(directory, "package_throttle_count");
+    if (fd >= 0)
+      counter_fds[counter_count++] = fd;
+  }
+  closedir(dir);
+}
+
+void thermal_init(int policy, int bitrate) {
+  thermal_policy = policy;
+  stream_bitrate = bitrate;
+  level = LEVEL_NORMAL;
+  reduce_decode = false;
+
+  zone_count = policy_count = counter_count = 0;
+  discover_zones();
+  discover_cpufreq();
+  discover_counters();
+  rpi_fd = open(THERMAL_RPI_THROTTLED_PATH, O_RDONLY | O_CLOEXEC);
+
+  memset(&thermal_stats, 0, sizeof(thermal_stats));
+  thermal_stats.maxTemp = INT32_MIN;
+  thermal_stats.minFreqPercent = 100;
+  last_counters = 0;
+  for (int i = 0; i < counter_count; i++)
+    last_counters += read_value(counter_fds[i], 10);
+  last_sample_us = clock_now_us();
+  last_dropped = last_received = 0;
+}
+
+static void thermal_change(enum thermal_level next, const char* reason) {
+  char message[160];
+  recorder_write(RECORDER_EVENT, RECORDER_THERMAL, next, 0, 0);
+  if (next == LEVEL_THROTTLED)
+    thermal_stats.throttleOnsets++;
+  else if (next == LEVEL_WARNING && level == LEVEL_NORMAL)
+    thermal_stats.warnings++;
+
+  if (next > level) {
+    snprintf(message, sizeof(message), "Thermal: %s, %u of %u frames dropped so far", reason, thermal_stats.throttledDrops + thermal_stats.normalDrops, thermal_stats.throttledFrames + thermal_stats.normalFrames);
+    log_message(message);
+    if (thermal_policy == THERMAL_LOG && level == LEVEL_NORMAL) {
+      snprintf(message, sizeof(message), "Thermal: lowering the bitrate to %d kbps could avoid frame drops", stream_bitrate * 3 / 4);
+      log_message(message);
+    } else if (thermal_policy == THERMAL_REDUCE && !reduce_decode) {
+      reduce_decode = true;
+      log_message("Thermal: reducing decoding cost");
+    }
+  } else if (next == LEVEL_NORMAL) {
+    log_message("Thermal: back to normal temperature and clock speed");
+    if (reduce_decode) {
+      reduce_decode = false;
+      log_message("Thermal: restoring full decoding quality");
+    }
+  }
+  level = next;
+}
+
+void thermal_sample() {
+  int max_temp = INT32_MIN;
+  int min_margin = INT32_MAX;
+  const char* hottest = NULL;
+  for (int i = 0; i < zone_count; i++) {
+    long long temp = read_value(zones[i].fd, 10);
+    if (temp < 0)
+      continue;
+
+    if (temp > max_temp) {
+      max_temp = temp;
+      hottest = zones[i].type;
+    }
+    if (zones[i].limit - temp < min_margin)
+      min_margin = zones[i].limit - temp;
+  }
+
+  int freq_percent = 100;
+  bool capped = false;
+  for (int i = 0; i < policy_count; i++) {
+    long long cur = read_value(policies[i].cur_fd, 10);
+    long long max = read_value(policies[i].max_fd, 10);
+    if (cur > 0 && cur * 100 / policies[i].hw_max < freq_percent)
+      freq_percent = cur * 100 / policies[i].hw_max;
+    if (max > 0 && max < policies[i].initial_max)
+      capped = true;
+  }
+
+  uint64_t counters = 0;
+  for (int i = 0; i < counter_count; i++)
+    counters += read_value(counter_fds[i], 10);
+  bool counted = counters > last_counters;
+  last_counters = counters;
+
+  bool firmware = rpi_fd >= 0 && (read_value(rpi_fd, 16) & THERMAL_RPI_THROTTLED_NOW) > 0;
+
+  // Frame drops since the last sample are attributed to the state during that interval
+  VIDEO_STATS video;
+  stats_get_video(&video);
+  uint64_t now = clock_now_us();
+  uint32_t frames = video.receivedFrames - last_received;
+  uint32_t drops = video.droppedFrames - last_dropped;
+  if (level == LEVEL_THROTTLED) {
+    thermal_stats.throttledUs += now - last_sample_us;
+    thermal_stats.throttledFrames += frames;
+    thermal_stats.throttledDrops += drops;
+  } else {
+    thermal_stats.normalFrames += frames;
+    thermal_stats.normalDrops += drops;
+  }
+  last_received = video.receivedFrames;
+  last_dropped = video.droppedFrames;
+  last_sample_us = now;
+
+  thermal_stats.samples++;
+  if (max_temp > thermal_stats.maxTemp)
+    thermal_stats.maxTemp = max_temp;
+  if (freq_percent < thermal_stats.minFreqPercent)
+    thermal_stats.minFreqPercent = freq_percent;
+
+  char reason[96];
+  if (counted || capped || firmware) {
+    if (level != LEVEL_THROTTLED) {
+      snprintf(reason, sizeof(reason), "processor throttled (%s, clock at %d%%)", counted ? "throttle events" : capped ? "frequency capped" : "firmware", freq_percent);
+      thermal_change(LEVEL_THROTTLED, reason);
+    }
+  } else if (min_margin <= THERMAL_MARGIN_MC) {
+    if (level == LEVEL_NORMAL) {
+      snprintf(reason, sizeof(reason), "%s at %.1f C, close to throttling", hottest, max_temp / 1000.0);
+      thermal_change(LEVEL_WARNING, reason);
+    } else if (level == LEVEL_THROTTLED)
+      level = LEVEL_WARNING;
+  } else if (level != LEVEL_NORMAL && min_margin > 2 * THERMAL_MARGIN_MC)
+    thermal_change(LEVEL_NORMAL, NULL);
+}
+
+static int thermal_handle() {
+  thermal_sample();
+  return LOOP_OK;
+}
+
+void thermal_start_loop() {
+  loop_add_timeout(THERMAL_INTERVAL_MS * 1000, thermal_handle);
+  sampling = true;
+}
+
+void thermal_stop() {
+  if (sampling) {
+    loop_remove_timeout(thermal_handle);
+    sampling = false;
+  }
+
+  // The zones and policies are still counted for thermal_print, a late sample reads nothing from them
+  for (int i = 0; i < zone_count; i++) {
+    close(zones[i].fd);
+    zones[i].fd = -1;
+  }
+  for (int i = 0; i < policy_count; i++) {
+    close(policies[i].cur_fd);
+    close(policies[i].max_fd);
+    policies[i].cur_fd = policies[i].max_fd = -1;
+  }
+  for (int i = 0; i < counter_count; i++)
+    close(counter_fds[i]);
+  if (rpi_fd >= 0)
+    close(rpi_fd);
+
+  counter_count = 0;
+  rpi_fd = -1;
+  reduce_decode = false;
+}
+
+// Checked by decoders to trade some picture quality for less work
+bool thermal_reduce_decode() {
+  return reduce_decode;
+}
+
+void thermal_print(FILE* out) {
+  if (thermal_stats.samples == 0)
+    return;
+
+  fprintf(out, "Thermal statistics over %u samples\n", thermal_stats.samples);
+  if (zone_count > 0)
+    fprintf(out, "  Maximum temperature: %.1f C\n", thermal_stats.maxTemp / 1000.0);
+  if (policy_count > 0)
+    fprintf(out, "  Minimum processor clock: %d%% of maximum\n", thermal_stats.minFreqPercent);
+  fprintf(out, "  Throttling warnings: %u\n", thermal_stats.warnings);
+  fprintf(out, "  Throttling periods: %u (%.1f seconds)\n", thermal_stats.throttleOnsets, thermal_stats.throttledUs / 1000000.0);
+  fprintf(out, "  Dropped frames while throttled: %u of %u\n", thermal_stats.throttledDrops, thermal_stats.throttledFrames);
+  fprintf(out, "  Dropped frames otherwise: %u of %u\n", thermal_stats.normalDrops, thermal_stats.normalFrames);
+}
@@ -0,0 +1,38 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2015-2019 Iwan Timmer
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#define THERMAL_NONE 0
+#define THERMAL_LOG 1
+#define THERMAL_REDUCE 2
+
+#define THERMAL_INTERVAL_MS 2000
+// Distance to the lowest passive trip point at which throttling is expected soon
+#define THERMAL_MARGIN_MC 5000
+// Assumed throttling temperature of zones without a passive trip point
+#define THERMAL_DEFAULT_LIMIT_MC 85000
+
+void thermal_init(int policy, int bitrate);
+void thermal_start_loop(void);
+void thermal_stop(void);
+void thermal_sample(void);
+bool thermal_reduce_decode(void);
+void thermal_print(FILE* out);
@@ -0,0 +1,345 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2015-2019 Iwan Timmer
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Per host tuning of the stream parameters from the metrics of previous
+// sessions. Every parameter moves at most one step per session and
+// stays between a safe minimum and the configured value, so the
+// profile converges over a few sessions and never asks for more than
+// the user configured.
+
+#include "platform.h"
+#include "config.h"
+#include "tune.h"
+#include "quality.h"
+#include "stats.h"
+#include "clock.h"
+#include "cpu.h"
+
+#include "audio/audio.h"
+#include "video/video.h"
+
+#include <Limelight.h>
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Bounds and steps of the tuned parameters
+#define MIN_BITRATE_PERCENT 25
+#define BITRATE_DECREASE_PERCENT 15
+#define BITRATE_INCREASE_PERCENT 10
+#define MIN_PACKET_SIZE 1024
+#define PACKET_SIZE_STEP 128
+#define MAX_AUDIO_LATENCY 60
+#define AUDIO_LATENCY_STEP 5
+#define MAX_DECODER_THREADS 4
+#define MAX_BUFFERED_FRAMES 2
+
+// Thresholds on the smoothed metrics
+#define POOR_PERCENT_HIGH 2.0
+#define POOR_PERCENT_LOW 0.5
+#define DROP_PERCENT_HIGH 1.0
+#define DROP_PERCENT_LOW 0.2
+#define IDR_PER_MINUTE_HIGH 2.0
+#define UNDERRUNS_PER_MINUTE_HIGH 1.0
+#define UNDERRUNS_PER_MINUTE_LOW 0.1
+#define RTT_VARIANCE_HIGH_MS 10.0
+
+// Decode time and its variation relative to the frame interval
+#define DECODE_SLOW_PERCENT 50
+#define DECODE_FAST_PERCENT 15
+#define JITTER_HIGH_PERCENT 25
+#define JITTER_LOW_PERCENT 10
+
+typedef struct _TUNE_PROFILE {
+  int sessions;
+  int bitrate;
+  int packetSize;
+  int audioLatency;
+  int decoderThreads;
+  int bufferedFrames;
+  double decodeP50Ms;
+  double decodeP95Ms;
+  double decodeP99Ms;
+  double dropPercent;
+  double idrPerMinute;
+  double underrunsPerMinute;
+  double poorPercent;
+  double rttMs;
+  double rttVarianceMs;
+} TUNE_PROFILE, *PTUNE_PROFILE;
+
+struct tune_field {
+  const char* key;
+  bool integer;
+  size_t offset;
+};
+
+static const struct tune_field tune_fields[] = {
+  {"sessions", true, offsetof(TUNE_PROFILE, sessions)},
+  {"bitrate", true, offsetof(TUNE_PROFILE, bitrate)},
+  {"packetsize", true, offsetof(TUNE_PROFILE, packetSize)},
+  {"audiolatency", true, offsetof(TUNE_PROFILE, audioLatency)},
+  {"decoderthreads", true, offsetof(TUNE_PROFILE, decoderThreads)},
+  {"bufferedframes", true, offsetof(TUNE_PROFILE, bufferedFrames)},
+  {"decodep50", false, offsetof(TUNE_PROFILE, decodeP50Ms)},
+  {"decodep95", false, offsetof(TUNE_PROFILE, decodeP95Ms)},
+  {"decodep99", false, offsetof(TUNE_PROFILE, decodeP99Ms)},
+  {"droppercent", false, offsetof(TUNE_PROFILE, dropPercent)},
+  {"idrperminute", false, offsetof(TUNE_PROFILE, idrPerMinute)},
+  {"underrunsperminute", false, offsetof(TUNE_PROFILE, underrunsPerMinute)},
+  {"poorpercent", false, offsetof(TUNE_PROFILE, poorPercent)},
+  {"rtt", false, offsetof(TUNE_PROFILE, rttMs)},
+  {"rttvariance", false, offsetof(TUNE_PROFILE, rttVarianceMs)},
+  {NULL, false, 0},
+};
+
+static TUNE_PROFILE profile;
+
+// Values from the configuration, the upper bounds of the tuning
+static int configured_bitrate;
+static int configured_packet_size;
+static int configured_audio_latency;
+
+static void tune_path(PCONFIGURATION config, char* path, size_t length) {
+  char file[256];
+  snprintf(file, sizeof(file), TUNE_PROFILE_FILE, config->address);
+  snprintf(path, length, "%s/%s", config->key_dir, file);
+}
+
+static bool tune_load(char* path, PTUNE_PROFILE profile) {
+  FILE* fd = fopen(path, "r");
+  if (fd == NULL)
+    return false;
+
+  char key[64];
+  double value;
+  while (fscanf(fd, "%63s = %lf\n", key, &value) == 2) {
+    for (int i = 0; tune_fields[i].key != NULL; i++) {
+      if (strcmp(tune_fields[i].key, key) == 0) {
+        char* field = (char*) profile + tune_fields[i].offset;
+        if (tune_fields[i].integer)
+          *(int*) field = (int) value;
+        else
+          *(double*) field = value;
+      }
+    }
+  }
+  fclose(fd);
+
+  return profile->sessions > 0;
+}
+
+static void tune_save(char* path, PTUNE_PROFILE profile) {
+  FILE* fd = fopen(path, "w");
+  if (fd == NULL) {
+    fprintf(stderr, "Can't save tuning profile: %s\n", path);
+    return;
+  }
+
+  for (int i = 0; tune_fields[i].key != NULL; i++) {
+    char* field = (char*) profile + tune_fields[i].offset;
+    if (tune_fields[i].integer)
+      fprintf(fd, "%s = %d\n", tune_fields[i].key, *(int*) field);
+    else
+      fprintf(fd, "%s = %f\n", tune_fields[i].key, *(double*) field);
+  }
+  fclose(fd);
+}
+
+static int tune_clamp(int value, int min, int max) {
+  if (value < min)
+    return min;
+  if (value > max)
+    return max;
+  return value;
+}
+
+static void tune_adjust(bool debug, const char* name, int* value, int next, const char* unit, const char* reason) {
+  if (next == *value)
+    return;
+
+  if (debug)
+    printf("Autotune: %s %d -> %d%s, %s\n", name, *value, next, unit, reason);
+  *value = next;
+}
+
+static double tune_blend(double smoothed, double session) {
+  return smoothed * (1 - TUNE_SESSION_WEIGHT) + session * TUNE_SESSION_WEIGHT;
+}
+
+void tune_apply(PCONFIGURATION config) {
+  bool debug = config->debug_level > 0;
+  char path[4096];
+
+  configured_bitrate = config->stream.bitrate;
+  configured_packet_size = config->stream.packetSize;
+  configured_audio_latency = config->audio_latency;
+
+  memset(&profile, 0, sizeof(profile));
+  tune_path(config, path, sizeof(path));
+  if (!tune_load(path, &profile)) {
+    memset(&profile, 0, sizeof(profile));
+    if (debug)
+      printf("Autotune: no profile for %s yet, using the configured settings\n", config->address);
+    return;
+  }
+
+  // The configuration may have changed since the profile was written
+  config->stream.bitrate = tune_clamp(profile.bitrate, configured_bitrate * MIN_BITRATE_PERCENT / 100, configured_bitrate);
+  config->stream.packetSize = tune_clamp(profile.packetSize, MIN_PACKET_SIZE < configured_packet_size ? MIN_PACKET_SIZE : configured_packet_size, configured_packet_size);
+  if (configured_audio_latency > 0)
+    config->audio_latency = tune_clamp(profile.audioLatency, configured_audio_latency, MAX_AUDIO_LATENCY);
+  video_decoder_threads = tune_clamp(profile.decoderThreads, 1, cpu_worker_threads(MAX_DECODER_THREADS));
+  video_buffered_frames = tune_clamp(profile.bufferedFrames, 1, MAX_BUFFERED_FRAMES);
+
+  if (debug) {
+    printf("Autotune: profile of %s from %d sessions\n", config->address, profile.sessions);
+    printf("Autotune: %d kbps (configured %d), %d byte packets (configured %d), %d decoder threads, %d buffered frames", config->stream.bitrate, configured_bitrate, config->stream.packetSize, configured_packet_size, video_decoder_threads, video_buffered_frames);
+    if (configured_audio_latency > 0)
+      printf(", %d ms audio latency (configured %d)", config->audio_latency, configured_audio_latency);
+    printf("\n");
+  }
+}
+
+void tune_record(PCONFIGURATION config) {
+  bool debug = config->debug_level > 0;
+  VIDEO_STATS video;
+  AUDIO_STATS audio;
+  stats_get_video(&video);
+  stats_get_audio(&audio);
+
+  double seconds = (clock_now_us() - video.startTimeUs) / 1000000.0;
+  if (seconds < TUNE_MIN_SESSION_S || video.decodedFrames == 0) {
+    if (debug)
+      printf("Autotune: session too short to update the profile\n");
+    return;
+  }
+
+  uint32_t poor_periods;
+  uint64_t poor_ms;
+  quality_get_poor(&poor_periods, &poor_ms);
+
+  uint32_t rtt, rtt_variance;
+  bool has_rtt = LiGetEstimatedRttInfo(&rtt, &rtt_variance);
+
+  TUNE_PROFILE session = {0};
+  double minutes = seconds / 60;
+  uint32_t frames = video.receivedFrames + video.droppedFrames;
+  // Decoders timing themselves leave out the renderer, otherwise the
+  // whole submission of a decode unit is all there is
+  bool timed = video.timedFrames > 0;
+  session.decodeP50Ms = (timed ? stats_decode_time_percentile(&video, 50) : stats_latency_percentile(&video, 50)) / 1000.0;
+  session.decodeP95Ms = (timed ? stats_decode_time_percentile(&video, 95) : stats_latency_percentile(&video, 95)) / 1000.0;
+  session.decodeP99Ms = (timed ? stats_decode_time_percentile(&video, 99) : stats_latency_percentile(&video, 99)) / 1000.0;
+  session.dropPercent = frames > 0 ? video.droppedFrames * 100.0 / frames : 0;
+  session.idrPerMinute = video.idrRequests / minutes;
+  session.underrunsPerMinute = audio.underruns / minutes;
+  session.poorPercent = poor_ms / (seconds * 10);
+  session.rttMs = has_rtt ? rtt : profile.rttMs;
+  session.rttVarianceMs = has_rtt ? rtt_variance : profile.rttVarianceMs;
+
+  if (debug) {
+    printf("Autotune: decode %.1f/%.1f/%.1f ms (p50/p95/p99), %.2f%% frames dropped, %.1f IDR requests and %.1f audio underruns per minute\n", session.decodeP50Ms, session.decodeP95Ms, session.decodeP99Ms, session.dropPercent, session.idrPerMinute, session.underrunsPerMinute);
+    printf("Autotune: %u poor connection periods (%.1f%% of the session)", poor_periods, session.poorPercent);
+    if (has_rtt)
+      printf(", RTT %u ms (variance %u ms)", rtt, rtt_variance);
+    printf("\n");
+  }
+
+  if (profile.sessions == 0) {
+    profile = session;
+  } else {
+    profile.decodeP50Ms = tune_blend(profile.decodeP50Ms, session.decodeP50Ms);
+    profile.decodeP95Ms = tune_blend(profile.decodeP95Ms, session.decodeP95Ms);
+    profile.decodeP99Ms = tune_blend(profile.decodeP99Ms, session.decodeP99Ms);
+    profile.dropPercent = tune_blend(profile.dropPercent, session.dropPercent);
+    profile.idrPerMinute = tune_blend(profile.idrPerMinute, session.idrPerMinute);
+    profile.underrunsPerMinute = tune_blend(profile.underrunsPerMinute, session.underrunsPerMinute);
+    profile.poorPercent = tune_blend(profile.poorPercent, session.poorPercent);
+    profile.rttMs = tune_blend(profile.rttMs, session.rttMs);
+    profile.rttVarianceMs = tune_blend(profile.rttVarianceMs, session.rttVarianceMs);
+  }
+
+  // Start from the values used during this session
+  profile.sessions++;
+  profile.bitrate = config->stream.bitrate;
+  profile.packetSize = config->stream.packetSize;
+  profile.audioLatency = config->audio_latency;
+  profile.decoderThreads = video_decoder_threads > 0 ? video_decoder_threads : cpu_worker_threads(MAX_DECODER_THREADS);
+  profile.bufferedFrames = video_buffered_frames > 0 ? video_buffered_frames : MAX_BUFFERED_FRAMES;
+
+  char reason[160];
+  bool congested = profile.poorPercent > POOR_PERCENT_HIGH || profile.dropPercent > DROP_PERCENT_HIGH || profile.idrPerMinute > IDR_PER_MINUTE_HIGH;
+  bool clean = profile.poorPercent < POOR_PERCENT_LOW && profile.dropPercent < DROP_PERCENT_LOW;
+  if (congested) {
+    snprintf(reason, sizeof(reason), "connection poor %.1f%% of the time, %.2f%% frames dropped, %.1f IDR requests per minute", profile.poorPercent, profile.dropPercent, profile.idrPerMinute);
+    tune_adjust(debug, "bitrate", &profile.bitrate, tune_clamp(profile.bitrate * (100 - BITRATE_DECREASE_PERCENT) / 100, configured_bitrate * MIN_BITRATE_PERCENT / 100, configured_bitrate), " kbps", reason);
+  } else if (clean) {
+    snprintf(reason, sizeof(reason), "connection stable (poor %.1f%% of the time, %.2f%% frames dropped)", profile.poorPercent, profile.dropPercent);
+    tune_adjust(debug, "bitrate", &profile.bitrate, tune_clamp(profile.bitrate * (100 + BITRATE_INCREASE_PERCENT) / 100, 0, configured_bitrate), " kbps", reason);
+  }
+
+  // Loss without congestion points at fragmented or oversized packets
+  if (profile.dropPercent > DROP_PERCENT_HIGH && profile.poorPercent <= POOR_PERCENT_HIGH && profile.packetSize > MIN_PACKET_SIZE) {
+    snprintf(reason, sizeof(reason), "%.2f%% frames dropped without congestion", profile.dropPercent);
+    tune_adjust(debug, "packet size", &profile.packetSize, tune_clamp(profile.packetSize - PACKET_SIZE_STEP, MIN_PACKET_SIZE, configured_packet_size), " bytes", reason);
+  } else if (profile.dropPercent < DROP_PERCENT_LOW && profile.packetSize < configured_packet_size) {
+    snprintf(reason, sizeof(reason), "only %.2f%% frames dropped", profile.dropPercent);
+    tune_adjust(debug, "packet size", &profile.packetSize, tune_clamp(profile.packetSize + PACKET_SIZE_STEP, 0, configured_packet_size), " bytes", reason);
+  }
+
+  // Low latency audio gives up some latency to stop underruns
+  if (configured_audio_latency > 0) {
+    if (profile.underrunsPerMinute > UNDERRUNS_PER_MINUTE_HIGH || profile.rttVarianceMs > RTT_VARIANCE_HIGH_MS) {
+      snprintf(reason, sizeof(reason), "%.1f underruns per minute, RTT variance %.1f ms", profile.underrunsPerMinute, profile.rttVarianceMs);
+      tune_adjust(debug, "audio latency", &profile.audioLatency, tune_clamp(profile.audioLatency + AUDIO_LATENCY_STEP, configured_audio_latency, MAX_AUDIO_LATENCY), " ms", reason);
+    } else if (profile.underrunsPerMinute < UNDERRUNS_PER_MINUTE_LOW) {
+      snprintf(reason, sizeof(reason), "%.1f underruns per minute", profile.underrunsPerMinute);
+      tune_adjust(debug, "audio latency", &profile.audioLatency, tune_clamp(profile.audioLatency - AUDIO_LATENCY_STEP, configured_audio_latency, MAX_AUDIO_LATENCY), " ms", reason);
+    }
+  }
+
+  // Decoder threads only exist for decoders timing themselves, and never
+  // exceed the cores fast enough to run them
+  double frame_ms = 1000.0 / config->stream.fps;
+  int max_threads = cpu_worker_threads(MAX_DECODER_THREADS);
+  if (timed && profile.decodeP95Ms > frame_ms * DECODE_SLOW_PERCENT / 100) {
+    snprintf(reason, sizeof(reason), "p95 decode time %.1f ms of a %.1f ms frame", profile.decodeP95Ms, frame_ms);
+    tune_adjust(debug, "decoder threads", &profile.decoderThreads, tune_clamp(profile.decoderThreads + 1, 1, max_threads), "", reason);
+  } else if (timed && profile.decodeP95Ms < frame_ms * DECODE_FAST_PERCENT / 100) {
+    snprintf(reason, sizeof(reason), "p95 decode time only %.1f ms of a %.1f ms frame", profile.decodeP95Ms, frame_ms);
+    tune_adjust(debug, "decoder threads", &profile.decoderThreads, tune_clamp(profile.decoderThreads - 1, 1, max_threads), "", reason);
+  }
+
+  // Queue another frame for smooth pacing when decode times vary a lot
+  double jitter_ms = profile.decodeP99Ms - profile.decodeP50Ms;
+  if (jitter_ms > frame_ms * JITTER_HIGH_PERCENT / 100) {
+    snprintf(reason, sizeof(reason), "decode time varies %.1f ms between p50 and p99", jitter_ms);
+    tune_adjust(debug, "buffered frames", &profile.bufferedFrames, MAX_BUFFERED_FRAMES, "", reason);
+  } else if (jitter_ms < frame_ms * JITTER_LOW_PERCENT / 100) {
+    snprintf(reason, sizeof(reason), "decode time varies only %.1f ms between p50 and p99", jitter_ms);
+    tune_adjust(debug, "buffered frames", &profile.bufferedFrames, 1, "", reason);
+  }
+
+  char path[4096];
+  tune_path(config, path, sizeof(path));
+  tune_save(path, &profile);
+}
@@ -0,0 +1,28 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2015-2019 Iwan Timmer
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define TUNE_PROFILE_FILE "tune-%s.conf"
+
+// Sessions shorter than this say too little about the host
+#define TUNE_MIN_SESSION_S 30
+// Weight of the last session in the smoothed metrics
+#define TUNE_SESSION_WEIGHT 0.5
+
+void tune_apply(PCONFIGURATION config);
+void tune_record(PCONFIGURATION config);
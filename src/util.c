@@ -25,6 +25,7 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <time.h>
 
 int write_bool(char *path, bool val) {
   int fd = open(path, O_RDWR);
@@ -64,3 +65,14 @@ bool ensure_buf_size(void **buf, size_t *buf_size, size_t required_size) {
 
   return true;
 }
+
+// Print a message prefixed with the time of day, to relate it to what was seen on screen
+void log_message(const char* message) {
+  struct timespec ts;
+  struct tm tm;
+  char time[16];
+  clock_gettime(CLOCK_REALTIME, &ts);
+  localtime_r(&ts.tv_sec, &tm);
+  strftime(time, sizeof(time), "%H:%M:%S", &tm);
+  printf("[%s.%03ld] %s\n", time, ts.tv_nsec / 1000000, message);
+}
@@ -18,14 +18,19 @@
  */
 
 #include "egl.h"
+#include "video.h"
+
+#include "../stats.h"
 
 #include <Limelight.h>
 
+#include <EGL/eglext.h>
 #include <GLES2/gl2.h>
 
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <string.h>
 #include <pthread.h>
 #include <unistd.h>
 
@@ -80,6 +85,33 @@ static bool current;
 static GLuint texture_id[3], texture_uniform[3];
 static GLuint shader_program;
 
+// Fences of the frames submitted to the GPU, oldest first
+static PFNEGLCREATESYNCKHRPROC create_sync;
+static PFNEGLDESTROYSYNCKHRPROC destroy_sync;
+static PFNEGLCLIENTWAITSYNCKHRPROC client_wait_sync;
+static PFNEGLGETSYNCATTRIBKHRPROC get_sync_attrib;
+static EGLSyncKHR fences[EGL_MAX_FRAMES_IN_FLIGHT];
+static int fence_count;
+static uint32_t fence_wait_us;
+
+static void egl_make_current() {
+  if (current)
+    return;
+
+  eglMakeCurrent(display, surface, surface, context);
+  current = true;
+
+  // The swap interval applies to the surface bound to the current context
+  if (video_swap_interval >= 0 && eglSwapInterval(display, video_swap_interval) != EGL_TRUE)
+    fprintf(stderr, "EGL: couldn't set swap interval %d\n", video_swap_interval);
+}
+
+static void egl_retire_fence() {
+  destroy_sync(display, fences[0]);
+  fence_count--;
+  memmove(fences, fences + 1, fence_count * sizeof(EGLSyncKHR));
+}
+
 void egl_init(EGLNativeDisplayType native_display, NativeWindowType native_window, int display_width, int display_height) {
   width = display_width;
   height = display_height;
@@ -166,14 +198,49 @@ void egl_init(EGLNativeDisplayType native_display, NativeWindowType native_windo
     texture_uniform[i] = glGetUniformLocation(shader_program, texture_mappings[i]);
   }
 
+  const char* extensions = eglQueryString(display, EGL_EXTENSIONS);
+  if (extensions != NULL && strstr(extensions, "EGL_KHR_fence_sync") != NULL) {
+    create_sync = (PFNEGLCREATESYNCKHRPROC) eglGetProcAddress("eglCreateSyncKHR");
+    destroy_sync = (PFNEGLDESTROYSYNCKHRPROC) eglGetProcAddress("eglDestroySyncKHR");
+    client_wait_sync = (PFNEGLCLIENTWAITSYNCKHRPROC) eglGetProcAddress("eglClientWaitSyncKHR");
+    get_sync_attrib = (PFNEGLGETSYNCATTRIBKHRPROC) eglGetProcAddress("eglGetSyncAttribKHR");
+  }
+  if (create_sync == NULL || destroy_sync == NULL || client_wait_sync == NULL || get_sync_attrib == NULL) {
+    create_sync = NULL;
+    fprintf(stderr, "EGL: fence sync not supported, GPU queue depth is left to the driver\n");
+  }
+  fence_count = 0;
+
   eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
 }
 
-void egl_draw(uint8_t* image[3]) {
-  if (!current) {
-    eglMakeCurrent(display, surface, surface, context);
-    current = true;
+void egl_wait_queue() {
+  fence_wait_us = 0;
+  if (create_sync == NULL)
+    return;
+
+  egl_make_current();
+
+  // Drop the fences of frames the GPU already finished
+  EGLint status;
+  while (fence_count > 0 && get_sync_attrib(display, fences[0], EGL_SYNC_STATUS_KHR, &status) == EGL_TRUE && status == EGL_SIGNALED_KHR)
+    egl_retire_fence();
+
+  // Allow a single frame in flight when only one frame may be buffered
+  int max_frames = video_buffered_frames == 1 ? 1 : EGL_MAX_FRAMES_IN_FLIGHT;
+  if (fence_count < max_frames)
+    return;
+
+  uint64_t start = stats_time_us();
+  while (fence_count >= max_frames) {
+    client_wait_sync(display, fences[0], EGL_SYNC_FLUSH_COMMANDS_BIT_KHR, EGL_FENCE_TIMEOUT_NS);
+    egl_retire_fence();
   }
+  fence_wait_us = stats_time_us() - start;
+}
+
+void egl_draw(uint8_t* image[3]) {
+  egl_make_current();
 
   glUseProgram(shader_program);
   glEnableVertexAttribArray(0);
@@ -188,9 +255,19 @@ void egl_draw(uint8_t* image[3]) {
   glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
 
   eglSwapBuffers(display, surface);
+
+  if (create_sync != NULL && fence_count < EGL_MAX_FRAMES_IN_FLIGHT) {
+    EGLSyncKHR fence = create_sync(display, EGL_SYNC_FENCE_KHR, NULL);
+    if (fence != EGL_NO_SYNC_KHR)
+      fences[fence_count++] = fence;
+  }
+  stats_frame_rendered(fence_count, fence_wait_us);
+  fence_wait_us = 0;
 }
 
 void egl_destroy() {
+  while (fence_count > 0)
+    egl_retire_fence();
   eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
   eglDestroySurface(display, surface);
   eglDestroyContext(display, context);
@@ -19,6 +19,13 @@
 
 #include <EGL/egl.h>
 
+// Frames submitted to the GPU before drawing waits for the oldest
+#define EGL_MAX_FRAMES_IN_FLIGHT 2
+// Don't hang the renderer on a fence that never signals
+#define EGL_FENCE_TIMEOUT_NS 100000000ULL
+
 void egl_init(EGLNativeDisplayType native_display, NativeWindowType native_window, int display_width, int display_height);
+// Wait until the GPU has room for another frame
+void egl_wait_queue(void);
 void egl_draw(uint8_t* image[3]);
 void egl_destroy();
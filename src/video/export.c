@@ -0,0 +1,415 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2015-2019 Iwan Timmer
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+
+#include "export.h"
+
+#include "../connection.h"
+
+#include <libavutil/frame.h>
+#include <libavutil/imgutils.h>
+#include <libavutil/pixdesc.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+struct export_client {
+  int fd;
+  bool held[EXPORT_BUFFERS];
+};
+
+static pthread_mutex_t export_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t export_thread;
+static bool thread_started;
+static int listen_fd = -1;
+static int wake_fd[2] = {-1, -1};
+static char socket_path[sizeof(((struct sockaddr_un*) 0)->sun_path)];
+
+static struct export_client clients[EXPORT_MAX_CLIENTS];
+static int client_count;
+
+// Shared buffer ring, recreated with a new generation on format changes
+static int buffer_fds[EXPORT_BUFFERS];
+static unsigned char* buffer_maps[EXPORT_BUFFERS];
+static int buffer_refs[EXPORT_BUFFERS];
+static size_t buffer_size;
+static uint32_t generation;
+static int next_buffer;
+
+static uint32_t sequence;
+static uint64_t exported_frames, skipped_frames, dropped_messages;
+static bool unsupported_reported;
+
+static uint32_t export_format(enum AVPixelFormat format) {
+  switch (format) {
+  case AV_PIX_FMT_YUV420P:
+  case AV_PIX_FMT_YUVJ420P:
+    return EXPORT_FORMAT_YUV420;
+  case AV_PIX_FMT_YUV444P:
+  case AV_PIX_FMT_YUVJ444P:
+    return EXPORT_FORMAT_YUV444;
+  case AV_PIX_FMT_NV12:
+    return EXPORT_FORMAT_NV12;
+  case AV_PIX_FMT_P010LE:
+    return EXPORT_FORMAT_P010;
+  default:
+    return 0;
+  }
+}
+
+static void free_buffers() {
+  for (int i = 0; i < EXPORT_BUFFERS; i++) {
+    if (buffer_maps[i] != NULL)
+      munmap(buffer_maps[i], buffer_size);
+    if (buffer_fds[i] >= 0)
+      close(buffer_fds[i]);
+
+    buffer_maps[i] = NULL;
+    buffer_fds[i] = -1;
+    buffer_refs[i] = 0;
+  }
+  for (int i = 0; i < client_count; i++)
+    memset(clients[i].held, 0, sizeof(clients[i].held));
+
+  buffer_size = 0;
+}
+
+// Consumers keep their own mappings of the old buffers,
+// so they can be replaced without waiting for releases
+static int alloc_buffers(size_t size) {
+  free_buffers();
+  for (int i = 0; i < EXPORT_BUFFERS; i++) {
+    buffer_fds[i] = memfd_create("moonlight-frame", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (buffer_fds[i] < 0 || ftruncate(buffer_fds[i], size) < 0) {
+      perror("Couldn't create frame export buffer");
+      free_buffers();
+      return -1;
+    }
+
+    // Consumers can rely on the size of the mapping
+    fcntl(buffer_fds[i], F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL);
+
+    buffer_maps[i] = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, buffer_fds[i], 0);
+    if (buffer_maps[i] == MAP_FAILED) {
+      buffer_maps[i] = NULL;
+      perror("Couldn't map frame export buffer");
+      free_buffers();
+      return -1;
+    }
+  }
+
+  buffer_size = size;
+  generation++;
+  next_buffer = 0;
+  return 0;
+}
+
+static int send_buffers(int fd) {
+  struct export_buffers_msg msg = {
+    .type = EXPORT_MSG_BUFFERS,
+    .generation = generation,
+    .count = EXPORT_BUFFERS,
+    .size = buffer_size,
+  };
+  struct iovec iov = { .iov_base = &msg, .iov_len = sizeof(msg) };
+  char control[CMSG_SPACE(sizeof(buffer_fds))];
+  struct msghdr hdr = {
+    .msg_iov = &iov,
+    .msg_iovlen = 1,
+    .msg_control = control,
+    .msg_controllen = sizeof(control),
+  };
+
+  memset(control, 0, sizeof(control));
+  struct cmsghdr* cmsg = CMSG_FIRSTHDR(&hdr);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(buffer_fds));
+  memcpy(CMSG_DATA(cmsg), buffer_fds, sizeof(buffer_fds));
+
+  return sendmsg(fd, &hdr, MSG_DONTWAIT | MSG_NOSIGNAL) == sizeof(msg) ? 0 : -1;
+}
+
+static void remove_client(int index) {
+  for (int i = 0; i < EXPORT_BUFFERS; i++) {
+    if (clients[index].held[i])
+      buffer_refs[i]--;
+  }
+
+  close(clients[index].fd);
+  clients[index] = clients[--client_count];
+  if (connection_debug)
+    printf("Frame export consumer disconnected\n");
+}
+
+static void add_client(int fd) {
+  if (client_count == EXPORT_MAX_CLIENTS) {
+    fprintf(stderr, "Too many frame export consumers\n");
+    close(fd);
+    return;
+  }
+
+  if (buffer_size > 0 && send_buffers(fd) < 0) {
+    close(fd);
+    return;
+  }
+
+  memset(&clients[client_count], 0, sizeof(clients[client_count]));
+  clients[client_count++].fd = fd;
+  if (connection_debug)
+    printf("Frame export consumer connected\n");
+}
+
+static void handle_client(int index) {
+  struct export_release_msg msg;
+  ssize_t len;
+
+  while ((len = recv(clients[index].fd, &msg, sizeof(msg), MSG_DONTWAIT)) > 0) {
+    if (len != sizeof(msg) || msg.type != EXPORT_MSG_RELEASE)
+      continue;
+
+    // Releases of a previous ring arrive after it has been replaced
+    if (msg.generation == generation && msg.buffer < EXPORT_BUFFERS && clients[index].held[msg.buffer]) {
+      clients[index].held[msg.buffer] = false;
+      buffer_refs[msg.buffer]--;
+    }
+  }
+
+  if (len == 0 || (len < 0 && errno != EAGAIN && errno != EWOULDBLOCK))
+    remove_client(index);
+}
+
+static void* export_loop(void* arg) {
+  struct pollfd fds[EXPORT_MAX_CLIENTS + 2];
+
+  while (true) {
+    pthread_mutex_lock(&export_mutex);
+    int count = client_count;
+    for (int i = 0; i < count; i++) {
+      fds[i].fd = clients[i].fd;
+      fds[i].events = POLLIN;
+    }
+    pthread_mutex_unlock(&export_mutex);
+
+    fds[count].fd = listen_fd;
+    fds[count].events = POLLIN;
+    fds[count + 1].fd = wake_fd[0];
+    fds[count + 1].events = POLLIN;
+
+    if (poll(fds, count + 2, -1) < 0) {
+      if (errno == EINTR)
+        continue;
+
+      perror("Frame export poll");
+      break;
+    }
+
+    if (fds[count + 1].revents)
+      break;
+
+    pthread_mutex_lock(&export_mutex);
+    // Walk backwards as removing a client moves the last one in its place
+    for (int i = count - 1; i >= 0; i--) {
+      if (fds[i].revents)
+        handle_client(i);
+    }
+
+    if (fds[count].revents & POLLIN) {
+      int fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+      if (fd >= 0)
+        add_client(fd);
+    }
+    pthread_mutex_unlock(&export_mutex);
+  }
+
+  return NULL;
+}
+
+int export_init(const char* path) {
+  struct sockaddr_un addr = { .sun_family = AF_UNIX };
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "Frame export socket path too long: %s\n", path);
+    return -1;
+  }
+  strcpy(addr.sun_path, path);
+
+  for (int i = 0; i < EXPORT_BUFFERS; i++)
+    buffer_fds[i] = -1;
+
+  client_count = 0;
+  sequence = 0;
+  exported_frames = skipped_frames = dropped_messages = 0;
+  unsupported_reported = false;
+
+  listen_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+  if (listen_fd < 0) {
+    perror("Couldn't create frame export socket");
+    return -1;
+  }
+
+  // A socket left behind by a session which didn't exit cleanly is replaced
+  if (connect(listen_fd, (struct sockaddr*) &addr, sizeof(addr)) == 0) {
+    fprintf(stderr, "Frame export socket %s is already in use\n", path);
+    close(listen_fd);
+    listen_fd = -1;
+    return -1;
+  } else if (errno == ECONNREFUSED)
+    unlink(path);
+
+  if (bind(listen_fd, (struct sockaddr*) &addr, sizeof(addr)) < 0 || listen(listen_fd, EXPORT_MAX_CLIENTS) < 0) {
+    fprintf(stderr, "Couldn't listen on frame export socket %s: %s\n", path, strerror(errno));
+    close(listen_fd);
+    listen_fd = -1;
+    return -1;
+  }
+  strcpy(socket_path, path);
+
+  thread_started = pipe2(wake_fd, O_CLOEXEC) == 0 && pthread_create(&export_thread, NULL, export_loop, NULL) == 0;
+  if (!thread_started) {
+    fprintf(stderr, "Couldn't start frame export thread\n");
+    export_destroy();
+    return -1;
+  }
+
+  printf("Exporting decoded frames on %s\n", path);
+  return 0;
+}
+
+void export_destroy(void) {
+  if (listen_fd < 0)
+    return;
+
+  if (thread_started && write(wake_fd[1], "", 1) == 1)
+    pthread_join(export_thread, NULL);
+  thread_started = false;
+
+  if (wake_fd[0] >= 0) {
+    close(wake_fd[0]);
+    close(wake_fd[1]);
+    wake_fd[0] = wake_fd[1] = -1;
+  }
+
+  while (client_count > 0)
+    remove_client(client_count - 1);
+
+  close(listen_fd);
+  listen_fd = -1;
+  unlink(socket_path);
+  free_buffers();
+
+  if (connection_debug)
+    printf("Frame export: %llu exported, %llu skipped without free buffer, %llu messages dropped\n", (unsigned long long) exported_frames, (unsigned long long) skipped_frames, (unsigned long long) dropped_messages);
+}
+
+void export_frame(AVFrame* frame, uint64_t presentationTimeMs) {
+  if (listen_fd < 0 || frame == NULL)
+    return;
+
+  pthread_mutex_lock(&export_mutex);
+  // Don't spend a copy on frames nobody is watching
+  if (client_count == 0)
+    goto out;
+
+  uint32_t format = export_format(frame->format);
+  if (frame->hw_frames_ctx != NULL || format == 0) {
+    if (!unsupported_reported) {
+      const char* name = av_get_pix_fmt_name(frame->format);
+      fprintf(stderr, "Can't export frames in %s format\n", name != NULL ? name : "unknown");
+      unsupported_reported = true;
+    }
+    goto out;
+  }
+
+  int size = av_image_get_buffer_size(frame->format, frame->width, frame->height, 1);
+  if (size <= 0)
+    goto out;
+
+  if ((size_t) size != buffer_size) {
+    if (alloc_buffers(size) < 0)
+      goto out;
+
+    for (int i = client_count - 1; i >= 0; i--) {
+      if (send_buffers(clients[i].fd) < 0)
+        remove_client(i);
+    }
+  }
+
+  int index = -1;
+  for (int i = 0; i < EXPORT_BUFFERS; i++) {
+    int candidate = (next_buffer + i) % EXPORT_BUFFERS;
+    if (buffer_refs[candidate] == 0) {
+      index = candidate;
+      break;
+    }
+  }
+
+  if (index < 0) {
+    skipped_frames++;
+    goto out;
+  }
+
+  av_image_copy_to_buffer(buffer_maps[index], size, (const uint8_t* const*) frame->data, frame->linesize, frame->format, frame->width, frame->height, 1);
+
+  struct export_frame_msg msg = {
+    .type = EXPORT_MSG_FRAME,
+    .generation = generation,
+    .buffer = index,
+    .sequence = sequence++,
+    .format = format,
+    .width = frame->width,
+    .height = frame->height,
+    .presentationTimeMs = presentationTimeMs,
+  };
+
+  // Describe the tightly packed layout written by av_image_copy_to_buffer
+  int linesizes[4];
+  uint8_t* pointers[4];
+  av_image_fill_linesizes(linesizes, frame->format, frame->width);
+  av_image_fill_pointers(pointers, frame->format, frame->height, buffer_maps[index], linesizes);
+  for (int i = 0; i < EXPORT_MAX_PLANES && pointers[i] != NULL; i++) {
+    msg.offsets[i] = pointers[i] - buffer_maps[index];
+    msg.strides[i] = linesizes[i];
+    msg.planes++;
+  }
+
+  for (int i = 0; i < client_count; i++) {
+    if (send(clients[i].fd, &msg, sizeof(msg), MSG_DONTWAIT | MSG_NOSIGNAL) == sizeof(msg)) {
+      clients[i].held[index] = true;
+      buffer_refs[index]++;
+    } else
+      dropped_messages++;
+  }
+
+  next_buffer = (index + 1) % EXPORT_BUFFERS;
+  exported_frames++;
+
+out:
+  pthread_mutex_unlock(&export_mutex);
+}
@@ -0,0 +1,78 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2015-2019 Iwan Timmer
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Decoded frames can be shared with other processes (recorders, overlays,
+// vision pipelines) over a UNIX seqpacket socket. Frames are copied once
+// into a small ring of memfd backed buffers which are passed to every
+// consumer when it connects or the frame size changes. Each frame message
+// names the buffer it was written to, and the buffer is reused once all
+// consumers released it. When no buffer is free the frame is not exported,
+// so a slow consumer never stalls decoding.
+
+#include <stdint.h>
+
+#define EXPORT_BUFFERS 4
+#define EXPORT_MAX_CLIENTS 4
+#define EXPORT_MAX_PLANES 4
+
+#define EXPORT_FOURCC(a, b, c, d) ((uint32_t)(a) | ((uint32_t)(b) << 8) | ((uint32_t)(c) << 16) | ((uint32_t)(d) << 24))
+// Same codes as DRM_FORMAT_* from drm_fourcc.h
+#define EXPORT_FORMAT_YUV420 EXPORT_FOURCC('Y', 'U', '1', '2')
+#define EXPORT_FORMAT_YUV444 EXPORT_FOURCC('Y', 'U', '2', '4')
+#define EXPORT_FORMAT_NV12 EXPORT_FOURCC('N', 'V', '1', '2')
+#define EXPORT_FORMAT_P010 EXPORT_FOURCC('P', '0', '1', '0')
+
+enum export_message_type { EXPORT_MSG_BUFFERS = 1, EXPORT_MSG_FRAME, EXPORT_MSG_RELEASE };
+
+// Server to consumer, carries one file descriptor per buffer
+struct export_buffers_msg {
+  uint32_t type;
+  uint32_t generation;
+  uint32_t count;
+  uint32_t size;
+};
+
+// Server to consumer, the buffer must be released once read
+struct export_frame_msg {
+  uint32_t type;
+  uint32_t generation;
+  uint32_t buffer;
+  uint32_t sequence;
+  uint32_t format;
+  uint32_t width;
+  uint32_t height;
+  uint32_t planes;
+  uint32_t offsets[EXPORT_MAX_PLANES];
+  uint32_t strides[EXPORT_MAX_PLANES];
+  uint64_t presentationTimeMs;
+};
+
+// Consumer to server
+struct export_release_msg {
+  uint32_t type;
+  uint32_t generation;
+  uint32_t buffer;
+  uint32_t sequence;
+};
+
+struct AVFrame;
+
+int export_init(const char* path);
+void export_destroy(void);
+void export_frame(struct AVFrame* frame, uint64_t presentationTimeMs);
@@ -0,0 +1,229 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2015-2019 Iwan Timmer
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Reference consumer for frames exported with -export. It maps the shared
+// buffers, optionally records the raw frames to a file and releases every
+// buffer once done with it. A delay can be added to check the stream
+// keeps running smoothly with a consumer that can't keep up.
+
+#include "export.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+static volatile bool running = true;
+
+static int buffer_fds[EXPORT_BUFFERS];
+static unsigned char* buffer_maps[EXPORT_BUFFERS];
+static size_t buffer_size;
+static uint32_t generation;
+static bool mapped;
+
+static void consumer_stop(int sig) {
+  running = false;
+}
+
+static uint64_t consumer_time_us() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void unmap_buffers() {
+  for (int i = 0; i < EXPORT_BUFFERS && mapped; i++) {
+    munmap(buffer_maps[i], buffer_size);
+    close(buffer_fds[i]);
+  }
+  mapped = false;
+}
+
+static int map_buffers(struct export_buffers_msg* msg, struct msghdr* hdr) {
+  struct cmsghdr* cmsg = CMSG_FIRSTHDR(hdr);
+  if (msg->count != EXPORT_BUFFERS || cmsg == NULL || cmsg->cmsg_type != SCM_RIGHTS || cmsg->cmsg_len != CMSG_LEN(sizeof(buffer_fds))) {
+    fprintf(stderr, "Invalid buffer message\n");
+    return -1;
+  }
+
+  unmap_buffers();
+  memcpy(buffer_fds, CMSG_DATA(cmsg), sizeof(buffer_fds));
+  buffer_size = msg->size;
+  generation = msg->generation;
+
+  for (int i = 0; i < EXPORT_BUFFERS; i++) {
+    buffer_maps[i] = mmap(NULL, buffer_size, PROT_READ, MAP_SHARED, buffer_fds[i], 0);
+    if (buffer_maps[i] == MAP_FAILED) {
+      perror("Couldn't map frame buffer");
+      return -1;
+    }
+  }
+
+  mapped = true;
+  return 0;
+}
+
+static uint32_t checksum(const unsigned char* data, size_t size) {
+  uint32_t a = 1, b = 0;
+  for (size_t i = 0; i < size; i++) {
+    a = (a + data[i]) % 65521;
+    b = (b + a) % 65521;
+  }
+  return (b << 16) | a;
+}
+
+static void usage() {
+  printf("Usage: moonlight-exportconsumer [-frames <count>] [-output <file>] [-delay <ms>] [-verbose] <socket>\n\n");
+  printf("\t-frames <count>\t\tStop after <count> frames\n");
+  printf("\t-output <file>\t\tWrite the raw frames to <file>\n");
+  printf("\t-delay <ms>\t\tHold every frame for <ms> milliseconds before releasing it\n");
+  printf("\t-verbose\t\tPrint every frame with a checksum of its contents\n");
+  exit(0);
+}
+
+int main(int argc, char* argv[]) {
+  int frames = 0;
+  int delay = 0;
+  char* output = NULL;
+  char* path = NULL;
+  bool verbose = false;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-frames") == 0 && i + 1 < argc)
+      frames = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-output") == 0 && i + 1 < argc)
+      output = argv[++i];
+    else if (strcmp(argv[i], "-delay") == 0 && i + 1 < argc)
+      delay = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-verbose") == 0)
+      verbose = true;
+    else if (argv[i][0] == '-' || path != NULL)
+      usage();
+    else
+      path = argv[i];
+  }
+
+  if (path == NULL)
+    usage();
+
+  struct sockaddr_un addr = { .sun_family = AF_UNIX };
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "Socket path too long: %s\n", path);
+    exit(-1);
+  }
+  strcpy(addr.sun_path, path);
+
+  int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+  if (fd < 0 || connect(fd, (struct sockaddr*) &addr, sizeof(addr)) < 0) {
+    perror("Couldn't connect to frame export socket");
+    exit(-1);
+  }
+
+  FILE* file = NULL;
+  if (output != NULL && (file = fopen(output, "wb")) == NULL) {
+    perror("Couldn't open output file");
+    exit(-1);
+  }
+
+  struct sigaction sa = { .sa_handler = consumer_stop };
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+
+  uint64_t received = 0, missed = 0;
+  uint64_t first_us = 0, last_us = 0;
+  uint32_t last_sequence = 0;
+
+  while (running && (frames == 0 || received < frames)) {
+    union {
+      uint32_t type;
+      struct export_buffers_msg buffers;
+      struct export_frame_msg frame;
+    } msg;
+    char control[CMSG_SPACE(sizeof(buffer_fds))];
+    struct iovec iov = { .iov_base = &msg, .iov_len = sizeof(msg) };
+    struct msghdr hdr = {
+      .msg_iov = &iov,
+      .msg_iovlen = 1,
+      .msg_control = control,
+      .msg_controllen = sizeof(control),
+    };
+
+    ssize_t len = recvmsg(fd, &hdr, MSG_CMSG_CLOEXEC);
+    if (len <= 0)
+      break;
+
+    if (msg.type == EXPORT_MSG_BUFFERS && len == sizeof(msg.buffers)) {
+      if (map_buffers(&msg.buffers, &hdr) < 0)
+        exit(-1);
+      if (verbose)
+        printf("Mapped %d buffers of %zu bytes\n", EXPORT_BUFFERS, buffer_size);
+    } else if (msg.type == EXPORT_MSG_FRAME && len == sizeof(msg.frame)) {
+      struct export_frame_msg* frame = &msg.frame;
+      if (!mapped || frame->generation != generation || frame->buffer >= EXPORT_BUFFERS)
+        continue;
+
+      // Frames the server couldn't send to us still take a sequence number
+      if (received > 0 && frame->sequence != last_sequence + 1)
+        missed += frame->sequence - last_sequence - 1;
+      last_sequence = frame->sequence;
+
+      last_us = consumer_time_us();
+      if (received++ == 0)
+        first_us = last_us;
+
+      unsigned char* data = buffer_maps[frame->buffer];
+      if (verbose) {
+        printf("Frame %u: %ux%u %.4s, %u planes, pts %llu ms, checksum %08x\n", frame->sequence, frame->width, frame->height,
+               (char*) &frame->format, frame->planes, (unsigned long long) frame->presentationTimeMs, checksum(data, buffer_size));
+      }
+
+      if (file != NULL && fwrite(data, 1, buffer_size, file) != buffer_size) {
+        perror("Couldn't write frame");
+        break;
+      }
+
+      if (delay > 0)
+        usleep(delay * 1000);
+
+      struct export_release_msg release = {
+        .type = EXPORT_MSG_RELEASE,
+        .generation = frame->generation,
+        .buffer = frame->buffer,
+        .sequence = frame->sequence,
+      };
+      if (send(fd, &release, sizeof(release), MSG_NOSIGNAL) != sizeof(release))
+        break;
+    }
+  }
+
+  double seconds = (last_us - first_us) / 1000000.0;
+  printf("Received %llu frames (%.1f fps), %llu missed\n", (unsigned long long) received, seconds > 0 ? (received - 1) / seconds : 0, (unsigned long long) missed);
+
+  if (file != NULL)
+    fclose(file);
+  unmap_buffers();
+  close(fd);
+  return 0;
+}
@@ -18,6 +18,16 @@
  */
 
 #include "ffmpeg.h"
+#include "export.h"
+#include "video.h"
+
+#include "../connection.h"
+#include "../cpu.h"
+#include "../quality.h"
+#include "../stats.h"
+#include "../clock.h"
+#include "../thermal.h"
+#include "../watchdog.h"
 
 #ifdef HAVE_VAAPI
 #include "ffmpeg_vaapi.h"
@@ -42,6 +52,17 @@ static int current_frame, next_frame;
 
 enum decoders ffmpeg_decoder;
 
+// Error recovery state
+static bool last_frame_corrupt;
+static uint64_t send_time_us;
+static int error_frames;
+static int held_frames;
+static uint64_t error_start_ms;
+static uint64_t last_idr_request_ms;
+
+// Window visibility, updated from the renderer event loop
+static volatile bool hidden;
+
 #define BYTES_PER_PIXEL 4
 
 // This function must be called before
@@ -111,7 +132,7 @@ int ffmpeg_init(int videoFormat, int width, int height, int perf_lvl, int buffer
 
     if (perf_lvl & SLICE_THREADING) {
       decoder_ctx->thread_type = FF_THREAD_SLICE;
-      decoder_ctx->thread_count = thread_count;
+      decoder_ctx->thread_count = cpu_worker_threads(video_decoder_threads > 0 ? video_decoder_threads : thread_count);
     } else {
       decoder_ctx->thread_count = 1;
     }
@@ -135,6 +156,12 @@ int ffmpeg_init(int videoFormat, int width, int height, int perf_lvl, int buffer
 
   printf("Using FFmpeg decoder: %s\n", decoder->name);
 
+  last_frame_corrupt = false;
+  error_frames = 0;
+  held_frames = 0;
+  last_idr_request_ms = 0;
+  hidden = false;
+
   dec_frames_cnt = buffer_count;
   dec_frames = malloc(buffer_count * sizeof(AVFrame*));
   if (dec_frames == NULL) {
@@ -155,12 +182,16 @@ int ffmpeg_init(int videoFormat, int width, int height, int perf_lvl, int buffer
     vaapi_init(decoder_ctx);
   #endif
 
+  if (video_export_path != NULL && export_init(video_export_path) < 0)
+    return -1;
+
   return 0;
 }
 
 // This function must be called after
 // decoding is finished
 void ffmpeg_destroy(void) {
+  export_destroy();
   av_packet_free(&pkt);
   if (decoder_ctx) {
     avcodec_free_context(&decoder_ctx);
@@ -174,14 +205,28 @@ void ffmpeg_destroy(void) {
 }
 
 AVFrame* ffmpeg_get_frame(bool native_frame) {
+  uint64_t start = stats_time_us();
   int err = avcodec_receive_frame(decoder_ctx, dec_frames[next_frame]);
   if (err == 0) {
+    stats_decode_time(send_time_us + stats_time_us() - start);
+    AVFrame* frame = dec_frames[next_frame];
+    last_frame_corrupt = frame->decode_error_flags || (frame->flags & AV_FRAME_FLAG_CORRUPT);
+
+    // Keep showing the last good frame for a short while, hoping
+    // reference frame invalidation repairs the stream in time
+    if (last_frame_corrupt && held_frames < FFMPEG_MAX_HELD_FRAMES) {
+      held_frames++;
+      stats_frame_held();
+      return NULL;
+    }
+
     current_frame = next_frame;
     next_frame = (current_frame+1) % dec_frames_cnt;
 
     if (ffmpeg_decoder == SOFTWARE || native_frame)
       return dec_frames[current_frame];
   } else if (err != AVERROR(EAGAIN)) {
+    last_frame_corrupt = true;
     char errorstring[512];
     av_strerror(err, errorstring, sizeof(errorstring));
     fprintf(stderr, "Receive failed - %d/%s\n", err, errorstring);
@@ -196,8 +241,19 @@ int ffmpeg_decode(unsigned char* indata, int inlen) {
 
   pkt->data = indata;
   pkt->size = inlen;
+  last_frame_corrupt = false;
+
+  // While nothing is shown only reference frames need to be decoded,
+  // so the stream can be resumed without requesting an IDR frame
+  decoder_ctx->skip_frame = hidden ? AVDISCARD_NONREF : AVDISCARD_DEFAULT;
+  // Deblocking is a large share of the work of software decoding, skip it while overheating
+  decoder_ctx->skip_loop_filter = thermal_reduce_decode() ? AVDISCARD_ALL : AVDISCARD_DEFAULT;
 
+  uint64_t start = stats_time_us();
+  watchdog_enter(WATCHDOG_DECODE);
   err = avcodec_send_packet(decoder_ctx, pkt);
+  watchdog_leave(WATCHDOG_DECODE);
+  send_time_us = stats_time_us() - start;
   if (err < 0) {
     char errorstring[512];
     av_strerror(err, errorstring, sizeof(errorstring));
@@ -206,3 +262,54 @@ int ffmpeg_decode(unsigned char* indata, int inlen) {
 
   return err < 0 ? err : 0;
 }
+
+void ffmpeg_set_visible(bool visible) {
+  if (hidden != visible)
+    return;
+
+  hidden = !visible;
+  stats_visibility(visible);
+  if (connection_debug)
+    printf(visible ? "Window visible, resuming presentation\n" : "Window hidden, decoding reference frames only\n");
+}
+
+bool ffmpeg_visible(void) {
+  return !hidden;
+}
+
+// Decide how to recover after decoding the last decode unit. Errors
+// in IDR frames, or on streams without reference frame invalidation,
+// need a new IDR frame. Otherwise the host gets a few frames to repair
+// the stream using RFI before falling back to an IDR frame.
+int ffmpeg_recovery_status(int frame_type, int decode_err, bool rfi) {
+  uint64_t now = clock_now_us() / 1000;
+  quality_frame(decode_err != 0 || last_frame_corrupt);
+
+  if (decode_err == 0 && !last_frame_corrupt) {
+    if (error_frames > 0) {
+      uint32_t duration = now - error_start_ms;
+      stats_recovered(duration);
+      if (connection_debug)
+        printf("Recovered from decoding errors after %u ms (%d frames)\n", duration, error_frames);
+    }
+    error_frames = 0;
+    held_frames = 0;
+    return DR_OK;
+  }
+
+  if (error_frames++ == 0)
+    error_start_ms = now;
+
+  if (frame_type != FRAME_TYPE_IDR && rfi && error_frames <= FFMPEG_MAX_RFI_FRAMES)
+    return DR_OK;
+
+  // Don't flood the host while a requested IDR frame is underway
+  if (now - last_idr_request_ms < FFMPEG_IDR_REQUEST_INTERVAL_MS)
+    return DR_OK;
+
+  if (connection_debug)
+    printf("Requesting IDR frame after %d corrupt frames\n", error_frames);
+
+  last_idr_request_ms = now;
+  return DR_NEED_IDR;
+}
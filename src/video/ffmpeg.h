@@ -27,6 +27,13 @@
 #define VDPAU_ACCELERATION 0x40
 #define VAAPI_ACCELERATION 0x80
 
+// Number of corrupt frames to hide by holding the last good frame
+#define FFMPEG_MAX_HELD_FRAMES 3
+// Number of corrupt frames to wait for reference frame invalidation
+#define FFMPEG_MAX_RFI_FRAMES 6
+// Minimum interval between IDR frame requests
+#define FFMPEG_IDR_REQUEST_INTERVAL_MS 500
+
 enum decoders {SOFTWARE, VDPAU, VAAPI};
 extern enum decoders ffmpeg_decoder;
 
@@ -36,3 +43,8 @@ void ffmpeg_destroy(void);
 int ffmpeg_draw_frame(AVFrame *pict);
 AVFrame* ffmpeg_get_frame(bool native_frame);
 int ffmpeg_decode(unsigned char* indata, int inlen);
+int ffmpeg_recovery_status(int frame_type, int decode_err, bool rfi);
+
+// Stop presenting and skip non-reference frames while the window is hidden
+void ffmpeg_set_visible(bool visible);
+bool ffmpeg_visible(void);
@@ -68,7 +68,7 @@ int vaapi_init(AVCodecContext* decoder_ctx) {
   return 0;
 }
 
-void vaapi_queue(AVFrame* dec_frame, Window win, int width, int height) {
+void vaapi_queue(AVFrame* dec_frame, Drawable win, int width, int height) {
   VASurfaceID surface = (VASurfaceID)(uintptr_t)dec_frame->data[3];
   AVHWDeviceContext* device = (AVHWDeviceContext*) device_ref->data;
   AVVAAPIDeviceContext *va_ctx = device->hwctx;
@@ -22,4 +22,4 @@
 
 int vaapi_init_lib();
 int vaapi_init(AVCodecContext* decoder_ctx);
-void vaapi_queue(AVFrame* dec_frame, Window win, int width, int height);
+void vaapi_queue(AVFrame* dec_frame, Drawable win, int width, int height);
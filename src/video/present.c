@@ -0,0 +1,205 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2017 Iwan Timmer
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "present.h"
+
+#include "../input/x11.h"
+#include "../connection.h"
+#include "../stats.h"
+
+#include <X11/extensions/Xpresent.h>
+
+#include <math.h>
+#include <stdio.h>
+#include <stdint.h>
+
+#define PRESENT_PIXMAPS 3
+#define PRESENT_QUEUE_SIZE 8
+// Frames a bit longer than a whole number of vblanks, because of clock differences, don't add a vblank
+#define PRESENT_VBLANK_TOLERANCE 0.05
+
+static Display* display;
+static Window window;
+static int present_opcode;
+static XID event_context;
+
+static Pixmap pixmaps[PRESENT_PIXMAPS];
+static bool pixmap_idle[PRESENT_PIXMAPS];
+
+// Queue times of presents waiting for completion, in submission order
+static uint64_t queue_times[PRESENT_QUEUE_SIZE];
+static int queue_head, queue_count;
+
+static uint32_t serial;
+static uint64_t last_msc, last_ust;
+static double frame_us, vblank_us;
+static bool pixmap_in_flight;
+
+PresentCompleteHandler present_complete_handler = NULL;
+
+static void queue_present() {
+  if (queue_count == PRESENT_QUEUE_SIZE) {
+    // Completions were lost, restart the bookkeeping
+    queue_count = 0;
+  }
+  queue_times[(queue_head + queue_count) % PRESENT_QUEUE_SIZE] = stats_time_us();
+  queue_count++;
+}
+
+// Content at a lower rate than the display shows every frame for several vblanks,
+// only vblanks beyond those are missed. The vblank period is measured from the
+// timestamps of the completions.
+static uint32_t missed_vblanks(XPresentCompleteNotifyEvent* event) {
+  if (last_msc == 0 || event->msc <= last_msc || event->ust <= last_ust)
+    return 0;
+
+  uint64_t vblanks = event->msc - last_msc;
+  double interval = (double) (event->ust - last_ust) / vblanks;
+  vblank_us = vblank_us > 0 ? vblank_us * 0.9 + interval * 0.1 : interval;
+
+  uint64_t expected = frame_us > vblank_us ? (uint64_t) ceil(frame_us / vblank_us - PRESENT_VBLANK_TOLERANCE) : 1;
+  return vblanks > expected ? vblanks - expected : 0;
+}
+
+static void handle_complete(XPresentCompleteNotifyEvent* event) {
+  if (event->kind != PresentCompleteKindPixmap)
+    return;
+
+  if (queue_count > 0) {
+    uint64_t queued = queue_times[queue_head];
+    queue_head = (queue_head + 1) % PRESENT_QUEUE_SIZE;
+    queue_count--;
+
+    uint32_t latency = event->ust > queued ? event->ust - queued : 0;
+    stats_frame_presented(latency, missed_vblanks(event), event->mode == PresentCompleteModeFlip);
+  }
+  last_msc = event->msc;
+  last_ust = event->ust;
+
+  if (pixmap_in_flight) {
+    pixmap_in_flight = false;
+    if (present_complete_handler)
+      present_complete_handler();
+  }
+}
+
+static void handle_idle(XPresentIdleNotifyEvent* event) {
+  for (int i = 0; i < PRESENT_PIXMAPS; i++) {
+    if (pixmaps[i] == event->pixmap)
+      pixmap_idle[i] = true;
+  }
+}
+
+static void present_event(XEvent* event) {
+  if (event->type != GenericEvent || event->xcookie.extension != present_opcode)
+    return;
+
+  if (!XGetEventData(display, &event->xcookie))
+    return;
+
+  switch (event->xcookie.evtype) {
+  case PresentCompleteNotify:
+    handle_complete((XPresentCompleteNotifyEvent*) event->xcookie.data);
+    break;
+  case PresentIdleNotify:
+    handle_idle((XPresentIdleNotifyEvent*) event->xcookie.data);
+    break;
+  }
+
+  XFreeEventData(display, &event->xcookie);
+}
+
+// Completion events are delivered for every present on the window,
+// including the ones done by the EGL implementation on buffer swaps
+bool present_init(Display* x11_display, Window x11_window, int width, int height, int fps) {
+  int event_base, error_base;
+
+  display = x11_display;
+  window = x11_window;
+
+  if (!XPresentQueryExtension(display, &present_opcode, &event_base, &error_base)) {
+    if (connection_debug)
+      printf("X11 Present extension not available\n");
+    return false;
+  }
+
+  event_context = XPresentSelectInput(display, window, PresentCompleteNotifyMask | PresentIdleNotifyMask);
+
+  int depth = DefaultDepth(display, DefaultScreen(display));
+  for (int i = 0; i < PRESENT_PIXMAPS; i++) {
+    pixmaps[i] = XCreatePixmap(display, window, width, height, depth);
+    pixmap_idle[i] = true;
+  }
+
+  queue_head = queue_count = 0;
+  last_msc = last_ust = 0;
+  frame_us = fps > 0 ? 1000000.0 / fps : 0;
+  vblank_us = 0;
+  pixmap_in_flight = false;
+  x11_generic_event_handler = present_event;
+
+  if (connection_debug)
+    printf("Using X11 Present extension for presentation feedback\n");
+
+  return true;
+}
+
+void present_destroy() {
+  if (display == NULL || event_context == 0)
+    return;
+
+  x11_generic_event_handler = NULL;
+  XPresentFreeInput(display, window, event_context);
+  for (int i = 0; i < PRESENT_PIXMAPS; i++)
+    XFreePixmap(display, pixmaps[i]);
+
+  event_context = 0;
+}
+
+// A pixmap present is still waiting for the next vblank
+bool present_busy() {
+  return pixmap_in_flight;
+}
+
+Pixmap present_get_pixmap() {
+  for (int i = 0; i < PRESENT_PIXMAPS; i++) {
+    if (pixmap_idle[i])
+      return pixmaps[i];
+  }
+  return None;
+}
+
+void present_pixmap(Pixmap pixmap) {
+  for (int i = 0; i < PRESENT_PIXMAPS; i++) {
+    if (pixmaps[i] == pixmap)
+      pixmap_idle[i] = false;
+  }
+
+  XPresentPixmap(display, window, pixmap, ++serial, None, None, 0, 0, None, None, None, PresentOptionNone, 0, 0, 0, NULL, 0);
+  XFlush(display);
+
+  pixmap_in_flight = true;
+  queue_present();
+}
+
+// Track a buffer swap presented by EGL
+void present_swapped() {
+  if (event_context != 0)
+    queue_present();
+}
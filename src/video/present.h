@@ -0,0 +1,34 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2017 Iwan Timmer
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <X11/Xlib.h>
+
+#include <stdbool.h>
+
+typedef void(*PresentCompleteHandler)(void);
+
+bool present_init(Display* display, Window window, int width, int height, int fps);
+void present_destroy(void);
+
+bool present_busy(void);
+Pixmap present_get_pixmap(void);
+void present_pixmap(Pixmap pixmap);
+void present_swapped(void);
+
+extern PresentCompleteHandler present_complete_handler;
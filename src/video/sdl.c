@@ -19,6 +19,7 @@
 
 #include "video.h"
 #include "ffmpeg.h"
+#include "export.h"
 
 #include "../sdl.h"
 #include "../util.h"
@@ -26,6 +27,8 @@
 #include <SDL.h>
 #include <SDL_thread.h>
 
+#include <libavutil/hwcontext.h>
+
 #include <unistd.h>
 #include <stdbool.h>
 
@@ -33,6 +36,10 @@
 
 static void* ffmpeg_buffer;
 static size_t ffmpeg_buffer_size;
+static bool rfi;
+
+// System memory copies of hardware frames, one per queued frame
+static AVFrame* sw_frames[SDL_BUFFER_FRAMES];
 
 static int sdl_setup(int videoFormat, int width, int height, int redrawRate, void* context, int drFlags) {
   if (ffmpeg_init(videoFormat, width, height, SLICE_THREADING, SDL_BUFFER_FRAMES, SLICES_PER_FRAME) < 0) {
@@ -40,13 +47,24 @@ static int sdl_setup(int videoFormat, int width, int height, int redrawRate, voi
     return -1;
   }
 
+  for (int i = 0; i < SDL_BUFFER_FRAMES; i++) {
+    sw_frames[i] = av_frame_alloc();
+    if (sw_frames[i] == NULL) {
+      fprintf(stderr, "Couldn't allocate frame\n");
+      return -1;
+    }
+  }
+
   ensure_buf_size(&ffmpeg_buffer, &ffmpeg_buffer_size, INITIAL_DECODER_BUFFER_SIZE + AV_INPUT_BUFFER_PADDING_SIZE);
+  rfi = videoFormat & VIDEO_FORMAT_MASK_H265;
 
   return 0;
 }
 
 static void sdl_cleanup() {
   ffmpeg_destroy();
+  for (int i = 0; i < SDL_BUFFER_FRAMES; i++)
+    av_frame_free(&sw_frames[i]);
 }
 
 static int sdl_submit_decode_unit(PDECODE_UNIT decodeUnit) {
@@ -60,23 +78,36 @@ static int sdl_submit_decode_unit(PDECODE_UNIT decodeUnit) {
     length += entry->length;
     entry = entry->next;
   }
-  ffmpeg_decode(ffmpeg_buffer, length);
+  int err = ffmpeg_decode(ffmpeg_buffer, length);
 
   SDL_LockMutex(mutex);
   AVFrame* frame = ffmpeg_get_frame(false);
-  if (frame != NULL) {
+  if (frame != NULL && frame->hw_frames_ctx != NULL && ffmpeg_visible()) {
+    // Frames in device memory (e.g. DRM PRIME) can't be uploaded
+    // directly, download them to a frame the renderer can consume
+    AVFrame* sw_frame = sw_frames[(sdlNextFrame + 1) % SDL_BUFFER_FRAMES];
+    av_frame_unref(sw_frame);
+    if (av_hwframe_transfer_data(sw_frame, frame, 0) < 0) {
+      fprintf(stderr, "Couldn't download hardware frame\n");
+      frame = NULL;
+    } else
+      frame = sw_frame;
+  }
+  export_frame(frame, decodeUnit->presentationTimeMs);
+
+  if (frame != NULL && ffmpeg_visible()) {
     sdlNextFrame++;
 
     SDL_Event event;
     event.type = SDL_USEREVENT;
     event.user.code = SDL_CODE_FRAME;
-    event.user.data1 = &frame->data;
-    event.user.data2 = &frame->linesize;
+    event.user.data1 = frame;
+    event.user.data2 = NULL;
     SDL_PushEvent(&event);
   }
   SDL_UnlockMutex(mutex);
 
-  return DR_OK;
+  return ffmpeg_recovery_status(decodeUnit->frameType, err, rfi);
 }
 
 DECODER_RENDERER_CALLBACKS decoder_callbacks_sdl = {
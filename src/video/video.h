@@ -35,6 +35,14 @@
 
 #define INITIAL_DECODER_BUFFER_SIZE (256*1024)
 
+// Decoder threads and frames queued for rendering, 0 for the renderer defaults
+extern int video_decoder_threads;
+extern int video_buffered_frames;
+// Socket path to export decoded frames on, NULL when disabled
+extern char* video_export_path;
+// Swap interval of the EGL renderer, -1 for the driver default
+extern int video_swap_interval;
+
 #ifdef HAVE_X11
 int x11_init(bool vdpau, bool vaapi);
 extern DECODER_RENDERER_CALLBACKS decoder_callbacks_x11;
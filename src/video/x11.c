@@ -20,13 +20,20 @@
 #include "video.h"
 #include "egl.h"
 #include "ffmpeg.h"
+#include "export.h"
 #ifdef HAVE_VAAPI
 #include "ffmpeg_vaapi.h"
 #endif
+#ifdef HAVE_XPRESENT
+#include "present.h"
+#endif
 
 #include "../input/x11.h"
 #include "../loop.h"
+#include "../alloc.h"
+#include "../stats.h"
 #include "../util.h"
+#include "../watchdog.h"
 
 #include <X11/Xatom.h>
 #include <X11/Xutil.h>
@@ -50,19 +57,77 @@ static Window window;
 
 static int pipefd[2];
 
+static bool rfi;
+
 static int display_width;
 static int display_height;
 
+#ifdef HAVE_XPRESENT
+static bool use_present;
+#endif
+
+#if defined(HAVE_XPRESENT) && defined(HAVE_VAAPI)
+static AVFrame* pending_frame;
+
+static bool present_queue(AVFrame* frame) {
+  Pixmap pixmap;
+  if (present_busy() || (pixmap = present_get_pixmap()) == None)
+    return false;
+
+  vaapi_queue(frame, pixmap, display_width, display_height);
+  present_pixmap(pixmap);
+  return true;
+}
+
+// Render into a pixmap and present it at the next vblank. While a
+// present is in flight a reference to the latest frame is kept, so the
+// decoder can't reuse its surface before it is queued.
+static void present_frame(AVFrame* frame) {
+  av_frame_unref(pending_frame);
+  if (!present_queue(frame))
+    av_frame_ref(pending_frame, frame);
+}
+
+static void present_complete() {
+  if (pending_frame->buf[0] && present_queue(pending_frame))
+    av_frame_unref(pending_frame);
+}
+#endif
+
 static int frame_handle(int pipefd) {
   AVFrame* frame = NULL;
-  while (read(pipefd, &frame, sizeof(void*)) > 0);
+  int frames = 0;
+  while (read(pipefd, &frame, sizeof(void*)) > 0)
+    frames++;
   if (frame) {
-    if (ffmpeg_decoder == SOFTWARE)
+    alloc_enter(ALLOC_VIDEO);
+    watchdog_enter(WATCHDOG_PRESENT);
+    if (ffmpeg_decoder == SOFTWARE) {
+      // Frames decoded while waiting for the GPU replace this one
+      egl_wait_queue();
+      while (read(pipefd, &frame, sizeof(void*)) > 0)
+        frames++;
+      if (frames > 1)
+        stats_frames_replaced(frames - 1);
+
       egl_draw(frame->data);
+      #ifdef HAVE_XPRESENT
+      if (use_present)
+        present_swapped();
+      #endif
+    }
     #ifdef HAVE_VAAPI
-    else if (ffmpeg_decoder == VAAPI)
+    else if (ffmpeg_decoder == VAAPI) {
+      #ifdef HAVE_XPRESENT
+      if (use_present)
+        present_frame(frame);
+      else
+      #endif
       vaapi_queue(frame, window, display_width, display_height);
+    }
     #endif
+    watchdog_leave(WATCHDOG_PRESENT);
+    alloc_leave();
   }
 
   return LOOP_OK;
@@ -100,7 +165,7 @@ int x11_setup(int videoFormat, int width, int height, int redrawRate, void* cont
   }
 
   Window root = DefaultRootWindow(display);
-  XSetWindowAttributes winattr = { .event_mask = PointerMotionMask | ButtonPressMask | ButtonReleaseMask | KeyPressMask | KeyReleaseMask };
+  XSetWindowAttributes winattr = { .event_mask = PointerMotionMask | ButtonPressMask | ButtonReleaseMask | KeyPressMask | KeyReleaseMask | VisibilityChangeMask | StructureNotifyMask | PropertyChangeMask };
   window = XCreateWindow(display, root, 0, 0, display_width, display_height, 0, CopyFromParent, InputOutput, CopyFromParent, CWEventMask, &winattr);
   XMapWindow(display, window);
   XStoreName(display, window, "Moonlight");
@@ -119,6 +184,11 @@ int x11_setup(int videoFormat, int width, int height, int redrawRate, void* cont
     xev.xclient.data.l[2] = 0;
 
     XSendEvent(display, DefaultRootWindow(display), False, SubstructureRedirectMask | SubstructureNotifyMask, &xev);
+
+    // Ask the compositor to unredirect the window to avoid an extra copy
+    Atom bypass_compositor = XInternAtom(display, "_NET_WM_BYPASS_COMPOSITOR", False);
+    long bypass = 1;
+    XChangeProperty(display, window, bypass_compositor, XA_CARDINAL, 32, PropModeReplace, (unsigned char*) &bypass, 1);
   }
   XFlush(display);
 
@@ -138,6 +208,8 @@ int x11_setup(int videoFormat, int width, int height, int redrawRate, void* cont
   if (ffmpeg_decoder == SOFTWARE)
     egl_init(display, window, width, height);
 
+  rfi = (videoFormat & VIDEO_FORMAT_MASK_H265) && avc_flags == SLICE_THREADING;
+
   if (pipe(pipefd) == -1) {
     fprintf(stderr, "Can't create communication channel between threads\n");
     return -2;
@@ -146,6 +218,15 @@ int x11_setup(int videoFormat, int width, int height, int redrawRate, void* cont
   fcntl(pipefd[0], F_SETFL, O_NONBLOCK);
 
   x11_input_init(display, window);
+  x11_visibility_handler = ffmpeg_set_visible;
+
+  #ifdef HAVE_XPRESENT
+  use_present = present_init(display, window, display_width, display_height, redrawRate);
+  #ifdef HAVE_VAAPI
+  pending_frame = av_frame_alloc();
+  present_complete_handler = present_complete;
+  #endif
+  #endif
 
   return 0;
 }
@@ -159,6 +240,13 @@ int x11_setup_vaapi(int videoFormat, int width, int height, int redrawRate, void
 }
 
 void x11_cleanup() {
+  #ifdef HAVE_XPRESENT
+  if (use_present)
+    present_destroy();
+  #ifdef HAVE_VAAPI
+  av_frame_free(&pending_frame);
+  #endif
+  #endif
   ffmpeg_destroy();
   egl_destroy();
 }
@@ -175,13 +263,14 @@ int x11_submit_decode_unit(PDECODE_UNIT decodeUnit) {
     entry = entry->next;
   }
 
-  ffmpeg_decode(ffmpeg_buffer, length);
+  int err = ffmpeg_decode(ffmpeg_buffer, length);
 
   AVFrame* frame = ffmpeg_get_frame(true);
-  if (frame != NULL)
+  export_frame(frame, decodeUnit->presentationTimeMs);
+  if (frame != NULL && ffmpeg_visible())
     write(pipefd[1], &frame, sizeof(void*));
 
-  return DR_OK;
+  return ffmpeg_recovery_status(decodeUnit->frameType, err, rfi);
 }
 
 DECODER_RENDERER_CALLBACKS decoder_callbacks_x11 = {
@@ -0,0 +1,171 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2015-2019 Iwan Timmer
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "watchdog.h"
+#include "recorder.h"
+#include "stats.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <unistd.h>
+
+struct stage_state {
+  // Written by the threads of the stage only
+  uint64_t busy_since;
+  uint64_t last_done;
+  uint32_t history_index;
+  uint32_t history[WATCHDOG_HISTORY];
+  uint32_t max_us;
+  // Only used by the watchdog thread
+  uint64_t reported_since;
+  uint32_t stalls;
+};
+
+static const char* stage_names[WATCHDOG_STAGES] = { "submit", "decode", "present", "audio", "input" };
+
+static struct stage_state stages[WATCHDOG_STAGES];
+static volatile bool watchdog_running;
+static uint64_t watchdog_budget_us;
+static pthread_t watchdog_thread;
+
+static AUDIO_RENDERER_CALLBACKS audio_callbacks;
+static AudioRendererDecodeAndPlaySample audio_decode;
+
+void watchdog_enter(enum watchdog_stage stage) {
+  if (watchdog_running)
+    __atomic_store_n(&stages[stage].busy_since, stats_time_us(), __ATOMIC_RELAXED);
+}
+
+void watchdog_leave(enum watchdog_stage stage) {
+  if (!watchdog_running)
+    return;
+
+  struct stage_state* state = &stages[stage];
+  uint64_t since = __atomic_exchange_n(&state->busy_since, 0, __ATOMIC_RELAXED);
+  if (since == 0)
+    return;
+
+  uint64_t now = stats_time_us();
+  uint32_t duration = now - since;
+  uint32_t index = __atomic_fetch_add(&state->history_index, 1, __ATOMIC_RELAXED);
+  __atomic_store_n(&state->history[index % WATCHDOG_HISTORY], duration, __ATOMIC_RELAXED);
+  __atomic_store_n(&state->last_done, now, __ATOMIC_RELAXED);
+  if (duration > __atomic_load_n(&state->max_us, __ATOMIC_RELAXED))
+    __atomic_store_n(&state->max_us, duration, __ATOMIC_RELAXED);
+}
+
+static void audio_decode_and_play_sample(char* sampleData, int sampleLength) {
+  watchdog_enter(WATCHDOG_AUDIO);
+  audio_decode(sampleData, sampleLength);
+  watchdog_leave(WATCHDOG_AUDIO);
+}
+
+PAUDIO_RENDERER_CALLBACKS watchdog_track_audio(PAUDIO_RENDERER_CALLBACKS callbacks) {
+  if (callbacks == NULL)
+    return NULL;
+
+  audio_callbacks = *callbacks;
+  audio_decode = callbacks->decodeAndPlaySample;
+  audio_callbacks.decodeAndPlaySample = audio_decode_and_play_sample;
+  return &audio_callbacks;
+}
+
+// The snapshot is read while stages keep running, values can be off by a unit of work
+static void watchdog_dump(uint64_t now) {
+  fprintf(stderr, "Watchdog: recent activity, durations in ms, newest first\n");
+  for (int i = 0; i < WATCHDOG_STAGES; i++) {
+    struct stage_state* state = &stages[i];
+    uint32_t count = __atomic_load_n(&state->history_index, __ATOMIC_RELAXED);
+    uint64_t since = __atomic_load_n(&state->busy_since, __ATOMIC_RELAXED);
+    uint64_t last_done = __atomic_load_n(&state->last_done, __ATOMIC_RELAXED);
+    if (count == 0 && since == 0)
+      continue;
+
+    char line[256];
+    int len = snprintf(line, sizeof(line), "  %-8s", stage_names[i]);
+    if (since != 0)
+      len += snprintf(line + len, sizeof(line) - len, " busy for %llu ms,", (unsigned long long) (now - since) / 1000);
+    if (last_done != 0)
+      len += snprintf(line + len, sizeof(line) - len, " last done %llu ms ago,", (unsigned long long) (now - last_done) / 1000);
+    len += snprintf(line + len, sizeof(line) - len, " max %.1f:", __atomic_load_n(&state->max_us, __ATOMIC_RELAXED) / 1000.0);
+    for (uint32_t j = 0; j < WATCHDOG_HISTORY && j < count && len < sizeof(line); j++) {
+      uint32_t duration = __atomic_load_n(&state->history[(count - 1 - j) % WATCHDOG_HISTORY], __ATOMIC_RELAXED);
+      len += snprintf(line + len, sizeof(line) - len, " %.1f", duration / 1000.0);
+    }
+    fprintf(stderr, "%s\n", line);
+  }
+  stats_print(stderr);
+}
+
+static void* watchdog_run(void* data) {
+  while (watchdog_running) {
+    usleep(WATCHDOG_INTERVAL_MS * 1000);
+
+    uint64_t now = stats_time_us();
+    bool stalled = false;
+    for (int i = 0; i < WATCHDOG_STAGES; i++) {
+      struct stage_state* state = &stages[i];
+      uint64_t since = __atomic_load_n(&state->busy_since, __ATOMIC_RELAXED);
+      if (state->reported_since != 0 && since != state->reported_since) {
+        fprintf(stderr, "Watchdog: %s stage resumed after about %llu ms\n", stage_names[i], (unsigned long long) (now - state->reported_since) / 1000);
+        state->reported_since = 0;
+      }
+
+      if (since != 0 && since != state->reported_since && now - since > watchdog_budget_us) {
+        fprintf(stderr, "Watchdog: %s stage stuck for %llu ms\n", stage_names[i], (unsigned long long) (now - since) / 1000);
+        state->reported_since = since;
+        state->stalls++;
+        recorder_write(RECORDER_EVENT, RECORDER_STALL, i, (now - since) / 1000, 0);
+        stalled = true;
+      }
+    }
+
+    if (stalled)
+      watchdog_dump(now);
+  }
+
+  return NULL;
+}
+
+void watchdog_start(int budget_ms) {
+  for (int i = 0; i < WATCHDOG_STAGES; i++)
+    stages[i] = (struct stage_state) {0};
+
+  watchdog_budget_us = budget_ms * 1000ULL;
+  watchdog_running = true;
+  if (pthread_create(&watchdog_thread, NULL, watchdog_run, NULL) != 0) {
+    fprintf(stderr, "Can't start watchdog\n");
+    watchdog_running = false;
+  }
+}
+
+void watchdog_stop() {
+  if (!watchdog_running)
+    return;
+
+  watchdog_running = false;
+  pthread_join(watchdog_thread, NULL);
+
+  for (int i = 0; i < WATCHDOG_STAGES; i++) {
+    if (stages[i].stalls > 0)
+      fprintf(stderr, "Watchdog: %s stage stalled %u times, longest unit of work %.1f ms\n", stage_names[i], stages[i].stalls, stages[i].max_us / 1000.0);
+  }
+}
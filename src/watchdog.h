@@ -0,0 +1,38 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2015-2019 Iwan Timmer
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Stall detection for the streaming pipeline. Every stage marks the start
+// and end of each unit of work with two atomic stores, a separate thread
+// reports stages which are busy for longer than the budget.
+
+#include <Limelight.h>
+
+enum watchdog_stage { WATCHDOG_SUBMIT, WATCHDOG_DECODE, WATCHDOG_PRESENT, WATCHDOG_AUDIO, WATCHDOG_INPUT, WATCHDOG_STAGES };
+
+#define WATCHDOG_INTERVAL_MS 50
+// Durations of the last units of work of every stage, printed on a stall
+#define WATCHDOG_HISTORY 16
+
+void watchdog_enter(enum watchdog_stage stage);
+void watchdog_leave(enum watchdog_stage stage);
+
+PAUDIO_RENDERER_CALLBACKS watchdog_track_audio(PAUDIO_RENDERER_CALLBACKS callbacks);
+
+void watchdog_start(int budget_ms);
+void watchdog_stop(void);
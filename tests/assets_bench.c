@@ -0,0 +1,126 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2015-2019 Iwan Timmer
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Fetches the box art of the apps of a mock host into an empty cache,
+// revalidates the cache and fetches again after every image changed. The
+// same is repeated against a host without validators, whose cached box art
+// must be used without any request.
+//
+// Usage: assets_bench [apps] [delay ms] [jobs]
+
+#include "mock_host.h"
+#include "clock.h"
+
+#include <client.h>
+#include <errors.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+
+#define KEY_DIRECTORY "assets_bench_keys"
+
+// Returns the number of apps whose image changed from the previous run
+static int run_assets(PSERVER_DATA server, PAPP_LIST list, int jobs, const char* name, char (*previous)[PATH_MAX], int* failures) {
+  mock_host_reset_counts();
+  uint64_t start = clock_now_us();
+  int ret = gs_app_assets(server, list, jobs, 5000);
+  uint64_t elapsed = (clock_now_us() - start) / 1000;
+
+  int apps = 0, assets = 0, changed = 0;
+  for (PAPP_LIST app = list; app != NULL; app = app->next, apps++) {
+    if (app->asset == NULL || access(app->asset, R_OK) != 0)
+      continue;
+
+    assets++;
+    if (strcmp(previous[apps], app->asset) != 0)
+      changed++;
+    snprintf(previous[apps], PATH_MAX, "%s", app->asset);
+  }
+
+  printf("%s: %llu ms, %d/%d images, %d changed, %d transferred, %d not modified\n", name, (unsigned long long) elapsed,
+         assets, apps, changed, mock_host_count(MOCK_APPASSET), mock_host_count(MOCK_APPASSET_NOT_MODIFIED));
+  if (ret != GS_OK) {
+    printf("%s: %s\n", name, server->error);
+    (*failures)++;
+  }
+  if (assets != apps)
+    (*failures)++;
+
+  return changed;
+}
+
+int main(int argc, char* argv[]) {
+  int apps = argc > 1 ? atoi(argv[1]) : 200;
+  int delay_ms = argc > 2 ? atoi(argv[2]) : 20;
+  int jobs = argc > 3 ? atoi(argv[3]) : 8;
+
+  if (mock_host_start(1, delay_ms, apps) < 0)
+    return 1;
+
+  char address[16];
+  mock_host_address(0, address, sizeof(address));
+
+  SERVER_DATA server;
+  if (gs_init(&server, address, MOCK_HOST_HTTP_PORT, KEY_DIRECTORY, 0, true) != GS_OK) {
+    fprintf(stderr, "Can't connect to mock host: %s\n", server.error);
+    return 1;
+  }
+
+  PAPP_LIST list = NULL;
+  if (gs_applist(&server, &list) != GS_OK) {
+    fprintf(stderr, "Can't get app list: %s\n", server.error);
+    return 1;
+  }
+
+  // Start without an index, images left from earlier runs are only found by their hash
+  char path[PATH_MAX];
+  snprintf(path, sizeof(path), "%s/assets/%s.idx", KEY_DIRECTORY, address);
+  unlink(path);
+
+  char (*previous)[PATH_MAX] = calloc(apps, PATH_MAX);
+  int failures = 0;
+  printf("%d apps answering after %d ms, %d jobs\n", apps, delay_ms, jobs);
+  run_assets(&server, list, jobs, "empty cache", previous, &failures);
+  if (mock_host_count(MOCK_APPASSET) != apps)
+    failures++;
+
+  if (run_assets(&server, list, jobs, "unchanged", previous, &failures) != 0 || mock_host_count(MOCK_APPASSET_NOT_MODIFIED) != apps)
+    failures++;
+
+  mock_host_set_asset_version(2);
+  if (run_assets(&server, list, jobs, "changed", previous, &failures) != apps)
+    failures++;
+
+  mock_host_set_asset_validators(false);
+  unlink(path);
+  run_assets(&server, list, jobs, "no validators", previous, &failures);
+  if (mock_host_count(MOCK_APPASSET) != apps)
+    failures++;
+
+  if (run_assets(&server, list, jobs, "no validators, warm", previous, &failures) != 0 || mock_host_count(MOCK_APPASSET) != 0 || mock_host_count(MOCK_APPASSET_NOT_MODIFIED) != 0)
+    failures++;
+
+  free(previous);
+  gs_destroy(&server);
+  mock_host_stop();
+  return failures > 0 ? 1 : 0;
+}
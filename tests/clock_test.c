@@ -0,0 +1,141 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2015-2019 Iwan Timmer
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Runs the event loop on the virtual clock. A pipe that is always readable
+// moves the clock forward on every pass of the loop, so the timeouts, the
+// quality restoring and the audio latency sampling are checked against
+// exact times without waiting for them.
+
+#include "loop.h"
+#include "clock.h"
+#include "quality.h"
+#include "recorder.h"
+#include "stats.h"
+#include "audio/audio.h"
+
+#include <poll.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <unistd.h>
+
+// Normally defined by the connection, recorder and stats modules
+pthread_t main_thread_id;
+bool connection_debug;
+void recorder_write(enum recorder_ring ring, enum recorder_type type, uint32_t a, uint32_t b, uint32_t c) {}
+void stats_audio_latency(uint32_t latency_us) {}
+
+static int failures;
+
+static uint64_t step_us;
+static int calls, last_call;
+static int samples, packets;
+
+static void check(bool condition, const char* description) {
+  printf("%s: %s\n", condition ? "ok" : "FAIL", description);
+  if (!condition)
+    failures++;
+}
+
+static int advance(int fd) {
+  clock_advance_us(clock_now_us() + step_us);
+  return LOOP_OK;
+}
+
+static int tick(void) {
+  return ++calls == last_call ? LOOP_RETURN : LOOP_OK;
+}
+
+// A renderer showing clean frames until the quality is restored
+static int frame(void) {
+  quality_frame(false);
+  return quality_degraded() ? LOOP_OK : LOOP_RETURN;
+}
+
+// An audio renderer playing a second of packets
+static int packet(void) {
+  if (audio_latency_sample_due())
+    samples++;
+  return ++packets == 200 ? LOOP_RETURN : LOOP_OK;
+}
+
+// Runs the loop with the handler called every interval, returns the elapsed time in ms
+static uint64_t run(uint64_t interval_us, TimeoutHandler handler) {
+  uint64_t start = clock_now_us();
+  loop_add_timeout(interval_us, handler);
+  loop_main();
+  loop_remove_timeout(handler);
+  return (clock_now_us() - start) / 1000;
+}
+
+int main() {
+  int fds[2];
+  if (pipe(fds) < 0 || write(fds[1], "", 1) != 1) {
+    perror("Can't create pipe");
+    return 1;
+  }
+
+  loop_init();
+  loop_add_fd(fds[0], advance, POLLIN);
+  clock_virtual_start();
+
+  step_us = 10000;
+  calls = 0;
+  last_call = 20;
+  uint64_t elapsed = run(50000, tick);
+  check(calls == 20 && elapsed == 1000, "timeouts run at their interval of the virtual clock");
+
+  step_us = 120000;
+  calls = 0;
+  last_call = 3;
+  elapsed = run(50000, tick);
+  check(calls == 3 && elapsed == 360, "intervals missed while the loop was busy are skipped");
+
+  uint32_t periods;
+  uint64_t poor_ms;
+  step_us = 1000;
+  quality_reset();
+  quality_connection_status(true);
+  quality_connection_status(false);
+  elapsed = run(10000, frame);
+  quality_get_poor(&periods, &poor_ms);
+  check(elapsed == QUALITY_RECOVERY_MS, "quality is restored after the recovery time");
+  check(periods == 1 && poor_ms == QUALITY_RECOVERY_MS, "the poor period lasted the recovery time");
+
+  int period_size, buffer_size;
+  step_us = 5000;
+  audio_buffer_size(48000, 240, &period_size, &buffer_size);
+  samples = packets = 0;
+  elapsed = run(5000, packet);
+  check(elapsed == 1000 && samples == 1000 / AUDIO_LATENCY_SAMPLE_INTERVAL_MS, "audio latency is sampled at its interval");
+
+  quality_connection_status(true);
+  samples = packets = 0;
+  run(5000, packet);
+  check(samples == 0, "audio latency isn't sampled while the quality is degraded");
+  quality_reset();
+
+  clock_virtual_stop();
+  loop_remove_fd(fds[0]);
+  close(fds[0]);
+  close(fds[1]);
+
+  return failures > 0 ? 1 : 0;
+}
@@ -0,0 +1,124 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2015-2019 Iwan Timmer
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Feeds axis changes of a virtual SDL gamepad into the SDL input handler
+// faster than frames are shown and reports how many controller packets
+// were sent for them. Packets are flushed once per frame, like the SDL
+// event loop does when a frame is presented.
+//
+// Usage: input_bench [frames] [axis events per frame]
+
+#include "sdl.h"
+#include "input/sdl.h"
+
+#include <Limelight.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+static int controller_packets;
+
+int LiSendMultiControllerEvent(short controllerNumber, short activeGamepadMask, int buttonFlags, unsigned char leftTrigger, unsigned char rightTrigger, short leftStickX, short leftStickY, short rightStickX, short rightStickY) {
+  controller_packets++;
+  return 0;
+}
+
+// Everything else the input handler might send is ignored
+int LiSendMouseMoveEvent(short deltaX, short deltaY) { return 0; }
+int LiSendMousePositionEvent(short x, short y, short referenceWidth, short referenceHeight) { return 0; }
+int LiSendMouseButtonEvent(char action, int button) { return 0; }
+int LiSendKeyboardEvent(short keyCode, char keyAction, char modifiers) { return 0; }
+int LiSendScrollEvent(signed char scrollClicks) { return 0; }
+int LiSendHScrollEvent(signed char scrollClicks) { return 0; }
+int LiSendHighResScrollEvent(short scrollAmount) { return 0; }
+int LiSendHighResHScrollEvent(short scrollAmount) { return 0; }
+int LiSendControllerArrivalEvent(uint8_t controllerNumber, uint16_t activeGamepadMask, uint8_t type, uint32_t supportedButtonFlags, uint16_t capabilities) { return 0; }
+int LiSendControllerMotionEvent(uint8_t controllerNumber, uint8_t motionType, float x, float y, float z) { return 0; }
+int LiSendTouchEvent(uint8_t eventType, uint32_t pointerId, float x, float y, float pressureOrDistance, float contactAreaMajor, float contactAreaMinor, uint16_t rotation) { return 0; }
+int LiSendControllerTouchEvent(uint8_t controllerNumber, uint8_t eventType, uint32_t pointerId, float x, float y, float pressure) { return 0; }
+
+// Pass the queued events to the input handler, counting the axis changes
+static int drain_events() {
+  SDL_Event event;
+  int axis_events = 0;
+  while (SDL_PollEvent(&event)) {
+    if (event.type == SDL_CONTROLLERAXISMOTION)
+      axis_events++;
+    sdlinput_handle_event(NULL, &event);
+  }
+  return axis_events;
+}
+
+int main(int argc, char* argv[]) {
+  int frames = argc > 1 ? atoi(argv[1]) : 600;
+  int rate = argc > 2 ? atoi(argv[2]) : 8;
+
+  if (SDL_Init(SDL_INIT_GAMECONTROLLER) < 0) {
+    fprintf(stderr, "Can't initialize SDL: %s\n", SDL_GetError());
+    return 1;
+  }
+
+  int index = SDL_JoystickAttachVirtual(SDL_JOYSTICK_TYPE_GAMECONTROLLER, SDL_CONTROLLER_AXIS_MAX, SDL_CONTROLLER_BUTTON_MAX, 0);
+  SDL_Joystick* joystick = index >= 0 ? SDL_JoystickOpen(index) : NULL;
+  if (joystick == NULL) {
+    fprintf(stderr, "Can't attach virtual gamepad: %s\n", SDL_GetError());
+    SDL_Quit();
+    return 1;
+  }
+
+  sdlinput_init(NULL);
+  drain_events();
+  if (sdl_gamepads == 0) {
+    fprintf(stderr, "Virtual gamepad isn't recognized as a game controller\n");
+    SDL_JoystickClose(joystick);
+    SDL_Quit();
+    return 1;
+  }
+
+  controller_packets = 0;
+  int axis_events = 0;
+  for (int frame = 0; frame < frames; frame++) {
+    // Move both sticks, with every change a separate event
+    for (int i = 0; i < rate; i++) {
+      int step = frame * rate + i;
+      Sint16 value = (step * 4099) % 65536 - 32768;
+      SDL_JoystickSetVirtualAxis(joystick, step % 4, value);
+      SDL_JoystickUpdate();
+    }
+
+    axis_events += drain_events();
+    sdlinput_flush();
+  }
+
+  SDL_JoystickClose(joystick);
+  SDL_JoystickDetachVirtual(index);
+  drain_events();
+  SDL_Quit();
+
+  printf("%d frames, %d axis events in, %d controller packets sent (%.1f events per packet)\n", frames, axis_events, controller_packets, controller_packets > 0 ? (double) axis_events / controller_packets : 0.0);
+
+  // Every frame with axis changes sends a single packet for the gamepad,
+  // plus the one from removing the gamepad
+  if (axis_events < frames || controller_packets > frames + 1) {
+    fprintf(stderr, "Axis changes weren't coalesced into one packet per frame\n");
+    return 1;
+  }
+
+  return 0;
+}
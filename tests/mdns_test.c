@@ -0,0 +1,263 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2015-2019 Iwan Timmer
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Runs mdns_discover against a responder on the loopback interface. The
+// querier sends to the configured group address and takes answers from
+// whoever replies, so a unicast responder on 127.0.0.1 stands in for the
+// multicast group.
+
+#include "mdns.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include <poll.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SERVICE "_nvstream._tcp.local"
+#define TYPE_A 1
+#define TYPE_PTR 12
+#define TYPE_SRV 33
+
+struct host {
+  const char* name;
+  const char* target;
+  const char* address;
+  unsigned short port;
+};
+
+// Which records a scenario answers with
+struct scenario {
+  struct host hosts[2];
+  int host_count;
+  // Send the SRV and A records together with the PTR answer
+  bool additional;
+  // Answer A questions about this host target
+  bool resolvable[2];
+};
+
+static int responder_fd;
+static volatile bool responder_quit;
+static const struct scenario* current;
+static int failures;
+
+static int write_name(unsigned char* packet, int offset, const char* name) {
+  while (*name) {
+    const char* dot = strchr(name, '.');
+    int length = dot ? dot - name : strlen(name);
+    packet[offset++] = length;
+    memcpy(packet + offset, name, length);
+    offset += length;
+    name += length + (dot ? 1 : 0);
+  }
+  packet[offset++] = 0;
+  return offset;
+}
+
+static int read_name(const unsigned char* packet, int length, int offset, char* name, int size) {
+  int used = 0;
+  while (offset < length && packet[offset] != 0) {
+    int label = packet[offset++];
+    if (offset + label > length || used + label + 2 > size)
+      return -1;
+    if (used > 0)
+      name[used++] = '.';
+    memcpy(name + used, packet + offset, label);
+    used += label;
+    offset += label;
+  }
+  name[used] = 0;
+  return offset + 1;
+}
+
+static int write_record(unsigned char* packet, int offset, const char* name, int type, const struct host* host) {
+  char instance[256];
+  offset = write_name(packet, offset, name);
+  packet[offset++] = 0;
+  packet[offset++] = type;
+  packet[offset++] = 0x80;
+  packet[offset++] = 1;
+  memcpy(packet + offset, "\0\0\0\x78", 4);
+  offset += 4;
+
+  int rdlength = offset;
+  offset += 2;
+  switch (type) {
+  case TYPE_PTR:
+    snprintf(instance, sizeof(instance), "%s.%s", host->name, SERVICE);
+    offset = write_name(packet, offset, instance);
+    break;
+  case TYPE_SRV:
+    memset(packet + offset, 0, 4);
+    packet[offset + 4] = host->port >> 8;
+    packet[offset + 5] = host->port & 0xff;
+    offset = write_name(packet, offset + 6, host->target);
+    break;
+  case TYPE_A:
+    inet_pton(AF_INET, host->address, packet + offset);
+    offset += 4;
+    break;
+  }
+  packet[rdlength] = (offset - rdlength - 2) >> 8;
+  packet[rdlength + 1] = (offset - rdlength - 2) & 0xff;
+  return offset;
+}
+
+static void respond(const unsigned char* query, int length, struct sockaddr_in* source) {
+  unsigned char packet[4096] = {0};
+  char name[256], instance[256];
+  int answers = 0;
+  int offset = 12;
+  int questions = query[4] << 8 | query[5];
+
+  int position = 12;
+  for (int q = 0; q < questions; q++) {
+    if ((position = read_name(query, length, position, name, sizeof(name))) < 0 || position + 4 > length)
+      return;
+    int type = query[position] << 8 | query[position + 1];
+    position += 4;
+
+    for (int i = 0; i < current->host_count; i++) {
+      const struct host* host = &current->hosts[i];
+      snprintf(instance, sizeof(instance), "%s.%s", host->name, SERVICE);
+      if (type == TYPE_PTR && strcasecmp(name, SERVICE) == 0) {
+        offset = write_record(packet, offset, SERVICE, TYPE_PTR, host);
+        answers++;
+        if (current->additional) {
+          offset = write_record(packet, offset, instance, TYPE_SRV, host);
+          answers++;
+          if (current->resolvable[i]) {
+            offset = write_record(packet, offset, host->target, TYPE_A, host);
+            answers++;
+          }
+        }
+      } else if (type == TYPE_SRV && strcasecmp(name, instance) == 0) {
+        offset = write_record(packet, offset, instance, TYPE_SRV, host);
+        answers++;
+      } else if (type == TYPE_A && strcasecmp(name, host->target) == 0 && current->resolvable[i]) {
+        offset = write_record(packet, offset, host->target, TYPE_A, host);
+        answers++;
+      }
+    }
+  }
+
+  if (answers == 0)
+    return;
+
+  packet[2] = 0x84;
+  packet[6] = answers >> 8;
+  packet[7] = answers & 0xff;
+  sendto(responder_fd, packet, offset, 0, (struct sockaddr*) source, sizeof(*source));
+}
+
+static void* responder(void* arg) {
+  while (!responder_quit) {
+    struct pollfd pfd = { .fd = responder_fd, .events = POLLIN };
+    if (poll(&pfd, 1, 50) <= 0)
+      continue;
+
+    unsigned char query[4096];
+    struct sockaddr_in source;
+    socklen_t source_length = sizeof(source);
+    int length = recvfrom(responder_fd, query, sizeof(query), 0, (struct sockaddr*) &source, &source_length);
+    if (length >= 12 && current != NULL)
+      respond(query, length, &source);
+  }
+  return NULL;
+}
+
+static uint64_t time_ms() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void check(bool condition, const char* description) {
+  printf("%s: %s\n", condition ? "ok" : "FAIL", description);
+  if (!condition)
+    failures++;
+}
+
+static bool has_host(PMDNS_HOST host, const char* name, const char* address, unsigned short port) {
+  return strcmp(host->name, name) == 0 && strcmp(host->address, address) == 0 && host->port == port;
+}
+
+int main() {
+  responder_fd = socket(AF_INET, SOCK_DGRAM, 0);
+  struct sockaddr_in address = { .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+  socklen_t address_length = sizeof(address);
+  if (responder_fd < 0 || bind(responder_fd, (struct sockaddr*) &address, sizeof(address)) < 0 || getsockname(responder_fd, (struct sockaddr*) &address, &address_length) < 0) {
+    perror("Can't create responder socket");
+    return 1;
+  }
+  unsigned short port = ntohs(address.sin_port);
+
+  pthread_t thread;
+  pthread_create(&thread, NULL, responder, NULL);
+
+  MDNS_HOST hosts[MDNS_MAX_HOSTS];
+  int count;
+
+  // The first host announced never resolves to an address
+  struct scenario unresolved_first = {
+    .hosts = {{ "Alpha", "alpha.local", "10.0.0.1", 47989 }, { "Beta", "beta.local", "10.0.0.2", 47990 }},
+    .host_count = 2,
+    .additional = true,
+    .resolvable = { false, true },
+  };
+  current = &unresolved_first;
+  count = mdns_discover(SERVICE, "127.0.0.1", port, 1000, hosts, MDNS_MAX_HOSTS, 1);
+  check(count == 1 && has_host(&hosts[0], "Beta", "10.0.0.2", 47990), "a single wanted host is one that resolved");
+
+  count = mdns_discover(SERVICE, "127.0.0.1", port, 600, hosts, MDNS_MAX_HOSTS, 0);
+  check(count == 2 && has_host(&hosts[0], "Beta", "10.0.0.2", 47990), "resolved hosts are listed first");
+  check(count == 2 && has_host(&hosts[1], "Alpha", "127.0.0.1", 47989), "unresolved hosts fall back to the responder address");
+
+  // Only the PTR record is sent, the rest has to be asked for
+  struct scenario followup = {
+    .hosts = {{ "Gamma", "gamma.local", "10.0.0.3", 47989 }},
+    .host_count = 1,
+    .additional = false,
+    .resolvable = { true },
+  };
+  current = &followup;
+  uint64_t start = time_ms();
+  count = mdns_discover(SERVICE, "127.0.0.1", port, 1000, hosts, MDNS_MAX_HOSTS, 1);
+  uint64_t elapsed = time_ms() - start;
+  check(count == 1 && has_host(&hosts[0], "Gamma", "10.0.0.3", 47989), "missing records are resolved with follow-up queries");
+  check(elapsed < 200, "follow-up queries don't wait for the retransmission");
+
+  current = NULL;
+  count = mdns_discover(SERVICE, "127.0.0.1", port, 300, hosts, MDNS_MAX_HOSTS, 1);
+  check(count == 0, "nothing is found without a responder");
+
+  responder_quit = true;
+  pthread_join(thread, NULL);
+  close(responder_fd);
+
+  return failures > 0 ? 1 : 0;
+}
@@ -0,0 +1,337 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2015-2019 Iwan Timmer
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+
+#include "mock_host.h"
+
+#include <mkcert.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#include <openssl/ssl.h>
+
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define MOCK_HOST_BASE_ADDRESS 0x7f010001
+#define MOCK_ASSET_SIZE 32768
+#define MOCK_MAX_REQUEST 8192
+
+struct mock_connection {
+  int fd;
+  SSL* ssl;
+};
+
+static int host_count;
+static int delay_ms;
+static int app_count;
+static volatile int asset_version;
+static volatile bool asset_validators;
+
+static struct pollfd* listeners;
+static SSL_CTX* ssl_ctx;
+static CERT_KEY_PAIR cert;
+static pthread_t accept_thread;
+static volatile bool quit;
+
+static pthread_mutex_t count_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int counts[MOCK_COUNTERS];
+
+static void count(enum mock_host_counter counter) {
+  pthread_mutex_lock(&count_mutex);
+  counts[counter]++;
+  pthread_mutex_unlock(&count_mutex);
+}
+
+void mock_host_address(int host, char* address, int length) {
+  struct in_addr addr = { .s_addr = htonl(MOCK_HOST_BASE_ADDRESS + host) };
+  inet_ntop(AF_INET, &addr, address, length);
+}
+
+static int mock_read(struct mock_connection* conn, char* buffer, int length) {
+  return conn->ssl ? SSL_read(conn->ssl, buffer, length) : recv(conn->fd, buffer, length, 0);
+}
+
+static int mock_write(struct mock_connection* conn, const char* buffer, int length) {
+  while (length > 0) {
+    int written = conn->ssl ? SSL_write(conn->ssl, buffer, length) : send(conn->fd, buffer, length, MSG_NOSIGNAL);
+    if (written <= 0)
+      return -1;
+    buffer += written;
+    length -= written;
+  }
+  return 0;
+}
+
+static int mock_respond(struct mock_connection* conn, int status, const char* headers, const char* body, int length) {
+  char header[512];
+  int header_length = snprintf(header, sizeof(header), "HTTP/1.1 %d %s\r\nContent-Length: %d\r\n%sConnection: keep-alive\r\n\r\n",
+                               status, status == 200 ? "OK" : status == 304 ? "Not Modified" : "Not Found", length, headers);
+  if (mock_write(conn, header, header_length) < 0)
+    return -1;
+  return length > 0 ? mock_write(conn, body, length) : 0;
+}
+
+static int query_int(const char* path, const char* key) {
+  const char* value = strstr(path, key);
+  return value ? atoi(value + strlen(key)) : -1;
+}
+
+static int mock_serverinfo(struct mock_connection* conn, int host) {
+  char body[1024];
+  int length = snprintf(body, sizeof(body), "<?xml version=\"1.0\" encoding=\"utf-8\"?><root status_code=\"200\"><hostname>mock-%d</hostname>"
+                        "<appversion>7.1.431.0</appversion><GfeVersion>3.23.0.74</GfeVersion><GsVersion>x</GsVersion><HttpsPort>%d</HttpsPort>"
+                        "<currentgame>0</currentgame><PairStatus>%d</PairStatus><state>SUNSHINE_SERVER_FREE</state><ServerCodecModeSupport>259</ServerCodecModeSupport>"
+                        "<gputype>Mock GPU</gputype><SupportedDisplayMode></SupportedDisplayMode></root>", host, MOCK_HOST_HTTPS_PORT, conn->ssl != NULL);
+  count(MOCK_SERVERINFO);
+  return mock_respond(conn, 200, "", body, length);
+}
+
+static int mock_applist(struct mock_connection* conn) {
+  int size = 128 + app_count * 96;
+  char* body = malloc(size);
+  int length = snprintf(body, size, "<?xml version=\"1.0\" encoding=\"utf-8\"?><root status_code=\"200\">");
+  for (int i = 0; i < app_count; i++)
+    length += snprintf(body + length, size - length, "<App><AppTitle>Game %d</AppTitle><ID>%d</ID><IsHdrSupported>0</IsHdrSupported></App>", i, 1000 + i);
+  length += snprintf(body + length, size - length, "</root>");
+
+  count(MOCK_APPLIST);
+  int ret = mock_respond(conn, 200, "", body, length);
+  free(body);
+  return ret;
+}
+
+// Box art is served with an entity tag and honours If-None-Match, unless
+// validators are disabled like on hosts which always send the image
+static int mock_appasset(struct mock_connection* conn, const char* path, const char* request) {
+  int id = query_int(path, "appid=");
+  int version = asset_version;
+  bool validators = asset_validators;
+  char etag[64], headers[128];
+  snprintf(etag, sizeof(etag), "\"%d-%d\"", id, version);
+  if (validators)
+    snprintf(headers, sizeof(headers), "ETag: %s\r\nContent-Type: image/png\r\n", etag);
+  else
+    snprintf(headers, sizeof(headers), "Content-Type: image/png\r\n");
+
+  char match[128] = "";
+  const char* header = strcasestr(request, "\r\nIf-None-Match:");
+  if (header != NULL)
+    sscanf(header + 16, " %127[^\r]", match);
+  if (validators && strstr(match, etag) != NULL) {
+    count(MOCK_APPASSET_NOT_MODIFIED);
+    return mock_respond(conn, 304, headers, NULL, 0);
+  }
+
+  char* body = malloc(MOCK_ASSET_SIZE);
+  for (int i = 0; i < MOCK_ASSET_SIZE; i++)
+    body[i] = (char) (id * 31 + version * 7 + i);
+  memcpy(body, "\x89PNG", 4);
+
+  count(MOCK_APPASSET);
+  int ret = mock_respond(conn, 200, headers, body, MOCK_ASSET_SIZE);
+  free(body);
+  return ret;
+}
+
+static void* mock_connection_thread(void* arg) {
+  struct mock_connection* conn = arg;
+  int host = -1;
+  struct sockaddr_in local;
+  socklen_t local_length = sizeof(local);
+  if (getsockname(conn->fd, (struct sockaddr*) &local, &local_length) == 0)
+    host = ntohl(local.sin_addr.s_addr) - MOCK_HOST_BASE_ADDRESS;
+
+  if (conn->ssl != NULL && SSL_accept(conn->ssl) <= 0)
+    goto done;
+
+  char request[MOCK_MAX_REQUEST + 1];
+  int used = 0;
+  while (!quit) {
+    char* end;
+    while ((end = (request[used] = 0, strstr(request, "\r\n\r\n"))) == NULL) {
+      int length = used < MOCK_MAX_REQUEST ? mock_read(conn, request + used, MOCK_MAX_REQUEST - used) : -1;
+      if (length <= 0)
+        goto done;
+      used += length;
+    }
+
+    char path[1024];
+    if (sscanf(request, "GET %1023s", path) != 1)
+      goto done;
+
+    usleep(delay_ms * 1000);
+    int ret;
+    if (strncmp(path, "/serverinfo", 11) == 0)
+      ret = mock_serverinfo(conn, host);
+    else if (strncmp(path, "/applist", 8) == 0 && conn->ssl != NULL)
+      ret = mock_applist(conn);
+    else if (strncmp(path, "/appasset", 9) == 0 && conn->ssl != NULL)
+      ret = mock_appasset(conn, path, request);
+    else
+      ret = mock_respond(conn, 404, "", NULL, 0);
+    if (ret < 0)
+      goto done;
+
+    // Keep what was sent after this request
+    int consumed = end + 4 - request;
+    memmove(request, request + consumed, used - consumed);
+    used -= consumed;
+  }
+
+  done:
+  if (conn->ssl != NULL) {
+    SSL_shutdown(conn->ssl);
+    SSL_free(conn->ssl);
+  }
+  close(conn->fd);
+  free(conn);
+  return NULL;
+}
+
+static void* mock_accept_thread(void* arg) {
+  while (!quit) {
+    if (poll(listeners, host_count * 2, 100) <= 0)
+      continue;
+
+    for (int i = 0; i < host_count * 2; i++) {
+      if (!(listeners[i].revents & POLLIN))
+        continue;
+
+      int fd = accept(listeners[i].fd, NULL, NULL);
+      if (fd < 0)
+        continue;
+
+      // Headers and body are written separately, don't let the body wait for an acknowledgement
+      int nodelay = 1;
+      setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+
+      struct mock_connection* conn = calloc(1, sizeof(*conn));
+      conn->fd = fd;
+      if (i % 2 == 1) {
+        conn->ssl = SSL_new(ssl_ctx);
+        SSL_set_fd(conn->ssl, fd);
+      }
+      count(MOCK_CONNECTIONS);
+
+      pthread_t thread;
+      pthread_attr_t attr;
+      pthread_attr_init(&attr);
+      pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+      pthread_attr_setstacksize(&attr, 256 * 1024);
+      if (pthread_create(&thread, &attr, mock_connection_thread, conn) != 0) {
+        if (conn->ssl != NULL)
+          SSL_free(conn->ssl);
+        close(fd);
+        free(conn);
+      }
+      pthread_attr_destroy(&attr);
+    }
+  }
+  return NULL;
+}
+
+// Clients present their pairing certificate, which is accepted as is
+static int mock_verify(int preverify, X509_STORE_CTX* ctx) {
+  return 1;
+}
+
+static int mock_listen(int host, unsigned short port) {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  int enable = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+
+  struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(port), .sin_addr.s_addr = htonl(MOCK_HOST_BASE_ADDRESS + host) };
+  if (bind(fd, (struct sockaddr*) &addr, sizeof(addr)) < 0 || listen(fd, 64) < 0) {
+    perror("Can't listen for mock host");
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+int mock_host_start(int hosts, int delay, int apps) {
+  host_count = hosts;
+  delay_ms = delay;
+  app_count = apps;
+  asset_version = 1;
+  asset_validators = true;
+  quit = false;
+  mock_host_reset_counts();
+
+  cert = mkcert_generate();
+  ssl_ctx = SSL_CTX_new(TLS_server_method());
+  if (ssl_ctx == NULL || SSL_CTX_use_certificate(ssl_ctx, cert.x509) != 1 || SSL_CTX_use_PrivateKey(ssl_ctx, cert.pkey) != 1) {
+    fprintf(stderr, "Can't set up TLS for the mock hosts\n");
+    return -1;
+  }
+  SSL_CTX_set_verify(ssl_ctx, SSL_VERIFY_PEER, mock_verify);
+
+  listeners = calloc(hosts * 2, sizeof(struct pollfd));
+  for (int i = 0; i < hosts; i++) {
+    listeners[i * 2].fd = mock_listen(i, MOCK_HOST_HTTP_PORT);
+    listeners[i * 2 + 1].fd = mock_listen(i, MOCK_HOST_HTTPS_PORT);
+    listeners[i * 2].events = listeners[i * 2 + 1].events = POLLIN;
+    if (listeners[i * 2].fd < 0 || listeners[i * 2 + 1].fd < 0)
+      return -1;
+  }
+
+  return pthread_create(&accept_thread, NULL, mock_accept_thread, NULL) == 0 ? 0 : -1;
+}
+
+// Connections still open end with their next request
+void mock_host_stop() {
+  quit = true;
+  pthread_join(accept_thread, NULL);
+  for (int i = 0; i < host_count * 2; i++)
+    close(listeners[i].fd);
+  free(listeners);
+  SSL_CTX_free(ssl_ctx);
+  mkcert_free(cert);
+}
+
+void mock_host_set_asset_version(int version) {
+  asset_version = version;
+}
+
+void mock_host_set_asset_validators(bool enabled) {
+  asset_validators = enabled;
+}
+
+int mock_host_count(enum mock_host_counter counter) {
+  pthread_mutex_lock(&count_mutex);
+  int value = counts[counter];
+  pthread_mutex_unlock(&count_mutex);
+  return value;
+}
+
+void mock_host_reset_counts() {
+  pthread_mutex_lock(&count_mutex);
+  memset(counts, 0, sizeof(counts));
+  pthread_mutex_unlock(&count_mutex);
+}
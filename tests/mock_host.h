@@ -0,0 +1,39 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2015-2019 Iwan Timmer
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Mock GameStream hosts for the tests and benchmarks. Every host listens
+// on its own loopback address (127.1.x.y) with an HTTP and an HTTPS port,
+// and answers serverinfo, applist and appasset requests after a delay.
+
+#include <stdbool.h>
+
+#define MOCK_HOST_HTTP_PORT 48989
+#define MOCK_HOST_HTTPS_PORT 48984
+
+enum mock_host_counter { MOCK_CONNECTIONS, MOCK_SERVERINFO, MOCK_APPLIST, MOCK_APPASSET, MOCK_APPASSET_NOT_MODIFIED, MOCK_COUNTERS };
+
+int mock_host_start(int hosts, int delay_ms, int apps);
+void mock_host_stop(void);
+void mock_host_address(int host, char* address, int length);
+// Changing the version changes the content and validator of every asset
+void mock_host_set_asset_version(int version);
+// Without validators assets are sent without ETag and always transferred
+void mock_host_set_asset_validators(bool enabled);
+int mock_host_count(enum mock_host_counter counter);
+void mock_host_reset_counts(void);
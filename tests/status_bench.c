@@ -0,0 +1,103 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2015-2019 Iwan Timmer
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Runs the status action against mock hosts on the loopback interface
+// and reports how long querying all of them took.
+//
+// Usage: status_bench [hosts] [delay ms] [jobs...]
+
+#include "platform.h"
+#include "config.h"
+#include "status.h"
+#include "mock_host.h"
+#include "clock.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Run the status action with its JSON output going to a file
+static int run_status(PCONFIGURATION config, FILE* output) {
+  fflush(stdout);
+  int saved = dup(STDOUT_FILENO);
+  dup2(fileno(output), STDOUT_FILENO);
+  int ret = status_print(config);
+  fflush(stdout);
+  dup2(saved, STDOUT_FILENO);
+  close(saved);
+  return ret;
+}
+
+static int count_online(FILE* output) {
+  char line[1024];
+  int online = 0;
+  rewind(output);
+  while (fgets(line, sizeof(line), output) != NULL) {
+    if (strstr(line, "\"online\": true") != NULL)
+      online++;
+  }
+  return online;
+}
+
+int main(int argc, char* argv[]) {
+  int hosts = argc > 1 ? atoi(argv[1]) : 400;
+  int delay_ms = argc > 2 ? atoi(argv[2]) : 50;
+
+  if (mock_host_start(hosts, delay_ms, 0) < 0)
+    return 1;
+
+  char host_file[] = "/tmp/status_bench_XXXXXX";
+  FILE* fd = fdopen(mkstemp(host_file), "w");
+  for (int i = 0; i < hosts; i++) {
+    char address[16];
+    mock_host_address(i, address, sizeof(address));
+    fprintf(fd, "%s\n", address);
+  }
+  fclose(fd);
+
+  CONFIGURATION config = {0};
+  config.address = host_file;
+  config.port = MOCK_HOST_HTTP_PORT;
+  config.status_timeout = STATUS_DEFAULT_TIMEOUT_MS;
+  snprintf(config.key_dir, sizeof(config.key_dir), "status_bench_keys");
+
+  int failures = 0;
+  for (int i = 3; i < (argc > 3 ? argc : 4); i++) {
+    config.status_jobs = argc > 3 ? atoi(argv[i]) : STATUS_DEFAULT_JOBS;
+    mock_host_reset_counts();
+
+    FILE* output = tmpfile();
+    uint64_t start = clock_now_us();
+    int ret = run_status(&config, output);
+    uint64_t elapsed = (clock_now_us() - start) / 1000;
+    int online = count_online(output);
+    fclose(output);
+
+    printf("%d hosts answering after %d ms, %d jobs: %llu ms, %d online, %d connections, %d serverinfo requests\n",
+           hosts, delay_ms, config.status_jobs, (unsigned long long) elapsed, online,
+           mock_host_count(MOCK_CONNECTIONS), mock_host_count(MOCK_SERVERINFO));
+    if (ret != 0 || online != hosts)
+      failures++;
+  }
+
+  unlink(host_file);
+  mock_host_stop();
+  return failures > 0 ? 1 : 0;
+}